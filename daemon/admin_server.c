@@ -388,3 +388,48 @@ adminServerSetClientLimits(virNetServerPtr srv,
 
     return 0;
 }
+
+int
+adminServerGetMessagePoolStats(virNetServerPtr srv,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long retained;
+    unsigned long long maxRetained;
+
+    virCheckFlags(0, -1);
+
+    virNetMessagePoolGetStats(virNetServerGetMessagePool(srv),
+                              &hits, &misses, &retained, &maxRetained);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_HITS, hits) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_MISSES, misses) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_RETAINED, retained) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MSGPOOL_RETAINED_MAX,
+                                maxRetained) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
@@ -155,6 +155,9 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->max_requests = 20;
     data->max_client_requests = 5;
 
+    data->stream_packet_size = 1024 * 1024;
+    data->stream_window = 4;
+
     data->audit_level = 1;
     data->audit_logging = 0;
 
@@ -350,6 +353,11 @@ daemonConfigLoadOptions(struct daemonConfig *data,
     if (virConfGetValueUInt(conf, "max_client_requests", &data->max_client_requests) < 0)
         goto error;
 
+    if (virConfGetValueUInt(conf, "stream_packet_size", &data->stream_packet_size) < 0)
+        goto error;
+    if (virConfGetValueUInt(conf, "stream_window", &data->stream_window) < 0)
+        goto error;
+
     if (virConfGetValueUInt(conf, "admin_min_workers", &data->admin_min_workers) < 0)
         goto error;
     if (virConfGetValueUInt(conf, "admin_max_workers", &data->admin_max_workers) < 0)
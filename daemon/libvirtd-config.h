@@ -74,6 +74,9 @@ struct daemonConfig {
     unsigned int max_requests;
     unsigned int max_client_requests;
 
+    unsigned int stream_packet_size;
+    unsigned int stream_window;
+
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
@@ -51,6 +51,7 @@
 #include "virnetlink.h"
 #include "virnetdaemon.h"
 #include "remote.h"
+#include "stream.h"
 #include "virhook.h"
 #include "viraudit.h"
 #include "virstring.h"
@@ -1471,6 +1472,9 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    daemonStreamSetLimits(config->stream_packet_size,
+                          config->stream_window);
+
     if (!(lxcProgram = virNetServerProgramNew(LXC_PROGRAM,
                                               LXC_PROTOCOL_VERSION,
                                               lxcProcs,
@@ -77,6 +77,9 @@ struct daemonClientPrivate {
     virConnectPtr conn;
 
     daemonClientStreamPtr streams;
+    /* Whether the client can receive stream packets bigger
+     * than VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX */
+    bool streamLargePackets;
 };
 
 /* Separate private data for admin connection */
@@ -4519,6 +4519,15 @@ static int remoteDispatchConnectSupportsFeature(virNetServerPtr server ATTRIBUTE
         supported = 1;
         break;
 
+    case VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PACKET:
+        /* Only clients that can receive large stream packets know
+         * to ask about them, so remember it for their streams */
+        virMutexLock(&priv->lock);
+        priv->streamLargePackets = true;
+        virMutexUnlock(&priv->lock);
+        supported = 1;
+        break;
+
     default:
         if ((supported = virConnectSupportsFeature(priv->conn, args->feature)) < 0)
             goto cleanup;
@@ -5173,7 +5182,7 @@ remoteDispatchDomainMigratePrepareTunnel3Params(virNetServerPtr server ATTRIBUTE
 
     if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)) ||
         !(stream = daemonCreateClientStream(client, st, remoteProgram,
-                                            &msg->header)))
+                                            &msg->header, false)))
         goto cleanup;
 
     if (virDomainMigratePrepareTunnel3Params(priv->conn, st, params, nparams,
@@ -23,17 +23,28 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+
 #include "stream.h"
 #include "remote.h"
 #include "viralloc.h"
 #include "virlog.h"
 #include "virnetserverclient.h"
 #include "virerror.h"
+#include "virfile.h"
+#include "fdstream.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
 VIR_LOG_INIT("daemon.stream");
 
+/* Payload size of data packets for clients that can receive
+ * packets larger than VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX */
+static size_t daemonStreamPacketSize = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+/* How many data packets a stream may have in flight in each
+ * direction before it stops reading more */
+static size_t daemonStreamWindow = 1;
+
 struct daemonClientStream {
     daemonClientPrivatePtr priv;
     int refs;
@@ -52,6 +63,18 @@ struct daemonClientStream {
     virNetMessagePtr rx;
     bool tx;
 
+    bool sparse;
+
+    size_t packetSize;  /* Max payload of data packets sent to the client */
+    size_t txInFlight;  /* Data packets queued for the client */
+    char *txBuffer;
+
+    /* Local clients get data packets spliced from here instead */
+    bool spliceChecked;
+    int splicePipe[2];
+    size_t spliceSize;   /* Capacity of the pipe */
+    size_t spliceQueued; /* Bytes in the pipe, owned by queued packets */
+
     daemonClientStreamPtr next;
 };
 
@@ -98,9 +121,12 @@ daemonStreamMessageFinished(virNetMessagePtr msg,
                             void *opaque)
 {
     daemonClientStream *stream = opaque;
-    VIR_DEBUG("stream=%p proc=%d serial=%u",
-              stream, msg->header.proc, msg->header.serial);
+    VIR_DEBUG("stream=%p proc=%d serial=%u inflight=%zu",
+              stream, msg->header.proc, msg->header.serial,
+              stream->txInFlight);
 
+    stream->txInFlight--;
+    stream->spliceQueued -= msg->spliceLength;
     stream->tx = true;
     daemonStreamUpdateEvents(stream);
 
@@ -209,6 +235,7 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
         stream->refs++;
+        stream->txInFlight++;
         if (virNetServerProgramSendStreamData(remoteProgram,
                                               client,
                                               msg,
@@ -276,7 +303,7 @@ daemonStreamEvent(virStreamPtr st, int events, void *opaque)
  * -1 on fatal client error
  */
 static int
-daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+daemonStreamFilter(virNetServerClientPtr client,
                    virNetMessagePtr msg,
                    void *opaque)
 {
@@ -285,7 +312,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -299,6 +327,23 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
               client, stream->rx, msg->header.proc,
               msg->header.serial, msg->header.status);
 
+    /* Let up to a window's worth of data packets queue up on the
+     * stream without holding up further reads from the client.
+     * Past that they count as requests again, which throttles the
+     * client once it sends faster than the stream drains. */
+    if (msg->header.status == VIR_NET_CONTINUE) {
+        virNetMessagePtr tmp;
+        size_t untracked = 0;
+
+        for (tmp = stream->rx; tmp; tmp = tmp->next) {
+            if (!tmp->tracked)
+                untracked++;
+        }
+
+        if (untracked < daemonStreamWindow)
+            virNetServerClientUntrackMessage(client, msg);
+    }
+
     virNetMessageQueuePush(&stream->rx, msg);
     daemonStreamUpdateEvents(stream);
     ret = 1;
@@ -309,9 +354,29 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 }
 
 
+/*
+ * @packetSize: payload size of data packets sent to clients which
+ *              can receive more than VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+ * @window: number of data packets a stream may have in flight
+ *
+ * Sets the limits used by streams created from now on
+ */
+void
+daemonStreamSetLimits(size_t packetSize,
+                      size_t window)
+{
+    daemonStreamPacketSize = MAX(packetSize,
+                                 VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX);
+    daemonStreamPacketSize = MIN(daemonStreamPacketSize,
+                                 VIR_NET_MESSAGE_PAYLOAD_MAX);
+    daemonStreamWindow = MAX(window, 1);
+}
+
+
 /*
  * @conn: a connection object to associate the stream with
  * @header: the method call to associate with the stream
+ * @sparse: whether holes may be transferred over the stream
  *
  * Creates a new stream for this conn
  *
@@ -321,13 +386,14 @@ daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr header)
+                         virNetMessageHeaderPtr header,
+                         bool sparse)
 {
     daemonClientStream *stream;
     daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
 
-    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p",
-              client, header->proc, header->serial, st);
+    VIR_DEBUG("client=%p, proc=%d, serial=%u, st=%p, sparse=%d",
+              client, header->proc, header->serial, st, sparse);
 
     if (VIR_ALLOC(stream) < 0)
         return NULL;
@@ -339,6 +405,15 @@ daemonCreateClientStream(virNetServerClientPtr client,
     stream->serial = header->serial;
     stream->filterID = -1;
     stream->st = st;
+    stream->sparse = sparse;
+    stream->splicePipe[0] = stream->splicePipe[1] = -1;
+
+    virMutexLock(&priv->lock);
+    if (priv->streamLargePackets)
+        stream->packetSize = daemonStreamPacketSize;
+    else
+        stream->packetSize = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    virMutexUnlock(&priv->lock);
 
     return stream;
 }
@@ -386,6 +461,9 @@ int daemonFreeClientStream(virNetServerClientPtr client,
     }
 
     virObjectUnref(stream->st);
+    VIR_FREE(stream->txBuffer);
+    VIR_FORCE_CLOSE(stream->splicePipe[0]);
+    VIR_FORCE_CLOSE(stream->splicePipe[1]);
     VIR_FREE(stream);
 
     return ret;
@@ -557,6 +635,63 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole packet from the client, skipping over the
+ * requested number of bytes in the stream.
+ *
+ * Returns 0 if the hole was processed, or an error RPC was sent,
+ * 1 if the stream would block, -1 upon fatal error
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    virNetMessageError rerr;
+    int ret;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%u",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+    memset(&rerr, 0, sizeof(rerr));
+
+    if (!stream->sparse) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        goto error;
+    }
+
+    if (virNetMessageDecodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    ret = virStreamSendHole(stream->st, data.length, data.flags);
+
+    /* Blocking, so indicate we have more todo later */
+    if (ret == -2)
+        return 1;
+    if (ret < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    VIR_INFO("Stream hole failed");
+    stream->closed = true;
+    virStreamEventRemoveCallback(stream->st);
+    virStreamAbort(stream->st);
+
+    return virNetServerProgramSendReplyError(stream->prog,
+                                             client,
+                                             msg,
+                                             &rerr,
+                                             &msg->header);
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -672,7 +807,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -713,6 +851,106 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
 
 
 
+static int
+daemonStreamRecv(daemonClientStream *stream,
+                 char *buffer,
+                 size_t bufferLen)
+{
+    if (stream->sparse)
+        return virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                  VIR_STREAM_RECV_STOP_AT_HOLE);
+
+    return virStreamRecv(stream->st, buffer, bufferLen);
+}
+
+
+/*
+ * Data of file, block device and iohelper backed streams can go
+ * into the socket of a local client without being copied through
+ * user space: it is spliced into a pipe, where it waits behind the
+ * packets in flight, and from there into the socket when its packet
+ * is transmitted. This is not possible when the transport has to
+ * encrypt or encode the data.
+ *
+ * Uploads are not spliced: the payload of a packet from the client
+ * has already been read into its message, along with the header,
+ * by the time the packet is dispatched here.
+ */
+static bool
+daemonStreamCanSplice(virNetServerClientPtr client,
+                      daemonClientStream *stream)
+{
+    int size = -1;
+
+    if (stream->spliceChecked)
+        return stream->splicePipe[0] >= 0;
+    stream->spliceChecked = true;
+
+    if (!virFDStreamCanSplice(stream->st) ||
+        !virNetServerClientCanSplice(client))
+        return false;
+
+    if (pipe2(stream->splicePipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        VIR_DEBUG("Unable to create splice pipe, copying stream data");
+        stream->splicePipe[0] = stream->splicePipe[1] = -1;
+        return false;
+    }
+
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    /* Try to make room for the whole window, the default pipe only
+     * holds 64 KiB. Smaller packets will do if we're not allowed. */
+    ignore_value(fcntl(stream->splicePipe[1], F_SETPIPE_SZ,
+                       (int)MIN(stream->packetSize * daemonStreamWindow,
+                                INT_MAX)));
+    size = fcntl(stream->splicePipe[1], F_GETPIPE_SZ);
+#endif
+    stream->spliceSize = size > 0 ? size : 64 * 1024;
+
+    VIR_DEBUG("stream=%p splicing through a %zu byte pipe",
+              stream, stream->spliceSize);
+    return true;
+}
+
+
+/*
+ * Same as daemonStreamRecv, topping up the packet, except that the
+ * data goes to the splice pipe.
+ */
+static int
+daemonStreamSpliceRecv(daemonClientStream *stream)
+{
+    unsigned int flags = 0;
+    size_t want = MIN(stream->packetSize,
+                      stream->spliceSize - stream->spliceQueued);
+    size_t got = 0;
+    int rv = -2;
+
+    if (stream->sparse)
+        flags |= VIR_STREAM_RECV_STOP_AT_HOLE;
+
+    while (got < want) {
+        rv = virFDStreamSplice(stream->st, stream->splicePipe[1],
+                               want - got, flags);
+        if (rv <= 0)
+            break;
+        got += rv;
+    }
+
+    if (got) {
+        stream->spliceQueued += got;
+        return got;
+    }
+
+    /* A pipe with packets waiting in it can run out of buffers
+     * before it runs out of bytes, so we can't tell a full pipe from
+     * a drained source. Wait for a packet to go out either way. */
+    if (rv == -2 && stream->spliceQueued)
+        stream->tx = false;
+
+    return rv;
+}
+
+
 /*
  * Invoked when a stream is signalled as having data
  * available to read. This reads up to one message
@@ -729,13 +967,13 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 {
     virNetMessagePtr msg = NULL;
     virNetMessageError rerr;
-    char *buffer;
-    size_t bufferLen = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    bool spliced = false;
     int ret = -1;
     int rv;
 
-    VIR_DEBUG("client=%p, stream=%p tx=%d closed=%d",
-              client, stream, stream->tx, stream->closed);
+    VIR_DEBUG("client=%p, stream=%p tx=%d closed=%d inflight=%zu",
+              client, stream, stream->tx, stream->closed,
+              stream->txInFlight);
 
     /* We might have had an event pending before we shut
      * down the stream, so if we're marked as closed,
@@ -751,14 +989,68 @@ daemonStreamHandleRead(virNetServerClientPtr client,
 
     memset(&rerr, 0, sizeof(rerr));
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
-        return -1;
-
     if (!(msg = virNetMessageNew(false)))
         goto cleanup;
 
-    rv = virStreamRecv(stream->st, buffer, bufferLen);
-    if (rv == -2) {
+    if (daemonStreamCanSplice(client, stream)) {
+        rv = daemonStreamSpliceRecv(stream);
+        spliced = rv > 0;
+    } else {
+        if (!stream->txBuffer &&
+            VIR_ALLOC_N(stream->txBuffer, stream->packetSize) < 0)
+            goto cleanup;
+
+        rv = daemonStreamRecv(stream, stream->txBuffer, stream->packetSize);
+
+        /* Sources behind a pipe, like the iohelper, hand out far less
+         * than a packet per read. Top the packet up for as long as more
+         * data is there right away; whatever stopped us (EOF, a hole,
+         * an error) shows up again on the next read. */
+        if (rv > 0) {
+            size_t got = rv;
+
+            while (got < stream->packetSize) {
+                rv = daemonStreamRecv(stream, stream->txBuffer + got,
+                                      stream->packetSize - got);
+                if (rv <= 0)
+                    break;
+                got += rv;
+            }
+            rv = got;
+        }
+    }
+
+    if (rv == -3) {
+        /* We're at a hole, tell the client how big it is instead
+         * of sending the zeroes over */
+        long long length;
+
+        if (virStreamRecvHole(stream->st, &length, 0) < 0) {
+            if (virNetServerProgramSendStreamError(remoteProgram,
+                                                   client,
+                                                   msg,
+                                                   &rerr,
+                                                   stream->procedure,
+                                                   stream->serial) < 0)
+                goto cleanup;
+            msg = NULL;
+        } else {
+            if (++stream->txInFlight >= daemonStreamWindow)
+                stream->tx = false;
+
+            msg->cb = daemonStreamMessageFinished;
+            msg->opaque = stream;
+            stream->refs++;
+            if (virNetServerProgramSendStreamHole(remoteProgram,
+                                                  client,
+                                                  msg,
+                                                  stream->procedure,
+                                                  stream->serial,
+                                                  length, 0) < 0)
+                goto cleanup;
+            msg = NULL;
+        }
+    } else if (rv == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
     } else if (rv < 0) {
@@ -771,26 +1063,42 @@ daemonStreamHandleRead(virNetServerClientPtr client,
             goto cleanup;
         msg = NULL;
     } else {
-        stream->tx = false;
-        if (rv == 0)
+        /* Keep reading ahead while earlier packets are still on
+         * their way to the client, up to the stream window */
+        if (++stream->txInFlight >= daemonStreamWindow)
+            stream->tx = false;
+        if (rv == 0) {
+            stream->tx = false;
             stream->recvEOF = true;
+        }
 
         msg->cb = daemonStreamMessageFinished;
         msg->opaque = stream;
         stream->refs++;
-        if (virNetServerProgramSendStreamData(remoteProgram,
-                                              client,
-                                              msg,
-                                              stream->procedure,
-                                              stream->serial,
-                                              buffer, rv) < 0)
-            goto cleanup;
+        if (spliced) {
+            if (virNetServerProgramSendStreamSplice(remoteProgram,
+                                                    client,
+                                                    msg,
+                                                    stream->procedure,
+                                                    stream->serial,
+                                                    stream->splicePipe[0],
+                                                    rv) < 0)
+                goto cleanup;
+        } else {
+            if (virNetServerProgramSendStreamData(remoteProgram,
+                                                  client,
+                                                  msg,
+                                                  stream->procedure,
+                                                  stream->serial,
+                                                  rv ? stream->txBuffer : "",
+                                                  rv) < 0)
+                goto cleanup;
+        }
         msg = NULL;
     }
 
     ret = 0;
  cleanup:
-    VIR_FREE(buffer);
     virNetMessageFree(msg);
     return ret;
 }
@@ -26,11 +26,16 @@
 
 # include "libvirtd.h"
 
+void
+daemonStreamSetLimits(size_t packetSize,
+                      size_t window);
+
 daemonClientStream *
 daemonCreateClientStream(virNetServerClientPtr client,
                          virStreamPtr st,
                          virNetServerProgramPtr prog,
-                         virNetMessageHeaderPtr hdr);
+                         virNetMessageHeaderPtr hdr,
+                         bool sparse);
 
 int daemonFreeClientStream(virNetServerClientPtr client,
                            daemonClientStream *stream);
@@ -404,6 +404,48 @@ int virAdmServerSetClientLimits(virAdmServerPtr srv,
                                 int nparams,
                                 unsigned int flags);
 
+/* Per-server RPC message buffer pool statistics */
+
+/**
+ * VIR_SERVER_MSGPOOL_HITS:
+ * Macro for per-server msgpool_hits attribute: represents the number of
+ * message buffers that were reused from the pool, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_HITS "msgpool_hits"
+
+/**
+ * VIR_SERVER_MSGPOOL_MISSES:
+ * Macro for per-server msgpool_misses attribute: represents the number of
+ * message buffers that had to be freshly allocated because the pool had no
+ * free buffer of the right size, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_MISSES "msgpool_misses"
+
+/**
+ * VIR_SERVER_MSGPOOL_RETAINED:
+ * Macro for per-server msgpool_retained attribute: represents the number of
+ * bytes currently held by the pool in free buffers, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_RETAINED "msgpool_retained"
+
+/**
+ * VIR_SERVER_MSGPOOL_RETAINED_MAX:
+ * Macro for per-server msgpool_retained_max attribute: represents the upper
+ * limit on bytes the pool may hold in free buffers, as
+ * VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MSGPOOL_RETAINED_MAX "msgpool_retained_max"
+
+int virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                    virTypedParameterPtr *params,
+                                    int *nparams,
+                                    unsigned int flags);
+
 # ifdef __cplusplus
 }
 # endif
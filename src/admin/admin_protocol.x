@@ -48,6 +48,9 @@ const ADMIN_CLIENT_INFO_PARAMETERS_MAX = 64;
 /* Upper limit on number of client processing controls */
 const ADMIN_SERVER_CLIENT_LIMITS_MAX = 32;
 
+/* Upper limit on number of message pool statistics */
+const ADMIN_SERVER_MESSAGE_POOL_STATS_MAX = 32;
+
 /* A long string, which may NOT be NULL. */
 typedef string admin_nonnull_string<ADMIN_STRING_MAX>;
 
@@ -183,6 +186,15 @@ struct admin_server_set_client_limits_args {
     unsigned int flags;
 };
 
+struct admin_server_get_message_pool_stats_args {
+    admin_nonnull_server srv;
+    unsigned int flags;
+};
+
+struct admin_server_get_message_pool_stats_ret {
+    admin_typed_param params<ADMIN_SERVER_MESSAGE_POOL_STATS_MAX>;
+};
+
 /* Define the program number, protocol version and procedure numbers here. */
 const ADMIN_PROGRAM = 0x06900690;
 const ADMIN_PROTOCOL_VERSION = 1;
@@ -268,5 +280,10 @@ enum admin_procedure {
     /**
      * @generate: none
      */
-    ADMIN_PROC_SERVER_SET_CLIENT_LIMITS = 13
+    ADMIN_PROC_SERVER_SET_CLIENT_LIMITS = 13,
+
+    /**
+     * @generate: none
+     */
+    ADMIN_PROC_SERVER_GET_MESSAGE_POOL_STATS = 14
 };
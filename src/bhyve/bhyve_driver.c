@@ -1265,7 +1265,7 @@ bhyveStateInitialize(bool privileged,
 
     if (virDomainObjListLoadAllConfigs(bhyve_driver->domains,
                                        BHYVE_STATE_DIR,
-                                       NULL, 1,
+                                       NULL, 1, 0,
                                        bhyve_driver->caps,
                                        bhyve_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -1273,7 +1273,7 @@ bhyveStateInitialize(bool privileged,
 
     if (virDomainObjListLoadAllConfigs(bhyve_driver->domains,
                                        BHYVE_CONFIG_DIR,
-                                       BHYVE_AUTOSTART_DIR, 0,
+                                       BHYVE_AUTOSTART_DIR, 0, 0,
                                        bhyve_driver->caps,
                                        bhyve_driver->xmlopt,
                                        NULL, NULL) < 0)
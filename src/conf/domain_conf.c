@@ -6305,7 +6305,7 @@ virDomainNetIPInfoParseXML(const char *source,
     int ret = -1;
     size_t i;
 
-    if ((nnodes = virXPathNodeSet("./ip", ctxt, &nodes)) < 0)
+    if ((nnodes = virXMLNodeGetSubelementList(ctxt->node, "ip", &nodes)) < 0)
         goto cleanup;
 
     for (i = 0; i < nnodes; i++) {
@@ -6315,7 +6315,8 @@ virDomainNetIPInfoParseXML(const char *source,
     }
     VIR_FREE(nodes);
 
-    if ((nnodes = virXPathNodeSet("./route", ctxt, &nodes)) < 0)
+    if ((nnodes = virXMLNodeGetSubelementList(ctxt->node, "route",
+                                              &nodes)) < 0)
         goto cleanup;
 
     for (i = 0; i < nnodes; i++) {
@@ -6793,7 +6794,7 @@ virSecurityDeviceLabelDefParseXML(virSecurityDeviceLabelDefPtr **seclabels_rtn,
     virSecurityLabelDefPtr vmDef = NULL;
     char *model, *relabel, *label, *labelskip;
 
-    if ((n = virXPathNodeSet("./seclabel", ctxt, &list)) < 0)
+    if ((n = virXMLNodeGetSubelementList(ctxt->node, "seclabel", &list)) < 0)
         goto error;
     if (n == 0)
         return 0;
@@ -6862,9 +6863,13 @@ virSecurityDeviceLabelDefParseXML(virSecurityDeviceLabelDefPtr **seclabels_rtn,
             seclabels[i]->labelskip = STREQ(labelskip, "yes");
         VIR_FREE(labelskip);
 
-        ctxt->node = list[i];
-        label = virXPathStringLimit("string(./label)",
-                                    VIR_SECURITY_LABEL_BUFLEN-1, ctxt);
+        label = virXMLNodeGetSubelementContent(list[i], "label");
+        if (label && strlen(label) >= VIR_SECURITY_LABEL_BUFLEN - 1) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("'label' value longer than %d bytes"),
+                           VIR_SECURITY_LABEL_BUFLEN - 1);
+            VIR_FREE(label);
+        }
         seclabels[i]->label = label;
 
         if (label && !seclabels[i]->relabel) {
@@ -7118,7 +7123,9 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
     char *format = NULL;
     int ret = -1;
 
-    if (!(ctxt->node = virXPathNode("./backingStore[*]", ctxt))) {
+    /* An empty <backingStore/> terminates the chain */
+    if (!(ctxt->node = virXMLNodeGetSubelement(ctxt->node, "backingStore")) ||
+        virXMLChildElementCount(ctxt->node) <= 0) {
         ret = 0;
         goto cleanup;
     }
@@ -7152,7 +7159,7 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
         goto cleanup;
     }
 
-    if (!(source = virXPathNode("./source", ctxt))) {
+    if (!(source = virXMLNodeGetSubelement(ctxt->node, "source"))) {
         virReportError(VIR_ERR_XML_ERROR, "%s",
                        _("missing disk backing store source"));
         goto cleanup;
@@ -7175,8 +7182,8 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
 }
 
 #define PARSE_IOTUNE(val)                                                      \
-    if (virXPathULongLong("string(./iotune/" #val ")",                         \
-                          ctxt, &def->blkdeviotune.val) == -2) {               \
+    if (virXMLNodeGetSubelementULongLong(node, #val,                           \
+                                         &def->blkdeviotune.val) == -2) {      \
         virReportError(VIR_ERR_XML_ERROR,                                      \
                        _("disk iotune field '%s' must be an integer"), #val);  \
         return -1;                                                             \
@@ -7184,7 +7191,7 @@ virDomainDiskBackingStoreParse(xmlXPathContextPtr ctxt,
 
 static int
 virDomainDiskDefIotuneParse(virDomainDiskDefPtr def,
-                            xmlXPathContextPtr ctxt)
+                            xmlNodePtr node)
 {
     PARSE_IOTUNE(total_bytes_sec);
     PARSE_IOTUNE(read_bytes_sec);
@@ -7739,7 +7746,7 @@ virDomainDiskDefParseXML(virDomainXMLOptionPtr xmlopt,
                 goto error;
             }
         } else if (xmlStrEqual(cur->name, BAD_CAST "iotune")) {
-            if (virDomainDiskDefIotuneParse(def, ctxt) < 0)
+            if (virDomainDiskDefIotuneParse(def, cur) < 0)
                 goto error;
         } else if (xmlStrEqual(cur->name, BAD_CAST "readonly")) {
             def->src->readonly = true;
@@ -9089,6 +9096,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
     char *vhost_path = NULL;
     virNWFilterHashTablePtr filterparams = NULL;
     virDomainActualNetDefPtr actual = NULL;
+    xmlNodePtr driver_host = NULL;
+    xmlNodePtr driver_guest = NULL;
     xmlNodePtr oldnode = ctxt->node;
     int ret, val;
 
@@ -9247,6 +9256,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
                 event_idx = virXMLPropString(cur, "event_idx");
                 queues = virXMLPropString(cur, "queues");
                 rx_queue_size = virXMLPropString(cur, "rx_queue_size");
+                driver_host = virXMLNodeGetSubelement(cur, "host");
+                driver_guest = virXMLNodeGetSubelement(cur, "guest");
             } else if (xmlStrEqual(cur->name, BAD_CAST "filterref")) {
                 if (filter) {
                     virReportError(VIR_ERR_XML_ERROR, "%s",
@@ -9640,7 +9651,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             }
             def->driver.virtio.rx_queue_size = q;
         }
-        if ((str = virXPathString("string(./driver/host/@csum)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host csum mode '%s'"),
@@ -9650,7 +9662,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@gso)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "gso"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host gso mode '%s'"),
@@ -9660,7 +9673,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.gso = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso4)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso4 mode '%s'"),
@@ -9670,7 +9684,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@tso6)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host tso6 mode '%s'"),
@@ -9680,7 +9695,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ecn)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ecn mode '%s'"),
@@ -9690,7 +9706,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@ufo)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host ufo mode '%s'"),
@@ -9700,7 +9717,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.ufo = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/host/@mrg_rxbuf)", ctxt))) {
+        if (driver_host &&
+            (str = virXMLPropString(driver_host, "mrg_rxbuf"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown host mrg_rxbuf mode '%s'"),
@@ -9710,7 +9728,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.host.mrg_rxbuf = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@csum)", ctxt))) {
+        if (driver_guest &&
+            (str = virXMLPropString(driver_guest, "csum"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest csum mode '%s'"),
@@ -9720,7 +9739,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.csum = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso4)", ctxt))) {
+        if (driver_guest &&
+            (str = virXMLPropString(driver_guest, "tso4"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso4 mode '%s'"),
@@ -9730,7 +9750,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso4 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@tso6)", ctxt))) {
+        if (driver_guest &&
+            (str = virXMLPropString(driver_guest, "tso6"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest tso6 mode '%s'"),
@@ -9740,7 +9761,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.tso6 = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ecn)", ctxt))) {
+        if (driver_guest &&
+            (str = virXMLPropString(driver_guest, "ecn"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ecn mode '%s'"),
@@ -9750,7 +9772,8 @@ virDomainNetDefParseXML(virDomainXMLOptionPtr xmlopt,
             def->driver.virtio.guest.ecn = val;
         }
         VIR_FREE(str);
-        if ((str = virXPathString("string(./driver/guest/@ufo)", ctxt))) {
+        if (driver_guest &&
+            (str = virXMLPropString(driver_guest, "ufo"))) {
             if ((val = virTristateSwitchTypeFromString(str)) <= 0) {
                 virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
                                _("unknown guest ufo mode '%s'"),
@@ -16351,7 +16374,8 @@ virDomainDefParseXML(xmlDocPtr xml,
                      &def->blkio.weight) < 0)
         def->blkio.weight = 0;
 
-    if ((n = virXPathNodeSet("./blkiotune/device", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "blkiotune", "device",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot extract blkiotune nodes"));
         goto error;
@@ -16406,7 +16430,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(tmp);
 
     /* Extract any iothread id's defined */
-    if ((n = virXPathNodeSet("./iothreadids/iothread", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "iothreadids", "iothread",
+                                             &nodes)) < 0)
         goto error;
 
     if (n > def->iothreads)
@@ -16570,7 +16595,8 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
     }
 
-    if ((n = virXPathNodeSet("./cputune/vcpupin", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "cputune", "vcpupin",
+                                             &nodes)) < 0)
         goto error;
 
     for (i = 0; i < n; i++) {
@@ -16579,7 +16605,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./cputune/emulatorpin", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "cputune", "emulatorpin",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot extract emulatorpin nodes"));
         goto error;
@@ -16599,7 +16626,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
 
-    if ((n = virXPathNodeSet("./cputune/iothreadpin", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "cputune", "iothreadpin",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot extract iothreadpin nodes"));
         goto error;
@@ -16611,7 +16639,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./cputune/vcpusched", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "cputune", "vcpusched",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot extract vcpusched nodes"));
         goto error;
@@ -16623,7 +16652,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./cputune/iothreadsched", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "cputune", "iothreadsched",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("cannot extract iothreadsched nodes"));
         goto error;
@@ -16691,7 +16721,8 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./features/*", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "features", NULL,
+                                             &nodes)) < 0)
         goto error;
 
     for (i = 0; i < n; i++) {
@@ -17079,7 +17110,8 @@ virDomainDefParseXML(xmlDocPtr xml,
         break;
     }
 
-    if ((n = virXPathNodeSet("./clock/timer", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "clock", "timer",
+                                             &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->clock.timers, n) < 0)
@@ -17099,7 +17131,8 @@ virDomainDefParseXML(xmlDocPtr xml,
         goto error;
 
     /* analysis of the disk devices */
-    if ((n = virXPathNodeSet("./devices/disk", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "disk",
+                                             &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->disks, n) < 0)
@@ -17121,7 +17154,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the controller devices */
-    if ((n = virXPathNodeSet("./devices/controller", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "controller",
+                                             &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->controllers, n) < 0)
@@ -17172,7 +17206,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* analysis of the resource leases */
-    if ((n = virXPathNodeSet("./devices/lease", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "lease",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot extract device leases"));
         goto error;
@@ -17189,7 +17224,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the filesystems */
-    if ((n = virXPathNodeSet("./devices/filesystem", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "filesystem",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->fss, n) < 0)
         goto error;
@@ -17204,7 +17240,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the network devices */
-    if ((n = virXPathNodeSet("./devices/interface", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "interface",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->nets, n) < 0)
         goto error;
@@ -17234,7 +17271,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the smartcard devices */
-    if ((n = virXPathNodeSet("./devices/smartcard", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "smartcard",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->smartcards, n) < 0)
         goto error;
@@ -17252,7 +17290,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the character devices */
-    if ((n = virXPathNodeSet("./devices/parallel", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "parallel",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->parallels, n) < 0)
         goto error;
@@ -17279,7 +17318,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/serial", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "serial",
+                                             &nodes)) < 0)
         goto error;
 
     if (n && VIR_ALLOC_N(def->serials, n) < 0)
@@ -17307,7 +17347,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/console", ctxt, &nodes)) < 0) {
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "console",
+                                             &nodes)) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        "%s", _("cannot extract console devices"));
         goto error;
@@ -17330,7 +17371,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/channel", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "channel",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->channels, n) < 0)
         goto error;
@@ -17351,7 +17393,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
 
     /* analysis of the input devices */
-    if ((n = virXPathNodeSet("./devices/input", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "input",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->inputs, n) < 0)
         goto error;
@@ -17378,7 +17421,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the graphics devices */
-    if ((n = virXPathNodeSet("./devices/graphics", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "graphics",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->graphics, n) < 0)
         goto error;
@@ -17394,7 +17438,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the sound devices */
-    if ((n = virXPathNodeSet("./devices/sound", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "sound",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->sounds, n) < 0)
         goto error;
@@ -17410,7 +17455,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the video devices */
-    if ((n = virXPathNodeSet("./devices/video", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "video",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->videos, n) < 0)
         goto error;
@@ -17443,7 +17489,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the host devices */
-    if ((n = virXPathNodeSet("./devices/hostdev", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "hostdev",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_REALLOC_N(def->hostdevs, def->nhostdevs + n) < 0)
         goto error;
@@ -17479,7 +17526,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
     /* analysis of the watchdog devices */
     def->watchdog = NULL;
-    if ((n = virXPathNodeSet("./devices/watchdog", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "watchdog",
+                                             &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -17498,7 +17546,8 @@ virDomainDefParseXML(xmlDocPtr xml,
 
     /* analysis of the memballoon devices */
     def->memballoon = NULL;
-    if ((n = virXPathNodeSet("./devices/memballoon", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "memballoon",
+                                             &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -17516,7 +17565,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* Parse the RNG devices */
-    if ((n = virXPathNodeSet("./devices/rng", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "rng",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->rngs, n) < 0)
         goto error;
@@ -17531,7 +17581,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* Parse the TPM devices */
-    if ((n = virXPathNodeSet("./devices/tpm", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "tpm",
+                                             &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -17546,7 +17597,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/nvram", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "nvram",
+                                             &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -17563,7 +17615,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
 
     /* analysis of the hub devices */
-    if ((n = virXPathNodeSet("./devices/hub", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "hub",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->hubs, n) < 0)
         goto error;
@@ -17585,7 +17638,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the redirected devices */
-    if ((n = virXPathNodeSet("./devices/redirdev", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "redirdev",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->redirdevs, n) < 0)
         goto error;
@@ -17600,7 +17654,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the redirection filter rules */
-    if ((n = virXPathNodeSet("./devices/redirfilter", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "redirfilter",
+                                             &nodes)) < 0)
         goto error;
     if (n > 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -17619,7 +17674,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the panic devices */
-    if ((n = virXPathNodeSet("./devices/panic", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "panic",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->panics, n) < 0)
         goto error;
@@ -17633,7 +17689,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the shmem devices */
-    if ((n = virXPathNodeSet("./devices/shmem", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "shmem",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->shmems, n) < 0)
         goto error;
@@ -17652,7 +17709,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of memory devices */
-    if ((n = virXPathNodeSet("./devices/memory", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "memory",
+                                             &nodes)) < 0)
         goto error;
     if (n && VIR_ALLOC_N(def->mems, n) < 0)
         goto error;
@@ -17668,7 +17726,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if ((n = virXPathNodeSet("./devices/iommu", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "devices", "iommu",
+                                             &nodes)) < 0)
         goto error;
 
     if (n > 1) {
@@ -17684,7 +17743,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     VIR_FREE(nodes);
 
     /* analysis of the user namespace mapping */
-    if ((n = virXPathNodeSet("./idmap/uid", ctxt, &nodes)) < 0)
+    if ((n = virXMLNodeGetSubelementPathList(root, "idmap", "uid",
+                                             &nodes)) < 0)
         goto error;
 
     if (n) {
@@ -17696,7 +17756,8 @@ virDomainDefParseXML(xmlDocPtr xml,
     }
     VIR_FREE(nodes);
 
-    if  ((n = virXPathNodeSet("./idmap/gid", ctxt, &nodes)) < 0)
+    if  ((n = virXMLNodeGetSubelementPathList(root, "idmap", "gid",
+                                              &nodes)) < 0)
         goto error;
 
     if (n) {
@@ -24757,16 +24818,389 @@ virDomainDiskDefForeachPath(virDomainDiskDefPtr disk,
 }
 
 
-/* Copy src into a new definition; with the quality of the copy
- * depending on the migratable flag (false for transitions between
- * persistent and active, true for transitions across save files or
- * snapshots).  */
-virDomainDefPtr
-virDomainDefCopy(virDomainDefPtr src,
-                 virCapsPtr caps,
-                 virDomainXMLOptionPtr xmlopt,
-                 void *parseOpaque,
-                 bool migratable)
+/* virDomainDefCopy used to clone everything by formatting the
+ * definition and parsing it back, which for domains with many disks
+ * and interfaces is dominated by those two device types.  The helpers
+ * below copy them directly, keeping exactly what formatting with
+ * virDomainDefCopy's flags and parsing the result as inactive XML
+ * would keep.  Every field is copied by name, so a field added to
+ * virDomainDiskDef or virDomainNetDef has to be added here as well;
+ * qemudomaincopytest notices when one that the XML knows about is
+ * missing.  */
+
+static int
+virDomainDiskSourceCopyConfig(virStorageSourcePtr dst,
+                              virStorageSourcePtr src,
+                              int startupPolicy,
+                              bool migratable)
+{
+    virSecurityDeviceLabelDefPtr seclabel = NULL;
+    size_t i;
+
+    dst->type = src->type;
+    dst->format = src->format;
+    dst->readonly = src->readonly;
+    dst->shared = src->shared;
+
+    if (VIR_STRDUP(dst->driverName, src->driverName) < 0)
+        return -1;
+
+    if (src->auth &&
+        !(dst->auth = virStorageAuthDefCopy(src->auth)))
+        return -1;
+
+    if (src->encryption &&
+        !(dst->encryption = virStorageEncryptionCopy(src->encryption)))
+        return -1;
+
+    /* No <source> is formatted when there is nothing to put in it */
+    if (!src->path && !src->nhosts && !src->srcpool && !startupPolicy)
+        return 0;
+
+    switch ((virStorageType) src->type) {
+    case VIR_STORAGE_TYPE_FILE:
+    case VIR_STORAGE_TYPE_BLOCK:
+    case VIR_STORAGE_TYPE_DIR:
+        if (VIR_STRDUP(dst->path, src->path) < 0)
+            return -1;
+        break;
+
+    case VIR_STORAGE_TYPE_NETWORK:
+        dst->protocol = src->protocol;
+        if (VIR_STRDUP(dst->path, src->path) < 0 ||
+            VIR_STRDUP(dst->volume, src->volume) < 0 ||
+            VIR_STRDUP(dst->snapshot, src->snapshot) < 0 ||
+            VIR_STRDUP(dst->configFile, src->configFile) < 0)
+            return -1;
+        if (src->nhosts) {
+            if (!(dst->hosts = virStorageNetHostDefCopy(src->nhosts,
+                                                        src->hosts)))
+                return -1;
+            dst->nhosts = src->nhosts;
+        }
+        break;
+
+    case VIR_STORAGE_TYPE_VOLUME:
+        /* the translated path and pool details are runtime only */
+        if (src->srcpool) {
+            if (VIR_ALLOC(dst->srcpool) < 0 ||
+                VIR_STRDUP(dst->srcpool->pool, src->srcpool->pool) < 0 ||
+                VIR_STRDUP(dst->srcpool->volume, src->srcpool->volume) < 0)
+                return -1;
+            dst->srcpool->mode = src->srcpool->mode;
+        }
+        break;
+
+    case VIR_STORAGE_TYPE_NONE:
+    case VIR_STORAGE_TYPE_LAST:
+        break;
+    }
+
+    if (src->type == VIR_STORAGE_TYPE_DIR ||
+        src->type == VIR_STORAGE_TYPE_NETWORK)
+        return 0;
+
+    for (i = 0; i < src->nseclabels; i++) {
+        /* inactive XML leaves out labels that will be generated anyway */
+        if (migratable &&
+            !src->seclabels[i]->label && src->seclabels[i]->relabel)
+            continue;
+
+        if (!(seclabel = virSecurityDeviceLabelDefCopy(src->seclabels[i])))
+            return -1;
+
+        /* labelskip is only parsed for live definitions */
+        if (seclabel->labelskip) {
+            seclabel->labelskip = false;
+            seclabel->relabel = true;
+        }
+
+        if (VIR_APPEND_ELEMENT(dst->seclabels, dst->nseclabels, seclabel) < 0) {
+            virSecurityDeviceLabelDefFree(seclabel);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static virDomainDiskDefPtr
+virDomainDiskDefCopyConfig(virDomainDiskDefPtr src,
+                           virDomainXMLOptionPtr xmlopt,
+                           bool migratable)
+{
+    virDomainDiskDefPtr def;
+
+    if (!(def = virDomainDiskDefNew(xmlopt)))
+        return NULL;
+
+    /* mirror, mirrorState and mirrorJob are left alone, block jobs
+     * are never parsed from inactive XML */
+    def->device = src->device;
+    def->bus = src->bus;
+    if (def->device == VIR_DOMAIN_DISK_DEVICE_FLOPPY ||
+        def->device == VIR_DOMAIN_DISK_DEVICE_CDROM)
+        def->tray_status = src->tray_status;
+    else
+        def->tray_status = VIR_DOMAIN_DISK_TRAY_CLOSED;
+    if (def->bus == VIR_DOMAIN_DISK_BUS_USB)
+        def->removable = src->removable;
+    def->geometry.cylinders = src->geometry.cylinders;
+    def->geometry.heads = src->geometry.heads;
+    def->geometry.sectors = src->geometry.sectors;
+    def->geometry.trans = src->geometry.trans;
+    def->blockio.logical_block_size = src->blockio.logical_block_size;
+    def->blockio.physical_block_size = src->blockio.physical_block_size;
+    def->blkdeviotune = src->blkdeviotune;
+    def->cachemode = src->cachemode;
+    def->error_policy = src->error_policy;
+    def->rerror_policy = src->rerror_policy;
+    def->iomode = src->iomode;
+    def->ioeventfd = src->ioeventfd;
+    def->event_idx = src->event_idx;
+    def->copy_on_read = src->copy_on_read;
+    def->snapshot = src->snapshot;
+    if (src->src->type != VIR_STORAGE_TYPE_NETWORK)
+        def->startupPolicy = src->startupPolicy;
+    def->transient = src->transient;
+    def->rawio = src->rawio;
+    def->sgio = src->sgio;
+    def->discard = src->discard;
+    def->iothread = src->iothread;
+    def->detect_zeroes = src->detect_zeroes;
+
+    if (VIR_STRDUP(def->dst, src->dst) < 0 ||
+        VIR_STRDUP(def->serial, src->serial) < 0 ||
+        VIR_STRDUP(def->wwn, src->wwn) < 0 ||
+        VIR_STRDUP(def->vendor, src->vendor) < 0 ||
+        VIR_STRDUP(def->product, src->product) < 0 ||
+        VIR_STRDUP(def->domain_name, src->domain_name) < 0)
+        goto error;
+
+    if (virDomainDiskSourceCopyConfig(def->src, src->src,
+                                      src->startupPolicy, migratable) < 0)
+        goto error;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+    VIR_FREE(def->info.alias);
+    VIR_FREE(def->info.romfile);
+    def->info.rombar = VIR_TRISTATE_SWITCH_ABSENT;
+
+    return def;
+
+ error:
+    virDomainDiskDefFree(def);
+    return NULL;
+}
+
+
+static virDomainNetDefPtr
+virDomainNetDefCopyConfig(virDomainNetDefPtr src,
+                          const char *netprefix)
+{
+    virDomainNetDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    def->type = src->type;
+    virMacAddrSet(&def->mac, &src->mac);
+    /* driver options are only read along with the virtio model, and
+     * all of them are plain values */
+    if (STREQ_NULLABLE(src->model, "virtio"))
+        def->driver.virtio = src->driver.virtio;
+    def->tune.sndbuf_specified = src->tune.sndbuf_specified;
+    def->tune.sndbuf = src->tune.sndbuf;
+    def->trustGuestRxFilters = src->trustGuestRxFilters;
+    def->linkstate = src->linkstate;
+
+    switch (src->type) {
+    case VIR_DOMAIN_NET_TYPE_VHOSTUSER:
+        if (VIR_ALLOC(def->data.vhostuser) < 0)
+            goto error;
+        def->data.vhostuser->type = VIR_DOMAIN_CHR_TYPE_UNIX;
+        def->data.vhostuser->data.nix.listen = src->data.vhostuser->data.nix.listen;
+        if (VIR_STRDUP(def->data.vhostuser->data.nix.path,
+                       src->data.vhostuser->data.nix.path) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+    case VIR_DOMAIN_NET_TYPE_UDP:
+        def->data.socket.port = src->data.socket.port;
+        if (VIR_STRDUP(def->data.socket.address,
+                       src->data.socket.address) < 0)
+            goto error;
+        if (src->type == VIR_DOMAIN_NET_TYPE_UDP) {
+            def->data.socket.localport = src->data.socket.localport;
+            if (VIR_STRDUP(def->data.socket.localaddr,
+                           src->data.socket.localaddr) < 0)
+                goto error;
+        }
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+        /* the actual device is allocated again on every start */
+        if (VIR_STRDUP(def->data.network.name, src->data.network.name) < 0 ||
+            VIR_STRDUP(def->data.network.portgroup,
+                       src->data.network.portgroup) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        if (VIR_STRDUP(def->data.bridge.brname, src->data.bridge.brname) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+        if (VIR_STRDUP(def->data.internal.name, src->data.internal.name) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+        def->data.direct.mode = src->data.direct.mode;
+        if (VIR_STRDUP(def->data.direct.linkdev, src->data.direct.linkdev) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+        /* callers copy these through XML */
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    if (VIR_STRDUP(def->model, src->model) < 0 ||
+        VIR_STRDUP(def->backend.tap, src->backend.tap) < 0 ||
+        VIR_STRDUP(def->backend.vhost, src->backend.vhost) < 0 ||
+        VIR_STRDUP(def->script, src->script) < 0 ||
+        VIR_STRDUP(def->domain_name, src->domain_name) < 0 ||
+        VIR_STRDUP(def->ifname_guest, src->ifname_guest) < 0 ||
+        VIR_STRDUP(def->ifname_guest_actual, src->ifname_guest_actual) < 0)
+        goto error;
+
+    /* Generated target names are blanked out when parsing inactive XML,
+     * and macvtap ones are always generated */
+    if (src->ifname &&
+        src->type != VIR_DOMAIN_NET_TYPE_DIRECT &&
+        !STRPREFIX(src->ifname, VIR_NET_GENERATED_PREFIX) &&
+        !(netprefix && STRPREFIX(src->ifname, netprefix)) &&
+        VIR_STRDUP(def->ifname, src->ifname) < 0)
+        goto error;
+
+    /* the profile only holds values, no pointers */
+    if (src->virtPortProfile) {
+        if (VIR_ALLOC(def->virtPortProfile) < 0)
+            goto error;
+        *def->virtPortProfile = *src->virtPortProfile;
+    }
+
+    if (virNetDevIPInfoCopy(&def->hostIP, &src->hostIP) < 0 ||
+        virNetDevIPInfoCopy(&def->guestIP, &src->guestIP) < 0)
+        goto error;
+
+    if (src->filter &&
+        (src->type == VIR_DOMAIN_NET_TYPE_ETHERNET ||
+         src->type == VIR_DOMAIN_NET_TYPE_NETWORK ||
+         src->type == VIR_DOMAIN_NET_TYPE_BRIDGE)) {
+        if (VIR_STRDUP(def->filter, src->filter) < 0)
+            goto error;
+        if (src->filterparams &&
+            (!(def->filterparams = virNWFilterHashTableCreate(0)) ||
+             virNWFilterHashTablePutAll(src->filterparams,
+                                        def->filterparams) < 0))
+            goto error;
+    }
+
+    if (virNetDevBandwidthCopy(&def->bandwidth, src->bandwidth) < 0 ||
+        virNetDevVlanCopy(&def->vlan, &src->vlan) < 0)
+        goto error;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+    VIR_FREE(def->info.alias);
+
+    return def;
+
+ error:
+    virDomainNetDefFree(def);
+    return NULL;
+}
+
+
+/* Whether some disk or interface of @def holds state which only an
+ * XML round trip reproduces faithfully */
+static bool
+virDomainDefCopyNeedsXML(virDomainDefPtr def,
+                         bool migratable)
+{
+    size_t i;
+
+    for (i = 0; i < def->ndisks; i++) {
+        /* the backing chain is formatted and parsed back */
+        if (!migratable && def->disks[i]->src->backingStore)
+            return true;
+    }
+
+    for (i = 0; i < def->nnets; i++) {
+        virDomainNetDefPtr net = def->nets[i];
+
+        /* these also live in def->hostdevs */
+        if (net->type == VIR_DOMAIN_NET_TYPE_HOSTDEV)
+            return true;
+
+        /* the actual device is reported in place of the config */
+        if (!migratable &&
+            net->type == VIR_DOMAIN_NET_TYPE_NETWORK &&
+            net->data.network.actual)
+            return true;
+
+        if (net->type == VIR_DOMAIN_NET_TYPE_VHOSTUSER &&
+            net->data.vhostuser->type != VIR_DOMAIN_CHR_TYPE_UNIX)
+            return true;
+    }
+
+    return false;
+}
+
+
+static int
+virDomainDefCountAddressesCallback(virDomainDefPtr def ATTRIBUTE_UNUSED,
+                                   virDomainDeviceDefPtr dev ATTRIBUTE_UNUSED,
+                                   virDomainDeviceInfoPtr info,
+                                   void *opaque)
+{
+    size_t *count = opaque;
+
+    if (info->type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_NONE)
+        (*count)++;
+    return 0;
+}
+
+
+static size_t
+virDomainDefCountAddresses(virDomainDefPtr def)
+{
+    size_t count = 0;
+
+    ignore_value(virDomainDeviceInfoIterate(def,
+                                            virDomainDefCountAddressesCallback,
+                                            &count));
+    return count;
+}
+
+
+static virDomainDefPtr
+virDomainDefCopyXML(virDomainDefPtr src,
+                    virCapsPtr caps,
+                    virDomainXMLOptionPtr xmlopt,
+                    void *parseOpaque,
+                    bool migratable)
 {
     char *xml;
     virDomainDefPtr ret;
@@ -24777,7 +25211,6 @@ virDomainDefCopy(virDomainDefPtr src,
     if (migratable)
         format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE | VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
 
-    /* Easiest to clone via a round-trip through XML.  */
     if (!(xml = virDomainDefFormat(src, caps, format_flags)))
         return NULL;
 
@@ -24787,6 +25220,85 @@ virDomainDefCopy(virDomainDefPtr src,
     return ret;
 }
 
+
+/* Copy src into a new definition; with the quality of the copy
+ * depending on the migratable flag (false for transitions between
+ * persistent and active, true for transitions across save files or
+ * snapshots).  The result is the same as formatting src and parsing
+ * it back as inactive XML, which is literally what happens to
+ * everything but disks and interfaces.  */
+virDomainDefPtr
+virDomainDefCopy(virDomainDefPtr src,
+                 virCapsPtr caps,
+                 virDomainXMLOptionPtr xmlopt,
+                 void *parseOpaque,
+                 bool migratable)
+{
+    virDomainDef skel;
+    virDomainDefPtr ret;
+    const char *netprefix = caps ? caps->host.netprefix : NULL;
+    bool deviceBoot = false;
+    size_t i;
+
+    if (virDomainDefCopyNeedsXML(src, migratable))
+        return virDomainDefCopyXML(src, caps, xmlopt, parseOpaque, migratable);
+
+    /* src itself must not be touched, so hide the devices in a copy */
+    skel = *src;
+    skel.ndisks = 0;
+    skel.disks = NULL;
+    skel.nnets = 0;
+    skel.nets = NULL;
+
+    if (!(ret = virDomainDefCopyXML(&skel, caps, xmlopt, parseOpaque,
+                                    migratable)))
+        return NULL;
+
+    /* Any address the parser assigned to the skeleton was picked
+     * without seeing those of the disks and interfaces, and may
+     * clash with them. Only a full round trip picks the right one. */
+    if (virDomainDefCountAddresses(ret) != virDomainDefCountAddresses(&skel)) {
+        virDomainDefFree(ret);
+        return virDomainDefCopyXML(src, caps, xmlopt, parseOpaque, migratable);
+    }
+
+    if (VIR_ALLOC_N(ret->disks, src->ndisks) < 0 ||
+        VIR_ALLOC_N(ret->nets, src->nnets) < 0)
+        goto error;
+
+    for (i = 0; i < src->ndisks; i++) {
+        if (!(ret->disks[i] = virDomainDiskDefCopyConfig(src->disks[i],
+                                                         xmlopt,
+                                                         migratable)))
+            goto error;
+        ret->ndisks++;
+        if (ret->disks[i]->info.bootIndex)
+            deviceBoot = true;
+    }
+
+    for (i = 0; i < src->nnets; i++) {
+        if (!(ret->nets[i] = virDomainNetDefCopyConfig(src->nets[i],
+                                                       netprefix)))
+            goto error;
+        ret->nnets++;
+        if (ret->nets[i]->info.bootIndex)
+            deviceBoot = true;
+    }
+
+    /* Not seeing any per-device boot order, the parser of the skeleton
+     * defaulted to booting from the first disk */
+    if (deviceBoot && src->os.nBootDevs == 0) {
+        ret->os.nBootDevs = 0;
+        memset(ret->os.bootDevs, 0, sizeof(ret->os.bootDevs));
+    }
+
+    return ret;
+
+ error:
+    virDomainDefFree(ret);
+    return NULL;
+}
+
 virDomainDefPtr
 virDomainObjCopyPersistentDef(virDomainObjPtr dom,
                               virCapsPtr caps,
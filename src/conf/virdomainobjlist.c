@@ -32,6 +32,7 @@
 #include "virfile.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -42,7 +43,11 @@ static void virDomainObjListDispose(void *obj);
 
 
 struct _virDomainObjList {
-    virObjectLockable parent;
+    /* Lookups by UUID and name only read the hash tables, so they take
+     * the lock for reading and don't contend with each other. Anything
+     * modifying the tables or iterating over them needs the write lock,
+     * virHash iterators are not safe to be run concurrently. */
+    virObjectRWLockable parent;
 
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
@@ -56,7 +61,7 @@ struct _virDomainObjList {
 
 static int virDomainObjListOnceInit(void)
 {
-    if (!(virDomainObjListClass = virClassNew(virClassForObjectLockable(),
+    if (!(virDomainObjListClass = virClassNew(virClassForObjectRWLockable(),
                                               "virDomainObjList",
                                               sizeof(virDomainObjList),
                                               virDomainObjListDispose)))
@@ -74,7 +79,7 @@ virDomainObjListPtr virDomainObjListNew(void)
     if (virDomainObjListInitialize() < 0)
         return NULL;
 
-    if (!(doms = virObjectLockableNew(virDomainObjListClass)))
+    if (!(doms = virObjectRWLockableNew(virDomainObjListClass)))
         return NULL;
 
     if (!(doms->objs = virHashCreate(50, virObjectFreeHashData)) ||
@@ -118,11 +123,11 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
                                  bool ref)
 {
     virDomainObjPtr obj;
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
@@ -134,7 +139,7 @@ virDomainObjListFindByIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -160,13 +165,13 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virObjectRWLockRead(doms);
     virUUIDFormat(uuid, uuidstr);
 
     obj = virHashLookup(doms->objs, uuidstr);
     if (ref) {
         virObjectRef(obj);
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     }
     if (obj) {
         virObjectLock(obj);
@@ -178,7 +183,7 @@ virDomainObjListFindByUUIDInternal(virDomainObjListPtr doms,
         }
     }
     if (!ref)
-        virObjectUnlock(doms);
+        virObjectRWUnlock(doms);
     return obj;
 }
 
@@ -204,10 +209,10 @@ virDomainObjPtr virDomainObjListFindByName(virDomainObjListPtr doms,
 {
     virDomainObjPtr obj;
 
-    virObjectLock(doms);
+    virObjectRWLockRead(doms);
     obj = virHashLookup(doms->objsName, name);
     virObjectRef(obj);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     if (obj) {
         virObjectLock(obj);
         if (obj->removing) {
@@ -327,9 +332,9 @@ virDomainObjPtr virDomainObjListAdd(virDomainObjListPtr doms,
 {
     virDomainObjPtr ret;
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     ret = virDomainObjListAddLocked(doms, def, xmlopt, flags, oldDef);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return ret;
 }
 
@@ -349,13 +354,13 @@ void virDomainObjListRemove(virDomainObjListPtr doms,
     virObjectRef(dom);
     virObjectUnlock(dom);
 
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
     virHashRemoveEntry(doms->objs, uuidstr);
     virHashRemoveEntry(doms->objsName, dom->def->name);
     virObjectUnlock(dom);
     virObjectUnref(dom);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
 }
 
 
@@ -394,7 +399,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
      * hold a lock on dom but not refcount it. */
     virObjectRef(dom);
     virObjectUnlock(dom);
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virObjectLock(dom);
     virObjectUnref(dom);
 
@@ -420,7 +425,7 @@ virDomainObjListRename(virDomainObjListPtr doms,
 
     ret = 0;
  cleanup:
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     VIR_FREE(old_name);
     return ret;
 }
@@ -444,80 +449,206 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 }
 
 
+/* A domain config or status file loaded by virDomainObjListLoadAllConfigs */
+struct virDomainObjListLoadFile {
+    char *name;
+    virDomainDefPtr def;        /* parsed config */
+    int autostart;
+    virDomainObjPtr obj;        /* parsed status */
+};
+
+struct virDomainObjListLoadData {
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+
+    virMutex lock;
+    virCond cond;
+    size_t pending;             /* files queued to the parser threads */
+};
+
+
+static int
+virDomainObjListParseConfig(struct virDomainObjListLoadData *data,
+                            struct virDomainObjListLoadFile *file)
+{
+    char *configFile = NULL, *autostartLink = NULL;
+    int ret = -1;
+
+    if ((configFile = virDomainConfigFile(data->configDir, file->name)) == NULL)
+        goto cleanup;
+    if (!(file->def = virDomainDefParseFile(configFile, data->caps,
+                                            data->xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                            VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                            VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(data->autostartDir,
+                                             file->name)) == NULL)
+        goto cleanup;
+
+    if ((file->autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virDomainDefFree(file->def);
+        file->def = NULL;
+    }
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+    return ret;
+}
+
+
+static int
+virDomainObjListParseStatus(struct virDomainObjListLoadData *data,
+                            struct virDomainObjListLoadFile *file)
+{
+    char *statusFile = NULL;
+
+    if ((statusFile = virDomainConfigFile(data->configDir, file->name)) == NULL)
+        return -1;
+
+    file->obj = virDomainObjParseFile(statusFile, data->caps, data->xmlopt,
+                                      VIR_DOMAIN_DEF_PARSE_STATUS |
+                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+
+    VIR_FREE(statusFile);
+
+    if (!file->obj)
+        return -1;
+
+    /* The object is locked by the thread which is going to add it to
+     * the list */
+    virObjectUnlock(file->obj);
+    return 0;
+}
+
+
+static void
+virDomainObjListParseFile(struct virDomainObjListLoadData *data,
+                          struct virDomainObjListLoadFile *file)
+{
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", file->name);
+    if (data->liveStatus)
+        ignore_value(virDomainObjListParseStatus(data, file));
+    else
+        ignore_value(virDomainObjListParseConfig(data, file));
+}
+
+
+static void
+virDomainObjListParseWorker(void *jobdata,
+                            void *opaque)
+{
+    struct virDomainObjListLoadData *data = opaque;
+
+    virDomainObjListParseFile(data, jobdata);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Parses all @files using up to @nworkers threads */
+static void
+virDomainObjListParseFiles(struct virDomainObjListLoadData *data,
+                           struct virDomainObjListLoadFile *files,
+                           size_t nfiles,
+                           unsigned int nworkers)
+{
+    virThreadPoolPtr pool = NULL;
+    size_t i;
+
+    if (nworkers > 1 && nfiles > 1) {
+        /* Parsing in this thread works just as well, only slower */
+        if (!(pool = virThreadPoolNew(0, MIN(nworkers, nfiles), 0,
+                                      virDomainObjListParseWorker, data)))
+            virResetLastError();
+    }
+
+    data->pending = 0;
+    for (i = 0; i < nfiles; i++) {
+        if (pool) {
+            virMutexLock(&data->lock);
+            data->pending++;
+            virMutexUnlock(&data->lock);
+
+            if (virThreadPoolSendJob(pool, 0, files + i) == 0)
+                continue;
+
+            virResetLastError();
+            virMutexLock(&data->lock);
+            data->pending--;
+            virMutexUnlock(&data->lock);
+        }
+
+        virDomainObjListParseFile(data, files + i);
+    }
+
+    if (!pool)
+        return;
+
+    virMutexLock(&data->lock);
+    while (data->pending > 0)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    virMutexUnlock(&data->lock);
+
+    virThreadPoolFree(pool);
+}
+
+
 static virDomainObjPtr
 virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
                            virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
+                           struct virDomainObjListLoadFile *file,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
     virDomainObjPtr dom;
-    int autostart;
     virDomainDefPtr oldDef = NULL;
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
-                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
-
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
+    if (!file->def)
+        return NULL;
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
+    if (!(dom = virDomainObjListAddLocked(doms, file->def, xmlopt, 0, &oldDef)))
+        return NULL;
+    file->def = NULL;
 
-    dom->autostart = autostart;
+    dom->autostart = file->autostart;
 
     if (notify)
         (*notify)(dom, oldDef == NULL, opaque);
 
     virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
-
- error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    virDomainDefFree(def);
-    return NULL;
 }
 
 
 static virDomainObjPtr
 virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
+                           struct virDomainObjListLoadFile *file,
                            virDomainLoadConfigNotify notify,
                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = file->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
+    if (!obj)
+        return NULL;
 
     virUUIDFormat(obj->def->uuid, uuidstr);
 
@@ -525,82 +656,123 @@ virDomainObjListLoadStatus(virDomainObjListPtr doms,
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected domain %s already exists"),
                        obj->def->name);
-        goto error;
+        return NULL;
     }
 
     if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
-        goto error;
+        return NULL;
 
     if (virHashAddEntry(doms->objsName, obj->def->name, obj) < 0) {
         virHashRemoveEntry(doms->objs, uuidstr);
-        goto error;
+        return NULL;
     }
 
     /* Since domain is in two hash tables, increment the
      * reference counter */
     virObjectRef(obj);
+    file->obj = NULL;
+
+    virObjectLock(obj);
 
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
-
- error:
-    virObjectUnref(obj);
-    VIR_FREE(statusFile);
-    return NULL;
 }
 
 
+/**
+ * virDomainObjListLoadAllConfigs:
+ * @doms: the domain list
+ * @configDir: directory with the domain config or status XML files
+ * @autostartDir: directory with autostart links, unused for status
+ * @liveStatus: whether to load status rather than config files
+ * @nworkers: maximum number of threads parsing the files
+ * @caps: capabilities
+ * @xmlopt: XML parser configuration
+ * @notify: callback invoked for every loaded domain
+ * @opaque: data for @notify
+ *
+ * Loads all domains from @configDir into @doms. Files which fail to be
+ * parsed are skipped. With @nworkers > 1 the files are parsed by a pool
+ * of threads, but the domains are still added to @doms and passed to
+ * @notify in the order in which the files were found in @configDir.
+ *
+ * Returns 0 on success, -1 if @configDir couldn't be read.
+ */
 int
 virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                const char *configDir,
                                const char *autostartDir,
                                int liveStatus,
+                               unsigned int nworkers,
                                virCapsPtr caps,
                                virDomainXMLOptionPtr xmlopt,
                                virDomainLoadConfigNotify notify,
                                void *opaque)
 {
+    struct virDomainObjListLoadData data = {
+        .configDir = configDir,
+        .autostartDir = autostartDir,
+        .liveStatus = liveStatus,
+        .caps = caps,
+        .xmlopt = xmlopt,
+    };
+    struct virDomainObjListLoadFile *files = NULL;
+    size_t nfiles = 0;
     DIR *dir;
     struct dirent *entry;
     int ret = -1;
     int rc;
+    size_t i;
 
     VIR_INFO("Scanning for configs in %s", configDir);
 
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectLock(doms);
+    if (virMutexInit(&data.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init mutex"));
+        VIR_DIR_CLOSE(dir);
+        return -1;
+    }
+    if (virCondInit(&data.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to init condition"));
+        virMutexDestroy(&data.lock);
+        VIR_DIR_CLOSE(dir);
+        return -1;
+    }
 
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
+        struct virDomainObjListLoadFile file = { NULL, NULL, 0, NULL };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
+        if (VIR_STRDUP(file.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(files, nfiles, file) < 0) {
+            VIR_FREE(file.name);
+            ret = -1;
+            break;
+        }
+    }
+
+    VIR_DIR_CLOSE(dir);
+
+    /* Parsing doesn't need the domain list, only adding the parsed
+     * domains does */
+    virDomainObjListParseFiles(&data, files, nfiles, nworkers);
+
+    virObjectRWLockWrite(doms);
+
+    for (i = 0; i < nfiles; i++) {
+        virDomainObjPtr dom;
+
         if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
+            dom = virDomainObjListLoadStatus(doms, files + i, notify, opaque);
         else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             notify,
-                                             opaque);
+            dom = virDomainObjListLoadConfig(doms, xmlopt, files + i,
+                                             notify, opaque);
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
@@ -608,8 +780,16 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
         }
     }
 
-    VIR_DIR_CLOSE(dir);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
+
+    for (i = 0; i < nfiles; i++) {
+        VIR_FREE(files[i].name);
+        virDomainDefFree(files[i].def);
+        virObjectUnref(files[i].obj);
+    }
+    VIR_FREE(files);
+    virCondDestroy(&data.cond);
+    virMutexDestroy(&data.lock);
     return ret;
 }
 
@@ -653,9 +833,9 @@ virDomainObjListNumOfDomains(virDomainObjListPtr doms,
                              virConnectPtr conn)
 {
     struct virDomainObjListData data = { filter, conn, active, 0 };
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListCount, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return data.count;
 }
 
@@ -697,9 +877,9 @@ virDomainObjListGetActiveIDs(virDomainObjListPtr doms,
 {
     struct virDomainIDData data = { filter, conn,
                                     0, maxids, ids };
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListCopyActiveIDs, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return data.numids;
 }
 
@@ -751,9 +931,9 @@ virDomainObjListGetInactiveNames(virDomainObjListPtr doms,
     struct virDomainNameData data = { filter, conn,
                                       0, 0, maxnames, names };
     size_t i;
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListCopyInactiveNames, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     if (data.oom) {
         for (i = 0; i < data.numnames; i++)
             VIR_FREE(data.names[i]);
@@ -792,9 +972,9 @@ virDomainObjListForEach(virDomainObjListPtr doms,
     struct virDomainListIterData data = {
         callback, opaque, 0,
     };
-    virObjectLock(doms);
+    virObjectRWLockWrite(doms);
     virHashForEach(doms->objs, virDomainObjListHelper, &data);
-    virObjectUnlock(doms);
+    virObjectRWUnlock(doms);
     return data.ret;
 }
 
@@ -925,15 +1105,15 @@ virDomainObjListCollect(virDomainObjListPtr domlist,
 {
     struct virDomainListData data = { NULL, 0 };
 
-    virObjectLock(domlist);
+    virObjectRWLockWrite(domlist);
     sa_assert(domlist->objs);
     if (VIR_ALLOC_N(data.vms, virHashSize(domlist->objs)) < 0) {
-        virObjectUnlock(domlist);
+        virObjectRWUnlock(domlist);
         return -1;
     }
 
     virHashForEach(domlist->objs, virDomainObjListCollectIterator, &data);
-    virObjectUnlock(domlist);
+    virObjectRWUnlock(domlist);
 
     virDomainObjListFilter(&data.vms, &data.nvms, conn, filter, flags);
 
@@ -962,7 +1142,7 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
     *nvms = 0;
     *vms = NULL;
 
-    virObjectLock(domlist);
+    virObjectRWLockRead(domlist);
     for (i = 0; i < ndoms; i++) {
         virDomainPtr dom = doms[i];
 
@@ -972,7 +1152,7 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
             if (skip_missing)
                 continue;
 
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virReportError(VIR_ERR_NO_DOMAIN,
                            _("no domain with matching uuid '%s' (%s)"),
                            uuidstr, dom->name);
@@ -982,12 +1162,12 @@ virDomainObjListConvert(virDomainObjListPtr domlist,
         virObjectRef(vm);
 
         if (VIR_APPEND_ELEMENT(*vms, *nvms, vm) < 0) {
-            virObjectUnlock(domlist);
+            virObjectRWUnlock(domlist);
             virObjectUnref(vm);
             goto error;
         }
     }
-    virObjectUnlock(domlist);
+    virObjectRWUnlock(domlist);
 
     sa_assert(*vms);
     virDomainObjListFilter(vms, nvms, conn, filter, flags);
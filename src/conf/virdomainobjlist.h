@@ -73,6 +73,7 @@ int virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
                                    const char *configDir,
                                    const char *autostartDir,
                                    int liveStatus,
+                                   unsigned int nworkers,
                                    virCapsPtr caps,
                                    virDomainXMLOptionPtr xmlopt,
                                    virDomainLoadConfigNotify notify,
@@ -56,6 +56,11 @@ struct virFDStreamData {
     virCommandPtr cmd;
     unsigned long long offset;
     unsigned long long length;
+    bool sparse;        /* fd is a file whose holes can be detected */
+    bool framed;        /* a sparse file behind the iohelper, whose
+                         * pipe carries virFileSparseRecord sections */
+    bool inHole;        /* the current section is a hole */
+    unsigned long long section; /* bytes left in the current section */
 
     int watch;
     int events;         /* events the stream callback is subscribed for */
@@ -376,6 +381,97 @@ virFDStreamAbort(virStreamPtr st)
     return virFDStreamCloseInt(st, true);
 }
 
+/*
+ * Read the header of the next section coming from the iohelper.
+ *
+ * Returns 1 if there's a new section, 0 on EOF, -1 on error and -2
+ * if the pipe would block.
+ */
+static int
+virFDStreamReadRecord(struct virFDStreamData *fdst)
+{
+    virFileSparseRecord rec;
+    ssize_t got;
+
+ retry:
+    got = read(fdst->fd, &rec, sizeof(rec));
+    if (got < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            return -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("cannot read from stream"));
+        return -1;
+    }
+
+    if (got == 0)
+        return 0;
+
+    /* The iohelper writes headers in one go, which a pipe never splits */
+    if (got != sizeof(rec) ||
+        (rec.type != VIR_FILE_SPARSE_DATA &&
+         rec.type != VIR_FILE_SPARSE_HOLE)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("malformed sparse record in stream"));
+        return -1;
+    }
+
+    fdst->inHole = rec.type == VIR_FILE_SPARSE_HOLE;
+    fdst->section = rec.length;
+    return 1;
+}
+
+
+/*
+ * Tell the iohelper about a section of @length bytes.
+ *
+ * Returns 0 on success, -1 on error and -2 if the pipe would block.
+ */
+static int
+virFDStreamWriteRecord(struct virFDStreamData *fdst,
+                       virFileSparseType type,
+                       unsigned long long length)
+{
+    virFileSparseRecord rec;
+    ssize_t done;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.length = length;
+
+    /* Being smaller than PIPE_BUF, the header either fits in the
+     * pipe in one piece or not at all */
+ retry:
+    done = write(fdst->fd, &rec, sizeof(rec));
+    if (done < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            return -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("cannot write to stream"));
+        return -1;
+    }
+
+    if (done != sizeof(rec)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("short write of sparse record to stream"));
+        return -1;
+    }
+
+    if (type == VIR_FILE_SPARSE_DATA)
+        fdst->section = length;
+    return 0;
+}
+
+
 static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 {
     struct virFDStreamData *fdst = st->privateData;
@@ -407,6 +503,19 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->framed) {
+        /* Start a new data section covering the whole buffer */
+        if (!fdst->section && nbytes &&
+            (ret = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_DATA,
+                                          nbytes)) < 0) {
+            virMutexUnlock(&fdst->lock);
+            return ret;
+        }
+
+        if (fdst->section < nbytes)
+            nbytes = fdst->section;
+    }
+
  retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -421,8 +530,11 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->framed)
+            fdst->section -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
     virMutexUnlock(&fdst->lock);
@@ -430,11 +542,16 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+static int virFDStreamReadFlags(virStreamPtr st,
+                               char *bytes,
+                               size_t nbytes,
+                               unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -459,6 +576,61 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->framed) {
+        if (!fdst->section &&
+            (ret = virFDStreamReadRecord(fdst)) <= 0)
+            goto cleanup;
+
+        if (fdst->section < nbytes)
+            nbytes = fdst->section;
+
+        if (fdst->inHole) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+
+            /* Caller doesn't care about holes, hand out zeroes */
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            fdst->section -= ret;
+            if (fdst->length)
+                fdst->offset += ret;
+            goto cleanup;
+        }
+    } else if (fdst->sparse) {
+        int inData;
+        long long sectionLen;
+
+        if (virFileInData(fdst->fd, &inData, &sectionLen) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (sectionLen < nbytes)
+            nbytes = sectionLen;
+
+        if (!inData && nbytes > 0) {
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+                goto cleanup;
+            }
+
+            /* Caller doesn't care about holes, hand out zeroes */
+            if (lseek(fdst->fd, nbytes, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to seek in stream"));
+                ret = -1;
+                goto cleanup;
+            }
+            memset(bytes, 0, nbytes);
+            ret = nbytes;
+            if (fdst->length)
+                fdst->offset += ret;
+            goto cleanup;
+        }
+    }
+
  retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -473,10 +645,146 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else if (fdst->framed && ret == 0) {
+        ret = -1;
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("truncated sparse record in stream"));
+    } else {
+        if (fdst->framed)
+            fdst->section -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamReadFlags(st, bytes, nbytes, 0);
+}
+
+
+static int virFDStreamRecvHole(virStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int inData;
+    long long sectionLen = 0;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    *length = 0;
+
+    if (!fdst->sparse) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    /* The iohelper already told us about the hole */
+    if (fdst->framed) {
+        if (fdst->inHole) {
+            *length = fdst->section;
+            if (fdst->length)
+                fdst->offset += fdst->section;
+            fdst->section = 0;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virFileInData(fdst->fd, &inData, &sectionLen) < 0)
+        goto cleanup;
+
+    if (inData) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (fdst->length && (fdst->length - fdst->offset) < sectionLen)
+        sectionLen = fdst->length - fdst->offset;
+
+    if (lseek(fdst->fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        goto cleanup;
+    }
+
+    if (fdst->length)
+        fdst->offset += sectionLen;
+
+    *length = sectionLen;
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamSendHole(virStreamPtr st,
+                               long long length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("stream is not sparse"));
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        (fdst->length - fdst->offset) < length) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("cannot write to stream"));
+        goto cleanup;
+    }
+
+    if (fdst->framed) {
+        if (fdst->section) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("cannot send a hole in the middle of data"));
+            goto cleanup;
+        }
+
+        if ((ret = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_HOLE,
+                                          length)) < 0)
+            goto cleanup;
+    } else if (virFileWriteHole(fdst->fd, length) < 0) {
+        goto cleanup;
+    }
+
+    if (fdst->length)
+        fdst->offset += length;
+
+    ret = 0;
+
+ cleanup:
     virMutexUnlock(&fdst->lock);
     return ret;
 }
@@ -485,6 +793,9 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamReadFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamAbort,
     .streamEventAddCallback = virFDStreamAddCallback,
@@ -496,12 +807,13 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    int fd,
                                    virCommandPtr cmd,
                                    int errfd,
-                                   unsigned long long length)
+                                   unsigned long long length,
+                                   bool sparse)
 {
     struct virFDStreamData *fdst;
 
-    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
-              st, fd, cmd, errfd, length);
+    VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu sparse=%d",
+              st, fd, cmd, errfd, length, sparse);
 
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         virSetNonBlock(fd) < 0) {
@@ -516,6 +828,8 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    fdst->sparse = sparse;
+    fdst->framed = sparse && cmd;
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -533,7 +847,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
 int virFDStreamOpen(virStreamPtr st,
                     int fd)
 {
-    return virFDStreamOpenInternal(st, fd, NULL, -1, 0);
+    return virFDStreamOpenInternal(st, fd, NULL, -1, 0, false);
 }
 
 
@@ -579,7 +893,7 @@ int virFDStreamConnectUNIX(virStreamPtr st,
         goto error;
     }
 
-    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0) < 0)
+    if (virFDStreamOpenInternal(st, fd, NULL, -1, 0, false) < 0)
         goto error;
     return 0;
 
@@ -605,7 +919,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long length,
                             int oflags,
                             int mode,
-                            bool forceIOHelper)
+                            bool forceIOHelper,
+                            bool sparse)
 {
     int fd = -1;
     int childfd = -1;
@@ -614,8 +929,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     int errfd = -1;
     char *iohelper_path = NULL;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o "
+              "sparse=%d", st, path, oflags, offset, length, mode, sparse);
 
     oflags |= O_NOCTTY | O_BINARY;
 
@@ -645,10 +960,16 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         goto error;
     }
 
+    /* Holes can only be found and made on the file itself */
+    if (sparse && !S_ISREG(sb.st_mode) && !S_ISBLK(sb.st_mode))
+        sparse = false;
+
     /* Thanks to the POSIX i/o model, we can't reliably get
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
      * the I/O so we just have a fifo. Or use AIO :-(
+     * For a sparse stream the helper sends the holes it finds
+     * (or is told about) over the fifo too.
      */
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         ((!S_ISCHR(sb.st_mode) &&
@@ -673,9 +994,10 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                                                   LIBEXECDIR)))
             goto error;
 
-        cmd = virCommandNewArgList(iohelper_path,
-                                   path,
-                                   NULL);
+        cmd = virCommandNew(iohelper_path);
+        if (sparse)
+            virCommandAddArg(cmd, "-s");
+        virCommandAddArg(cmd, path);
 
         VIR_FREE(iohelper_path);
 
@@ -701,7 +1023,7 @@ virFDStreamOpenFileInternal(virStreamPtr st,
         VIR_FORCE_CLOSE(childfd);
     }
 
-    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
+    if (virFDStreamOpenInternal(st, fd, cmd, errfd, length, sparse) < 0)
         goto error;
 
     return 0;
@@ -731,7 +1053,7 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, false);
+                                       oflags, 0, false, false);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -744,7 +1066,7 @@ int virFDStreamCreateFile(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, mode,
-                                       false);
+                                       false, false);
 }
 
 #ifdef HAVE_CFMAKERAW
@@ -760,7 +1082,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     if (virFDStreamOpenFileInternal(st, path,
                                     offset, length,
                                     oflags | O_CREAT, 0,
-                                    false) < 0)
+                                    false, false) < 0)
         return -1;
 
     fdst = st->privateData;
@@ -797,7 +1119,7 @@ int virFDStreamOpenPTY(virStreamPtr st,
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
                                        oflags | O_CREAT, 0,
-                                       false);
+                                       false, false);
 }
 #endif /* !HAVE_CFMAKERAW */
 
@@ -805,13 +1127,137 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags)
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0, true);
+                                       oflags, 0, true, sparse);
+}
+
+/*
+ * Whether the data of @st can be moved with virFDStreamSplice, which
+ * is the case for file descriptor streams over files, block devices,
+ * pipes (like the one to the iohelper) and sockets, but not TTYs nor
+ * sparse files behind the iohelper.
+ */
+bool virFDStreamCanSplice(virStreamPtr st)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    bool ret = false;
+#ifdef HAVE_SPLICE
+    struct stat sb;
+#endif
+
+    if (st->driver != &virFDStreamDrv || !fdst)
+        return false;
+
+    /* The records from the iohelper must not reach the peer */
+    if (fdst->framed)
+        return false;
+
+#ifdef HAVE_SPLICE
+    virMutexLock(&fdst->lock);
+    if (fstat(fdst->fd, &sb) == 0 &&
+        (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode) ||
+         S_ISFIFO(sb.st_mode) || S_ISSOCK(sb.st_mode)))
+        ret = true;
+    virMutexUnlock(&fdst->lock);
+#endif
+
+    return ret;
 }
 
+
+/*
+ * Same as reading from @st, except that the data is moved into the
+ * pipe @fd instead of being copied into a buffer. Holes in sparse
+ * files are reported only with VIR_STREAM_RECV_STOP_AT_HOLE and read
+ * back as zeroes otherwise.
+ *
+ * Returns the number of bytes moved, 0 on EOF, -1 on error, -2 if
+ * either end would block and -3 if @st is at a hole.
+ */
+int virFDStreamSplice(virStreamPtr st,
+                      int fd,
+                      size_t nbytes,
+                      unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
+    if (nbytes > INT_MAX) {
+        virReportSystemError(ERANGE, "%s",
+                             _("Too many bytes to read from stream"));
+        return -1;
+    }
+
+    if (st->driver != &virFDStreamDrv || !fdst) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "%s", _("stream is not open"));
+        return -1;
+    }
+
+#ifdef HAVE_SPLICE
+    virMutexLock(&fdst->lock);
+
+    if (fdst->length) {
+        if (fdst->length == fdst->offset) {
+            ret = 0;
+            goto cleanup;
+        }
+
+        if ((fdst->length - fdst->offset) < nbytes)
+            nbytes = fdst->length - fdst->offset;
+    }
+
+    if (fdst->sparse && (flags & VIR_STREAM_RECV_STOP_AT_HOLE)) {
+        int inData;
+        long long sectionLen;
+
+        if (virFileInData(fdst->fd, &inData, &sectionLen) < 0)
+            goto cleanup;
+
+        if (sectionLen < nbytes)
+            nbytes = sectionLen;
+
+        if (!inData && nbytes > 0) {
+            ret = -3;
+            goto cleanup;
+        }
+    }
+
+ retry:
+    ret = splice(fdst->fd, NULL, fd, NULL, nbytes,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (ret < 0) {
+        VIR_WARNINGS_NO_WLOGICALOP_EQUAL_EXPR
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        VIR_WARNINGS_RESET
+            ret = -2;
+        } else if (errno == EINTR) {
+            goto retry;
+        } else {
+            ret = -1;
+            virReportSystemError(errno, "%s",
+                                 _("cannot splice from stream"));
+        }
+    } else if (fdst->length) {
+        fdst->offset += ret;
+    }
+
+ cleanup:
+    virMutexUnlock(&fdst->lock);
+#else /* !HAVE_SPLICE */
+    virReportSystemError(ENOSYS,
+                         _("Cannot splice stream into FD %d"), fd);
+#endif /* !HAVE_SPLICE */
+    return ret;
+}
+
+
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
                                   virFDStreamInternalCloseCb cb,
                                   void *opaque,
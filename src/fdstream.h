@@ -60,8 +60,15 @@ int virFDStreamOpenBlockDevice(virStreamPtr st,
                                const char *path,
                                unsigned long long offset,
                                unsigned long long length,
+                               bool sparse,
                                int oflags);
 
+bool virFDStreamCanSplice(virStreamPtr st);
+int virFDStreamSplice(virStreamPtr st,
+                      int fd,
+                      size_t nbytes,
+                      unsigned int flags);
+
 int virFDStreamSetInternalCloseCb(virStreamPtr st,
                                   virFDStreamInternalCloseCb cb,
                                   void *opaque,
@@ -1063,6 +1063,47 @@ virAdmServerGetClientLimits(virAdmServerPtr srv,
     return -1;
 }
 
+/**
+ * virAdmServerGetMessagePoolStats:
+ * @srv: a valid server object reference
+ * @params: pointer to statistics object
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve statistics of the pool @srv takes RPC message buffers from.
+ * These include:
+ *  - number of buffers reused from the pool,
+ *  - number of buffers that had to be allocated,
+ *  - number of bytes currently kept in the pool,
+ *  - maximum number of bytes the pool may keep.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, flags=%x", srv, flags);
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+
+    if ((ret = remoteAdminServerGetMessagePoolStats(srv, params,
+                                                    nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
+
 /**
  * virAdmServerSetClientLimits:
  * @srv: a valid server object reference
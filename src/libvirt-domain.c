@@ -11385,6 +11385,14 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * "state.state" - state of the VM, returned as int from virDomainState enum
  * "state.reason" - reason for entering given state, returned as int from
  *                  virDomain*Reason enum corresponding to given state.
+ * "state.status_saves.requested" - number of times the hypervisor driver
+ *                                  was asked to record a change of the
+ *                                  running domain's state on disk, as
+ *                                  unsigned long long.
+ * "state.status_saves.written" - number of times it actually wrote the
+ *                                domain's state out, as unsigned long long.
+ *                                The difference is the number of changes
+ *                                written out together with others.
  *
  * VIR_DOMAIN_STATS_CPU_TOTAL: Return CPU statistics and usage information.
  * The typed parameter keys are in this format:
@@ -11502,6 +11510,13 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * fields for offline domains if the statistics are meaningful only for a
  * running domain.
  *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED as @flags allows the
+ * hypervisor to return statistics gathered by an earlier call with the same
+ * @stats and VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING setting, as long as
+ * they are not older than a hypervisor specific limit. This lets multiple
+ * monitoring applications poll the statistics without each of them causing
+ * the guests to be queried again.
+ *
  * Similarly to virConnectListAllDomains, @flags can contain various flags to
  * filter the list of domains to provide stats for.
  *
@@ -1549,12 +1549,18 @@ virStorageVolCreateXMLFrom(virStoragePoolPtr pool,
  * @stream: stream to use as output
  * @offset: position in @vol to start reading from
  * @length: limit on amount of data to download
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolDownloadFlags
  *
  * Download the content of the volume as a stream. If @length
  * is zero, then the remaining contents of the volume after
  * @offset will be downloaded.
  *
+ * If VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM is set in @flags,
+ * holes in the volume are not transferred as zeroes but
+ * reported through the stream, see virStreamRecvFlags() and
+ * virStreamRecvHole(). Servers not knowing the flag reject it,
+ * in which case the caller may retry without it.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -1613,7 +1619,7 @@ virStorageVolDownload(virStorageVolPtr vol,
  * @stream: stream to use as input
  * @offset: position to start writing to
  * @length: limit on amount of data to upload
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolUploadFlags
  *
  * Upload new content to the volume from a stream. This call
  * will fail if @offset + @length exceeds the size of the
@@ -1635,6 +1641,10 @@ virStorageVolDownload(virStorageVolPtr vol,
  * characteristics from the source stream such as format type,
  * capacity, and allocation.
  *
+ * If VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM is set in @flags, the
+ * caller may send holes with virStreamSendHole() instead of
+ * zeroes. Holes are punched into, or skipped in, the volume.
+ *
  * Returns 0, or -1 upon error.
  */
 int
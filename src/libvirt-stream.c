@@ -29,6 +29,11 @@ VIR_LOG_INIT("libvirt.stream");
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
 
+/* Chunk size used by virStreamSendAll and virStreamRecvAll. Remote
+ * streams split it into packets the daemon can take, but against a
+ * recent one each chunk goes out as a single packet. */
+#define VIR_STREAM_ALL_CHUNK (1024 * 1024)
+
 
 /**
  * virStreamNew:
@@ -285,6 +290,167 @@ virStreamRecv(virStreamPtr stream,
 }
 
 
+/**
+ * virStreamRecvFlags:
+ * @stream: pointer to the stream object
+ * @data: buffer to read into from stream
+ * @nbytes: size of @data buffer
+ * @flags: bitwise-OR of virStreamRecvFlagsValues
+ *
+ * Reads a series of bytes from the stream. This is just like
+ * virStreamRecv() except it takes @flags.
+ *
+ * If VIR_STREAM_RECV_STOP_AT_HOLE is set in @flags and the
+ * stream has reached a hole in the underlying data, the
+ * function returns -3 and the caller should fetch the length
+ * of the hole with virStreamRecvHole(). Without the flag holes
+ * are returned as zeroes. Holes only ever appear in sparse
+ * streams, e.g. those set up with
+ * VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM.
+ *
+ * Returns the number of bytes read, which may be less
+ * than requested.
+ *
+ * Returns 0 when the end of the stream is reached, at
+ * which time the caller should invoke virStreamFinish()
+ * to get confirmation of stream completion.
+ *
+ * Returns -1 upon error, at which time the stream will
+ * be marked as aborted, and the caller should now release
+ * the stream with virStreamFree.
+ *
+ * Returns -2 if there is no data pending to be read & the
+ * stream is marked as non-blocking.
+ *
+ * Returns -3 if there is a hole in the stream and
+ * VIR_STREAM_RECV_STOP_AT_HOLE was requested.
+ */
+int
+virStreamRecvFlags(virStreamPtr stream,
+                   char *data,
+                   size_t nbytes,
+                   unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, data=%p, nbytes=%zu, flags=%x",
+              stream, data, nbytes, flags);
+
+    virResetLastError();
+
+    virCheckStreamReturn(stream, -1);
+    virCheckNonNullArgGoto(data, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvFlags) {
+        int ret;
+        ret = (stream->driver->streamRecvFlags)(stream, data, nbytes, flags);
+        if (ret == -2 || ret == -3)
+            return ret;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamSendHole:
+ * @stream: pointer to the stream object
+ * @length: number of bytes to skip
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Rather than transmitting @length zero bytes, tell the other
+ * side of a sparse stream to skip them. The receiver punches a
+ * hole into, or seeks over, its destination.
+ *
+ * Returns 0 on success, -2 if the outgoing transmit buffers
+ * are full & the stream is marked as non-blocking, -1 upon
+ * error, at which time the stream will be marked as aborted.
+ */
+int
+virStreamSendHole(virStreamPtr stream,
+                  long long length,
+                  unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%lld, flags=%x",
+              stream, length, flags);
+
+    virResetLastError();
+
+    virCheckStreamReturn(stream, -1);
+    if (length < 0) {
+        virReportInvalidArg(length, "%s",
+                            _("length in virStreamSendHole must be "
+                              "non-negative"));
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamSendHole) {
+        int ret;
+        ret = (stream->driver->streamSendHole)(stream, length, flags);
+        if (ret == -2)
+            return -2;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamRecvHole:
+ * @stream: pointer to the stream object
+ * @length: number of bytes to skip
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Once virStreamRecvFlags() returned -3, this reads the length
+ * of the hole the stream is at and moves past it. @length is
+ * set to 0 if the stream is not at a hole.
+ *
+ * Returns 0 on success, -1 upon error.
+ */
+int
+virStreamRecvHole(virStreamPtr stream,
+                  long long *length,
+                  unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%p, flags=%x",
+              stream, length, flags);
+
+    virResetLastError();
+
+    virCheckStreamReturn(stream, -1);
+    virCheckNonNullArgGoto(length, error);
+
+    if (stream->driver &&
+        stream->driver->streamRecvHole) {
+        int ret;
+        ret = (stream->driver->streamRecvHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virReportUnsupportedError();
+
+ error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
 /**
  * virStreamSendAll:
  * @stream: pointer to the stream object
@@ -331,7 +497,7 @@ virStreamSendAll(virStreamPtr stream,
                  void *opaque)
 {
     char *bytes = NULL;
-    size_t want = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    size_t want = VIR_STREAM_ALL_CHUNK;
     int ret = -1;
     VIR_DEBUG("stream=%p, handler=%p, opaque=%p", stream, handler, opaque);
 
@@ -424,7 +590,7 @@ virStreamRecvAll(virStreamPtr stream,
                  void *opaque)
 {
     char *bytes = NULL;
-    size_t want = VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX;
+    size_t want = VIR_STREAM_ALL_CHUNK;
     int ret = -1;
     VIR_DEBUG("stream=%p, handler=%p, opaque=%p", stream, handler, opaque);
 
@@ -123,6 +123,13 @@ enum {
      * Support for driver close callback rpc
      */
     VIR_DRV_FEATURE_REMOTE_CLOSE_CALLBACK = 15,
+
+    /*
+     * Support for stream packets larger than
+     * VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX. Querying this remote feature
+     * also tells the daemon that the client can receive them.
+     */
+    VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PACKET = 16,
 };
 
 
@@ -758,7 +758,7 @@ libxlStateInitialize(bool privileged,
     if (virDomainObjListLoadAllConfigs(libxl_driver->domains,
                                        cfg->stateDir,
                                        cfg->autostartDir,
-                                       1,
+                                       1, 0,
                                        cfg->caps,
                                        libxl_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -770,7 +770,7 @@ libxlStateInitialize(bool privileged,
     if (virDomainObjListLoadAllConfigs(libxl_driver->domains,
                                        cfg->configDir,
                                        cfg->autostartDir,
-                                       0,
+                                       0, 0,
                                        cfg->caps,
                                        libxl_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -810,7 +810,7 @@ libxlStateReload(void)
     virDomainObjListLoadAllConfigs(libxl_driver->domains,
                                    cfg->configDir,
                                    cfg->autostartDir,
-                                   1,
+                                   1, 0,
                                    cfg->caps,
                                    libxl_driver->xmlopt,
                                    NULL, libxl_driver);
@@ -1690,7 +1690,7 @@ static int lxcStateInitialize(bool privileged,
     /* Get all the running persistent or transient configs first */
     if (virDomainObjListLoadAllConfigs(lxc_driver->domains,
                                        cfg->stateDir,
-                                       NULL, 1,
+                                       NULL, 1, 0,
                                        caps,
                                        lxc_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -1701,7 +1701,7 @@ static int lxcStateInitialize(bool privileged,
     /* Then inactive persistent configs */
     if (virDomainObjListLoadAllConfigs(lxc_driver->domains,
                                        cfg->configDir,
-                                       cfg->autostartDir, 0,
+                                       cfg->autostartDir, 0, 0,
                                        caps,
                                        lxc_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -1765,7 +1765,7 @@ lxcStateReload(void)
 
     virDomainObjListLoadAllConfigs(lxc_driver->domains,
                                    cfg->configDir,
-                                   cfg->autostartDir, 0,
+                                   cfg->autostartDir, 0, 0,
                                    caps,
                                    lxc_driver->xmlopt,
                                    lxcNotifyLoadDomain, lxc_driver);
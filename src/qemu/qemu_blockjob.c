@@ -185,7 +185,7 @@ qemuBlockJobEventProcess(virQEMUDriverPtr driver,
     }
 
     if (save) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatusSync(driver, vm) < 0)
             VIR_WARN("Unable to save status on vm %s after block job",
                      vm->def->name);
         if (persistDisk && virDomainSaveConfig(cfg->configDir,
@@ -49,6 +49,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
 #include <sys/wait.h>
 #include <stdarg.h>
 
@@ -357,11 +360,12 @@ struct virQEMUCapsMachineType {
     bool hotplugCpus;
 };
 /*
- * Update the XML parser/formatter when adding more
- * information to this struct so that it gets cached
- * correctly. It does not have to be ABI-stable, as
- * the cache will be discarded & repopulated if the
- * timestamp on the libvirtd binary changes.
+ * Update the XML and binary cache parsers/formatters
+ * when adding more information to this struct so that
+ * it gets cached correctly. It does not have to be
+ * ABI-stable, as the cache will be discarded &
+ * repopulated if the timestamp on the libvirtd binary
+ * changes.
  *
  * And don't forget to update virQEMUCapsNewCopy.
  */
@@ -3343,6 +3347,478 @@ virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps,
 }
 
 
+/*
+ * The binary cache format. Unlike the XML one it can be used right
+ * from a mapped file: all data is stored in fixed size records referring
+ * to NUL terminated strings by their offsets within the string table at
+ * the end of the file:
+ *
+ *   header | flags | cpus | machines | gic | strings
+ *
+ * The format is native endian and tied to the libvirtd binary which
+ * wrote it, e.g., flags are stored as virQEMUCapsFlags values. Such
+ * files are discarded by virQEMUCapsInitCached anyway once libvirtd
+ * changes.
+ */
+#define VIR_QEMU_CAPS_CACHE_MAGIC "LVQCAPS"
+#define VIR_QEMU_CAPS_CACHE_VERSION 1
+#define VIR_QEMU_CAPS_CACHE_NONE UINT32_MAX
+#define VIR_QEMU_CAPS_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct _virQEMUCapsCacheHeader virQEMUCapsCacheHeader;
+struct _virQEMUCapsCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;          /* size of the whole file */
+    int64_t qemuctime;
+    int64_t selfctime;
+    uint64_t selfvers;
+    uint32_t usedQMP;
+    uint32_t qemuVersion;
+    uint32_t kvmVersion;
+    uint32_t arch;          /* string */
+    uint32_t package;       /* string or VIR_QEMU_CAPS_CACHE_NONE */
+    uint32_t flagsLast;     /* QEMU_CAPS_LAST */
+    uint32_t nflags;        /* uint32_t array */
+    uint32_t flags;
+    uint32_t ncpus;         /* uint32_t array of strings */
+    uint32_t cpus;
+    uint32_t nmachines;     /* virQEMUCapsCacheMachine array */
+    uint32_t machines;
+    uint32_t ngic;          /* virQEMUCapsCacheGIC array */
+    uint32_t gic;
+    uint32_t strings;
+    uint32_t stringsSize;
+};
+
+typedef struct _virQEMUCapsCacheMachine virQEMUCapsCacheMachine;
+struct _virQEMUCapsCacheMachine {
+    uint32_t name;          /* string */
+    uint32_t alias;         /* string or VIR_QEMU_CAPS_CACHE_NONE */
+    uint32_t maxCpus;
+    uint32_t hotplugCpus;
+};
+
+typedef struct _virQEMUCapsCacheGIC virQEMUCapsCacheGIC;
+struct _virQEMUCapsCacheGIC {
+    uint32_t version;
+    uint32_t implementation;
+};
+
+typedef struct _virQEMUCapsCacheStrings virQEMUCapsCacheStrings;
+struct _virQEMUCapsCacheStrings {
+    char *data;
+    size_t len;
+    size_t alloc;
+};
+
+
+static int
+virQEMUCapsCacheAddString(virQEMUCapsCacheStrings *strings,
+                          const char *str,
+                          uint32_t *offset)
+{
+    size_t len;
+
+    if (!str) {
+        *offset = VIR_QEMU_CAPS_CACHE_NONE;
+        return 0;
+    }
+
+    len = strlen(str) + 1;
+    if (VIR_RESIZE_N(strings->data, strings->alloc, strings->len, len) < 0)
+        return -1;
+
+    memcpy(strings->data + strings->len, str, len);
+    *offset = strings->len;
+    strings->len += len;
+    return 0;
+}
+
+
+/**
+ * virQEMUCapsFormatCacheBinary:
+ * @qemuCaps: capabilities to store
+ * @selfCTime: libvirtd ctime
+ * @selfVersion: libvirtd version
+ * @len: filled with the size of the result
+ *
+ * Stores @qemuCaps in the binary cache format which can be read back
+ * by virQEMUCapsParseCacheBinary.
+ *
+ * Returns a buffer of @len bytes, NULL on error.
+ */
+char *
+virQEMUCapsFormatCacheBinary(virQEMUCapsPtr qemuCaps,
+                             time_t selfCTime,
+                             unsigned long selfVersion,
+                             size_t *len)
+{
+    virQEMUCapsCacheHeader hdr;
+    virQEMUCapsCacheStrings strings = { NULL, 0, 0 };
+    uint32_t *flags = NULL;
+    uint32_t *cpus = NULL;
+    virQEMUCapsCacheMachine *machines = NULL;
+    virQEMUCapsCacheGIC *gic = NULL;
+    size_t ncpus = 0;
+    size_t size;
+    char *ret = NULL;
+    size_t i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VIR_QEMU_CAPS_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = VIR_QEMU_CAPS_CACHE_VERSION;
+    hdr.qemuctime = qemuCaps->ctime;
+    hdr.selfctime = selfCTime;
+    hdr.selfvers = selfVersion;
+    hdr.usedQMP = qemuCaps->usedQMP;
+    hdr.qemuVersion = qemuCaps->version;
+    hdr.kvmVersion = qemuCaps->kvmVersion;
+    hdr.flagsLast = QEMU_CAPS_LAST;
+
+    if (virQEMUCapsCacheAddString(&strings, virArchToString(qemuCaps->arch),
+                                  &hdr.arch) < 0 ||
+        virQEMUCapsCacheAddString(&strings, qemuCaps->package,
+                                  &hdr.package) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(flags, QEMU_CAPS_LAST) < 0)
+        goto cleanup;
+    for (i = 0; i < QEMU_CAPS_LAST; i++) {
+        if (virQEMUCapsGet(qemuCaps, i))
+            flags[hdr.nflags++] = i;
+    }
+
+    if (qemuCaps->cpuDefinitions)
+        ncpus = qemuCaps->cpuDefinitions->nmodels;
+    if (VIR_ALLOC_N(cpus, ncpus) < 0)
+        goto cleanup;
+    for (i = 0; i < ncpus; i++) {
+        if (virQEMUCapsCacheAddString(&strings,
+                                      qemuCaps->cpuDefinitions->models[i].name,
+                                      &cpus[i]) < 0)
+            goto cleanup;
+    }
+    hdr.ncpus = ncpus;
+
+    if (VIR_ALLOC_N(machines, qemuCaps->nmachineTypes) < 0)
+        goto cleanup;
+    for (i = 0; i < qemuCaps->nmachineTypes; i++) {
+        if (virQEMUCapsCacheAddString(&strings,
+                                      qemuCaps->machineTypes[i].name,
+                                      &machines[i].name) < 0 ||
+            virQEMUCapsCacheAddString(&strings,
+                                      qemuCaps->machineTypes[i].alias,
+                                      &machines[i].alias) < 0)
+            goto cleanup;
+        machines[i].maxCpus = qemuCaps->machineTypes[i].maxCpus;
+        machines[i].hotplugCpus = qemuCaps->machineTypes[i].hotplugCpus;
+    }
+    hdr.nmachines = qemuCaps->nmachineTypes;
+
+    if (VIR_ALLOC_N(gic, qemuCaps->ngicCapabilities) < 0)
+        goto cleanup;
+    for (i = 0; i < qemuCaps->ngicCapabilities; i++) {
+        gic[i].version = qemuCaps->gicCapabilities[i].version;
+        gic[i].implementation = qemuCaps->gicCapabilities[i].implementation;
+    }
+    hdr.ngic = qemuCaps->ngicCapabilities;
+
+    hdr.flags = sizeof(hdr);
+    hdr.cpus = hdr.flags + hdr.nflags * sizeof(*flags);
+    hdr.machines = hdr.cpus + hdr.ncpus * sizeof(*cpus);
+    hdr.gic = hdr.machines + hdr.nmachines * sizeof(*machines);
+    hdr.strings = hdr.gic + hdr.ngic * sizeof(*gic);
+    hdr.stringsSize = strings.len;
+    size = hdr.strings + strings.len;
+
+    if (size > VIR_QEMU_CAPS_CACHE_MAX_SIZE) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("QEMU capabilities of '%s' are too big to be cached"),
+                       qemuCaps->binary);
+        goto cleanup;
+    }
+    hdr.size = size;
+
+    if (VIR_ALLOC_N(ret, size) < 0)
+        goto cleanup;
+
+    memcpy(ret, &hdr, sizeof(hdr));
+    memcpy(ret + hdr.flags, flags, hdr.nflags * sizeof(*flags));
+    memcpy(ret + hdr.cpus, cpus, hdr.ncpus * sizeof(*cpus));
+    memcpy(ret + hdr.machines, machines, hdr.nmachines * sizeof(*machines));
+    memcpy(ret + hdr.gic, gic, hdr.ngic * sizeof(*gic));
+    memcpy(ret + hdr.strings, strings.data, strings.len);
+    *len = size;
+
+ cleanup:
+    VIR_FREE(strings.data);
+    VIR_FREE(flags);
+    VIR_FREE(cpus);
+    VIR_FREE(machines);
+    VIR_FREE(gic);
+    return ret;
+}
+
+
+/* Checks that an array of @count records of @size bytes at @offset lies
+ * within the cache data following the header */
+static bool
+virQEMUCapsCacheArrayValid(const virQEMUCapsCacheHeader *hdr,
+                           uint32_t offset,
+                           uint32_t count,
+                           size_t size)
+{
+    return offset >= sizeof(*hdr) &&
+        offset % sizeof(uint32_t) == 0 &&
+        offset <= hdr->size &&
+        count <= (hdr->size - offset) / size;
+}
+
+
+static const char *
+virQEMUCapsCacheString(const virQEMUCapsCacheHeader *hdr,
+                       uint32_t offset)
+{
+    if (offset >= hdr->stringsSize)
+        return NULL;
+
+    return (const char *) hdr + hdr->strings + offset;
+}
+
+
+/**
+ * virQEMUCapsParseCacheBinary:
+ * @caps: host capabilities
+ * @qemuCaps: capabilities to fill in
+ * @data: cache data created by virQEMUCapsFormatCacheBinary
+ * @len: size of @data
+ * @qemuctime: filled with QEMU binary ctime the cache was created for
+ * @selfctime: filled with libvirtd ctime the cache was created by
+ * @selfvers: filled with libvirtd version the cache was created by
+ *
+ * Fills @qemuCaps with the capabilities stored in @data. All offsets
+ * and sizes are checked before use so that a corrupted cache is
+ * refused rather than read out of bounds.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virQEMUCapsParseCacheBinary(virCapsPtr caps,
+                            virQEMUCapsPtr qemuCaps,
+                            const char *data,
+                            size_t len,
+                            time_t *qemuctime,
+                            time_t *selfctime,
+                            unsigned long *selfvers)
+{
+    const virQEMUCapsCacheHeader *hdr = (const virQEMUCapsCacheHeader *) data;
+    const uint32_t *flags;
+    const uint32_t *cpus;
+    const virQEMUCapsCacheMachine *machines;
+    const virQEMUCapsCacheGIC *gic;
+    const char *str;
+    size_t i;
+
+    if (len < sizeof(*hdr) ||
+        memcmp(hdr->magic, VIR_QEMU_CAPS_CACHE_MAGIC, sizeof(hdr->magic)) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("not a QEMU capabilities cache"));
+        return -1;
+    }
+
+    if (hdr->version != VIR_QEMU_CAPS_CACHE_VERSION ||
+        hdr->flagsLast != QEMU_CAPS_LAST) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unsupported QEMU capabilities cache version %u"),
+                       hdr->version);
+        return -1;
+    }
+
+    if (hdr->size != len ||
+        !virQEMUCapsCacheArrayValid(hdr, hdr->flags, hdr->nflags,
+                                    sizeof(*flags)) ||
+        !virQEMUCapsCacheArrayValid(hdr, hdr->cpus, hdr->ncpus,
+                                    sizeof(*cpus)) ||
+        !virQEMUCapsCacheArrayValid(hdr, hdr->machines, hdr->nmachines,
+                                    sizeof(*machines)) ||
+        !virQEMUCapsCacheArrayValid(hdr, hdr->gic, hdr->ngic,
+                                    sizeof(*gic)) ||
+        !virQEMUCapsCacheArrayValid(hdr, hdr->strings, hdr->stringsSize, 1) ||
+        (hdr->stringsSize > 0 &&
+         data[hdr->strings + hdr->stringsSize - 1] != '\0')) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("corrupted QEMU capabilities cache"));
+        return -1;
+    }
+
+    flags = (const uint32_t *) (data + hdr->flags);
+    cpus = (const uint32_t *) (data + hdr->cpus);
+    machines = (const virQEMUCapsCacheMachine *) (data + hdr->machines);
+    gic = (const virQEMUCapsCacheGIC *) (data + hdr->gic);
+
+    *qemuctime = hdr->qemuctime;
+    *selfctime = hdr->selfctime;
+    *selfvers = hdr->selfvers;
+
+    qemuCaps->usedQMP = !!hdr->usedQMP;
+    qemuCaps->version = hdr->qemuVersion;
+    qemuCaps->kvmVersion = hdr->kvmVersion;
+
+    for (i = 0; i < hdr->nflags; i++) {
+        if (flags[i] >= QEMU_CAPS_LAST) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unknown qemu capabilities flag %u"), flags[i]);
+            return -1;
+        }
+        virQEMUCapsSet(qemuCaps, flags[i]);
+    }
+
+    if (hdr->package != VIR_QEMU_CAPS_CACHE_NONE) {
+        if (!(str = virQEMUCapsCacheString(hdr, hdr->package)))
+            goto corrupted;
+        if (VIR_STRDUP(qemuCaps->package, str) < 0)
+            return -1;
+    }
+
+    if (!(str = virQEMUCapsCacheString(hdr, hdr->arch)))
+        goto corrupted;
+    if (!(qemuCaps->arch = virArchFromString(str))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unknown arch %s in QEMU capabilities cache"), str);
+        return -1;
+    }
+
+    if (hdr->ncpus > 0) {
+        if (!(qemuCaps->cpuDefinitions = virDomainCapsCPUModelsNew(hdr->ncpus)))
+            return -1;
+
+        for (i = 0; i < hdr->ncpus; i++) {
+            if (!(str = virQEMUCapsCacheString(hdr, cpus[i])))
+                goto corrupted;
+            if (virDomainCapsCPUModelsAdd(qemuCaps->cpuDefinitions, str, -1,
+                                          VIR_DOMCAPS_CPU_USABLE_UNKNOWN) < 0)
+                return -1;
+        }
+    }
+
+    if (hdr->nmachines > 0) {
+        if (VIR_ALLOC_N(qemuCaps->machineTypes, hdr->nmachines) < 0)
+            return -1;
+        qemuCaps->nmachineTypes = hdr->nmachines;
+
+        for (i = 0; i < hdr->nmachines; i++) {
+            struct virQEMUCapsMachineType *mach = qemuCaps->machineTypes + i;
+
+            if (!(str = virQEMUCapsCacheString(hdr, machines[i].name)))
+                goto corrupted;
+            if (VIR_STRDUP(mach->name, str) < 0)
+                return -1;
+
+            if (machines[i].alias != VIR_QEMU_CAPS_CACHE_NONE) {
+                if (!(str = virQEMUCapsCacheString(hdr, machines[i].alias)))
+                    goto corrupted;
+                if (VIR_STRDUP(mach->alias, str) < 0)
+                    return -1;
+            }
+
+            mach->maxCpus = machines[i].maxCpus;
+            mach->hotplugCpus = !!machines[i].hotplugCpus;
+        }
+    }
+
+    if (hdr->ngic > 0) {
+        if (VIR_ALLOC_N(qemuCaps->gicCapabilities, hdr->ngic) < 0)
+            return -1;
+        qemuCaps->ngicCapabilities = hdr->ngic;
+
+        for (i = 0; i < hdr->ngic; i++) {
+            qemuCaps->gicCapabilities[i].version = gic[i].version;
+            qemuCaps->gicCapabilities[i].implementation = gic[i].implementation;
+        }
+    }
+
+    virQEMUCapsInitHostCPUModel(qemuCaps, caps);
+
+    return 0;
+
+ corrupted:
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("invalid string in QEMU capabilities cache"));
+    return -1;
+}
+
+
+/**
+ * virQEMUCapsLoadCacheBinary:
+ *
+ * Same as virQEMUCapsLoadCache, but reads the binary cache format. The
+ * file is mapped rather than read, if possible.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virQEMUCapsLoadCacheBinary(virCapsPtr caps,
+                           virQEMUCapsPtr qemuCaps,
+                           const char *filename,
+                           time_t *qemuctime,
+                           time_t *selfctime,
+                           unsigned long *selfvers)
+{
+    int fd = -1;
+    struct stat sb;
+    char *data = NULL;
+    bool mapped = false;
+    int ret = -1;
+
+    if ((fd = open(filename, O_RDONLY)) < 0 ||
+        fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, _("unable to open '%s'"), filename);
+        goto cleanup;
+    }
+
+    if (sb.st_size < (off_t) sizeof(virQEMUCapsCacheHeader) ||
+        sb.st_size > VIR_QEMU_CAPS_CACHE_MAX_SIZE) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected size of QEMU capabilities cache '%s'"),
+                       filename);
+        goto cleanup;
+    }
+
+#if HAVE_MMAP
+    if ((data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE,
+                     fd, 0)) != MAP_FAILED) {
+        mapped = true;
+    } else {
+        data = NULL;
+    }
+#endif /* HAVE_MMAP */
+
+    if (!mapped) {
+        if (VIR_ALLOC_N(data, sb.st_size) < 0)
+            goto cleanup;
+
+        if (saferead(fd, data, sb.st_size) != sb.st_size) {
+            virReportSystemError(errno, _("unable to read '%s'"), filename);
+            goto cleanup;
+        }
+    }
+
+    ret = virQEMUCapsParseCacheBinary(caps, qemuCaps, data, sb.st_size,
+                                      qemuctime, selfctime, selfvers);
+
+ cleanup:
+#if HAVE_MMAP
+    if (mapped)
+        munmap(data, sb.st_size);
+#endif /* HAVE_MMAP */
+    if (!mapped)
+        VIR_FREE(data);
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
 static int
 virQEMUCapsSaveCache(virQEMUCapsPtr qemuCaps, const char *filename)
 {
@@ -3371,11 +3847,61 @@ virQEMUCapsSaveCache(virQEMUCapsPtr qemuCaps, const char *filename)
     return ret;
 }
 
+
+struct virQEMUCapsCacheData {
+    const char *data;
+    size_t len;
+};
+
+
+static int
+virQEMUCapsWriteCacheBinary(int fd, void *opaque)
+{
+    struct virQEMUCapsCacheData *cache = opaque;
+
+    if (safewrite(fd, cache->data, cache->len) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virQEMUCapsSaveCacheBinary(virQEMUCapsPtr qemuCaps, const char *filename)
+{
+    struct virQEMUCapsCacheData cache;
+    char *data = NULL;
+    int ret = -1;
+
+    if (!(data = virQEMUCapsFormatCacheBinary(qemuCaps,
+                                              virGetSelfLastChanged(),
+                                              LIBVIR_VERSION_NUMBER,
+                                              &cache.len)))
+        goto cleanup;
+    cache.data = data;
+
+    /* The file is replaced rather than rewritten in place, so that
+     * nobody ever maps a partially written cache */
+    if (virFileRewrite(filename, 0600, virQEMUCapsWriteCacheBinary,
+                       &cache) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Saved binary caps '%s' for '%s'", filename, qemuCaps->binary);
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(data);
+    return ret;
+}
+
+/* Only the binary cache is loaded by libvirtd, the XML one is kept
+ * alongside it for debugging. */
 static int
 virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
 {
     char *capsdir = NULL;
     char *capsfile = NULL;
+    char *xmlfile = NULL;
     int ret = -1;
     char *binaryhash = NULL;
 
@@ -3387,7 +3913,8 @@ virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
                             &binaryhash) < 0)
         goto cleanup;
 
-    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0)
+    if (virAsprintf(&capsfile, "%s/%s.bin", capsdir, binaryhash) < 0 ||
+        virAsprintf(&xmlfile, "%s/%s.xml", capsdir, binaryhash) < 0)
         goto cleanup;
 
     if (virFileMakePath(capsdir) < 0) {
@@ -3397,13 +3924,15 @@ virQEMUCapsRememberCached(virQEMUCapsPtr qemuCaps, const char *cacheDir)
         goto cleanup;
     }
 
-    if (virQEMUCapsSaveCache(qemuCaps, capsfile) < 0)
+    if (virQEMUCapsSaveCache(qemuCaps, xmlfile) < 0 ||
+        virQEMUCapsSaveCacheBinary(qemuCaps, capsfile) < 0)
         goto cleanup;
 
     ret = 0;
  cleanup:
     VIR_FREE(binaryhash);
     VIR_FREE(capsfile);
+    VIR_FREE(xmlfile);
     VIR_FREE(capsdir);
     return ret;
 }
@@ -3445,6 +3974,7 @@ virQEMUCapsInitCached(virCapsPtr caps,
 {
     char *capsdir = NULL;
     char *capsfile = NULL;
+    char *xmlfile = NULL;
     int ret = -1;
     char *binaryhash = NULL;
     struct stat sb;
@@ -3460,7 +3990,8 @@ virQEMUCapsInitCached(virCapsPtr caps,
                             &binaryhash) < 0)
         goto cleanup;
 
-    if (virAsprintf(&capsfile, "%s/%s.xml", capsdir, binaryhash) < 0)
+    if (virAsprintf(&capsfile, "%s/%s.bin", capsdir, binaryhash) < 0 ||
+        virAsprintf(&xmlfile, "%s/%s.xml", capsdir, binaryhash) < 0)
         goto cleanup;
 
     if (virFileMakePath(capsdir) < 0) {
@@ -3483,8 +4014,8 @@ virQEMUCapsInitCached(virCapsPtr caps,
         goto cleanup;
     }
 
-    if (virQEMUCapsLoadCache(caps, qemuCaps, capsfile,
-                             &qemuctime, &selfctime, &selfvers) < 0) {
+    if (virQEMUCapsLoadCacheBinary(caps, qemuCaps, capsfile,
+                                   &qemuctime, &selfctime, &selfvers) < 0) {
         VIR_WARN("Failed to load cached caps from '%s' for '%s': %s",
                  capsfile, qemuCaps->binary, virGetLastErrorMessage());
         virResetLastError();
@@ -3504,6 +4035,7 @@ virQEMUCapsInitCached(virCapsPtr caps,
                   (long long)selfctime, (long long)virGetSelfLastChanged(),
                   selfvers, (unsigned long)LIBVIR_VERSION_NUMBER);
         ignore_value(unlink(capsfile));
+        ignore_value(unlink(xmlfile));
         virQEMUCapsReset(qemuCaps);
         ret = 0;
         goto cleanup;
@@ -3517,6 +4049,7 @@ virQEMUCapsInitCached(virCapsPtr caps,
  cleanup:
     VIR_FREE(binaryhash);
     VIR_FREE(capsfile);
+    VIR_FREE(xmlfile);
     VIR_FREE(capsdir);
     return ret;
 }
@@ -58,6 +58,24 @@ char *virQEMUCapsFormatCache(virQEMUCapsPtr qemuCaps,
                              time_t selfCTime,
                              unsigned long selfVersion);
 
+int virQEMUCapsParseCacheBinary(virCapsPtr caps,
+                                virQEMUCapsPtr qemuCaps,
+                                const char *data,
+                                size_t len,
+                                time_t *qemuctime,
+                                time_t *selfctime,
+                                unsigned long *selfvers);
+int virQEMUCapsLoadCacheBinary(virCapsPtr caps,
+                               virQEMUCapsPtr qemuCaps,
+                               const char *filename,
+                               time_t *qemuctime,
+                               time_t *selfctime,
+                               unsigned long *selfvers);
+char *virQEMUCapsFormatCacheBinary(virQEMUCapsPtr qemuCaps,
+                                   time_t selfCTime,
+                                   unsigned long selfVersion,
+                                   size_t *len);
+
 void
 virQEMUCapsSetArch(virQEMUCapsPtr qemuCaps,
                    virArch arch);
@@ -306,6 +306,11 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->maxStatsWorkers = 8;
+    cfg->maxLoadWorkers = 8;
+    cfg->statsCacheMaxAge = 1000;
+    cfg->statusSaveDelay = 250;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
@@ -651,6 +656,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueString(conf, "snapshot_image_format", &cfg->snapshotImageFormat) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "save_image_io_threads", &cfg->saveImageIOThreads) < 0)
+        goto cleanup;
 
     if (virConfGetValueString(conf, "auto_dump_path", &cfg->autoDumpPath) < 0)
         goto cleanup;
@@ -740,6 +747,14 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
 
     if (virConfGetValueUInt(conf, "max_queued", &cfg->maxQueuedJobs) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "max_stats_workers", &cfg->maxStatsWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_cache_max_age", &cfg->statsCacheMaxAge) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "max_load_workers", &cfg->maxLoadWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "status_save_delay", &cfg->statusSaveDelay) < 0)
+        goto cleanup;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &cfg->keepAliveInterval) < 0)
         goto cleanup;
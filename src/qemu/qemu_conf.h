@@ -43,6 +43,7 @@
 # include "virportallocator.h"
 # include "vircommand.h"
 # include "virthreadpool.h"
+# include "vircgroup.h"
 # include "locking/lock_manager.h"
 # include "qemu_capabilities.h"
 # include "virclosecallbacks.h"
@@ -161,6 +162,10 @@ struct _virQEMUDriverConfig {
     bool dumpGuestCore;
 
     unsigned int maxQueuedJobs;
+    unsigned int maxStatsWorkers;
+    unsigned int statsCacheMaxAge;
+    unsigned int maxLoadWorkers;
+    unsigned int statusSaveDelay;
 
     char **securityDriverNames;
     bool securityDefaultConfined;
@@ -169,6 +174,7 @@ struct _virQEMUDriverConfig {
     char *saveImageFormat;
     char *dumpImageFormat;
     char *snapshotImageFormat;
+    unsigned int saveImageIOThreads;
 
     char *autoDumpPath;
     bool autoDumpBypassCache;
@@ -205,6 +211,14 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virThreadPoolPtr workerPool;
 
+    /* Immutable pointer, self-locking APIs. NULL if bulk stats
+     * are collected serially. */
+    virThreadPoolPtr statsPool;
+
+    /* Immutable pointer, self-locking APIs. NULL if cgroups are
+     * not available. */
+    virCgroupStatsWalkPtr statsWalk;
+
     /* Atomic increment only */
     int lastvmid;
 
@@ -44,6 +44,7 @@
 #include "virstoragefile.h"
 #include "virstring.h"
 #include "virthreadjob.h"
+#include "virevent.h"
 #include "viratomic.h"
 #include "virprocess.h"
 #include "vircrypto.h"
@@ -1356,6 +1357,7 @@ qemuDomainObjPrivateAlloc(void)
         goto error;
 
     priv->migMaxBandwidth = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+    priv->statusSaveTimer = -1;
 
     return priv;
 
@@ -1398,6 +1400,7 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->libDir);
     VIR_FREE(priv->channelTargetDir);
     qemuDomainMasterKeyFree(priv);
+    qemuDomainStatsCacheClear(priv);
 
     VIR_FREE(priv);
 }
@@ -2927,17 +2930,257 @@ virDomainDefParserConfig virQEMUDriverDomainDefParserConfig = {
 };
 
 
+/*
+ * Writing the status XML of a running domain is not cheap: it formats
+ * the whole definition including the private data and rewrites the file
+ * with fsync. Changes which are only needed to be on disk eventually go
+ * through qemuDomainSaveStatus, which records the request and arms a
+ * timer. When it fires cfg->statusSaveDelay milliseconds later, the
+ * timer hands the domain to the driver's worker pool which writes all
+ * of the requests at once. Whatever the daemon needs to find after a
+ * crash to reconnect to the domain or to recover a job (starting the
+ * domain, job phases, devices, backing chains) goes through
+ * qemuDomainSaveStatusSync which also takes care of the pending write.
+ */
+typedef struct _qemuDomainSaveStatusData qemuDomainSaveStatusData;
+typedef qemuDomainSaveStatusData *qemuDomainSaveStatusDataPtr;
+struct _qemuDomainSaveStatusData {
+    virQEMUDriverPtr driver;
+    virDomainObjPtr vm;
+};
+
+
+static void
+qemuDomainSaveStatusDataFree(void *opaque)
+{
+    qemuDomainSaveStatusDataPtr data = opaque;
+
+    virObjectUnref(data->vm);
+    VIR_FREE(data);
+}
+
+
+void
+qemuDomainSaveStatusCancel(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (priv->statusSaveTimer != -1) {
+        virEventRemoveTimeout(priv->statusSaveTimer);
+        priv->statusSaveTimer = -1;
+    }
+    priv->statusSaveDirty = false;
+}
+
+
+static int
+qemuDomainSaveStatusWrite(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    int ret;
+
+    qemuDomainSaveStatusCancel(vm);
+
+    ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps);
+    if (ret == 0)
+        priv->statusSaveWritten++;
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
 static void
-qemuDomainObjSaveJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
+qemuDomainSaveStatusTimeout(int timer,
+                            void *opaque)
+{
+    qemuDomainSaveStatusDataPtr data = opaque;
+    virQEMUDriverPtr driver = data->driver;
+    virDomainObjPtr vm = data->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuProcessEvent *processEvent = NULL;
+
+    virObjectLock(vm);
+
+    /* already written or dropped by whoever held the lock before us */
+    if (priv->statusSaveTimer != timer)
+        goto cleanup;
+
+    virEventRemoveTimeout(priv->statusSaveTimer);
+    priv->statusSaveTimer = -1;
+
+    /* formatting and syncing the file has no business in the event loop,
+     * only fall back to it if there is no worker to hand it to */
+    if (!driver->workerPool ||
+        VIR_ALLOC_QUIET(processEvent) < 0)
+        goto write;
+
+    processEvent->eventType = QEMU_PROCESS_EVENT_SAVE_STATUS;
+    processEvent->vm = virObjectRef(vm);
+
+    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+        ignore_value(virObjectUnref(vm));
+        VIR_FREE(processEvent);
+        goto write;
+    }
+
+    priv->statusSaveQueued = true;
+    goto cleanup;
+
+ write:
+    qemuDomainSaveStatusFlush(driver, vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+}
+
+
+/**
+ * qemuDomainSaveStatusProcess:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Handles QEMU_PROCESS_EVENT_SAVE_STATUS sent from the timer set up by
+ * qemuDomainSaveStatus. Requests made while the event was waiting for
+ * a worker are written as well.
+ */
+void
+qemuDomainSaveStatusProcess(virQEMUDriverPtr driver,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->statusSaveQueued = false;
+
+    qemuDomainSaveStatusFlush(driver, vm);
+}
+
+
+/**
+ * qemuDomainSaveStatus:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Requests the status XML of @vm to be written out. The write happens
+ * in a worker thread once cfg->statusSaveDelay milliseconds passed,
+ * together with any other requests made meanwhile. It is done right away
+ * if the delay is 0 or there is no event loop to run the timer.
+ *
+ * Returns 0 on success, -1 if the status could not be written right away.
+ */
+int
+qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                     virDomainObjPtr vm)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainSaveStatusDataPtr data = NULL;
+    int ret = 0;
 
-    if (virDomainObjIsActive(obj)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, obj, driver->caps) < 0)
-            VIR_WARN("Failed to save status on vm %s", obj->def->name);
+    priv->statusSaveRequested++;
+    priv->statusSaveDirty = true;
+
+    if (priv->statusSaveTimer != -1 ||
+        priv->statusSaveQueued)
+        goto cleanup;
+
+    if (cfg->statusSaveDelay == 0 ||
+        VIR_ALLOC_QUIET(data) < 0)
+        goto write;
+
+    data->driver = driver;
+    data->vm = virObjectRef(vm);
+
+    if ((priv->statusSaveTimer =
+         virEventAddTimeout(cfg->statusSaveDelay,
+                            qemuDomainSaveStatusTimeout,
+                            data, qemuDomainSaveStatusDataFree)) < 0) {
+        priv->statusSaveTimer = -1;
+        qemuDomainSaveStatusDataFree(data);
+        goto write;
     }
 
+    goto cleanup;
+
+ write:
+    ret = qemuDomainSaveStatusWrite(driver, vm);
+
+ cleanup:
     virObjectUnref(cfg);
+    return ret;
+}
+
+
+/**
+ * qemuDomainSaveStatusSync:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Writes the status XML of @vm right away, including any changes
+ * requested by qemuDomainSaveStatus and not written yet.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainSaveStatusSync(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    priv->statusSaveRequested++;
+
+    return qemuDomainSaveStatusWrite(driver, vm);
+}
+
+
+/**
+ * qemuDomainSaveStatusFlush:
+ * @driver: qemu driver data
+ * @vm: domain object, locked
+ *
+ * Writes the status XML of @vm if there are changes waiting for the
+ * timer set up by qemuDomainSaveStatus or for the worker it queued.
+ */
+void
+qemuDomainSaveStatusFlush(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (!priv->statusSaveDirty)
+        return;
+
+    if (!virDomainObjIsActive(vm)) {
+        qemuDomainSaveStatusCancel(vm);
+        return;
+    }
+
+    if (qemuDomainSaveStatusWrite(driver, vm) < 0)
+        VIR_WARN("Failed to save status on vm %s", vm->def->name);
+}
+
+
+/* Async jobs are recovered from the status XML after a daemon restart,
+ * so their transitions are written right away */
+static void
+qemuDomainObjSaveJob(virQEMUDriverPtr driver,
+                     virDomainObjPtr obj,
+                     bool sync)
+{
+    int rc;
+
+    if (!virDomainObjIsActive(obj))
+        return;
+
+    if (sync)
+        rc = qemuDomainSaveStatusSync(driver, obj);
+    else
+        rc = qemuDomainSaveStatus(driver, obj);
+
+    if (rc < 0)
+        VIR_WARN("Failed to save status on vm %s", obj->def->name);
 }
 
 void
@@ -2963,7 +3206,7 @@ qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
 
     priv->job.phase = phase;
     priv->job.asyncOwner = me;
-    qemuDomainObjSaveJob(driver, obj);
+    qemuDomainObjSaveJob(driver, obj, true);
 }
 
 void
@@ -2986,7 +3229,7 @@ qemuDomainObjDiscardAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     if (priv->job.active == QEMU_JOB_ASYNC_NESTED)
         qemuDomainObjResetJob(priv);
     qemuDomainObjResetAsyncJob(priv);
-    qemuDomainObjSaveJob(driver, obj);
+    qemuDomainObjSaveJob(driver, obj, true);
 }
 
 void
@@ -3110,7 +3353,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     if (qemuDomainTrackJob(job))
-        qemuDomainObjSaveJob(driver, obj);
+        qemuDomainObjSaveJob(driver, obj, job == QEMU_JOB_ASYNC);
 
     virObjectUnref(cfg);
     return 0;
@@ -3248,7 +3491,7 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
 
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
-        qemuDomainObjSaveJob(driver, obj);
+        qemuDomainObjSaveJob(driver, obj, false);
     virCondSignal(&priv->job.cond);
 }
 
@@ -3264,7 +3507,7 @@ qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
               obj, obj->def->name);
 
     qemuDomainObjResetAsyncJob(priv);
-    qemuDomainObjSaveJob(driver, obj);
+    qemuDomainObjSaveJob(driver, obj, true);
     virCondBroadcast(&priv->job.asyncCond);
 }
 
@@ -4434,18 +4677,14 @@ qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                         bool value)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if (priv->fakeReboot == value)
-        goto cleanup;
+        return;
 
     priv->fakeReboot = value;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatusSync(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
-
- cleanup:
-    virObjectUnref(cfg);
 }
 
 static void
@@ -4641,6 +4880,20 @@ qemuDomainCleanupRun(virQEMUDriverPtr driver,
     priv->ncleanupCallbacks_max = 0;
 }
 
+
+/**
+ * qemuDomainStatsCacheClear:
+ * @priv: domain private data
+ *
+ * Drops the cached stats record of the domain, if there's any.
+ */
+void
+qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv)
+{
+    virTypedParamsFree(priv->statsCache.params, priv->statsCache.nparams);
+    memset(&priv->statsCache, 0, sizeof(priv->statsCache));
+}
+
 static void
 qemuDomainGetImageIds(virQEMUDriverConfigPtr cfg,
                       virDomainObjPtr vm,
@@ -165,6 +165,18 @@ struct _qemuDomainUnpluggingDevice {
     qemuDomainUnpluggingDeviceStatus status;
 };
 
+/* Stats record cached for VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED */
+typedef struct _qemuDomainStatsCache qemuDomainStatsCache;
+typedef qemuDomainStatsCache *qemuDomainStatsCachePtr;
+struct _qemuDomainStatsCache {
+    unsigned long long timestamp; /* when the stats were gathered, 0 if
+                                     the cache is empty */
+    unsigned int stats; /* virDomainStatsTypes the record was built for */
+    bool backing; /* whether backing chains were included */
+    virTypedParameterPtr params;
+    int nparams;
+};
+
 typedef struct _qemuDomainObjPrivate qemuDomainObjPrivate;
 typedef qemuDomainObjPrivate *qemuDomainObjPrivatePtr;
 struct _qemuDomainObjPrivate {
@@ -232,6 +244,15 @@ struct _qemuDomainObjPrivate {
     /* private XML) - need to restore at process reconnect */
     uint8_t *masterKey;
     size_t masterKeyLen;
+
+    qemuDomainStatsCache statsCache;
+
+    /* status XML writes, see qemuDomainSaveStatus */
+    int statusSaveTimer; /* -1 if no write is pending */
+    bool statusSaveQueued; /* QEMU_PROCESS_EVENT_SAVE_STATUS sent */
+    bool statusSaveDirty;
+    unsigned long long statusSaveRequested;
+    unsigned long long statusSaveWritten;
 };
 
 # define QEMU_DOMAIN_PRIVATE(vm)	\
@@ -375,6 +396,7 @@ typedef enum {
     QEMU_PROCESS_EVENT_SERIAL_CHANGED,
     QEMU_PROCESS_EVENT_BLOCK_JOB,
     QEMU_PROCESS_EVENT_MONITOR_EOF,
+    QEMU_PROCESS_EVENT_SAVE_STATUS,
 
     QEMU_PROCESS_EVENT_LAST
 } qemuProcessEventType;
@@ -569,6 +591,16 @@ void qemuDomainSetFakeReboot(virQEMUDriverPtr driver,
                              virDomainObjPtr vm,
                              bool value);
 
+int qemuDomainSaveStatus(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm);
+int qemuDomainSaveStatusSync(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm);
+void qemuDomainSaveStatusFlush(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm);
+void qemuDomainSaveStatusCancel(virDomainObjPtr vm);
+void qemuDomainSaveStatusProcess(virQEMUDriverPtr driver,
+                                 virDomainObjPtr vm);
+
 bool qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv,
                           qemuDomainJob job);
 
@@ -609,6 +641,8 @@ void qemuDomainCleanupRemove(virDomainObjPtr vm,
 void qemuDomainCleanupRun(virQEMUDriverPtr driver,
                           virDomainObjPtr vm);
 
+void qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv);
+
 extern virDomainXMLPrivateDataCallbacks virQEMUDriverPrivateDataCallbacks;
 extern virDomainXMLNamespace virQEMUDriverDomainXMLNamespace;
 extern virDomainDefParserConfig virQEMUDriverDomainDefParserConfig;
@@ -139,6 +139,8 @@ static void processGuestPanicEvent(virQEMUDriverPtr driver,
 
 static void qemuProcessEventHandler(void *data, void *opaque);
 
+static void qemuConnectGetAllDomainStatsWorker(void *data, void *opaque);
+
 static int qemuStateCleanup(void);
 
 static int qemuDomainObjStart(virConnectPtr conn,
@@ -886,6 +888,7 @@ qemuStateInitialize(bool privileged,
     if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
                                        cfg->stateDir,
                                        NULL, 1,
+                                       cfg->maxLoadWorkers,
                                        qemu_driver->caps,
                                        qemu_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -908,6 +911,7 @@ qemuStateInitialize(bool privileged,
     if (virDomainObjListLoadAllConfigs(qemu_driver->domains,
                                        cfg->configDir,
                                        cfg->autostartDir, 0,
+                                       cfg->maxLoadWorkers,
                                        qemu_driver->caps,
                                        qemu_driver->xmlopt,
                                        NULL, NULL) < 0)
@@ -927,6 +931,18 @@ qemuStateInitialize(bool privileged,
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (cfg->maxStatsWorkers > 1) {
+        qemu_driver->statsPool = virThreadPoolNew(0, cfg->maxStatsWorkers, 0,
+                                                  qemuConnectGetAllDomainStatsWorker,
+                                                  qemu_driver);
+        if (!qemu_driver->statsPool)
+            goto error;
+    }
+
+    if (virCgroupAvailable() &&
+        !(qemu_driver->statsWalk = virCgroupStatsWalkNew()))
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -989,6 +1005,7 @@ qemuStateReload(void)
     virDomainObjListLoadAllConfigs(qemu_driver->domains,
                                    cfg->configDir,
                                    cfg->autostartDir, 0,
+                                   cfg->maxLoadWorkers,
                                    caps, qemu_driver->xmlopt,
                                    qemuNotifyLoadDomain, qemu_driver);
  cleanup:
@@ -1058,6 +1075,19 @@ qemuStateStop(void)
     return ret;
 }
 
+static int
+qemuStateFlushStatus(virDomainObjPtr vm,
+                     void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+
+    virObjectLock(vm);
+    qemuDomainSaveStatusFlush(driver, vm);
+    virObjectUnlock(vm);
+
+    return 0;
+}
+
 /**
  * qemuStateCleanup:
  *
@@ -1069,6 +1099,10 @@ qemuStateCleanup(void)
     if (!qemu_driver)
         return -1;
 
+    /* the event loop won't run the timers of pending writes anymore */
+    virDomainObjListForEach(qemu_driver->domains,
+                            qemuStateFlushStatus, qemu_driver);
+
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
@@ -1101,6 +1135,8 @@ qemuStateCleanup(void)
 
     virMutexDestroy(&qemu_driver->lock);
     virThreadPoolFree(qemu_driver->workerPool);
+    virThreadPoolFree(qemu_driver->statsPool);
+    virCgroupStatsWalkFree(qemu_driver->statsWalk);
     VIR_FREE(qemu_driver);
 
     return 0;
@@ -1879,7 +1915,7 @@ static int qemuDomainSuspend(virDomainPtr dom)
                                              eventDetail);
         }
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -1942,7 +1978,7 @@ static int qemuDomainResume(virDomainPtr dom)
                                          VIR_DOMAIN_EVENT_RESUMED,
                                          VIR_DOMAIN_EVENT_RESUMED_UNPAUSED);
     }
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
     ret = 0;
 
@@ -2482,7 +2518,7 @@ static int qemuDomainSetMemoryStatsPeriod(virDomainPtr dom, int period,
         }
 
         def->memballoon->period = period;
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -2773,6 +2809,9 @@ typedef enum {
      */
     QEMU_SAVE_FORMAT_XZ = 3,
     QEMU_SAVE_FORMAT_LZOP = 4,
+    QEMU_SAVE_FORMAT_ZSTD = 5,
+    /* Zero and duplicate data elimination done by libvirt_iohelper */
+    QEMU_SAVE_FORMAT_DEDUP = 6,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2786,7 +2825,9 @@ VIR_ENUM_IMPL(qemuSaveCompression, QEMU_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "zstd",
+              "dedup")
 
 VIR_ENUM_DECL(qemuDumpFormat)
 VIR_ENUM_IMPL(qemuDumpFormat, VIR_DOMAIN_CORE_DUMP_FORMAT_LAST,
@@ -2842,11 +2883,21 @@ qemuDomainSaveHeader(int fd, const char *path, const char *xml,
 }
 
 
+static char *
+qemuDedupGetHelper(void)
+{
+    return virFileFindResource("libvirt_iohelper",
+                               abs_topbuilddir "/src",
+                               LIBEXECDIR);
+}
+
+
 static virCommandPtr
 qemuCompressGetCommand(virQEMUSaveFormat compression)
 {
     virCommandPtr ret = NULL;
     const char *prog = qemuSaveCompressionTypeToString(compression);
+    char *helper = NULL;
 
     if (!prog) {
         virReportError(VIR_ERR_OPERATION_FAILED,
@@ -2855,8 +2906,15 @@ qemuCompressGetCommand(virQEMUSaveFormat compression)
         return NULL;
     }
 
+    if (compression == QEMU_SAVE_FORMAT_DEDUP) {
+        if (!(helper = qemuDedupGetHelper()))
+            return NULL;
+        prog = helper;
+    }
+
     ret = virCommandNew(prog);
     virCommandAddArg(ret, "-dc");
+    VIR_FREE(helper);
 
     switch (compression) {
     case QEMU_SAVE_FORMAT_LZOP:
@@ -3052,6 +3110,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     int directFlag = 0;
     virFileWrapperFdPtr wrapperFd = NULL;
     unsigned int wrapperFlags = VIR_FILE_WRAPPER_NON_BLOCKING;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     memset(&header, 0, sizeof(header));
     memcpy(header.magic, QEMU_SAVE_PARTIAL, sizeof(header.magic));
@@ -3079,7 +3138,8 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     if (virSecurityManagerSetImageFDLabel(driver->securityManager, vm->def, fd) < 0)
         goto cleanup;
 
-    if (!(wrapperFd = virFileWrapperFdNew(&fd, path, wrapperFlags)))
+    if (!(wrapperFd = virFileWrapperFdNewParallel(&fd, path, wrapperFlags,
+                                                  cfg->saveImageIOThreads)))
         goto cleanup;
 
     /* Write header to file, followed by XML */
@@ -3124,6 +3184,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
  cleanup:
     VIR_FORCE_CLOSE(fd);
     virFileWrapperFdFree(wrapperFd);
+    virObjectUnref(cfg);
 
     if (ret < 0 && needUnlink)
         unlink(path);
@@ -3288,6 +3349,17 @@ qemuGetCompressionProgram(const char *imageFormat,
     if ((ret = qemuSaveCompressionTypeFromString(imageFormat)) < 0)
         goto error;
 
+    if (ret == QEMU_SAVE_FORMAT_DEDUP) {
+        /* Decoding needs the image file, a dump must be usable as is */
+        if (STREQ(styleFormat, "dump")) {
+            ret = -1;
+            goto error;
+        }
+        if (!(*compresspath = qemuDedupGetHelper()))
+            goto error;
+        return ret;
+    }
+
     if (!(*compresspath = virFindFileInPath(imageFormat)))
         goto error;
 
@@ -3979,7 +4051,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     virObjectEventPtr event = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool removeInactive = false;
 
     if (qemuDomainObjBeginAsyncJob(driver, vm, QEMU_ASYNC_JOB_DUMP) < 0)
@@ -4001,7 +4072,7 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
 
     qemuDomainEventQueue(driver, event);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+    if (qemuDomainSaveStatus(driver, vm) < 0) {
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
     }
@@ -4051,7 +4122,6 @@ processGuestPanicEvent(virQEMUDriverPtr driver,
         qemuDomainRemoveInactive(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
 }
 
 
@@ -4060,7 +4130,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
                           virDomainObjPtr vm,
                           char *devAlias)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainDeviceDef dev;
 
     VIR_DEBUG("Removing device %s from domain %p %s",
@@ -4084,7 +4153,7 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
             goto endjob;
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatusSync(driver, vm) < 0)
         VIR_WARN("unable to save domain status after removing device %s",
                  devAlias);
 
@@ -4093,7 +4162,6 @@ processDeviceDeletedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 }
 
 
@@ -4400,7 +4468,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
                           char *devAlias,
                           bool connected)
 {
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainChrDeviceState newstate;
     virObjectEventPtr event = NULL;
     virDomainDeviceDef dev;
@@ -4452,7 +4519,7 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
     dev.data.chr->state = newstate;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         VIR_WARN("unable to save status of domain %s after updating state of "
                  "channel %s", vm->def->name, devAlias);
 
@@ -4483,7 +4550,6 @@ processSerialChangedEvent(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FREE(devAlias);
-    virObjectUnref(cfg);
 
 }
 
@@ -4597,6 +4663,9 @@ static void qemuProcessEventHandler(void *data, void *opaque)
     case QEMU_PROCESS_EVENT_MONITOR_EOF:
         processMonitorEOFEvent(driver, vm);
         break;
+    case QEMU_PROCESS_EVENT_SAVE_STATUS:
+        qemuDomainSaveStatusProcess(driver, vm);
+        break;
     case QEMU_PROCESS_EVENT_LAST:
         break;
     }
@@ -4860,7 +4929,6 @@ qemuDomainSelectHotplugVcpuEntities(virDomainDefPtr def,
 
 static int
 qemuDomainSetVcpusLive(virQEMUDriverPtr driver,
-                       virQEMUDriverConfigPtr cfg,
                        virDomainObjPtr vm,
                        unsigned int nvcpus)
 {
@@ -4894,7 +4962,7 @@ qemuDomainSetVcpusLive(virQEMUDriverPtr driver,
 
     qemuDomainVcpuPersistOrder(vm->def);
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatusSync(driver, vm) < 0)
         goto cleanup;
 
     if (rc < 0)
@@ -4997,7 +5065,7 @@ qemuDomainSetVcpusInternal(virQEMUDriverPtr driver,
         goto cleanup;
     }
 
-    if (def && qemuDomainSetVcpusLive(driver, cfg, vm, nvcpus) < 0)
+    if (def && qemuDomainSetVcpusLive(driver, vm, nvcpus) < 0)
         goto cleanup;
 
     if (persistentDef) {
@@ -5074,7 +5142,6 @@ qemuDomainPinVcpuLive(virDomainObjPtr vm,
                       virDomainDefPtr def,
                       int vcpu,
                       virQEMUDriverPtr driver,
-                      virQEMUDriverConfigPtr cfg,
                       virBitmapPtr cpumap)
 {
     virBitmapPtr tmpmap = NULL;
@@ -5126,7 +5193,7 @@ qemuDomainPinVcpuLive(virDomainObjPtr vm,
     vcpuinfo->cpumask = tmpmap;
     tmpmap = NULL;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto cleanup;
 
     if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -5203,7 +5270,7 @@ qemuDomainPinVcpuFlags(virDomainPtr dom,
     }
 
     if (def &&
-        qemuDomainPinVcpuLive(vm, def, vcpu, driver, cfg, pcpumap) < 0)
+        qemuDomainPinVcpuLive(vm, def, vcpu, driver, pcpumap) < 0)
         goto endjob;
 
     if (persistentDef) {
@@ -5344,7 +5411,7 @@ qemuDomainPinEmulator(virDomainPtr dom,
         if (!(def->cputune.emulatorpin = virBitmapNewCopy(pcpumap)))
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
 
         str = virBitmapFormat(pcpumap);
@@ -5816,7 +5883,7 @@ qemuDomainPinIOThread(virDomainPtr dom,
         if (virProcessSetAffinity(iothrid->thread_id, pcpumap) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
 
         if (snprintf(paramField, VIR_TYPED_PARAM_FIELD_LENGTH,
@@ -6090,7 +6157,7 @@ qemuDomainChgIOThread(virQEMUDriverPtr driver,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatusSync(driver, vm) < 0)
             goto endjob;
     }
 
@@ -6451,6 +6518,16 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
     virDomainDefPtr def = NULL;
     int oflags = open_write ? O_RDWR : O_RDONLY;
     virCapsPtr caps = NULL;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned int ioThreads = cfg->saveImageIOThreads;
+    unsigned int wrapperFlags = 0;
+
+    virObjectUnref(cfg);
+
+    /* Parallel reads need the helper even if the cache is not bypassed,
+     * but never when the image is opened for updating its header.  */
+    if (!wrapperFd || open_write)
+        ioThreads = 0;
 
     if (bypass_cache) {
         int directFlag = virFileDirectFdFlag();
@@ -6460,6 +6537,7 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
             goto error;
         }
         oflags |= directFlag;
+        wrapperFlags |= VIR_FILE_WRAPPER_BYPASS_CACHE;
     }
 
     if (!(caps = virQEMUDriverGetCapabilities(driver, false)))
@@ -6467,9 +6545,9 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
 
     if ((fd = qemuOpenFile(driver, NULL, path, oflags, NULL, NULL)) < 0)
         goto error;
-    if (bypass_cache &&
-        !(*wrapperFd = virFileWrapperFdNew(&fd, path,
-                                           VIR_FILE_WRAPPER_BYPASS_CACHE)))
+    if ((bypass_cache || ioThreads > 1) &&
+        !(*wrapperFd = virFileWrapperFdNewParallel(&fd, path, wrapperFlags,
+                                                   ioThreads)))
         goto error;
 
     if (saferead(fd, &header, sizeof(header)) != sizeof(header)) {
@@ -6575,15 +6653,27 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     bool restored = false;
     virObjectEventPtr event;
     int intermediatefd = -1;
+    int imagefd = -1;
     virCommandPtr cmd = NULL;
     char *errbuf = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     if ((header->version == 2) &&
         (header->compressed != QEMU_SAVE_FORMAT_RAW)) {
         if (!(cmd = qemuCompressGetCommand(header->compressed)))
             goto cleanup;
 
+        if (header->compressed == QEMU_SAVE_FORMAT_DEDUP) {
+            /* Data seen more than once is read back from the image,
+             * which starts right after the header and the XML */
+            if ((imagefd = qemuOpenFile(driver, vm, path, O_RDONLY,
+                                        NULL, NULL)) < 0)
+                goto cleanup;
+            virCommandPassFD(cmd, imagefd, VIR_COMMAND_PASS_FD_CLOSE_PARENT);
+            virCommandAddArgFormat(cmd, "%d", imagefd);
+            virCommandAddArgFormat(cmd, "%zu",
+                                   sizeof(*header) + header->xml_len);
+        }
+
         intermediatefd = *fd;
         *fd = -1;
 
@@ -6653,7 +6743,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
                                "%s", _("failed to resume domain"));
             goto cleanup;
         }
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatusSync(driver, vm) < 0) {
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
             goto cleanup;
         }
@@ -6674,7 +6764,6 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     if (virSecurityManagerRestoreSavedStateLabel(driver->securityManager,
                                                  vm->def, path) < 0)
         VIR_WARN("failed to restore save state label on %s", path);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -8310,7 +8399,7 @@ qemuDomainAttachDeviceLiveAndConfig(virConnectPtr conn,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatusSync(driver, vm) < 0) {
             ret = -1;
             goto cleanup;
         }
@@ -8472,7 +8561,7 @@ static int qemuDomainUpdateDeviceFlags(virDomainPtr dom,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatusSync(driver, vm) < 0) {
             ret = -1;
             goto endjob;
         }
@@ -8573,7 +8662,7 @@ qemuDomainDetachDeviceLiveAndConfig(virQEMUDriverPtr driver,
          * changed even if we failed to attach the device. For example,
          * a new controller may be created.
          */
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatusSync(driver, vm) < 0) {
             ret = -1;
             goto cleanup;
         }
@@ -9133,7 +9222,7 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
             }
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
     if (ret < 0)
@@ -9399,7 +9488,7 @@ qemuDomainSetMemoryParameters(virDomainPtr dom,
 #undef VIR_SET_MEM_PARAMETER
 
     if (def &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (persistentDef &&
@@ -9668,7 +9757,7 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
                                  -1, mode, nodeset) < 0)
             goto endjob;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -9844,7 +9933,7 @@ qemuDomainSetPerfEvents(virDomainPtr dom,
                 VIR_TRISTATE_BOOL_YES : VIR_TRISTATE_BOOL_NO;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -10323,7 +10412,7 @@ qemuDomainSetSchedulerParametersFlags(virDomainPtr dom,
         }
     }
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatus(driver, vm) < 0)
         goto endjob;
 
     if (eventNparams) {
@@ -11122,7 +11211,7 @@ qemuDomainSetInterfaceParameters(virDomainPtr dom,
                 goto endjob;
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatus(driver, vm) < 0)
             goto endjob;
     }
 
@@ -14333,7 +14422,7 @@ qemuDomainSnapshotCreateDiskActive(virQEMUDriverPtr driver,
     }
 
     if (ret == 0 || !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_TRANSACTION)) {
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0 ||
+        if (qemuDomainSaveStatusSync(driver, vm) < 0 ||
             (persist && virDomainSaveConfig(cfg->configDir, driver->caps,
                                             vm->newDef) < 0))
             ret = -1;
@@ -16242,7 +16331,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     virQEMUDriverPtr driver = dom->conn->privateData;
     char *device = NULL;
     virDomainDiskDefPtr disk = NULL;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     bool save = false;
     bool modern;
     bool pivot = !!(flags & VIR_DOMAIN_BLOCK_JOB_ABORT_PIVOT);
@@ -16315,7 +16403,7 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
      * effort to save it now.  But we can ignore failure, since there
      * will be further changes when the event marks completion.  */
     if (save)
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
+        ignore_value(qemuDomainSaveStatusSync(driver, vm));
 
     /* With synchronous block cancel, we must synthesize an event, and
      * we silently ignore the ABORT_ASYNC flag.  With asynchronous
@@ -16352,7 +16440,6 @@ qemuDomainBlockJobAbort(virDomainPtr dom,
     qemuDomainObjEndJob(driver, vm);
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(device);
     virDomainObjEndAPI(&vm);
     return ret;
@@ -16460,11 +16547,8 @@ qemuDomainGetBlockJobInfo(virDomainPtr dom,
     if (disk->mirror &&
         rawInfo.ready != 0 &&
         info->cur == info->end && !disk->mirrorState) {
-        virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-
         disk->mirrorState = VIR_DOMAIN_DISK_MIRROR_STATE_READY;
-        ignore_value(virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps));
-        virObjectUnref(cfg);
+        ignore_value(qemuDomainSaveStatus(driver, vm));
     }
  endjob:
     qemuDomainObjEndJob(driver, vm);
@@ -16722,7 +16806,7 @@ qemuDomainBlockCopyCommon(virDomainObjPtr vm,
     disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_COPY;
     QEMU_DOMAIN_DISK_PRIVATE(disk)->blockjob = true;
 
-    if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+    if (qemuDomainSaveStatusSync(driver, vm) < 0)
         VIR_WARN("Unable to save status on vm %s after state change",
                  vm->def->name);
 
@@ -17116,13 +17200,10 @@ qemuDomainBlockCommit(virDomainPtr dom,
 
     if (mirror) {
         if (ret == 0) {
-            virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
-
             mirror = NULL;
-            if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+            if (qemuDomainSaveStatusSync(driver, vm) < 0)
                 VIR_WARN("Unable to save status on vm %s after block job",
                          vm->def->name);
-            virObjectUnref(cfg);
         } else {
             disk->mirror = NULL;
             disk->mirrorJob = VIR_DOMAIN_BLOCK_JOB_TYPE_UNKNOWN;
@@ -17619,7 +17700,7 @@ qemuDomainSetBlockIoTune(virDomainPtr dom,
             goto endjob;
         disk->blkdeviotune = info;
 
-        ret = virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps);
+        ret = qemuDomainSaveStatus(driver, vm);
         if (ret < 0)
             goto endjob;
 
@@ -18788,8 +18869,11 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
+                        virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                         unsigned int privflags ATTRIBUTE_UNUSED)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+
     if (virTypedParamsAddInt(&record->params,
                              &record->nparams,
                              maxparams,
@@ -18804,6 +18888,20 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              dom->state.reason) < 0)
         return -1;
 
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.status_saves.requested",
+                                priv->statusSaveRequested) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.status_saves.written",
+                                priv->statusSaveWritten) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -18820,30 +18918,46 @@ typedef enum {
 
 
 static int
-qemuDomainGetStatsCpu(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+qemuDomainGetStatsCpu(virQEMUDriverPtr driver,
                       virDomainObjPtr dom,
                       virDomainStatsRecordPtr record,
                       int *maxparams,
+                      virCgroupCpuacctStatsTablePtr cpustats,
                       unsigned int privflags ATTRIBUTE_UNUSED)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
+    virCgroupCpuacctStatsPtr cached = NULL;
     unsigned long long cpu_time = 0;
     unsigned long long user_time = 0;
     unsigned long long sys_time = 0;
+    int usage_err = 0;
     int err = 0;
 
     if (!priv->cgroup)
         return 0;
 
-    err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
-    if (!err && virTypedParamsAddULLong(&record->params,
-                                        &record->nparams,
-                                        maxparams,
-                                        "cpu.time",
-                                        cpu_time) < 0)
+    if (cpustats &&
+        (cached = virCgroupCpuacctStatsTableLookup(cpustats, priv->cgroup))) {
+        cpu_time = cached->usage;
+        user_time = cached->user;
+        sys_time = cached->sys;
+    } else {
+        /* Let the next walk over all domains read this one as well */
+        if (cpustats && driver->statsWalk &&
+            virCgroupStatsWalkAddGroup(driver->statsWalk, priv->cgroup) < 0)
+            virResetLastError();
+
+        usage_err = virCgroupGetCpuacctUsage(priv->cgroup, &cpu_time);
+        err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
+    }
+
+    if (!usage_err && virTypedParamsAddULLong(&record->params,
+                                              &record->nparams,
+                                              maxparams,
+                                              "cpu.time",
+                                              cpu_time) < 0)
         return -1;
 
-    err = virCgroupGetCpuacctStat(priv->cgroup, &user_time, &sys_time);
     if (!err && virTypedParamsAddULLong(&record->params,
                                         &record->nparams,
                                         maxparams,
@@ -18865,6 +18979,7 @@ qemuDomainGetStatsBalloon(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
+                          virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                           unsigned int privflags)
 {
     qemuDomainObjPrivatePtr priv = dom->privateData;
@@ -18936,6 +19051,7 @@ qemuDomainGetStatsVcpu(virQEMUDriverPtr driver,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
+                       virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                        unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -19071,6 +19187,7 @@ qemuDomainGetStatsInterface(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                             virDomainObjPtr dom,
                             virDomainStatsRecordPtr record,
                             int *maxparams,
+                            virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                             unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -19286,6 +19403,7 @@ qemuDomainGetStatsBlock(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
+                        virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                         unsigned int privflags)
 {
     size_t i;
@@ -19382,6 +19500,7 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                        virDomainObjPtr dom,
                        virDomainStatsRecordPtr record,
                        int *maxparams,
+                       virCgroupCpuacctStatsTablePtr cpustats ATTRIBUTE_UNUSED,
                        unsigned int privflags ATTRIBUTE_UNUSED)
 {
     size_t i;
@@ -19403,11 +19522,16 @@ qemuDomainGetStatsPerf(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
     return ret;
 }
 
+/* @cpustats holds the cpuacct statistics of the domains read in one walk
+ * by qemuConnectGetAllDomainStats, or is NULL. Only the cgroup based
+ * VIR_DOMAIN_STATS_CPU_TOTAL uses it: vCPU times come from /proc stat and
+ * schedstat of the vCPU threads, not from the cpuacct controller. */
 typedef int
 (*qemuDomainGetStatsFunc)(virQEMUDriverPtr driver,
                           virDomainObjPtr dom,
                           virDomainStatsRecordPtr record,
                           int *maxparams,
+                          virCgroupCpuacctStatsTablePtr cpustats,
                           unsigned int flags);
 
 struct qemuDomainGetStatsWorker {
@@ -19474,6 +19598,7 @@ static int
 qemuDomainGetStats(virConnectPtr conn,
                    virDomainObjPtr dom,
                    unsigned int stats,
+                   virCgroupCpuacctStatsTablePtr cpustats,
                    virDomainStatsRecordPtr *record,
                    unsigned int flags)
 {
@@ -19488,7 +19613,8 @@ qemuDomainGetStats(virConnectPtr conn,
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
         if (stats & qemuDomainGetStatsWorkers[i].stats) {
             if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
-                                                  &maxparams, flags) < 0)
+                                                  &maxparams, cpustats,
+                                                  flags) < 0)
                 goto cleanup;
         }
     }
@@ -19510,6 +19636,295 @@ qemuDomainGetStats(virConnectPtr conn,
 }
 
 
+/* Fills in @record from the stats cache of @vm if it holds a record
+ * for the same set of stats younger than @maxAge milliseconds.
+ * Returns 1 on cache hit, 0 on cache miss and -1 on error. */
+static int
+qemuDomainStatsCacheLookup(virConnectPtr conn,
+                           virDomainObjPtr vm,
+                           unsigned int stats,
+                           bool backing,
+                           unsigned int maxAge,
+                           virDomainStatsRecordPtr *record)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->statsCache;
+    virDomainStatsRecordPtr tmp = NULL;
+    unsigned long long now;
+
+    if (!cache->timestamp ||
+        cache->stats != stats ||
+        cache->backing != backing ||
+        virTimeMillisNow(&now) < 0 ||
+        now - cache->timestamp > maxAge)
+        return 0;
+
+    if (VIR_ALLOC(tmp) < 0)
+        goto error;
+
+    if (virTypedParamsCopy(&tmp->params, cache->params, cache->nparams) < 0)
+        goto error;
+    tmp->nparams = cache->nparams;
+
+    if (!(tmp->dom = virGetDomain(conn, vm->def->name, vm->def->uuid)))
+        goto error;
+
+    *record = tmp;
+    return 1;
+
+ error:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+    return -1;
+}
+
+
+/* Remembers the stats in @record so that following
+ * qemuDomainStatsCacheLookup calls may use them. Failure to
+ * update the cache is not fatal. */
+static void
+qemuDomainStatsCacheStore(virDomainObjPtr vm,
+                          unsigned int stats,
+                          bool backing,
+                          virDomainStatsRecordPtr record)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->statsCache;
+    virTypedParameterPtr params = NULL;
+    unsigned long long now;
+
+    qemuDomainStatsCacheClear(priv);
+
+    if (virTimeMillisNow(&now) < 0 ||
+        virTypedParamsCopy(&params, record->params, record->nparams) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    cache->timestamp = now;
+    cache->stats = stats;
+    cache->backing = backing;
+    cache->params = params;
+    cache->nparams = record->nparams;
+}
+
+
+/* Collects the stats of a single domain, acquiring a job if requested
+ * by @privflags. CPU stats are taken from @cpustats if it holds them.
+ * On success @record is filled in. */
+static int
+qemuConnectGetAllDomainStatsOne(virConnectPtr conn,
+                                virDomainObjPtr vm,
+                                unsigned int stats,
+                                virCgroupCpuacctStatsTablePtr cpustats,
+                                unsigned int privflags,
+                                unsigned int flags,
+                                virDomainStatsRecordPtr *record)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    bool backing = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING);
+    unsigned int maxAge = 0;
+    unsigned int domflags = 0;
+    int ret;
+
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED) {
+        cfg = virQEMUDriverGetConfig(driver);
+        maxAge = cfg->statsCacheMaxAge;
+        virObjectUnref(cfg);
+    }
+
+    virObjectLock(vm);
+
+    if (maxAge &&
+        (ret = qemuDomainStatsCacheLookup(conn, vm, stats, backing,
+                                          maxAge, record)) != 0)
+        goto cleanup;
+
+    if (HAVE_JOB(privflags) &&
+        qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
+        domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+    /* else: without a job it's still possible to gather some data */
+
+    /* Somebody else might have refreshed the cache while we were
+     * waiting for the job, so there's no need to query the domain
+     * again. This way concurrent callers share a single query. */
+    if (maxAge &&
+        (ret = qemuDomainStatsCacheLookup(conn, vm, stats, backing,
+                                          maxAge, record)) != 0)
+        goto endjob;
+
+    if (backing)
+        domflags |= QEMU_DOMAIN_STATS_BACKING;
+
+    ret = qemuDomainGetStats(conn, vm, stats, cpustats, record, domflags);
+
+    /* Don't cache incomplete stats gathered without the job */
+    if (ret == 0 && maxAge &&
+        HAVE_JOB(privflags) == HAVE_JOB(domflags))
+        qemuDomainStatsCacheStore(vm, stats, backing, *record);
+
+ endjob:
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndJob(driver, vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    return ret < 0 ? -1 : 0;
+}
+
+
+/* State shared by the stats workers serving one
+ * qemuConnectGetAllDomainStats call */
+typedef struct _qemuDomainStatsCollection qemuDomainStatsCollection;
+typedef qemuDomainStatsCollection *qemuDomainStatsCollectionPtr;
+struct _qemuDomainStatsCollection {
+    virMutex lock;
+    virCond cond;
+
+    virConnectPtr conn;
+    unsigned int stats;
+    virCgroupCpuacctStatsTablePtr cpustats;
+    unsigned int privflags;
+    unsigned int flags;
+
+    /* one slot per domain, so that records keep the domain order */
+    virDomainStatsRecordPtr *records;
+    size_t pending;
+    bool failed;
+    virErrorPtr err;
+};
+
+typedef struct _qemuDomainStatsJob qemuDomainStatsJob;
+typedef qemuDomainStatsJob *qemuDomainStatsJobPtr;
+struct _qemuDomainStatsJob {
+    qemuDomainStatsCollectionPtr collection;
+    virDomainObjPtr vm;
+    size_t idx;
+};
+
+
+static void
+qemuConnectGetAllDomainStatsWorker(void *data,
+                                   void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuDomainStatsJobPtr job = data;
+    qemuDomainStatsCollectionPtr collection = job->collection;
+    virDomainStatsRecordPtr record = NULL;
+    bool skip;
+    int rc = 0;
+
+    virMutexLock(&collection->lock);
+    skip = collection->failed;
+    virMutexUnlock(&collection->lock);
+
+    /* no point in querying the domain if the whole call fails anyway */
+    if (!skip)
+        rc = qemuConnectGetAllDomainStatsOne(collection->conn, job->vm,
+                                             collection->stats,
+                                             collection->cpustats,
+                                             collection->privflags,
+                                             collection->flags, &record);
+
+    virMutexLock(&collection->lock);
+    if (rc < 0 && !collection->failed) {
+        collection->failed = true;
+        collection->err = virSaveLastError();
+    }
+    collection->records[job->idx] = record;
+    if (--collection->pending == 0)
+        virCondSignal(&collection->cond);
+    virMutexUnlock(&collection->lock);
+
+    virResetLastError();
+    VIR_FREE(job);
+}
+
+
+/* Queries the domains in @vms on the stats worker pool, storing the
+ * record of each domain at the same index in @records. Returns after
+ * all the workers are done. */
+static int
+qemuConnectGetAllDomainStatsParallel(virConnectPtr conn,
+                                     virDomainObjPtr *vms,
+                                     size_t nvms,
+                                     unsigned int stats,
+                                     virCgroupCpuacctStatsTablePtr cpustats,
+                                     unsigned int privflags,
+                                     unsigned int flags,
+                                     virDomainStatsRecordPtr *records)
+{
+    virQEMUDriverPtr driver = conn->privateData;
+    qemuDomainStatsCollection collection;
+    int ret = -1;
+    size_t i;
+
+    memset(&collection, 0, sizeof(collection));
+
+    if (virMutexInit(&collection.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    if (virCondInit(&collection.cond) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init condition"));
+        virMutexDestroy(&collection.lock);
+        return -1;
+    }
+
+    collection.conn = conn;
+    collection.stats = stats;
+    collection.cpustats = cpustats;
+    collection.privflags = privflags;
+    collection.flags = flags;
+    collection.records = records;
+
+    virMutexLock(&collection.lock);
+
+    for (i = 0; i < nvms; i++) {
+        qemuDomainStatsJobPtr job;
+
+        if (VIR_ALLOC(job) < 0)
+            break;
+
+        job->collection = &collection;
+        job->vm = vms[i];
+        job->idx = i;
+
+        collection.pending++;
+        if (virThreadPoolSendJob(driver->statsPool, 0, job) < 0) {
+            collection.pending--;
+            VIR_FREE(job);
+            break;
+        }
+    }
+
+    /* Stop the workers from doing unnecessary work if we failed to
+     * queue all the domains. The error was reported already. */
+    if (i < nvms)
+        collection.failed = true;
+
+    /* The workers reference @collection, so we must not leave early */
+    while (collection.pending)
+        ignore_value(virCondWait(&collection.cond, &collection.lock));
+
+    virMutexUnlock(&collection.lock);
+
+    if (collection.err) {
+        virSetError(collection.err);
+        virFreeError(collection.err);
+    } else if (!collection.failed) {
+        ret = 0;
+    }
+
+    virCondDestroy(&collection.cond);
+    virMutexDestroy(&collection.lock);
+    return ret;
+}
+
+
 static int
 qemuConnectGetAllDomainStats(virConnectPtr conn,
                              virDomainPtr *doms,
@@ -19520,15 +19935,15 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
 {
     virQEMUDriverPtr driver = conn->privateData;
     virDomainObjPtr *vms = NULL;
-    virDomainObjPtr vm;
     size_t nvms;
     virDomainStatsRecordPtr *tmpstats = NULL;
+    virCgroupCpuacctStatsTable cputable;
+    virCgroupCpuacctStatsTablePtr cpustats = NULL;
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
     int nstats = 0;
     size_t i;
     int ret = -1;
     unsigned int privflags = 0;
-    unsigned int domflags = 0;
     unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
@@ -19537,6 +19952,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
 
     if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
@@ -19545,6 +19961,8 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
         return -1;
 
+    memset(&cputable, 0, sizeof(cputable));
+
     if (ndoms) {
         if (virDomainObjListConvert(driver->domains, conn, doms, ndoms, &vms,
                                     &nvms, virConnectGetAllDomainStatsCheckACL,
@@ -19558,40 +19976,71 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     }
 
     if (VIR_ALLOC_N(tmpstats, nvms + 1) < 0)
-        return -1;
+        goto cleanup;
 
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
 
-    for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
+    /* Read the CPU time of all the domains in a single walk over their
+     * cgroups rather than domain by domain. Only the domains requested
+     * and visible to the caller are read, the walk may know about more.
+     * Domains missing from the table read their cgroup themselves. */
+    if (driver->statsWalk && nvms > 1 &&
+        stats & VIR_DOMAIN_STATS_CPU_TOTAL) {
+        for (i = 0; i < nvms; i++) {
+            qemuDomainObjPrivatePtr priv = vms[i]->privateData;
+            int rc;
 
-        virObjectLock(vm);
+            virObjectLock(vms[i]);
+            rc = virCgroupCpuacctStatsTableWant(&cputable, priv->cgroup);
+            virObjectUnlock(vms[i]);
 
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
+            if (rc < 0)
+                goto cleanup;
+        }
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
-                qemuDomainObjEndJob(driver, vm);
+        if (cputable.nwanted > 0) {
+            if (VIR_ALLOC_N(cputable.stats, cputable.nwanted) < 0)
+                goto cleanup;
+            cputable.maxstats = cputable.nwanted;
 
-            virObjectUnlock(vm);
-            goto cleanup;
+            if (virCgroupGetCpuacctStatsAll(driver->statsWalk, &cputable) < 0)
+                virResetLastError();
+            else
+                cpustats = &cputable;
         }
+    }
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
+    /* Each domain waits for its monitor on its own, so querying them in
+     * parallel makes the call take as long as the slowest domain rather
+     * than the sum of all of them. */
+    if (driver->statsPool && nvms > 1) {
+        int rc = qemuConnectGetAllDomainStatsParallel(conn, vms, nvms, stats,
+                                                      cpustats, privflags,
+                                                      flags, tmpstats);
 
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
+        /* squash domains which didn't provide a record so that the list
+         * is NULL terminated even if some of the workers failed */
+        for (i = 0; i < nvms; i++) {
+            if (tmpstats[i])
+                tmpstats[nstats++] = tmpstats[i];
+        }
+        for (i = nstats; i < nvms; i++)
+            tmpstats[i] = NULL;
 
-        virObjectUnlock(vm);
+        if (rc < 0)
+            goto cleanup;
+    } else {
+        for (i = 0; i < nvms; i++) {
+            virDomainStatsRecordPtr tmp = NULL;
+
+            if (qemuConnectGetAllDomainStatsOne(conn, vms[i], stats, cpustats,
+                                                privflags, flags, &tmp) < 0)
+                goto cleanup;
+
+            if (tmp)
+                tmpstats[nstats++] = tmp;
+        }
     }
 
     *retStats = tmpstats;
@@ -19602,6 +20051,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
  cleanup:
     virDomainStatsRecordListFree(tmpstats);
     virObjectListFreeCount(vms, nvms);
+    virCgroupCpuacctStatsTableClear(&cputable);
 
     return ret;
 }
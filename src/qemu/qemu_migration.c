@@ -61,6 +61,7 @@
 #include "virprocess.h"
 #include "nwfilter_conf.h"
 #include "storage/storage_driver.h"
+#include "dirname.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -2127,7 +2128,6 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     unsigned long long mirror_speed = speed;
     unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
     int rv;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     VIR_DEBUG("Starting drive mirrors for domain %s", vm->def->name);
 
@@ -2185,7 +2185,7 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
         }
         diskPriv->migrating = true;
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0) {
+        if (qemuDomainSaveStatusSync(driver, vm) < 0) {
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
             goto cleanup;
         }
@@ -2219,7 +2219,6 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     ret = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     VIR_FREE(diskAlias);
     VIR_FREE(nbd_dest);
     VIR_FREE(hoststr);
@@ -4191,7 +4190,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     qemuMigrationCookiePtr mig;
     virObjectEventPtr event;
     int rv = -1;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     qemuDomainObjPrivatePtr priv = vm->privateData;
     qemuDomainJobInfoPtr jobInfo = NULL;
 
@@ -4280,7 +4278,7 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
             qemuDomainEventQueue(driver, event);
         }
 
-        if (virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        if (qemuDomainSaveStatusSync(driver, vm) < 0)
             VIR_WARN("Failed to save status on vm %s", vm->def->name);
     }
 
@@ -4289,7 +4287,6 @@ qemuMigrationConfirmPhase(virQEMUDriverPtr driver,
     rv = 0;
 
  cleanup:
-    virObjectUnref(cfg);
     return rv;
 }
 
@@ -6179,7 +6176,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     virErrorPtr orig_err = NULL;
     int cookie_flags = 0;
     qemuDomainObjPrivatePtr priv = vm->privateData;
-    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     unsigned short port;
     unsigned long long timeReceived = 0;
     virObjectEventPtr event;
@@ -6382,7 +6378,7 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
     }
 
     if (virDomainObjIsActive(vm) &&
-        virDomainSaveStatus(driver->xmlopt, cfg->stateDir, vm, driver->caps) < 0)
+        qemuDomainSaveStatusSync(driver, vm) < 0)
         VIR_WARN("Failed to save status on vm %s", vm->def->name);
 
     /* Guest is successfully running, so cancel previous auto destroy */
@@ -6439,7 +6435,6 @@ qemuMigrationFinish(virQEMUDriverPtr driver,
         virSetError(orig_err);
         virFreeError(orig_err);
     }
-    virObjectUnref(cfg);
 
     /* Set a special error if Finish is expected to return NULL as a result of
      * successful call with retcode != 0
@@ -6513,6 +6508,9 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         };
 
         cmd = virCommandNewArgs(args);
+        /* zstd is the only one able to compress on all host CPUs */
+        if (STREQ(last_component(prog), "zstd"))
+            virCommandAddArg(cmd, "-T0");
         virCommandSetInputFD(cmd, pipeFD[0]);
         virCommandSetOutputFD(cmd, &fd);
         virCommandSetErrorBuffer(cmd, &errbuf);
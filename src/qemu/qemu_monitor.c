@@ -55,6 +55,12 @@ VIR_LOG_INIT("qemu.qemu_monitor");
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Minimum free space in the receive buffer before reading */
+#define QEMU_MONITOR_READ_CHUNK 1024
+
+/* Receive buffers grown larger than this are released once drained */
+#define QEMU_MONITOR_BUFFER_KEEP (64 * 1024)
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -74,7 +80,12 @@ struct _qemuMonitor {
     qemuMonitorMessagePtr msg;
 
     /* Buffer incoming data ready for Text/QMP monitor
-     * code to process & find message boundaries */
+     * code to process & find message boundaries. Data
+     * between bufferConsumed and bufferOffset is still to
+     * be processed, and up to bufferScanned it is known not
+     * to contain any line ending */
+    size_t bufferConsumed;
+    size_t bufferScanned;
     size_t bufferOffset;
     size_t bufferLength;
     char *buffer;
@@ -407,6 +418,8 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
     qemuMonitorMessagePtr msg = NULL;
+    char *data = mon->buffer + mon->bufferConsumed;
+    size_t avail = mon->bufferOffset - mon->bufferConsumed;
 
     /* See if there's a message & whether its ready for its reply
      * ie whether its completed writing all its data */
@@ -416,26 +429,33 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
-    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    char *str2 = qemuMonitorEscapeNonPrintable(data);
+    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)avail, mon->msg, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
-    VIR_DEBUG("Process %d", (int)mon->bufferOffset);
+    VIR_DEBUG("Process %d", (int)avail);
 # endif
 #endif
 
     PROBE(QEMU_MONITOR_IO_PROCESS,
-          "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
+          "mon=%p buf=%s len=%zu", mon, data, avail);
 
-    if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
-    else
-        len = qemuMonitorTextIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
+    if (mon->bufferScanned < mon->bufferConsumed)
+        mon->bufferScanned = mon->bufferConsumed;
+
+    if (mon->json) {
+        /* Nothing can be parsed until a whole QMP line arrived, so
+         * don't rescan a long partial reply after every read */
+        if (memchr(mon->buffer + mon->bufferScanned, '\n',
+                   mon->bufferOffset - mon->bufferScanned))
+            len = qemuMonitorJSONIOProcess(mon, data, avail, msg);
+        else
+            len = 0;
+        mon->bufferScanned = mon->bufferOffset;
+    } else {
+        len = qemuMonitorTextIOProcess(mon, data, avail, msg);
+    }
 
     if (len < 0)
         return -1;
@@ -443,15 +463,19 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len && mon->waitGreeting)
         mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
-    } else {
-        VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
+    mon->bufferConsumed += len;
+    if (mon->bufferConsumed == mon->bufferOffset) {
+        /* Keep a small buffer around for the next reply, but don't
+         * hold on to the memory taken by a huge one */
+        if (mon->bufferLength > QEMU_MONITOR_BUFFER_KEEP) {
+            VIR_FREE(mon->buffer);
+            mon->bufferLength = 0;
+        }
+        mon->bufferConsumed = mon->bufferScanned = mon->bufferOffset = 0;
     }
 #if DEBUG_IO
-    VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
+    VIR_DEBUG("Process done %d used %d",
+              (int)(mon->bufferOffset - mon->bufferConsumed), len);
 #endif
     if (msg && msg->finished)
         virCondBroadcast(&mon->notify);
@@ -564,12 +588,23 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
-    if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0)
+    /* Reclaim the space of processed data before growing the buffer.
+     * The pending data is at most one partial line, so it is moved
+     * at most once per line rather than once per reply processed */
+    if (avail < QEMU_MONITOR_READ_CHUNK && mon->bufferConsumed > 0) {
+        memmove(mon->buffer, mon->buffer + mon->bufferConsumed,
+                mon->bufferOffset - mon->bufferConsumed + 1);
+        mon->bufferOffset -= mon->bufferConsumed;
+        mon->bufferScanned -= MIN(mon->bufferScanned, mon->bufferConsumed);
+        mon->bufferConsumed = 0;
+        avail = mon->bufferLength - mon->bufferOffset;
+    }
+
+    if (avail < QEMU_MONITOR_READ_CHUNK) {
+        if (VIR_RESIZE_N(mon->buffer, mon->bufferLength,
+                         mon->bufferOffset, QEMU_MONITOR_READ_CHUNK) < 0)
             return -1;
-        mon->bufferLength += 1024;
-        avail += 1024;
+        avail = mon->bufferLength - mon->bufferOffset;
     }
 
     /* Read as much as we can get into our buffer,
@@ -60,6 +60,9 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* Optional list of paths within the JSON reply the caller is
+     * interested in; see virJSONValueFromStringFiltered */
+    const char *const *rxFilter;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
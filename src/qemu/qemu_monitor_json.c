@@ -190,7 +190,12 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
     VIR_DEBUG("Line [%s]", line);
 
-    if (!(obj = virJSONValueFromString(line)))
+    if (msg && msg->rxFilter)
+        obj = virJSONValueFromStringFiltered(line, msg->rxFilter);
+    else
+        obj = virJSONValueFromString(line);
+
+    if (!obj)
         goto cleanup;
 
     if (obj->type != VIR_JSON_TYPE_OBJECT) {
@@ -229,7 +234,7 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 }
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg)
 {
@@ -240,18 +245,13 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
         char *nl = strstr(data + used, LINE_ENDING);
 
         if (nl) {
-            int got = nl - (data + used);
-            char *line;
-            if (VIR_STRNDUP(line, data + used, got) < 0)
-                return -1;
-            used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
+            char *line = data + used;
+            used += nl - line + strlen(LINE_ENDING);
+            /* Processed data is dropped by the caller, so the line
+             * can be terminated in place instead of copied */
+            *nl = '\0';
+            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0)
                 return -1;
-            }
-
-            VIR_FREE(line);
         } else {
             break;
         }
@@ -262,10 +262,11 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONCommandFull(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           const char *const *filter,
+                           virJSONValuePtr *reply)
 {
     int ret = -1;
     qemuMonitorMessage msg;
@@ -275,6 +276,7 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
     *reply = NULL;
 
     memset(&msg, 0, sizeof(msg));
+    msg.rxFilter = filter;
 
     if (virJSONValueObjectHasKey(cmd, "execute") == 1) {
         if (!(id = qemuMonitorNextCommandID(mon)))
@@ -320,6 +322,16 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
 }
 
 
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, scm_fd, NULL, reply);
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -328,6 +340,35 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
+/* Members of a QMP message which have to be kept intact when the reply
+ * is filtered, so that events, errors and the greeting, which may
+ * arrive while waiting for the reply, are processed as usual. */
+#define QEMU_MONITOR_JSON_FILTER_COMMON \
+    "QMP", "event", "data", "timestamp", "error", "id"
+
+/**
+ * qemuMonitorJSONCommandFiltered:
+ * @mon: monitor object
+ * @cmd: command to send
+ * @filter: NULL terminated list of paths within the reply to keep
+ * @reply: filled with the reply
+ *
+ * Like qemuMonitorJSONCommand, but only the parts of the reply listed
+ * in @filter (in addition to QEMU_MONITOR_JSON_FILTER_COMMON, which
+ * @filter has to include) are turned into JSON values. This avoids
+ * building large trees for replies of which only a few members are
+ * used. See virJSONValueFromStringFiltered for the path syntax.
+ */
+static int
+qemuMonitorJSONCommandFiltered(qemuMonitorPtr mon,
+                               virJSONValuePtr cmd,
+                               const char *const *filter,
+                               virJSONValuePtr *reply)
+{
+    return qemuMonitorJSONCommandFull(mon, cmd, -1, filter, reply);
+}
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -1378,6 +1419,16 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
 }
 
 
+/* Members of query-cpus used by qemuMonitorJSONExtractCPUInfo */
+static const char *const qemuMonitorJSONQueryCPUsFilter[] = {
+    QEMU_MONITOR_JSON_FILTER_COMMON,
+    "return/*/thread_id",
+    "return/*/halted",
+    "return/*/qom_path",
+    NULL
+};
+
+
 /**
  * qemuMonitorJSONQueryCPUs:
  *
@@ -1405,7 +1456,8 @@ qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
     if (!cmd)
         return -1;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandFiltered(mon, cmd, qemuMonitorJSONQueryCPUsFilter,
+                                       &reply) < 0)
         goto cleanup;
 
     if (!(data = virJSONValueObjectGetArray(reply, "return"))) {
@@ -1982,6 +2034,34 @@ qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
 }
 
 
+/* Members of query-blockstats used by qemuMonitorJSONGetOneBlockStatsInfo.
+ * The "backing" member nests the same structure again, which can't be
+ * expressed by a path, so it's kept whole if the backing chain is
+ * requested. */
+#define QEMU_MONITOR_JSON_BLOCKSTATS_FILTER \
+    QEMU_MONITOR_JSON_FILTER_COMMON, \
+    "return/*/device", \
+    "return/*/stats/rd_bytes", \
+    "return/*/stats/wr_bytes", \
+    "return/*/stats/rd_operations", \
+    "return/*/stats/wr_operations", \
+    "return/*/stats/rd_total_time_ns", \
+    "return/*/stats/wr_total_time_ns", \
+    "return/*/stats/flush_operations", \
+    "return/*/stats/flush_total_time_ns", \
+    "return/*/parent/stats/wr_highest_offset"
+
+static const char *const qemuMonitorJSONBlockStatsFilter[] = {
+    QEMU_MONITOR_JSON_BLOCKSTATS_FILTER,
+    NULL
+};
+
+static const char *const qemuMonitorJSONBlockStatsBackingFilter[] = {
+    QEMU_MONITOR_JSON_BLOCKSTATS_FILTER,
+    "return/*/backing",
+    NULL
+};
+
 int
 qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
                                     virHashTablePtr hash,
@@ -1998,7 +2078,11 @@ qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
     if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
         return -1;
 
-    if ((rc = qemuMonitorJSONCommand(mon, cmd, &reply)) < 0)
+    if ((rc = qemuMonitorJSONCommandFiltered(mon, cmd,
+                                             backingChain ?
+                                             qemuMonitorJSONBlockStatsBackingFilter :
+                                             qemuMonitorJSONBlockStatsFilter,
+                                             &reply)) < 0)
         goto cleanup;
 
     if (qemuMonitorJSONCheckError(cmd, reply) < 0)
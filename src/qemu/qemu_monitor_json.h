@@ -37,7 +37,7 @@ int qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                                  qemuMonitorMessagePtr msg);
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg);
 
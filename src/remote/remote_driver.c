@@ -97,6 +97,7 @@ struct private_data {
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
     bool serverEventFilter;     /* Does server support modern event filtering */
     bool serverCloseCallback;   /* Does server support driver close callback */
+    bool serverStreamLargePacket; /* Does server support large stream packets */
 
     virObjectEventStatePtr eventState;
     virConnectCloseCallbackDataPtr closeCallback;
@@ -1159,6 +1160,13 @@ doRemoteOpen(virConnectPtr conn,
                  "by the remote side.");
     }
 
+    priv->serverStreamLargePacket = remoteConnectSupportsFeatureUnlocked(conn,
+                                        priv, VIR_DRV_FEATURE_REMOTE_STREAM_LARGE_PACKET);
+    if (!priv->serverStreamLargePacket) {
+        VIR_INFO("Large stream packets aren't supported "
+                 "by the remote side.");
+    }
+
     /* Successful. */
     retcode = VIR_DRV_OPEN_SUCCESS;
 
@@ -5390,6 +5398,12 @@ remoteStreamSend(virStreamPtr st,
 
     remoteDriverLock(priv);
     priv->localUses++;
+    /* Send no more than one packet's worth, the caller
+     * will come back with the rest */
+    if (priv->serverStreamLargePacket)
+        nbytes = MIN(nbytes, VIR_NET_MESSAGE_PAYLOAD_MAX);
+    else
+        nbytes = MIN(nbytes, VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX);
     remoteDriverUnlock(priv);
 
     rv = virNetClientStreamSendPacket(privst,
@@ -5406,15 +5420,19 @@ remoteStreamSend(virStreamPtr st,
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x",
+              st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (virNetClientStreamRaiseError(privst))
         return -1;
 
@@ -5426,7 +5444,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -5436,6 +5455,65 @@ remoteStreamRecv(virStreamPtr st,
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    priv->localUses++;
+    remoteDriverUnlock(priv);
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+    remoteDriverLock(priv);
+    priv->localUses--;
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv;
+
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+
+    if (virNetClientStreamRaiseError(privst))
+        return -1;
+
+    remoteDriverLock(priv);
+    rv = virNetClientStreamRecvHole(privst, length, flags);
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -5608,7 +5686,10 @@ remoteStreamAbort(virStreamPtr st)
 
 static virStreamDriver remoteStreamDrv = {
     .streamRecv = remoteStreamRecv,
+    .streamRecvFlags = remoteStreamRecvFlags,
     .streamSend = remoteStreamSend,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
     .streamFinish = remoteStreamFinish,
     .streamAbort = remoteStreamAbort,
     .streamEventAddCallback = remoteStreamEventAddCallback,
@@ -5924,7 +6005,8 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto done;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -6848,7 +6930,8 @@ remoteDomainMigratePrepareTunnel3Params(virConnectPtr dconn,
 
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3_PARAMS,
-                                        priv->counter)))
+                                        priv->counter,
+                                        false)))
         goto cleanup;
 
     if (virNetClientAddStream(priv->client, netst) < 0) {
@@ -3366,6 +3366,12 @@ enum remote_procedure {
      *   <paramnumber> specifies at which offset the stream parameter is inserted
      *   in the function parameter list.
      *
+     * - @sparseflag: <flagname>
+     *
+     *   Only valid together with @readstream or @writestream. If the
+     *   <flagname> is set in the flags parameter the stream is allowed
+     *   to carry holes (VIR_NET_STREAM_HOLE packets) on top of data.
+     *
      * - @priority: low|high
      *
      *   Each API that might eventually access hypervisor's monitor (and thus
@@ -4828,6 +4834,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @writestream: 1
+     * @sparseflag: VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_write
      */
     REMOTE_PROC_STORAGE_VOL_UPLOAD = 208,
@@ -4835,6 +4842,7 @@ enum remote_procedure {
     /**
      * @generate: both
      * @readstream: 1
+     * @sparseflag: VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM
      * @acl: storage_vol:data_read
      */
     REMOTE_PROC_STORAGE_VOL_DOWNLOAD = 209,
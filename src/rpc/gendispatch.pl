@@ -281,6 +281,8 @@ while (<PROTOCOL>) {
             $calls{$name}->{streamflag} = "none";
         }
 
+        $calls{$name}->{sparseflag} = $opts{sparseflag};
+
         $calls{$name}->{acl} = $opts{acl};
         $calls{$name}->{aclfilter} = $opts{aclfilter};
 
@@ -1024,7 +1026,13 @@ elsif ($mode eq "server") {
             print "    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))\n";
             print "        goto cleanup;\n";
             print "\n";
-            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header)))\n";
+            print "    if (!(stream = daemonCreateClientStream(client, st, remoteProgram, &msg->header, ";
+            if ($call->{sparseflag}) {
+                print "!!(args->flags & $call->{sparseflag})";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto cleanup;\n";
             print "\n";
         }
@@ -1738,7 +1746,13 @@ elsif ($mode eq "client") {
 
         if ($call->{streamflag} ne "none") {
             print "\n";
-            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter)))\n";
+            print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, $call->{constname}, priv->counter, ";
+            if ($call->{sparseflag}) {
+                print "!!(flags & $call->{sparseflag})";
+            } else {
+                print "false";
+            }
+            print ")))\n";
             print "        goto done;\n";
             print "\n";
             print "    if (virNetClientAddStream(priv->client, netst) < 0) {\n";
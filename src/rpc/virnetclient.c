@@ -82,6 +82,8 @@ struct _virNetClient {
 
     /* For incoming message packets */
     virNetMessage msg;
+    /* Buffers for msg and for outgoing calls */
+    virNetMessagePoolPtr msgPool;
 
 #if WITH_SASL
     virNetSASLSessionPtr sasl;
@@ -131,6 +133,9 @@ static int virNetClientOnceInit(void)
 
 VIR_ONCE_GLOBAL_INIT(virNetClient)
 
+/* Upper bound on idle message buffers kept around for reuse */
+#define VIR_NET_CLIENT_MESSAGE_POOL_MAX (1024 * 1024)
+
 static void virNetClientIOEventLoopPassTheBuck(virNetClientPtr client,
                                                virNetClientCallPtr thiscall);
 static int virNetClientQueueNonBlocking(virNetClientPtr client,
@@ -323,6 +328,10 @@ static virNetClientPtr virNetClientNew(virNetSocketPtr sock,
     if (VIR_STRDUP(client->hostname, hostname) < 0)
         goto error;
 
+    if (!(client->msgPool = virNetMessagePoolNew(VIR_NET_CLIENT_MESSAGE_POOL_MAX)))
+        goto error;
+    client->msg.pool = virObjectRef(client->msgPool);
+
     PROBE(RPC_CLIENT_NEW,
           "client=%p sock=%p",
           client, client->sock);
@@ -629,6 +638,8 @@ void virNetClientDispose(void *obj)
 #endif
 
     virNetMessageClear(&client->msg);
+    virObjectUnref(client->msg.pool);
+    virObjectUnref(client->msgPool);
 }
 
 
@@ -872,6 +883,15 @@ bool virNetClientIsEncrypted(virNetClientPtr client)
 }
 
 
+/*
+ * The pool lives as long as @client, so it doesn't get referenced
+ */
+virNetMessagePoolPtr virNetClientGetMessagePool(virNetClientPtr client)
+{
+    return client->msgPool;
+}
+
+
 bool virNetClientIsOpen(virNetClientPtr client)
 {
     bool ret;
@@ -987,7 +1007,7 @@ virNetClientCallDispatchReply(virNetClientPtr client)
         return -1;
     }
 
-    if (VIR_REALLOC_N(thecall->msg->buffer, client->msg.bufferLength) < 0)
+    if (virNetMessageResizeBuffer(thecall->msg, client->msg.bufferLength) < 0)
         return -1;
 
     memcpy(thecall->msg->buffer, client->msg.buffer, client->msg.bufferLength);
@@ -1065,7 +1085,8 @@ static int virNetClientCallDispatchStream(virNetClientPtr client)
     /* Status is either
      *   - VIR_NET_OK - no payload for streams
      *   - VIR_NET_ERROR - followed by a remote_error struct
-     *   - VIR_NET_CONTINUE - followed by a raw data packet
+     *   - VIR_NET_CONTINUE - followed by a raw data packet,
+     *                        or a virNetStreamHole for hole packets
      */
     switch (client->msg.header.status) {
     case VIR_NET_CONTINUE: {
@@ -1147,6 +1168,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1232,11 +1254,9 @@ virNetClientIOReadMessage(virNetClientPtr client)
     ssize_t ret;
 
     /* Start by reading length word */
-    if (client->msg.bufferLength == 0) {
-        client->msg.bufferLength = 4;
-        if (VIR_ALLOC_N(client->msg.buffer, client->msg.bufferLength) < 0)
-            return -ENOMEM;
-    }
+    if (client->msg.bufferLength == 0 &&
+        virNetMessageResizeBuffer(&client->msg, 4) < 0)
+        return -ENOMEM;
 
     wantData = client->msg.bufferLength - client->msg.bufferOffset;
 
@@ -121,6 +121,8 @@ int virNetClientSetTLSSession(virNetClientPtr client,
 bool virNetClientIsEncrypted(virNetClientPtr client);
 bool virNetClientIsOpen(virNetClientPtr client);
 
+virNetMessagePoolPtr virNetClientGetMessagePool(virNetClientPtr client);
+
 const char *virNetClientLocalAddrStringSASL(virNetClientPtr client);
 const char *virNetClientRemoteAddrStringSASL(virNetClientPtr client);
 
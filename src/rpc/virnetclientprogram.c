@@ -287,7 +287,8 @@ int virNetClientProgramCall(virNetClientProgramPtr prog,
     if (ninfds)
         *ninfds = 0;
 
-    if (!(msg = virNetMessageNew(false)))
+    if (!(msg = virNetMessageNewPooled(virNetClientGetMessagePool(client),
+                                       false)))
         return -1;
 
     msg->header.prog = prog->program;
@@ -52,6 +52,9 @@ struct _virNetClientStream {
     virNetMessagePtr rx;
     bool incomingEOF;
 
+    bool sparse;            /* Stream may carry holes */
+    long long holeLength;   /* Size of the hole at the head of rx */
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -86,7 +89,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer rx=%p cbEvents=%d", st->rx, st->cbEvents);
 
-    if (((st->rx || st->incomingEOF) &&
+    if (((st->rx || st->incomingEOF || st->holeLength) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -108,7 +111,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->rx || st->incomingEOF))
+        (st->rx || st->incomingEOF || st->holeLength))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -135,7 +138,8 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
 virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
-                                            unsigned serial)
+                                            unsigned serial,
+                                            bool sparse)
 {
     virNetClientStreamPtr st;
 
@@ -148,6 +152,7 @@ virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
     st->prog = prog;
     st->proc = proc;
     st->serial = serial;
+    st->sparse = sparse;
 
     virObjectRef(prog);
 
@@ -270,10 +275,16 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
 
     VIR_DEBUG("Incoming stream message: stream=%p message=%p", st, msg);
 
+    if (msg->header.type == VIR_NET_STREAM_HOLE && !st->sparse) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected stream hole"));
+        return -1;
+    }
+
     /* Unfortunately, we must allocate new message as the one we
      * get in @msg is going to be cleared later in the process. */
 
-    if (!(tmp_msg = virNetMessageNew(false)))
+    if (!(tmp_msg = virNetMessageNewPooled(msg->pool, false)))
         return -1;
 
     /* Copy header */
@@ -283,8 +294,9 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
     tmp_msg->buffer = msg->buffer;
     tmp_msg->bufferLength = msg->bufferLength;
     tmp_msg->bufferOffset = msg->bufferOffset;
+    tmp_msg->bufferSize = msg->bufferSize;
     msg->buffer = NULL;
-    msg->bufferLength = msg->bufferOffset = 0;
+    msg->bufferLength = msg->bufferOffset = msg->bufferSize = 0;
 
     virObjectLock(st);
 
@@ -350,19 +362,55 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
     return -1;
 }
 
+/*
+ * Pop the hole message at the head of the rx queue, adding its
+ * length to the pending hole.
+ */
+static int
+virNetClientStreamHandleHole(virNetClientStreamPtr st)
+{
+    virNetMessagePtr msg = st->rx;
+    virNetStreamHole data;
+
+    memset(&data, 0, sizeof(data));
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    if (data.length < 0 || data.flags != 0) {
+        virReportError(VIR_ERR_RPC,
+                       _("Malformed stream hole: length=%lld flags=%u"),
+                       (long long) data.length, data.flags);
+        return -1;
+    }
+
+    VIR_DEBUG("Got hole of %lld bytes", (long long) data.length);
+    st->holeLength += data.length;
+
+    virNetMessageQueueServe(&st->rx);
+    virNetMessageFree(msg);
+    return 0;
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
     size_t want;
 
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virObjectLock(st);
-    if (!st->rx && !st->incomingEOF) {
+    if (!st->rx && !st->incomingEOF && !st->holeLength) {
         virNetMessagePtr msg;
         int ret;
 
@@ -394,10 +442,39 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
 
     VIR_DEBUG("After IO rx=%p", st->rx);
     want = nbytes;
-    while (want && st->rx) {
+    while (want) {
         virNetMessagePtr msg = st->rx;
         size_t len = want;
 
+        if (st->holeLength) {
+            /* Stop right at the hole, handing out any data read
+             * up to it first */
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                if (want == nbytes) {
+                    rv = -3;
+                    goto cleanup;
+                }
+                break;
+            }
+
+            /* Caller doesn't care about holes, hand out zeroes */
+            if (len > st->holeLength)
+                len = st->holeLength;
+            memset(data + (nbytes - want), 0, len);
+            want -= len;
+            st->holeLength -= len;
+            continue;
+        }
+
+        if (!msg)
+            break;
+
+        if (msg->header.type == VIR_NET_STREAM_HOLE) {
+            if (virNetClientStreamHandleHole(st) < 0)
+                goto cleanup;
+            continue;
+        }
+
         if (len > msg->bufferLength - msg->bufferOffset)
             len = msg->bufferLength - msg->bufferOffset;
 
@@ -512,6 +589,97 @@ int virNetClientStreamEventRemoveCallback(virNetClientStreamPtr st)
     return ret;
 }
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg = NULL;
+    virNetStreamHole data;
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%lld", st, length);
+
+    if (!st->sparse) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Holes are not supported with this stream"));
+        return -1;
+    }
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virObjectLock(st);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virObjectUnlock(st);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto cleanup;
+
+    /* Like data packets, holes are fire&forget */
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+
+    virCheckFlags(0, -1);
+
+    virObjectLock(st);
+
+    if (!st->sparse) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Holes are not supported with this stream"));
+        goto cleanup;
+    }
+
+    while (st->rx && st->rx->header.type == VIR_NET_STREAM_HOLE) {
+        if (virNetClientStreamHandleHole(st) < 0)
+            goto cleanup;
+    }
+
+    *length = st->holeLength;
+    st->holeLength = 0;
+
+    virNetClientStreamEventTimerUpdate(st);
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnlock(st);
+    return ret;
+}
+
+
 bool virNetClientStreamEOF(virNetClientStreamPtr st)
 {
     return st->incomingEOF;
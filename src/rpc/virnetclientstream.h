@@ -34,7 +34,8 @@ typedef void (*virNetClientStreamEventCallback)(virNetClientStreamPtr stream,
 
 virNetClientStreamPtr virNetClientStreamNew(virNetClientProgramPtr prog,
                                             int proc,
-                                            unsigned serial);
+                                            unsigned serial,
+                                            bool sparse);
 
 bool virNetClientStreamRaiseError(virNetClientStreamPtr st);
 
@@ -57,7 +58,17 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock);
+                                 bool nonblock,
+                                 unsigned int flags);
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags);
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags);
 
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
@@ -35,6 +35,193 @@
 
 VIR_LOG_INIT("rpc.netmessage");
 
+/* Buffer sizes kept by virNetMessagePool. The larger ones are the
+ * steps virNetMessageEncodePayload grows a buffer by. */
+static const size_t virNetMessagePoolClassSize[] = {
+    4096,
+    VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX,
+    VIR_NET_MESSAGE_INITIAL * 4 + VIR_NET_MESSAGE_LEN_MAX,
+    VIR_NET_MESSAGE_INITIAL * 16 + VIR_NET_MESSAGE_LEN_MAX,
+};
+#define VIR_NET_MESSAGE_POOL_CLASSES ARRAY_CARDINALITY(virNetMessagePoolClassSize)
+
+struct _virNetMessagePool {
+    virObjectLockable parent;
+
+    unsigned long long hits;
+    unsigned long long misses;
+    size_t retained;
+    size_t maxRetained;
+
+    /* Free buffers of each size class, used as stacks */
+    char **buffers[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t nbuffers[VIR_NET_MESSAGE_POOL_CLASSES];
+    size_t maxbuffers[VIR_NET_MESSAGE_POOL_CLASSES];
+};
+
+static virClassPtr virNetMessagePoolClass;
+static void virNetMessagePoolDispose(void *obj);
+
+static int virNetMessageOnceInit(void)
+{
+    if (!(virNetMessagePoolClass = virClassNew(virClassForObjectLockable(),
+                                               "virNetMessagePool",
+                                               sizeof(virNetMessagePool),
+                                               virNetMessagePoolDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessage)
+
+
+/**
+ * virNetMessagePoolNew:
+ * @maxRetained: how many bytes of free buffers to keep at most
+ *
+ * Create a pool of message buffers. Messages created by
+ * virNetMessageNewPooled take their buffers from the pool and
+ * return them when they are cleared or freed.
+ *
+ * Returns the new pool, or NULL on error
+ */
+virNetMessagePoolPtr virNetMessagePoolNew(size_t maxRetained)
+{
+    virNetMessagePoolPtr pool;
+    size_t i;
+
+    if (virNetMessageInitialize() < 0)
+        return NULL;
+
+    if (!(pool = virObjectLockableNew(virNetMessagePoolClass)))
+        return NULL;
+
+    pool->maxRetained = maxRetained;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        pool->maxbuffers[i] = maxRetained / virNetMessagePoolClassSize[i];
+        if (VIR_ALLOC_N(pool->buffers[i], pool->maxbuffers[i]) < 0)
+            goto error;
+    }
+
+    return pool;
+
+ error:
+    virObjectUnref(pool);
+    return NULL;
+}
+
+
+static void virNetMessagePoolDispose(void *obj)
+{
+    virNetMessagePoolPtr pool = obj;
+    size_t i, j;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        for (j = 0; j < pool->nbuffers[i]; j++)
+            VIR_FREE(pool->buffers[i][j]);
+        VIR_FREE(pool->buffers[i]);
+    }
+}
+
+
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               unsigned long long *hits,
+                               unsigned long long *misses,
+                               unsigned long long *retained,
+                               unsigned long long *maxRetained)
+{
+    virObjectLock(pool);
+    if (hits)
+        *hits = pool->hits;
+    if (misses)
+        *misses = pool->misses;
+    if (retained)
+        *retained = pool->retained;
+    if (maxRetained)
+        *maxRetained = pool->maxRetained;
+    virObjectUnlock(pool);
+}
+
+
+/*
+ * Get a buffer of at least @len bytes, storing its actual
+ * size in @size. Requests bigger than the largest size class
+ * are allocated exactly and don't count as misses.
+ */
+static char *virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                                  size_t len,
+                                  size_t *size)
+{
+    char *buf = NULL;
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+        if (virNetMessagePoolClassSize[i] >= len)
+            break;
+    }
+
+    if (i == VIR_NET_MESSAGE_POOL_CLASSES) {
+        if (VIR_ALLOC_N(buf, len) < 0)
+            return NULL;
+        *size = len;
+        return buf;
+    }
+
+    virObjectLock(pool);
+    if (pool->nbuffers[i] > 0) {
+        buf = pool->buffers[i][--pool->nbuffers[i]];
+        pool->retained -= virNetMessagePoolClassSize[i];
+        pool->hits++;
+    } else {
+        pool->misses++;
+    }
+    virObjectUnlock(pool);
+
+    if (!buf && VIR_ALLOC_N(buf, virNetMessagePoolClassSize[i]) < 0)
+        return NULL;
+
+    *size = virNetMessagePoolClassSize[i];
+    return buf;
+}
+
+
+/*
+ * Give @buf back to @pool, or free it if it doesn't belong to
+ * any size class or the pool is full already.
+ */
+static void virNetMessagePoolPut(virNetMessagePoolPtr pool,
+                                 char *buf,
+                                 size_t size)
+{
+    size_t i;
+
+    if (!buf)
+        return;
+
+    if (pool) {
+        for (i = 0; i < VIR_NET_MESSAGE_POOL_CLASSES; i++) {
+            if (virNetMessagePoolClassSize[i] == size)
+                break;
+        }
+
+        if (i < VIR_NET_MESSAGE_POOL_CLASSES) {
+            virObjectLock(pool);
+            if (pool->nbuffers[i] < pool->maxbuffers[i] &&
+                pool->retained + size <= pool->maxRetained) {
+                pool->buffers[i][pool->nbuffers[i]++] = buf;
+                pool->retained += size;
+                buf = NULL;
+            }
+            virObjectUnlock(pool);
+        }
+    }
+
+    VIR_FREE(buf);
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -49,6 +236,70 @@ virNetMessagePtr virNetMessageNew(bool tracked)
 }
 
 
+/**
+ * virNetMessageNewPooled:
+ * @pool: pool to take buffers from, may be NULL
+ * @tracked: whether the message counts against the client's requests
+ *
+ * Like virNetMessageNew, but the message buffer comes from @pool
+ * and goes back there once the message is cleared or freed.
+ */
+virNetMessagePtr virNetMessageNewPooled(virNetMessagePoolPtr pool,
+                                        bool tracked)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(tracked)))
+        return NULL;
+
+    msg->pool = virObjectRef(pool);
+    return msg;
+}
+
+
+/**
+ * virNetMessageResizeBuffer:
+ * @msg: the message
+ * @len: the new buffer length
+ *
+ * Make msg->buffer hold at least @len bytes and set bufferLength
+ * to @len. Existing data up to the old bufferLength is kept.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virNetMessageResizeBuffer(virNetMessagePtr msg,
+                              size_t len)
+{
+    char *buf;
+    size_t size;
+
+    if (len <= msg->bufferSize) {
+        msg->bufferLength = len;
+        return 0;
+    }
+
+    if (!msg->pool) {
+        if (VIR_REALLOC_N(msg->buffer, len) < 0)
+            return -1;
+        msg->bufferLength = msg->bufferSize = len;
+        return 0;
+    }
+
+    if (!(buf = virNetMessagePoolGet(msg->pool, len, &size)))
+        return -1;
+
+    if (msg->buffer) {
+        memcpy(buf, msg->buffer, MIN(msg->bufferLength, len));
+        virNetMessagePoolPut(msg->pool, msg->buffer, msg->bufferSize);
+    }
+
+    msg->buffer = buf;
+    msg->bufferSize = size;
+    msg->bufferLength = len;
+    return 0;
+}
+
+
 void
 virNetMessageClearPayload(virNetMessagePtr msg)
 {
@@ -61,21 +312,28 @@ virNetMessageClearPayload(virNetMessagePtr msg)
     msg->nfds = 0;
     VIR_FREE(msg->fds);
 
+    msg->spliceLength = 0;
+    msg->spliceOffset = 0;
+
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
-    VIR_FREE(msg->buffer);
+    virNetMessagePoolPut(msg->pool, msg->buffer, msg->bufferSize);
+    msg->buffer = NULL;
+    msg->bufferSize = 0;
 }
 
 
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
+    virNetMessagePoolPtr pool = msg->pool;
 
     VIR_DEBUG("msg=%p nfds=%zu", msg, msg->nfds);
 
     virNetMessageClearPayload(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
+    msg->pool = pool;
 }
 
 
@@ -90,6 +348,7 @@ void virNetMessageFree(virNetMessagePtr msg)
         msg->cb(msg, msg->opaque);
 
     virNetMessageClearPayload(msg);
+    virObjectUnref(msg->pool);
     VIR_FREE(msg);
 }
 
@@ -153,8 +412,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
 
     /* Extend our declared buffer length and carry
        on reading the header + payload */
-    msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength + len) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -230,8 +488,8 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageResizeBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                  VIR_NET_MESSAGE_LEN_MAX) < 0)
         return ret;
     msg->bufferOffset = 0;
 
@@ -343,6 +601,31 @@ int virNetMessageDecodeNumFDs(virNetMessagePtr msg)
 }
 
 
+/*
+ * Work out how long the buffer of @msg needs to be for the payload
+ * produced by @filter, which didn't fit into the current one. Where
+ * the XDR library can size a payload without encoding it, the result
+ * is exact, so the payload gets encoded only once more no matter how
+ * large it is. Otherwise fall back to growing the buffer 4 times.
+ */
+static size_t virNetMessagePayloadBufferLength(virNetMessagePtr msg,
+                                               xdrproc_t filter,
+                                               void *data)
+{
+#ifdef HAVE_XDR_SIZEOF
+    unsigned long len = xdr_sizeof(filter, data);
+
+    if (len > 0) {
+        VIR_DEBUG("Payload needs %lu bytes", len);
+        return msg->bufferOffset + len;
+    }
+#endif
+
+    return (msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX) * 4 +
+        VIR_NET_MESSAGE_LEN_MAX;
+}
+
+
 int virNetMessageEncodePayload(virNetMessagePtr msg,
                                xdrproc_t filter,
                                void *data)
@@ -358,18 +641,19 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
     /* Try to encode the payload. If the buffer is too small increase it. */
     while (!(*filter)(&xdr, data, 0)) {
-        unsigned int newlen = (msg->bufferLength - VIR_NET_MESSAGE_LEN_MAX) * 4;
+        size_t newlen = virNetMessagePayloadBufferLength(msg, filter, data);
 
-        if (newlen > VIR_NET_MESSAGE_MAX) {
+        /* A buffer which already has the size the payload needs
+         * means the failure wasn't about space */
+        if (newlen <= msg->bufferLength ||
+            newlen - VIR_NET_MESSAGE_LEN_MAX > VIR_NET_MESSAGE_MAX) {
             virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
             goto error;
         }
 
         xdr_destroy(&xdr);
 
-        msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, newlen) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -451,9 +735,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
             return -1;
         }
 
-        msg->bufferLength = msg->bufferOffset + len;
-
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, msg->bufferOffset + len) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
@@ -482,6 +764,54 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 }
 
 
+/*
+ * Like virNetMessageEncodePayloadRaw, except that the @len bytes of
+ * payload are not copied into the buffer: they must be waiting in
+ * the pipe @fd by the time the message is transmitted, and are
+ * spliced straight from there into the socket.
+ */
+int virNetMessageEncodePayloadSplice(virNetMessagePtr msg,
+                                     int fd,
+                                     size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if ((msg->bufferOffset + len) >
+        (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)) {
+        virReportError(VIR_ERR_RPC,
+                       _("Stream data too long to send "
+                         "(%zu bytes needed, %zu bytes available)"),
+                       len,
+                       VIR_NET_MESSAGE_MAX +
+                       VIR_NET_MESSAGE_LEN_MAX -
+                       msg->bufferOffset);
+        return -1;
+    }
+
+    /* The length word covers the payload left in the pipe too */
+    VIR_DEBUG("Encode length as %zu", msg->bufferOffset + len);
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virReportError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    msg->spliceFD = fd;
+    msg->spliceLength = len;
+    msg->spliceOffset = 0;
+    return 0;
+
+ error:
+    xdr_destroy(&xdr);
+    return -1;
+}
+
+
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
 {
     XDR xdr;
@@ -22,6 +22,7 @@
 # define __VIR_NET_MESSAGE_H__
 
 # include "virnetprotocol.h"
+# include "virobject.h"
 
 typedef struct virNetMessageHeader *virNetMessageHeaderPtr;
 typedef struct virNetMessageError *virNetMessageErrorPtr;
@@ -29,6 +30,9 @@ typedef struct virNetMessageError *virNetMessageErrorPtr;
 typedef struct _virNetMessage virNetMessage;
 typedef virNetMessage *virNetMessagePtr;
 
+typedef struct _virNetMessagePool virNetMessagePool;
+typedef virNetMessagePool *virNetMessagePoolPtr;
+
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
 struct _virNetMessage {
@@ -38,6 +42,10 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferSize; /* Allocated size of buffer, may be 0 if unknown */
+
+    /* Where to take buffers from and return them to, may be NULL */
+    virNetMessagePoolPtr pool;
 
     virNetMessageHeader header;
 
@@ -48,11 +56,31 @@ struct _virNetMessage {
     int *fds;
     size_t donefds;
 
+    /* Payload that follows the buffer on the wire, but is still
+     * waiting in the pipe @spliceFD, which the message does not own */
+    int spliceFD;
+    size_t spliceLength;
+    size_t spliceOffset;
+
     virNetMessagePtr next;
 };
 
 
+virNetMessagePoolPtr virNetMessagePoolNew(size_t maxRetained);
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               unsigned long long *hits,
+                               unsigned long long *misses,
+                               unsigned long long *retained,
+                               unsigned long long *maxRetained)
+    ATTRIBUTE_NONNULL(1);
+
 virNetMessagePtr virNetMessageNew(bool tracked);
+virNetMessagePtr virNetMessageNewPooled(virNetMessagePoolPtr pool,
+                                        bool tracked);
+
+int virNetMessageResizeBuffer(virNetMessagePtr msg,
+                              size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
 void virNetMessageClearPayload(virNetMessagePtr msg);
 
@@ -89,6 +117,10 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
                                   const char *buf,
                                   size_t len)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadSplice(virNetMessagePtr msg,
+                                     int fd,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
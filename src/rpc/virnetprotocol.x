@@ -89,6 +89,9 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -108,6 +111,9 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *         server message: stream had an error
  *         client message: client aborted the stream
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -132,6 +138,10 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_OK
  *          <empty>
  *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * status == VIR_NET_CONTINUE
+ *          virNetStreamHole  length of the hole
+ *
  *  - type == VIR_NET_CALL_WITH_FDS
  *          int8 - number of FDs
  *          XXX_args  for procedure
@@ -156,7 +166,11 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* either direction. stream hole packet, only ever sent for streams
+     * set up with a flag asking for a sparse stream, so peers which
+     * don't know it never see one */
+    VIR_NET_STREAM_HOLE = 6
 };
 
 enum virNetMessageStatus {
@@ -217,6 +231,12 @@ struct virNetMessageNonnullNetwork {
 typedef virNetMessageNonnullDomain *virNetMessageDomain;
 typedef virNetMessageNonnullNetwork *virNetMessageNetwork;
 
+/* Payload of VIR_NET_STREAM_HOLE */
+struct virNetStreamHole {
+    hyper length;
+    unsigned int flags;
+};
+
 /* NB. Fields "code", "domain" and "level" are really enums.  The
  * numeric value should remain compatible between libvirt and
  * libvirtd.  This means, no changing or reordering the enums as
@@ -36,6 +36,9 @@
 
 VIR_LOG_INIT("rpc.netserver");
 
+/* Upper bound on idle message buffers kept around for reuse */
+#define VIR_NET_SERVER_MESSAGE_POOL_MAX (16 * 1024 * 1024)
+
 
 typedef struct _virNetServerJob virNetServerJob;
 typedef virNetServerJob *virNetServerJobPtr;
@@ -73,6 +76,8 @@ struct _virNetServer {
     int keepaliveInterval;
     unsigned int keepaliveCount;
 
+    virNetMessagePoolPtr msgPool;       /* Buffers for all clients */
+
 #ifdef WITH_GNUTLS
     virNetTLSContextPtr tls;
 #endif
@@ -295,6 +300,7 @@ int virNetServerAddClient(virNetServerPtr srv,
     virNetServerClientSetDispatcher(client,
                                     virNetServerDispatchNewMessage,
                                     srv);
+    virNetServerClientSetMessagePool(client, srv->msgPool);
 
     virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
                                     srv->keepaliveCount);
@@ -371,6 +377,9 @@ virNetServerPtr virNetServerNew(const char *name,
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
+    if (!(srv->msgPool = virNetMessagePoolNew(VIR_NET_SERVER_MESSAGE_POOL_MAX)))
+        goto error;
+
     srv->next_client_id = next_client_id;
     srv->nclients_max = max_clients;
     srv->nclients_unauth_max = max_anonymous_clients;
@@ -783,6 +792,8 @@ void virNetServerDispose(void *obj)
     }
     VIR_FREE(srv->clients);
 
+    virObjectUnref(srv->msgPool);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
@@ -984,6 +995,15 @@ virNetServerGetCurrentUnauthClients(virNetServerPtr srv)
     return ret;
 }
 
+/*
+ * The pool lives as long as @srv, so it doesn't get referenced
+ */
+virNetMessagePoolPtr
+virNetServerGetMessagePool(virNetServerPtr srv)
+{
+    return srv->msgPool;
+}
+
 int
 virNetServerGetClients(virNetServerPtr srv,
                        virNetServerClientPtr **clts)
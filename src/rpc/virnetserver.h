@@ -116,6 +116,8 @@ size_t virNetServerGetCurrentClients(virNetServerPtr srv);
 size_t virNetServerGetMaxUnauthClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentUnauthClients(virNetServerPtr srv);
 
+virNetMessagePoolPtr virNetServerGetMessagePool(virNetServerPtr srv);
+
 int virNetServerSetClientLimits(virNetServerPtr srv,
                                 long long int maxClients,
                                 long long int maxClientsUnauth);
@@ -44,6 +44,11 @@
 
 VIR_LOG_INIT("rpc.netserverclient");
 
+/* Limits on how much of the tx queue is handed to
+ * the socket in a single write */
+#define VIR_NET_SERVER_CLIENT_TX_IOV_MAX 64
+#define VIR_NET_SERVER_CLIENT_TX_BYTES_MAX (256 * 1024)
+
 /* Allow for filtering of incoming messages to a custom
  * dispatch processing queue, instead of the workers.
  * This allows for certain types of messages to be handled
@@ -102,6 +107,9 @@ struct _virNetServerClient
     /* Zero or one messages being received. Zero if
      * nrequests >= max_clients and throttling */
     virNetMessagePtr rx;
+    /* Buffers for incoming calls and their replies, shared
+     * with the other clients of the server. May be NULL */
+    virNetMessagePoolPtr msgPool;
     /* Zero or many messages waiting for transmit
      * back to client, including async events */
     virNetMessagePtr tx;
@@ -301,6 +309,25 @@ void virNetServerClientRemoveFilter(virNetServerClientPtr client,
     virObjectUnlock(client);
 }
 
+/*
+ * @client: a locked client object
+ * @msg: a message handed to a filter
+ *
+ * Stop counting @msg against the client's request limit, so that
+ * more messages can be read while the filter keeps hold of @msg.
+ * Only to be called from within a filter, which must itself bound
+ * how many messages it takes over like this.
+ */
+void virNetServerClientUntrackMessage(virNetServerClientPtr client,
+                                      virNetMessagePtr msg)
+{
+    if (!msg->tracked)
+        return;
+
+    msg->tracked = false;
+    client->nrequests--;
+}
+
 
 #ifdef WITH_GNUTLS
 /* Check the client's access. */
@@ -325,8 +352,7 @@ virNetServerClientCheckAccess(virNetServerClientPtr client)
      * indicate this (otherwise the socket is abruptly closed).
      * (NB. The '\1' byte is sent in an encrypted record).
      */
-    confirm->bufferLength = 1;
-    if (VIR_ALLOC_N(confirm->buffer, confirm->bufferLength) < 0) {
+    if (virNetMessageResizeBuffer(confirm, 1) < 0) {
         virNetMessageFree(confirm);
         return -1;
     }
@@ -389,10 +415,8 @@ virNetServerClientNewInternal(unsigned long long id,
         goto error;
 
     /* Prepare one for packet receive */
-    if (!(client->rx = virNetMessageNew(true)))
-        goto error;
-    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (!(client->rx = virNetMessageNew(true)) ||
+        virNetMessageResizeBuffer(client->rx, VIR_NET_MESSAGE_LEN_MAX) < 0)
         goto error;
     client->nrequests = 1;
 
@@ -690,6 +714,29 @@ int virNetServerClientGetFD(virNetServerClientPtr client)
 }
 
 
+/*
+ * Whether messages queued for this client may carry payload to be
+ * spliced into the socket, see virNetMessageEncodePayloadSplice
+ */
+bool virNetServerClientCanSplice(virNetServerClientPtr client)
+{
+    bool canSplice = false;
+    virObjectLock(client);
+    if (client->sock)
+        canSplice = virNetSocketCanSplice(client->sock);
+#if WITH_GNUTLS
+    if (client->tls)
+        canSplice = false;
+#endif
+#if WITH_SASL
+    if (client->sasl)
+        canSplice = false;
+#endif
+    virObjectUnlock(client);
+    return canSplice;
+}
+
+
 bool virNetServerClientIsLocal(virNetServerClientPtr client)
 {
     bool local = false;
@@ -903,6 +950,22 @@ void virNetServerClientSetDispatcher(virNetServerClientPtr client,
 }
 
 
+/*
+ * Take buffers for incoming calls, and thus for the replies to
+ * them, from @pool
+ */
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool)
+{
+    virObjectLock(client);
+    virObjectUnref(client->msgPool);
+    client->msgPool = virObjectRef(pool);
+    if (client->rx && !client->rx->pool)
+        client->rx->pool = virObjectRef(pool);
+    virObjectUnlock(client);
+}
+
+
 const char *virNetServerClientLocalAddrStringSASL(virNetServerClientPtr client)
 {
     if (!client->sock)
@@ -948,6 +1011,7 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tlsCtxt);
 #endif
     virObjectUnref(client->sock);
+    virObjectUnref(client->msgPool);
 }
 
 
@@ -1275,12 +1339,11 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetMessageNewPooled(client->msgPool, true))) {
                 client->wantClose = true;
             } else {
-                client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
+                if (virNetMessageResizeBuffer(client->rx,
+                                              VIR_NET_MESSAGE_LEN_MAX) < 0) {
                     client->wantClose = true;
                 } else {
                     client->nrequests++;
@@ -1288,12 +1351,19 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
             }
         }
         virNetServerClientUpdateEvent(client);
+
+        /* Further pipelined messages may already be buffered in the
+         * socket, so deal with them without going back into poll() */
+        if (client->rx && !client->wantClose &&
+            virNetSocketHasCachedData(client->sock))
+            goto readmore;
     }
 }
 
 
 /*
- * Send client->tx using no encoding
+ * Send as much of the client->tx queue as the socket
+ * takes in one go, using no encoding
  *
  * Returns:
  *   -1 on error or EOF
@@ -1302,7 +1372,12 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
  */
 static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
 {
+    struct iovec iov[VIR_NET_SERVER_CLIENT_TX_IOV_MAX];
+    size_t niov = 0;
+    size_t total = 0;
+    virNetMessagePtr msg;
     ssize_t ret;
+    size_t done;
 
     if (client->tx->bufferLength < client->tx->bufferOffset) {
         virReportError(VIR_ERR_RPC,
@@ -1315,13 +1390,45 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
     if (client->tx->bufferLength == client->tx->bufferOffset)
         return 1;
 
-    ret = virNetSocketWrite(client->sock,
-                            client->tx->buffer + client->tx->bufferOffset,
-                            client->tx->bufferLength - client->tx->bufferOffset);
+    for (msg = client->tx;
+         msg && niov < VIR_NET_SERVER_CLIENT_TX_IOV_MAX &&
+         total < VIR_NET_SERVER_CLIENT_TX_BYTES_MAX;
+         msg = msg->next) {
+        if (msg->bufferLength <= msg->bufferOffset)
+            break;
+
+        iov[niov].iov_base = msg->buffer + msg->bufferOffset;
+        iov[niov].iov_len = msg->bufferLength - msg->bufferOffset;
+        total += iov[niov].iov_len;
+        niov++;
+
+        /* The FDs and spliced payload have to follow the data of
+         * their own message and a pending SASL session must be
+         * enabled as soon as the current message is out, so stop
+         * gathering here */
+        if (msg->nfds || msg->spliceLength)
+            break;
+#if WITH_SASL
+        if (client->sasl)
+            break;
+#endif
+    }
+
+    ret = virNetSocketWritev(client->sock, iov, niov);
     if (ret <= 0)
         return ret; /* -1 error, 0 = egain */
 
-    client->tx->bufferOffset += ret;
+    /* Account the written bytes to the messages they came from */
+    done = ret;
+    for (msg = client->tx; msg && done > 0; msg = msg->next) {
+        size_t len = msg->bufferLength - msg->bufferOffset;
+
+        if (len > done)
+            len = done;
+        msg->bufferOffset += len;
+        done -= len;
+    }
+
     return ret;
 }
 
@@ -1349,6 +1456,21 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             virNetMessagePtr msg;
             size_t i;
 
+            while (client->tx->spliceOffset < client->tx->spliceLength) {
+                ssize_t rv;
+                rv = virNetSocketSplice(client->sock,
+                                        client->tx->spliceFD,
+                                        client->tx->spliceLength -
+                                        client->tx->spliceOffset);
+                if (rv < 0) {
+                    client->wantClose = true;
+                    return;
+                }
+                if (rv == 0) /* Blocking */
+                    return;
+                client->tx->spliceOffset += rv;
+            }
+
             for (i = client->tx->donefds; i < client->tx->nfds; i++) {
                 int rv;
                 if ((rv = virNetSocketSendFD(client->sock, client->tx->fds[i])) < 0) {
@@ -1381,8 +1503,8 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     client->nrequests < client->nrequests_max) {
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
-                    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    if (virNetMessageResizeBuffer(msg,
+                                                  VIR_NET_MESSAGE_LEN_MAX) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
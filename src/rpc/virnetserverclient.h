@@ -78,6 +78,9 @@ int virNetServerClientAddFilter(virNetServerClientPtr client,
 void virNetServerClientRemoveFilter(virNetServerClientPtr client,
                                     int filterID);
 
+void virNetServerClientUntrackMessage(virNetServerClientPtr client,
+                                      virNetMessagePtr msg);
+
 int virNetServerClientGetAuth(virNetServerClientPtr client);
 void virNetServerClientSetAuth(virNetServerClientPtr client, int auth);
 bool virNetServerClientGetReadonly(virNetServerClientPtr client);
@@ -102,6 +105,7 @@ int virNetServerClientGetFD(virNetServerClientPtr client);
 bool virNetServerClientIsSecure(virNetServerClientPtr client);
 
 bool virNetServerClientIsLocal(virNetServerClientPtr client);
+bool virNetServerClientCanSplice(virNetServerClientPtr client);
 
 int virNetServerClientGetUNIXIdentity(virNetServerClientPtr client,
                                       uid_t *uid, gid_t *gid, pid_t *pid,
@@ -122,6 +126,8 @@ void virNetServerClientSetCloseHook(virNetServerClientPtr client,
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool);
 void virNetServerClientClose(virNetServerClientPtr client);
 bool virNetServerClientIsClosed(virNetServerClientPtr client);
 
@@ -207,7 +207,9 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
                                         msg,
                                         rerr,
                                         req->proc,
-                                        req->type == VIR_NET_STREAM ? VIR_NET_STREAM : VIR_NET_REPLY,
+                                        (req->type == VIR_NET_STREAM ||
+                                         req->type == VIR_NET_STREAM_HOLE) ?
+                                        VIR_NET_STREAM : VIR_NET_REPLY,
                                         req->serial);
 }
 
@@ -308,6 +310,7 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -548,6 +551,73 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
+/*
+ * Sends @len bytes of stream data which the caller has already put
+ * into the pipe @fd. The client must support splicing, see
+ * virNetServerClientCanSplice.
+ */
+int virNetServerProgramSendStreamSplice(virNetServerProgramPtr prog,
+                                        virNetServerClientPtr client,
+                                        virNetMessagePtr msg,
+                                        int procedure,
+                                        unsigned int serial,
+                                        int fd,
+                                        size_t len)
+{
+    VIR_DEBUG("client=%p msg=%p fd=%d len=%zu", client, msg, fd, len);
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayloadSplice(msg, fd, len) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      unsigned int serial,
+                                      long long length,
+                                      unsigned int flags)
+{
+    virNetStreamHole data;
+
+    VIR_DEBUG("client=%p msg=%p length=%lld", client, msg, length);
+
+    memset(&data, 0, sizeof(data));
+    data.length = length;
+    data.flags = flags;
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(msg,
+                                   (xdrproc_t) xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
 void virNetServerProgramDispose(void *obj ATTRIBUTE_UNUSED)
 {
 }
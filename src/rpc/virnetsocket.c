@@ -29,6 +29,7 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <limits.h>
 #ifdef HAVE_IFADDRS_H
 # include <ifaddrs.h>
 #endif
@@ -69,6 +70,14 @@
 
 VIR_LOG_INIT("rpc.netsocket");
 
+/* Maximum amount of plain text in one TLS record */
+#define VIR_NET_SOCKET_TLS_RECORD_MAX 16384
+
+/* Reads shorter than this are done into a per socket buffer, so the
+ * length word and body of a message, or several pipelined messages,
+ * are picked up by a single syscall */
+#define VIR_NET_SOCKET_READ_AHEAD 32768
+
 struct _virNetSocket {
     virObjectLockable parent;
 
@@ -89,8 +98,22 @@ struct _virNetSocket {
     char *remoteAddrStrSASL;
     char *remoteAddrStrURI;
 
+    /* Data read off the wire, but not consumed yet */
+    char *readAhead;
+    size_t readAheadLength;
+    size_t readAheadOffset;
+    /* File descriptors that arrived with the read-ahead data */
+    int *readAheadFDs;
+    size_t nreadAheadFDs;
+
 #if WITH_GNUTLS
     virNetTLSSessionPtr tlsSession;
+
+    /* Small buffers passed to virNetSocketWritev are gathered
+     * here so that they go out in a single TLS record */
+    char *tlsCoalesced;
+    size_t tlsCoalescedLength;
+    size_t tlsCoalescedOffset;
 #endif
 #if WITH_SASL
     virNetSASLSessionPtr saslSession;
@@ -1128,6 +1151,12 @@ virJSONValuePtr virNetSocketPreExecRestart(virNetSocketPtr sock)
         goto error;
     }
 #endif
+    if (sock->readAheadOffset < sock->readAheadLength ||
+        sock->nreadAheadFDs) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("Unable to save socket state when unread data is buffered"));
+        goto error;
+    }
 
     if (!(object = virJSONValueNewObject()))
         goto error;
@@ -1171,6 +1200,7 @@ virJSONValuePtr virNetSocketPreExecRestart(virNetSocketPtr sock)
 void virNetSocketDispose(void *obj)
 {
     virNetSocketPtr sock = obj;
+    size_t i;
 
     PROBE(RPC_SOCKET_DISPOSE,
           "sock=%p", sock);
@@ -1193,6 +1223,7 @@ void virNetSocketDispose(void *obj)
     if (sock->tlsSession)
         virNetTLSSessionSetIOCallbacks(sock->tlsSession, NULL, NULL, NULL);
     virObjectUnref(sock->tlsSession);
+    VIR_FREE(sock->tlsCoalesced);
 #endif
 #if WITH_SASL
     virObjectUnref(sock->saslSession);
@@ -1210,6 +1241,11 @@ void virNetSocketDispose(void *obj)
     VIR_FREE(sock->localAddrStrSASL);
     VIR_FREE(sock->remoteAddrStrSASL);
     VIR_FREE(sock->remoteAddrStrURI);
+
+    VIR_FREE(sock->readAhead);
+    for (i = 0; i < sock->nreadAheadFDs; i++)
+        VIR_FORCE_CLOSE(sock->readAheadFDs[i]);
+    VIR_FREE(sock->readAheadFDs);
 }
 
 
@@ -1476,6 +1512,118 @@ const char *virNetSocketRemoteAddrStringURI(virNetSocketPtr sock)
     return sock->remoteAddrStrURI;
 }
 
+/*
+ * Read everything the socket has got, up to the size of the
+ * read-ahead buffer. Behaves like read().
+ */
+static ssize_t virNetSocketFillReadAhead(virNetSocketPtr sock)
+{
+    ssize_t ret;
+
+    if (!sock->readAhead &&
+        VIR_ALLOC_N_QUIET(sock->readAhead, VIR_NET_SOCKET_READ_AHEAD) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+#ifdef __linux__
+    if (sock->localAddr.data.sa.sa_family == AF_UNIX) {
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg;
+        struct iovec iov;
+        struct cmsghdr *cmsg;
+        bool gotFD;
+
+ retry:
+        gotFD = false;
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = sock->readAhead;
+        iov.iov_len = VIR_NET_SOCKET_READ_AHEAD;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if ((ret = recvmsg(sock->fd, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+            return ret;
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            int fd;
+
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_RIGHTS ||
+                cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+                continue;
+
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+            if (VIR_APPEND_ELEMENT_QUIET(sock->readAheadFDs,
+                                         sock->nreadAheadFDs, fd) < 0) {
+                VIR_FORCE_CLOSE(fd);
+                errno = ENOMEM;
+                return -1;
+            }
+            gotFD = true;
+        }
+
+        /* Every descriptor comes with one byte of dummy data, see
+         * sendfd(). The kernel doesn't read past that byte in the
+         * same call, so it is the last one we got. */
+        if (gotFD && --ret == 0)
+            goto retry;
+    } else {
+        ret = read(sock->fd, sock->readAhead, VIR_NET_SOCKET_READ_AHEAD);
+    }
+#else /* !__linux__ */
+    ret = read(sock->fd, sock->readAhead, VIR_NET_SOCKET_READ_AHEAD);
+#endif /* !__linux__ */
+
+    if (ret <= 0)
+        return ret;
+
+    sock->readAheadLength = ret;
+    sock->readAheadOffset = 0;
+    return ret;
+}
+
+
+/*
+ * Read from the socket, going through the read-ahead buffer
+ * where possible. Behaves like read().
+ */
+static ssize_t virNetSocketReadRaw(virNetSocketPtr sock, char *buf, size_t len)
+{
+    size_t avail = sock->readAheadLength - sock->readAheadOffset;
+
+    if (avail == 0) {
+        ssize_t got;
+
+        /* Where the kernel semantics for descriptors sent along with
+         * the data are unknown, a read must never go past the end of
+         * the message the caller asked for */
+#ifndef __linux__
+        if (sock->localAddr.data.sa.sa_family == AF_UNIX)
+            return read(sock->fd, buf, len);
+#endif
+        if (len >= VIR_NET_SOCKET_READ_AHEAD)
+            return read(sock->fd, buf, len);
+
+        if ((got = virNetSocketFillReadAhead(sock)) <= 0)
+            return got;
+        avail = got;
+    }
+
+    if (len > avail)
+        len = avail;
+
+    memcpy(buf, sock->readAhead + sock->readAheadOffset, len);
+    sock->readAheadOffset += len;
+    if (sock->readAheadOffset == sock->readAheadLength)
+        sock->readAheadOffset = sock->readAheadLength = 0;
+
+    return len;
+}
+
+
 #if WITH_GNUTLS
 static ssize_t virNetSocketTLSSessionWrite(const char *buf,
                                            size_t len,
@@ -1491,7 +1639,7 @@ static ssize_t virNetSocketTLSSessionRead(char *buf,
                                           void *opaque)
 {
     virNetSocketPtr sock = opaque;
-    return read(sock->fd, buf, len);
+    return virNetSocketReadRaw(sock, buf, len);
 }
 
 
@@ -1535,6 +1683,10 @@ bool virNetSocketHasCachedData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
     if (sock->saslDecoded)
         hasCached = true;
 #endif
+
+    if (sock->readAheadOffset < sock->readAheadLength)
+        hasCached = true;
+
     virObjectUnlock(sock);
     return hasCached;
 }
@@ -1562,6 +1714,10 @@ bool virNetSocketHasPendingData(virNetSocketPtr sock ATTRIBUTE_UNUSED)
 #if WITH_SASL
     if (sock->saslEncoded)
         hasPending = true;
+#endif
+#if WITH_GNUTLS
+    if (sock->tlsCoalescedLength)
+        hasPending = true;
 #endif
     virObjectUnlock(sock);
     return hasPending;
@@ -1586,7 +1742,7 @@ static ssize_t virNetSocketReadWire(virNetSocketPtr sock, char *buf, size_t len)
         ret = virNetTLSSessionRead(sock->tlsSession, buf, len);
     } else {
 #endif
-        ret = read(sock->fd, buf, len);
+        ret = virNetSocketReadRaw(sock, buf, len);
 #if WITH_GNUTLS
     }
 #endif
@@ -1797,6 +1953,223 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+#if WITH_GNUTLS
+/*
+ * Copy as much of @iov as fits into one TLS record and send it.
+ * If the record can't be sent completely, the data stays in
+ * sock->tlsCoalesced and 0 is returned, so the caller comes back
+ * later with the same buffers. Once all of the record is sent,
+ * the number of bytes it covered is returned.
+ */
+static ssize_t virNetSocketWritevTLS(virNetSocketPtr sock,
+                                     const struct iovec *iov,
+                                     size_t niov)
+{
+    ssize_t ret;
+
+    /* No point in copying a buffer which fills a record by itself */
+    if (sock->tlsCoalescedLength == 0 &&
+        (niov == 1 || iov[0].iov_len >= VIR_NET_SOCKET_TLS_RECORD_MAX))
+        return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+
+    if (sock->tlsCoalescedLength == 0) {
+        size_t i;
+
+        if (!sock->tlsCoalesced &&
+            VIR_ALLOC_N(sock->tlsCoalesced, VIR_NET_SOCKET_TLS_RECORD_MAX) < 0)
+            return -1;
+
+        for (i = 0; i < niov; i++) {
+            size_t len = VIR_NET_SOCKET_TLS_RECORD_MAX - sock->tlsCoalescedLength;
+
+            if (len > iov[i].iov_len)
+                len = iov[i].iov_len;
+            memcpy(sock->tlsCoalesced + sock->tlsCoalescedLength,
+                   iov[i].iov_base, len);
+            sock->tlsCoalescedLength += len;
+            if (sock->tlsCoalescedLength == VIR_NET_SOCKET_TLS_RECORD_MAX)
+                break;
+        }
+        sock->tlsCoalescedOffset = 0;
+    }
+
+    while (sock->tlsCoalescedOffset < sock->tlsCoalescedLength) {
+        ret = virNetSocketWriteWire(sock,
+                                    sock->tlsCoalesced + sock->tlsCoalescedOffset,
+                                    sock->tlsCoalescedLength - sock->tlsCoalescedOffset);
+        if (ret <= 0)
+            return ret; /* -1 error, 0 == egain */
+
+        sock->tlsCoalescedOffset += ret;
+    }
+
+    ret = sock->tlsCoalescedLength;
+    sock->tlsCoalescedLength = sock->tlsCoalescedOffset = 0;
+    return ret;
+}
+#endif
+
+
+static ssize_t virNetSocketWritevWire(virNetSocketPtr sock,
+                                      const struct iovec *iov,
+                                      size_t niov)
+{
+#ifndef WIN32
+    ssize_t ret;
+
+    if (niov > IOV_MAX)
+        niov = IOV_MAX;
+
+ rewrite:
+    ret = writev(sock->fd, iov, niov);
+
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto rewrite;
+        if (errno == EAGAIN)
+            return 0;
+
+        virReportSystemError(errno, "%s",
+                             _("Cannot write data"));
+        return -1;
+    }
+    if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while writing data"));
+        return -1;
+    }
+
+    return ret;
+#else /* WIN32 */
+    return virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+#endif /* WIN32 */
+}
+
+
+/*
+ * Write out the buffers in @iov, in order. Plain sockets send as
+ * many of them as possible with one writev() call and TLS sessions
+ * gather small buffers into one record. Other transports fall
+ * back to writing the first buffer only.
+ *
+ * Returns the number of bytes written, which may end in the middle
+ * of any buffer, 0 if the write would block, -1 on error
+ */
+ssize_t virNetSocketWritev(virNetSocketPtr sock,
+                           const struct iovec *iov,
+                           size_t niov)
+{
+    ssize_t ret;
+
+    if (niov == 0)
+        return 0;
+
+    virObjectLock(sock);
+#if WITH_SASL
+    if (sock->saslSession)
+        ret = virNetSocketWriteSASL(sock, iov[0].iov_base, iov[0].iov_len);
+    else
+#endif
+#if WITH_SSH2
+    if (sock->sshSession)
+        ret = virNetSocketWriteWire(sock, iov[0].iov_base, iov[0].iov_len);
+    else
+#endif
+#if WITH_GNUTLS
+    if (sock->tlsSession &&
+        virNetTLSSessionGetHandshakeStatus(sock->tlsSession) ==
+        VIR_NET_TLS_HANDSHAKE_COMPLETE)
+        ret = virNetSocketWritevTLS(sock, iov, niov);
+    else
+#endif
+        ret = virNetSocketWritevWire(sock, iov, niov);
+    virObjectUnlock(sock);
+    return ret;
+}
+
+
+/*
+ * Whether payload can be moved into the socket with splice(),
+ * which is only the case for plain local sockets where nothing
+ * needs to transform the data on its way out
+ */
+bool virNetSocketCanSplice(virNetSocketPtr sock)
+{
+    bool canSplice = false;
+
+#ifdef HAVE_SPLICE
+    virObjectLock(sock);
+    canSplice = sock->localAddr.data.sa.sa_family == AF_UNIX;
+# if WITH_GNUTLS
+    if (sock->tlsSession)
+        canSplice = false;
+# endif
+# if WITH_SASL
+    if (sock->saslSession)
+        canSplice = false;
+# endif
+# if WITH_SSH2
+    if (sock->sshSession)
+        canSplice = false;
+# endif
+    virObjectUnlock(sock);
+#endif /* HAVE_SPLICE */
+
+    return canSplice;
+}
+
+
+/*
+ * Move up to @len bytes from the pipe @fd into the socket without
+ * copying them through user space.
+ *
+ * Returns the number of bytes moved, 0 if it would block, -1 on error
+ */
+#ifdef HAVE_SPLICE
+ssize_t virNetSocketSplice(virNetSocketPtr sock,
+                           int fd,
+                           size_t len)
+{
+    ssize_t ret;
+
+    if (!virNetSocketCanSplice(sock)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Splicing data is not supported on this socket"));
+        return -1;
+    }
+
+    virObjectLock(sock);
+ retry:
+    ret = splice(fd, NULL, sock->fd, NULL, len,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto retry;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            ret = 0;
+        else
+            virReportSystemError(errno, "%s",
+                                 _("Cannot splice data into socket"));
+    } else if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while splicing data"));
+        ret = -1;
+    }
+    virObjectUnlock(sock);
+    return ret;
+}
+#else /* !HAVE_SPLICE */
+ssize_t virNetSocketSplice(virNetSocketPtr sock ATTRIBUTE_UNUSED,
+                           int fd ATTRIBUTE_UNUSED,
+                           size_t len ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Splicing data is not supported on this platform"));
+    return -1;
+}
+#endif /* !HAVE_SPLICE */
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
@@ -1844,6 +2217,23 @@ int virNetSocketRecvFD(virNetSocketPtr sock, int *fd)
     }
     virObjectLock(sock);
 
+    if (sock->nreadAheadFDs) {
+        *fd = sock->readAheadFDs[0];
+        VIR_DELETE_ELEMENT(sock->readAheadFDs, 0, sock->nreadAheadFDs);
+        PROBE(RPC_SOCKET_RECV_FD,
+              "sock=%p fd=%d", sock, *fd);
+        ret = 1;
+        goto cleanup;
+    }
+
+    /* The descriptors are sent right after the message they belong
+     * to, so there must not be any buffered data in front of them */
+    if (sock->readAheadOffset < sock->readAheadLength) {
+        virReportError(VIR_ERR_RPC, "%s",
+                       _("Unexpected data while waiting for file descriptor"));
+        goto cleanup;
+    }
+
     if ((*fd = recvfd(sock->fd, O_CLOEXEC)) < 0) {
         if (errno == EAGAIN)
             ret = 0;
@@ -23,6 +23,8 @@
  *   - Read existing file
  *   - Write existing file
  *   - Create & write new file
+ *   - Encode & decode deduplicated save image data
+ *   - Forward the holes of sparse files
  */
 
 #include <config.h>
@@ -40,6 +42,7 @@
 #include "virrandom.h"
 #include "virstring.h"
 #include "virgettext.h"
+#include "virpagecodec.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -72,39 +75,151 @@ prepare(const char *path, int oflags, int mode,
     return fd;
 }
 
+#define IO_CHUNK_SIZE (1024 * 1024)
+#define IO_CHUNK_ALIGN (64 * 1024)
+#define IO_RING_SIZE 4
+#define IO_THREADS_MAX 64
+
+typedef enum {
+    IO_CHUNK_FREE = 0, /* owned by whoever fills it next */
+    IO_CHUNK_BUSY,     /* claimed by a worker for pread/pwrite */
+    IO_CHUNK_FULL,     /* holds data for chunk @seq */
+} ioChunkState;
+
+typedef struct _ioChunk ioChunk;
+struct _ioChunk {
+    char *base; /* Location to be freed */
+    char *buf;  /* Aligned location within base */
+    size_t len;
+    unsigned long long seq;
+    ioChunkState state;
+};
+
+static int
+ioAllocAligned(char **base, char **buf, size_t len)
+{
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign((void **) base, IO_CHUNK_ALIGN, len)) {
+        virReportOOMError();
+        return -1;
+    }
+    *buf = *base;
+#else
+    if (VIR_ALLOC_N(*base, len + IO_CHUNK_ALIGN - 1) < 0)
+        return -1;
+    *buf = (char *) (((intptr_t) *base + IO_CHUNK_ALIGN - 1) &
+                     ~((intptr_t) IO_CHUNK_ALIGN - 1));
+#endif
+    return 0;
+}
+
+static int
+ioAllocChunks(ioChunk **chunks, size_t nchunks)
+{
+    size_t i;
+
+    if (VIR_ALLOC_N(*chunks, nchunks) < 0)
+        return -1;
+
+    for (i = 0; i < nchunks; i++) {
+        if (ioAllocAligned(&(*chunks)[i].base, &(*chunks)[i].buf,
+                           IO_CHUNK_SIZE) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+ioFreeChunks(ioChunk **chunks, size_t nchunks)
+{
+    size_t i;
+
+    if (!*chunks)
+        return;
+
+    for (i = 0; i < nchunks; i++)
+        VIR_FREE((*chunks)[i].base);
+    VIR_FREE(*chunks);
+}
+
+/* Sequential copy: the main thread reads into a ring of aligned
+ * chunks while a writer thread drains them, so that the input and
+ * the output are busy at the same time instead of taking turns.  */
+typedef struct _ioRing ioRing;
+struct _ioRing {
+    virMutex lock;
+    virCond cond;
+
+    int fdout;
+
+    ioChunk *chunks;
+    size_t nchunks;
+
+    unsigned long long head; /* next chunk the reader fills */
+    unsigned long long tail; /* next chunk the writer drains */
+    bool eof;                /* no more chunks after @head */
+    bool quit;               /* reader failed, stop writing */
+    int err;                 /* errno of a failed write */
+};
+
+static void
+ioRingWriter(void *opaque)
+{
+    ioRing *ring = opaque;
+
+    virMutexLock(&ring->lock);
+    while (!ring->quit && !ring->err) {
+        ioChunk *chunk;
+        ssize_t wrote;
+
+        if (ring->tail == ring->head) {
+            if (ring->eof)
+                break;
+            virCondWait(&ring->cond, &ring->lock);
+            continue;
+        }
+
+        chunk = &ring->chunks[ring->tail % ring->nchunks];
+        virMutexUnlock(&ring->lock);
+
+        wrote = safewrite(ring->fdout, chunk->buf, chunk->len);
+
+        virMutexLock(&ring->lock);
+        if (wrote < 0)
+            ring->err = errno;
+        else
+            ring->tail++;
+        virCondBroadcast(&ring->cond);
+    }
+    virMutexUnlock(&ring->lock);
+}
+
 static int
 runIO(const char *path, int fd, int oflags, unsigned long long length)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
-    intptr_t alignMask = 64*1024 - 1;
+    ioRing ring;
+    virThread writer;
+    bool writerStarted = false;
+    bool locksReady = false;
+    size_t buflen = IO_CHUNK_SIZE;
+    intptr_t alignMask = IO_CHUNK_ALIGN - 1;
     int ret = -1;
-    int fdin, fdout;
+    int fdin;
     const char *fdinname, *fdoutname;
     unsigned long long total = 0;
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
 
-#if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
-        virReportOOMError();
-        goto cleanup;
-    }
-    buf = base;
-#else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0)
-        goto cleanup;
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
-#endif
+    memset(&ring, 0, sizeof(ring));
+    ring.nchunks = IO_RING_SIZE;
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
         fdin = fd;
         fdinname = path;
-        fdout = STDOUT_FILENO;
+        ring.fdout = STDOUT_FILENO;
         fdoutname = "stdout";
         /* To make the implementation simpler, we give up on any
          * attempt to use O_DIRECT in a non-trivial manner.  */
@@ -117,7 +232,7 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     case O_WRONLY:
         fdin = STDIN_FILENO;
         fdinname = "stdin";
-        fdout = fd;
+        ring.fdout = fd;
         fdoutname = path;
         /* To make the implementation simpler, we give up on any
          * attempt to use O_DIRECT in a non-trivial manner.  */
@@ -136,8 +251,30 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+    if (ioAllocChunks(&ring.chunks, ring.nchunks) < 0)
+        goto cleanup;
+
+    if (virMutexInit(&ring.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&ring.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize condition"));
+        virMutexDestroy(&ring.lock);
+        goto cleanup;
+    }
+    locksReady = true;
+
+    if (virThreadCreate(&writer, true, ioRingWriter, &ring) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create I/O thread"));
+        goto cleanup;
+    }
+    writerStarted = true;
+
     while (1) {
+        ioChunk *chunk;
         ssize_t got;
+        bool failed;
 
         if (length &&
             (length - total) < buflen)
@@ -146,7 +283,18 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         if (buflen == 0)
             break; /* End of requested data from client */
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        /* Wait for the writer to hand back a chunk */
+        virMutexLock(&ring.lock);
+        while (!ring.err && ring.head - ring.tail == ring.nchunks)
+            virCondWait(&ring.cond, &ring.lock);
+        chunk = &ring.chunks[ring.head % ring.nchunks];
+        failed = ring.err != 0;
+        virMutexUnlock(&ring.lock);
+
+        if (failed)
+            break;
+
+        if ((got = saferead(fdin, chunk->buf, buflen)) < 0) {
             virReportSystemError(errno, _("Unable to read %s"), fdinname);
             goto cleanup;
         }
@@ -157,28 +305,45 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
             if (direct && shortRead) {
                 virReportSystemError(EINVAL, "%s",
                                      _("Too many short reads for O_DIRECT"));
+                goto cleanup;
             }
             shortRead = true;
         }
 
         total += got;
-        if (fdout == fd && direct && shortRead) {
+        if (ring.fdout == fd && direct && shortRead) {
             end = total;
-            memset(buf + got, 0, buflen - got);
+            memset(chunk->buf + got, 0, buflen - got);
             got = (got + alignMask) & ~alignMask;
         }
-        if (safewrite(fdout, buf, got) < 0) {
-            virReportSystemError(errno, _("Unable to write %s"), fdoutname);
-            goto cleanup;
-        }
-        if (end && ftruncate(fd, end) < 0) {
-            virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
-            goto cleanup;
-        }
+        chunk->len = got;
+
+        virMutexLock(&ring.lock);
+        ring.head++;
+        virCondBroadcast(&ring.cond);
+        virMutexUnlock(&ring.lock);
+    }
+
+    virMutexLock(&ring.lock);
+    ring.eof = true;
+    virCondBroadcast(&ring.cond);
+    virMutexUnlock(&ring.lock);
+
+    virThreadJoin(&writer);
+    writerStarted = false;
+
+    if (ring.err) {
+        virReportSystemError(ring.err, _("Unable to write %s"), fdoutname);
+        goto cleanup;
+    }
+
+    if (end && ftruncate(fd, end) < 0) {
+        virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
     }
 
     /* Ensure all data is written */
-    if (fdatasync(fdout) < 0) {
+    if (fdatasync(ring.fdout) < 0) {
         if (errno != EINVAL && errno != EROFS) {
             /* fdatasync() may fail on some special FDs, e.g. pipes */
             virReportSystemError(errno, _("unable to fsync %s"), fdoutname);
@@ -189,13 +354,507 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     ret = 0;
 
  cleanup:
+    if (writerStarted) {
+        virMutexLock(&ring.lock);
+        ring.quit = true;
+        virCondBroadcast(&ring.cond);
+        virMutexUnlock(&ring.lock);
+        virThreadJoin(&writer);
+    }
+    if (locksReady) {
+        virCondDestroy(&ring.cond);
+        virMutexDestroy(&ring.lock);
+    }
+    ioFreeChunks(&ring.chunks, ring.nchunks);
+
+    if (VIR_CLOSE(fd) < 0 &&
+        ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Parallel I/O: the stream is cut into IO_CHUNK_SIZE pieces, piece N
+ * living at offset N * IO_CHUNK_SIZE of the file.  One side of the
+ * copy is the sequential pipe, handled by the main thread; the file
+ * side is handled by a pool of threads issuing positioned I/O.  Each
+ * thread owns two aligned buffers worth of slots in the ring so that
+ * the pipe can keep filling (or draining) one while the other is in
+ * flight to the disk.  */
+typedef struct _ioParallel ioParallel;
+struct _ioParallel {
+    virMutex lock;
+    virCond cond;
+
+    int fd;
+    bool output; /* true if the file is being written */
+    bool direct;
+    off_t size;  /* of the file being read */
+
+    ioChunk *chunks;
+    size_t nchunks;
+
+    unsigned long long next;  /* next chunk a worker will claim */
+    unsigned long long last;  /* number of chunks in the stream, if @eof */
+    bool eof;
+    bool quit;
+    int err;                  /* errno of the first worker failure */
+};
+
+/* Like saferead, but positioned.  The read only comes up short at
+ * @size, the end of the file: a short O_DIRECT read before that is
+ * retried rather than taken for the end of the data.  */
+static ssize_t
+ioPreadFull(int fd, char *buf, size_t len, off_t offset, off_t size)
+{
+    size_t done = 0;
+
+    while (done < len && offset + (off_t) done < size) {
+        ssize_t got = pread(fd, buf + done, len - done, offset + done);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (got == 0)
+            break;
+        done += got;
+    }
+
+    return done;
+}
+
+static ssize_t
+ioPwriteFull(int fd, const char *buf, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t got = pwrite(fd, buf + done, len - done, offset + done);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += got;
+    }
+
+    return done;
+}
+
+static void
+ioParallelWorker(void *opaque)
+{
+    ioParallel *io = opaque;
+
+    virMutexLock(&io->lock);
+    while (1) {
+        unsigned long long seq = io->next;
+        ioChunk *chunk = &io->chunks[seq % io->nchunks];
+        off_t offset = seq * IO_CHUNK_SIZE;
+        ssize_t got;
+
+        if (io->quit || io->err || (io->eof && seq >= io->last))
+            break;
+
+        if (io->output) {
+            if (chunk->state != IO_CHUNK_FULL || chunk->seq != seq) {
+                virCondWait(&io->cond, &io->lock);
+                continue;
+            }
+        } else if (chunk->state != IO_CHUNK_FREE) {
+            virCondWait(&io->cond, &io->lock);
+            continue;
+        }
+
+        io->next++;
+        chunk->state = IO_CHUNK_BUSY;
+        chunk->seq = seq;
+        virMutexUnlock(&io->lock);
+
+        if (io->output)
+            got = ioPwriteFull(io->fd, chunk->buf, chunk->len, offset);
+        else
+            got = ioPreadFull(io->fd, chunk->buf, IO_CHUNK_SIZE, offset,
+                              io->size);
+
+        virMutexLock(&io->lock);
+        if (got < 0) {
+            if (!io->err)
+                io->err = errno;
+        } else if (io->output) {
+            chunk->state = IO_CHUNK_FREE;
+        } else {
+            chunk->len = got;
+            chunk->state = IO_CHUNK_FULL;
+            if (got < IO_CHUNK_SIZE) {
+                unsigned long long last = got ? seq + 1 : seq;
+                if (!io->eof || last < io->last)
+                    io->last = last;
+                io->eof = true;
+            }
+        }
+        virCondBroadcast(&io->cond);
+    }
+    virMutexUnlock(&io->lock);
+}
+
+/* Wait until chunk @seq may be touched by the main thread.  Returns
+ * the chunk, or NULL on worker failure or (for input) end of file.  */
+static ioChunk *
+ioParallelWaitChunk(ioParallel *io, unsigned long long seq)
+{
+    ioChunk *chunk = &io->chunks[seq % io->nchunks];
+
+    virMutexLock(&io->lock);
+    while (!io->err) {
+        if (io->output) {
+            if (chunk->state == IO_CHUNK_FREE)
+                break;
+        } else {
+            if (io->eof && seq >= io->last)
+                break;
+            if (chunk->state == IO_CHUNK_FULL && chunk->seq == seq)
+                break;
+        }
+        virCondWait(&io->cond, &io->lock);
+    }
+    if (io->err || (!io->output && io->eof && seq >= io->last))
+        chunk = NULL;
+    virMutexUnlock(&io->lock);
+
+    return chunk;
+}
+
+static int
+runIOParallel(const char *path, int fd, int oflags, unsigned int nthreads)
+{
+    ioParallel io;
+    virThread *threads = NULL;
+    size_t nthreadsStarted = 0;
+    unsigned long long seq;
+    unsigned long long total = 0;
+    int ret = -1;
+    bool locksReady = false;
+    off_t end;
+    size_t i;
+
+    memset(&io, 0, sizeof(io));
+    io.fd = fd;
+    io.direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
+
+    switch (oflags & O_ACCMODE) {
+    case O_RDONLY:
+        if ((end = lseek(fd, 0, SEEK_CUR)) != 0) {
+            virReportSystemError(end < 0 ? errno : EINVAL, "%s",
+                                 _("parallel read needs entire seekable file"));
+            goto cleanup;
+        }
+        if ((io.size = lseek(fd, 0, SEEK_END)) < 0 ||
+            lseek(fd, 0, SEEK_SET) < 0) {
+            virReportSystemError(errno, _("Unable to seek %s"), path);
+            goto cleanup;
+        }
+        break;
+    case O_WRONLY:
+        io.output = true;
+        if ((end = lseek(fd, 0, SEEK_END)) != 0) {
+            virReportSystemError(end < 0 ? errno : EINVAL, "%s",
+                                 _("parallel write needs empty seekable file"));
+            goto cleanup;
+        }
+        break;
+    case O_RDWR:
+    default:
+        virReportSystemError(EINVAL,
+                             _("Unable to process file with flags %d"),
+                             (oflags & O_ACCMODE));
+        goto cleanup;
+    }
+
+    if (nthreads > IO_THREADS_MAX)
+        nthreads = IO_THREADS_MAX;
+
+    io.nchunks = nthreads * 2;
+    if (ioAllocChunks(&io.chunks, io.nchunks) < 0 ||
+        VIR_ALLOC_N(threads, nthreads) < 0)
+        goto cleanup;
+
+    if (virMutexInit(&io.lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&io.cond) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize condition"));
+        virMutexDestroy(&io.lock);
+        goto cleanup;
+    }
+    locksReady = true;
+
+    for (i = 0; i < nthreads; i++) {
+        if (virThreadCreate(&threads[i], true, ioParallelWorker, &io) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to create I/O thread"));
+            goto finish;
+        }
+        nthreadsStarted++;
+    }
+
+    for (seq = 0; ; seq++) {
+        ioChunk *chunk;
+        ssize_t got;
+
+        if (!(chunk = ioParallelWaitChunk(&io, seq)))
+            break;
+
+        if (io.output) {
+            if ((got = saferead(STDIN_FILENO, chunk->buf, IO_CHUNK_SIZE)) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to read stdin"));
+                goto finish;
+            }
+            total += got;
+
+            virMutexLock(&io.lock);
+            if (got == 0) {
+                io.eof = true;
+                io.last = seq;
+            } else {
+                chunk->len = got;
+                /* Only the final chunk can be short; O_DIRECT needs it
+                 * padded, the file is truncated back once done.  */
+                if (io.direct && got < IO_CHUNK_SIZE) {
+                    chunk->len = (got + IO_CHUNK_ALIGN - 1) &
+                                 ~(IO_CHUNK_ALIGN - 1);
+                    memset(chunk->buf + got, 0, chunk->len - got);
+                }
+                chunk->seq = seq;
+                chunk->state = IO_CHUNK_FULL;
+            }
+            virCondBroadcast(&io.cond);
+            virMutexUnlock(&io.lock);
+
+            if (got == 0)
+                break;
+        } else {
+            if (safewrite(STDOUT_FILENO, chunk->buf, chunk->len) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to write stdout"));
+                goto finish;
+            }
+
+            virMutexLock(&io.lock);
+            chunk->state = IO_CHUNK_FREE;
+            virCondBroadcast(&io.cond);
+            virMutexUnlock(&io.lock);
+        }
+    }
+
+    ret = 0;
+
+ finish:
+    virMutexLock(&io.lock);
+    io.quit = ret < 0 || !io.output;
+    virCondBroadcast(&io.cond);
+    virMutexUnlock(&io.lock);
+
+    for (i = 0; i < nthreadsStarted; i++)
+        virThreadJoin(&threads[i]);
+
+    if (ret < 0)
+        goto cleanup;
+
+    if (io.err) {
+        ret = -1;
+        if (io.output)
+            virReportSystemError(io.err, _("Unable to write %s"), path);
+        else
+            virReportSystemError(io.err, _("Unable to read %s"), path);
+        goto cleanup;
+    }
+
+    if (io.output) {
+        if (io.direct && (total % IO_CHUNK_ALIGN) &&
+            ftruncate(fd, total) < 0) {
+            ret = -1;
+            virReportSystemError(errno, _("Unable to truncate %s"), path);
+            goto cleanup;
+        }
+
+        if (fdatasync(fd) < 0 && errno != EINVAL && errno != EROFS) {
+            ret = -1;
+            virReportSystemError(errno, _("unable to fsync %s"), path);
+            goto cleanup;
+        }
+    }
+
+ cleanup:
+    if (locksReady) {
+        virCondDestroy(&io.cond);
+        virMutexDestroy(&io.lock);
+    }
+    ioFreeChunks(&io.chunks, io.nchunks);
+    VIR_FREE(threads);
+    if (VIR_CLOSE(fd) < 0 && ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
+    return ret;
+}
+
+/* Sparse copy: each section of the file is preceded on the pipe by
+ * a virFileSparseRecord, so that a hole is a record of its own
+ * rather than a run of zeroes.  */
+static int
+ioSparseToPipe(const char *path, int fd, unsigned long long length,
+               char *buf)
+{
+    unsigned long long total = 0;
+
+    while (!length || total < length) {
+        virFileSparseRecord rec;
+        int inData;
+        long long sectionLen;
+
+        if (virFileInData(fd, &inData, &sectionLen) < 0)
+            return -1;
+
+        if (sectionLen == 0)
+            break; /* End of file */
+
+        if (length && (length - total) < sectionLen)
+            sectionLen = length - total;
+
+        memset(&rec, 0, sizeof(rec));
+        if (inData) {
+            ssize_t got;
+
+            if (sectionLen > IO_CHUNK_SIZE)
+                sectionLen = IO_CHUNK_SIZE;
+
+            if ((got = saferead(fd, buf, sectionLen)) < 0) {
+                virReportSystemError(errno, _("Unable to read %s"), path);
+                return -1;
+            }
+            if (got == 0)
+                break; /* File shrunk under us */
+
+            rec.type = VIR_FILE_SPARSE_DATA;
+            rec.length = got;
+        } else {
+            if (lseek(fd, sectionLen, SEEK_CUR) == (off_t) -1) {
+                virReportSystemError(errno, _("Unable to seek %s"), path);
+                return -1;
+            }
+
+            rec.type = VIR_FILE_SPARSE_HOLE;
+            rec.length = sectionLen;
+        }
+
+        if (safewrite(STDOUT_FILENO, &rec, sizeof(rec)) < 0 ||
+            (rec.type == VIR_FILE_SPARSE_DATA &&
+             safewrite(STDOUT_FILENO, buf, rec.length) < 0)) {
+            virReportSystemError(errno, "%s", _("Unable to write stdout"));
+            return -1;
+        }
+
+        total += rec.length;
+    }
+
+    return 0;
+}
+
+static int
+ioSparseFromPipe(const char *path, int fd, char *buf)
+{
+    while (1) {
+        virFileSparseRecord rec;
+        ssize_t got;
+
+        if ((got = saferead(STDIN_FILENO, &rec, sizeof(rec))) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to read stdin"));
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of stream */
+        if (got != sizeof(rec) ||
+            (rec.type != VIR_FILE_SPARSE_DATA &&
+             rec.type != VIR_FILE_SPARSE_HOLE)) {
+            virReportSystemError(EINVAL, "%s",
+                                 _("Malformed sparse record on stdin"));
+            return -1;
+        }
+
+        if (rec.type == VIR_FILE_SPARSE_HOLE) {
+            if (virFileWriteHole(fd, rec.length) < 0)
+                return -1;
+            continue;
+        }
+
+        while (rec.length) {
+            size_t want = MIN(rec.length, IO_CHUNK_SIZE);
+
+            if ((got = saferead(STDIN_FILENO, buf, want)) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to read stdin"));
+                return -1;
+            }
+            if (got == 0) {
+                virReportSystemError(EINVAL, "%s",
+                                     _("Truncated sparse record on stdin"));
+                return -1;
+            }
+            if (safewrite(fd, buf, got) < 0) {
+                virReportSystemError(errno, _("Unable to write %s"), path);
+                return -1;
+            }
+            rec.length -= got;
+        }
+    }
+
+    return 0;
+}
+
+static int
+runIOSparse(const char *path, int fd, int oflags, unsigned long long length)
+{
+    char *buf = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, IO_CHUNK_SIZE) < 0)
+        goto cleanup;
+
+    switch (oflags & O_ACCMODE) {
+    case O_RDONLY:
+        if (ioSparseToPipe(path, fd, length, buf) < 0)
+            goto cleanup;
+        break;
+    case O_WRONLY:
+        if (ioSparseFromPipe(path, fd, buf) < 0)
+            goto cleanup;
+
+        if (fdatasync(fd) < 0 && errno != EINVAL && errno != EROFS) {
+            virReportSystemError(errno, _("unable to fsync %s"), path);
+            goto cleanup;
+        }
+        break;
+
+    case O_RDWR:
+    default:
+        virReportSystemError(EINVAL,
+                             _("Unable to process file with flags %d"),
+                             (oflags & O_ACCMODE));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(buf);
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
         ret = -1;
     }
 
-    VIR_FREE(base);
     return ret;
 }
 
@@ -208,8 +867,12 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
-               program_name, program_name);
+                 "   or: %s FILENAME LENGTH FD [THREADS]\n"
+                 "   or: %s -s FILENAME LENGTH FD\n"
+                 "   or: %s -c\n"
+                 "   or: %s -dc IMAGEFD OFFSET\n"),
+               program_name, program_name, program_name, program_name,
+               program_name);
     }
     exit(status);
 }
@@ -223,6 +886,8 @@ main(int argc, char **argv)
     int oflags = -1;
     int mode;
     unsigned int delete = 0;
+    unsigned int threads = 0;
+    bool sparse = false;
     int fd = -1;
     int lengthIndex = 0;
 
@@ -239,6 +904,37 @@ main(int argc, char **argv)
 
     if (argc > 1 && STREQ(argv[1], "--help"))
         usage(EXIT_SUCCESS);
+    if (argc == 2 && STREQ(argv[1], "-c")) { /* -c */
+        path = "stdin";
+        if (virPageCodecEncode(STDIN_FILENO, STDOUT_FILENO, NULL) < 0)
+            goto error;
+        return 0;
+    }
+    if (argc == 4 && STREQ(argv[1], "-dc")) { /* -dc IMAGEFD OFFSET */
+        int imagefd;
+        unsigned long long base;
+
+        path = "stdin";
+        if (virStrToLong_i(argv[2], NULL, 10, &imagefd) < 0) {
+            fprintf(stderr, _("%s: malformed fd %s"),
+                    program_name, argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        if (virStrToLong_ull(argv[3], NULL, 10, &base) < 0) {
+            fprintf(stderr, _("%s: malformed file offset %s"),
+                    program_name, argv[3]);
+            exit(EXIT_FAILURE);
+        }
+        if (virPageCodecDecode(STDIN_FILENO, imagefd, base, STDOUT_FILENO) < 0)
+            goto error;
+        return 0;
+    }
+    if (argc == 5 && STREQ(argv[1], "-s")) { /* -s FILENAME LENGTH FD */
+        sparse = true;
+        argc--;
+        argv++;
+        path = argv[1];
+    }
     if (argc == 7) { /* FILENAME OFLAGS MODE OFFSET LENGTH DELETE */
         lengthIndex = 5;
         if (virStrToLong_i(argv[2], NULL, 10, &oflags) < 0) {
@@ -262,13 +958,18 @@ main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
         fd = prepare(path, oflags, mode, offset);
-    } else if (argc == 4) { /* FILENAME LENGTH FD */
+    } else if (argc == 4 || argc == 5) { /* FILENAME LENGTH FD [THREADS] */
         lengthIndex = 2;
         if (virStrToLong_i(argv[3], NULL, 10, &fd) < 0) {
             fprintf(stderr, _("%s: malformed fd %s"),
                     program_name, argv[3]);
             exit(EXIT_FAILURE);
         }
+        if (argc == 5 && virStrToLong_ui(argv[4], NULL, 10, &threads) < 0) {
+            fprintf(stderr, _("%s: malformed thread count %s"),
+                    program_name, argv[4]);
+            exit(EXIT_FAILURE);
+        }
 #ifdef F_GETFL
         oflags = fcntl(fd, F_GETFL);
 #else
@@ -293,8 +994,19 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0)
+        goto error;
+
+    if (sparse) {
+        if (runIOSparse(path, fd, oflags, length) < 0)
+            goto error;
+    } else if (threads > 1 && !length) {
+        /* Positioned I/O only makes sense when the whole file is copied.  */
+        if (runIOParallel(path, fd, oflags, threads) < 0)
+            goto error;
+    } else if (runIO(path, fd, oflags, length) < 0) {
         goto error;
+    }
 
     if (delete)
         unlink(path);
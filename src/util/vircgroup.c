@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 #ifdef MAJOR_IN_MKDEV
 # include <sys/mkdev.h>
@@ -51,6 +52,8 @@
 
 #include "virutil.h"
 #include "viralloc.h"
+#include "viratomic.h"
+#include "virthread.h"
 #include "virerror.h"
 #include "virlog.h"
 #include "virfile.h"
@@ -127,6 +130,60 @@ virCgroupGetDevicePermsString(int perms)
 }
 
 
+static const char *
+virCgroupCpuacctPlacement(virCgroupPtr group)
+{
+    return group->controllers[VIR_CGROUP_CONTROLLER_CPUACCT].placement;
+}
+
+
+/* Returns the directory name of @group in the cpuacct hierarchy, and
+ * the length of the placement of its partition in @partlen. NULL if
+ * @group has no such parent directory. */
+static const char *
+virCgroupCpuacctName(virCgroupPtr group,
+                     size_t *partlen)
+{
+    const char *placement;
+    const char *name;
+
+    if (!group)
+        return NULL;
+
+    placement = virCgroupCpuacctPlacement(group);
+    if (!placement ||
+        !(name = strrchr(placement, '/')) ||
+        !name[1])
+        return NULL;
+
+    /* Keep the '/' of groups directly in the root */
+    *partlen = name == placement ? 1 : name - placement;
+    return name + 1;
+}
+
+
+static int
+virCgroupCpuacctStatsCompare(const void *a,
+                             const void *b)
+{
+    const virCgroupCpuacctStats *sa = a;
+    const virCgroupCpuacctStats *sb = b;
+
+    return strcmp(sa->name, sb->name);
+}
+
+
+static int
+virCgroupCpuacctWantedCompare(const void *a,
+                              const void *b)
+{
+    const char *const *sa = a;
+    const char *const *sb = b;
+
+    return strcmp(*sa, *sb);
+}
+
+
 #ifdef VIR_CGROUP_SUPPORTED
 bool
 virCgroupAvailable(void)
@@ -969,6 +1026,274 @@ virCgroupGetValueU64(virCgroupPtr group,
 }
 
 
+/*
+ * Statistics are read much more often than anything else: every stats
+ * call reads the cpuacct files of the domain and of each of its vCPUs.
+ * Instead of resolving the path, opening, reading into a new buffer and
+ * closing the file each time, the files are kept open per cgroup and
+ * read again with pread into a buffer the cgroup owns. Every cgroup
+ * holding a descriptor counts against a share of RLIMIT_NOFILE; once
+ * that is exhausted further files are opened for the read only.
+ *
+ * The same cgroup may be read by several threads at once, e.g. by
+ * virDomainGetCPUStats and a worker of virConnectGetAllDomainStats, so
+ * the cache has a lock of its own. Readers take it with
+ * virCgroupStatLock and keep it until they are done parsing the buffer.
+ */
+static const struct {
+    int controller;
+    const char *name;
+} virCgroupStatFiles[VIR_CGROUP_STAT_LAST] = {
+    [VIR_CGROUP_STAT_CPUACCT_USAGE] = {
+        VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage" },
+    [VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU] = {
+        VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu" },
+    [VIR_CGROUP_STAT_CPUACCT_STAT] = {
+        VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat" },
+};
+
+# define VIR_CGROUP_STAT_BUF_MIN 4096
+# define VIR_CGROUP_STAT_BUF_MAX (1024 * 1024)
+
+static int virCgroupStatFdsOpen;
+static int virCgroupStatFdsMax;
+
+static int
+virCgroupStatOnceInit(void)
+{
+    struct rlimit limit;
+
+    /* Leave most descriptors to guests' disks, sockets and the like */
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0 ||
+        limit.rlim_cur == RLIM_INFINITY)
+        virCgroupStatFdsMax = 1024;
+    else
+        virCgroupStatFdsMax = limit.rlim_cur / 4;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virCgroupStat)
+
+/* Serializes creating the cache of a cgroup */
+static virMutex virCgroupStatCacheMutex = VIR_MUTEX_INITIALIZER;
+
+
+static struct virCgroupStatCache *
+virCgroupStatCacheGet(virCgroupPtr group)
+{
+    struct virCgroupStatCache *stats = NULL;
+    size_t i;
+
+    if (virCgroupStatInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virCgroupStatCacheMutex);
+
+    if ((stats = group->stats))
+        goto cleanup;
+
+    if (VIR_ALLOC(stats) < 0)
+        goto cleanup;
+
+    if (virMutexInit(&stats->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        VIR_FREE(stats);
+        goto cleanup;
+    }
+
+    for (i = 0; i < VIR_CGROUP_STAT_LAST; i++)
+        stats->fds[i] = -1;
+
+    group->stats = stats;
+
+ cleanup:
+    virMutexUnlock(&virCgroupStatCacheMutex);
+    return stats;
+}
+
+
+/**
+ * virCgroupStatLock:
+ * @group: the cgroup
+ *
+ * Locks the statistics cache of @group, creating it if needed, for
+ * virCgroupStatRead. Release it with virCgroupStatUnlock.
+ *
+ * Returns the locked cache, NULL on error.
+ */
+static struct virCgroupStatCache *
+virCgroupStatLock(virCgroupPtr group)
+{
+    struct virCgroupStatCache *stats;
+
+    if (!(stats = virCgroupStatCacheGet(group)))
+        return NULL;
+
+    virMutexLock(&stats->lock);
+    return stats;
+}
+
+
+static void
+virCgroupStatUnlock(struct virCgroupStatCache *stats)
+{
+    if (stats)
+        virMutexUnlock(&stats->lock);
+}
+
+
+/* Only called on the way of @group out, from virCgroupRemove and
+ * virCgroupFree, which their callers don't run while @group is read
+ * elsewhere; qemu and lxc hold the domain object lock for both */
+static void
+virCgroupStatCacheFree(virCgroupPtr group)
+{
+    struct virCgroupStatCache *stats = group->stats;
+    size_t i;
+
+    if (!stats)
+        return;
+
+    for (i = 0; i < VIR_CGROUP_STAT_LAST; i++) {
+        if (stats->fds[i] >= 0) {
+            VIR_FORCE_CLOSE(stats->fds[i]);
+            virAtomicIntAdd(&virCgroupStatFdsOpen, -1);
+        }
+    }
+
+    for (i = 0; i < stats->nvcpus; i++)
+        virCgroupFree(&stats->vcpus[i]);
+    VIR_FREE(stats->vcpus);
+    VIR_FREE(stats->buf);
+    virMutexDestroy(&stats->lock);
+    VIR_FREE(group->stats);
+}
+
+
+/**
+ * virCgroupStatRead:
+ * @group: the cgroup
+ * @stats: the cache of @group returned by virCgroupStatLock
+ * @file: the statistics file to read
+ * @value: set to the contents of the file
+ *
+ * Reads a statistics file of @group into the buffer of @stats, which
+ * stays valid until @stats is unlocked or read into again. A trailing
+ * newline is stripped, like virCgroupGetValueStr does.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virCgroupStatRead(virCgroupPtr group,
+                  struct virCgroupStatCache *stats,
+                  virCgroupStatFile file,
+                  char **value)
+{
+    int controller = virCgroupStatFiles[file].controller;
+    const char *name = virCgroupStatFiles[file].name;
+    char *keypath = NULL;
+    bool reopened = false;
+    int fd = -1;
+    ssize_t got;
+    int ret = -1;
+
+    if (!stats->buf) {
+        if (VIR_ALLOC_N(stats->buf, VIR_CGROUP_STAT_BUF_MIN) < 0)
+            return -1;
+        stats->bufsize = VIR_CGROUP_STAT_BUF_MIN;
+    }
+
+ reopen:
+    if ((fd = stats->fds[file]) < 0) {
+        if (!keypath &&
+            virCgroupPathOfController(group, controller, name, &keypath) < 0)
+            return -1;
+
+        VIR_DEBUG("Opening %s", keypath);
+
+        if ((fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to read from '%s'"), keypath);
+            goto cleanup;
+        }
+
+        if (virAtomicIntAdd(&virCgroupStatFdsOpen, 1) < virCgroupStatFdsMax)
+            stats->fds[file] = fd;
+        else
+            virAtomicIntAdd(&virCgroupStatFdsOpen, -1);
+    }
+
+    /* cgroup files are generated in full on each read, so a read which
+     * doesn't fill the buffer has all of the contents */
+    while ((got = pread(fd, stats->buf, stats->bufsize - 1, 0)) ==
+           stats->bufsize - 1) {
+        if (stats->bufsize >= VIR_CGROUP_STAT_BUF_MAX) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("'%s' is larger than %d bytes"),
+                           name, VIR_CGROUP_STAT_BUF_MAX);
+            goto cleanup;
+        }
+        if (VIR_REALLOC_N(stats->buf, stats->bufsize * 2) < 0)
+            goto cleanup;
+        stats->bufsize *= 2;
+    }
+
+    if (got < 0) {
+        int err = errno;
+
+        /* A kept descriptor may belong to a group which was removed and
+         * created again meanwhile, e.g. by vCPU unplug and plug */
+        if (fd == stats->fds[file] && !reopened) {
+            VIR_FORCE_CLOSE(stats->fds[file]);
+            virAtomicIntAdd(&virCgroupStatFdsOpen, -1);
+            reopened = true;
+            goto reopen;
+        }
+
+        if (!keypath &&
+            virCgroupPathOfController(group, controller, name, &keypath) < 0)
+            goto cleanup;
+        virReportSystemError(err, _("Unable to read from '%s'"), keypath);
+        goto cleanup;
+    }
+
+    if (got > 0 && stats->buf[got - 1] == '\n')
+        got--;
+    stats->buf[got] = '\0';
+
+    *value = stats->buf;
+    ret = 0;
+
+ cleanup:
+    if (fd != stats->fds[file])
+        VIR_FORCE_CLOSE(fd);
+    VIR_FREE(keypath);
+    return ret;
+}
+
+
+/* Returns the sub-group of vCPU @vcpuid kept in the locked cache @stats
+ * of @group for reading its statistics */
+static virCgroupPtr
+virCgroupStatGetVcpu(virCgroupPtr group,
+                     struct virCgroupStatCache *stats,
+                     size_t vcpuid)
+{
+    if (vcpuid >= stats->nvcpus &&
+        VIR_EXPAND_N(stats->vcpus, stats->nvcpus,
+                     vcpuid + 1 - stats->nvcpus) < 0)
+        return NULL;
+
+    if (!stats->vcpus[vcpuid] &&
+        virCgroupNewThread(group, VIR_CGROUP_THREAD_VCPU, vcpuid,
+                           false, &stats->vcpus[vcpuid]) < 0)
+        return NULL;
+
+    return stats->vcpus[vcpuid];
+}
+
+
 static int
 virCgroupCpuSetInherit(virCgroupPtr parent, virCgroupPtr group)
 {
@@ -1759,6 +2084,8 @@ virCgroupFree(virCgroupPtr *group)
     if (*group == NULL)
         return;
 
+    virCgroupStatCacheFree(*group);
+
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         VIR_FREE((*group)->controllers[i].mountPoint);
         VIR_FREE((*group)->controllers[i].linkPoint);
@@ -3054,29 +3381,28 @@ virCgroupDenyDevicePath(virCgroupPtr group,
  */
 static int
 virCgroupGetPercpuVcpuSum(virCgroupPtr group,
+                          struct virCgroupStatCache *stats,
                           virBitmapPtr guestvcpus,
                           unsigned long long *sum_cpu_time,
                           size_t nsum,
                           virBitmapPtr cpumap)
 {
-    int ret = -1;
+    struct virCgroupStatCache *vcpustats = NULL;
     ssize_t i = -1;
-    char *buf = NULL;
-    virCgroupPtr group_vcpu = NULL;
+    int ret = -1;
 
     while ((i = virBitmapNextSetBit(guestvcpus, i)) >= 0) {
+        virCgroupPtr group_vcpu;
         char *pos;
         unsigned long long tmp;
         ssize_t j;
 
-        if (virCgroupNewThread(group, VIR_CGROUP_THREAD_VCPU, i,
-                               false, &group_vcpu) < 0)
-            goto cleanup;
-
-        if (virCgroupGetCpuacctPercpuUsage(group_vcpu, &buf) < 0)
+        if (!(group_vcpu = virCgroupStatGetVcpu(group, stats, i)) ||
+            !(vcpustats = virCgroupStatLock(group_vcpu)) ||
+            virCgroupStatRead(group_vcpu, vcpustats,
+                              VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU, &pos) < 0)
             goto cleanup;
 
-        pos = buf;
         for (j = virBitmapNextSetBit(cpumap, -1);
              j >= 0 && j < nsum;
              j = virBitmapNextSetBit(cpumap, j)) {
@@ -3088,14 +3414,14 @@ virCgroupGetPercpuVcpuSum(virCgroupPtr group,
             sum_cpu_time[j] += tmp;
         }
 
-        virCgroupFree(&group_vcpu);
-        VIR_FREE(buf);
+        virCgroupStatUnlock(vcpustats);
+        vcpustats = NULL;
     }
 
     ret = 0;
+
  cleanup:
-    virCgroupFree(&group_vcpu);
-    VIR_FREE(buf);
+    virCgroupStatUnlock(vcpustats);
     return ret;
 }
 
@@ -3132,12 +3458,12 @@ virCgroupGetPercpuStats(virCgroupPtr group,
     size_t i;
     int need_cpus, total_cpus;
     char *pos;
-    char *buf = NULL;
     unsigned long long *sum_cpu_time = NULL;
     virTypedParameterPtr ent;
     int param_idx;
     unsigned long long cpu_time;
     virBitmapPtr cpumap = NULL;
+    struct virCgroupStatCache *stats = NULL;
 
     /* return the number of supported params */
     if (nparams == 0 && ncpus != 0) {
@@ -3167,9 +3493,10 @@ virCgroupGetPercpuStats(virCgroupPtr group,
     }
 
     /* we get percpu cputime accounting info. */
-    if (virCgroupGetCpuacctPercpuUsage(group, &buf))
+    if (!(stats = virCgroupStatLock(group)) ||
+        virCgroupStatRead(group, stats, VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU,
+                          &pos) < 0)
         goto cleanup;
-    pos = buf;
 
     /* return percpu cputime in index 0 */
     param_idx = 0;
@@ -3199,7 +3526,7 @@ virCgroupGetPercpuStats(virCgroupPtr group,
     if (guestvcpus && param_idx < nparams) {
         if (VIR_ALLOC_N(sum_cpu_time, need_cpus) < 0)
             goto cleanup;
-        if (virCgroupGetPercpuVcpuSum(group, guestvcpus, sum_cpu_time,
+        if (virCgroupGetPercpuVcpuSum(group, stats, guestvcpus, sum_cpu_time,
                                       need_cpus, cpumap) < 0)
             goto cleanup;
 
@@ -3218,9 +3545,9 @@ virCgroupGetPercpuStats(virCgroupPtr group,
     ret = param_idx;
 
  cleanup:
+    virCgroupStatUnlock(stats);
     virBitmapFree(cpumap);
     VIR_FREE(sum_cpu_time);
-    VIR_FREE(buf);
     return ret;
 }
 
@@ -3367,8 +3694,22 @@ virCgroupSetCpuCfsQuota(virCgroupPtr group, long long cfs_quota)
 int
 virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage)
 {
-    return virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                                "cpuacct.usage_percpu", usage);
+    struct virCgroupStatCache *stats;
+    char *str;
+    int ret = -1;
+
+    if (!(stats = virCgroupStatLock(group)))
+        return -1;
+
+    if (virCgroupStatRead(group, stats, VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU,
+                          &str) < 0)
+        goto cleanup;
+
+    ret = VIR_STRDUP(*usage, str);
+
+ cleanup:
+    virCgroupStatUnlock(stats);
+    return ret;
 }
 
 
@@ -3440,6 +3781,9 @@ virCgroupRemove(virCgroupPtr group)
     size_t i;
     char *grppath = NULL;
 
+    /* Don't keep the files of removed groups busy */
+    virCgroupStatCacheFree(group);
+
     VIR_DEBUG("Removing cgroup %s", group->path);
     for (i = 0; i < VIR_CGROUP_CONTROLLER_LAST; i++) {
         /* Skip over controllers not mounted */
@@ -3766,9 +4110,29 @@ virCgroupGetCpuCfsQuota(virCgroupPtr group, long long *cfs_quota)
 int
 virCgroupGetCpuacctUsage(virCgroupPtr group, unsigned long long *usage)
 {
-    return virCgroupGetValueU64(group,
-                                VIR_CGROUP_CONTROLLER_CPUACCT,
-                                "cpuacct.usage", usage);
+    struct virCgroupStatCache *stats;
+    char *str;
+    int ret = -1;
+
+    if (!(stats = virCgroupStatLock(group)))
+        return -1;
+
+    if (virCgroupStatRead(group, stats, VIR_CGROUP_STAT_CPUACCT_USAGE,
+                          &str) < 0)
+        goto cleanup;
+
+    if (virStrToLong_ull(str, NULL, 10, usage) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to parse '%s' as an integer"),
+                       str);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupStatUnlock(stats);
+    return ret;
 }
 
 
@@ -3776,15 +4140,19 @@ int
 virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                         unsigned long long *sys)
 {
+    struct virCgroupStatCache *stats;
     char *str;
     char *p;
     int ret = -1;
     static double scale = -1.0;
 
-    if (virCgroupGetValueStr(group, VIR_CGROUP_CONTROLLER_CPUACCT,
-                             "cpuacct.stat", &str) < 0)
+    if (!(stats = virCgroupStatLock(group)))
         return -1;
 
+    if (virCgroupStatRead(group, stats, VIR_CGROUP_STAT_CPUACCT_STAT,
+                          &str) < 0)
+        goto cleanup;
+
     if (!(p = STRSKIP(str, "user ")) ||
         virStrToLong_ull(p, &p, 10, user) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -3816,7 +4184,234 @@ virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
 
     ret = 0;
  cleanup:
-    VIR_FREE(str);
+    virCgroupStatUnlock(stats);
+    return ret;
+}
+
+
+/*
+ * Bulk statistics of many domains, as virConnectGetAllDomainStats wants
+ * them, are read by walking the partition holding their groups once
+ * instead of going through the domains one by one. The walk learns
+ * which groups to read from virCgroupStatsWalkAddGroup and keeps them,
+ * so their statistics files stay open from one walk to the next.
+ * Groups which vanished from the partition are dropped by the walk.
+ */
+struct _virCgroupStatsWalk {
+    virMutex lock;
+
+    virCgroupPtr partition; /* NULL until the first group is added */
+    virHashTablePtr groups; /* directory name -> virCgroupPtr */
+};
+
+
+static void
+virCgroupStatsWalkGroupFree(void *payload,
+                            const void *name ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr group = payload;
+
+    virCgroupFree(&group);
+}
+
+
+virCgroupStatsWalkPtr
+virCgroupStatsWalkNew(void)
+{
+    virCgroupStatsWalkPtr walk;
+
+    if (VIR_ALLOC(walk) < 0)
+        return NULL;
+
+    if (virMutexInit(&walk->lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        VIR_FREE(walk);
+        return NULL;
+    }
+
+    if (!(walk->groups = virHashCreate(32, virCgroupStatsWalkGroupFree))) {
+        virCgroupStatsWalkFree(walk);
+        return NULL;
+    }
+
+    return walk;
+}
+
+
+void
+virCgroupStatsWalkFree(virCgroupStatsWalkPtr walk)
+{
+    if (!walk)
+        return;
+
+    virHashFree(walk->groups);
+    virCgroupFree(&walk->partition);
+    virMutexDestroy(&walk->lock);
+    VIR_FREE(walk);
+}
+
+
+/**
+ * virCgroupStatsWalkAddGroup:
+ * @walk: the walk
+ * @group: a group to be read by the walk
+ *
+ * Makes virCgroupGetCpuacctStatsAll read the statistics of @group for
+ * as long as it exists. Only the partition holding the first group
+ * added is walked, groups elsewhere are ignored.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCgroupStatsWalkAddGroup(virCgroupStatsWalkPtr walk,
+                           virCgroupPtr group)
+{
+    virCgroupPtr child = NULL;
+    char *partition = NULL;
+    const char *name;
+    size_t partlen;
+    int ret = -1;
+
+    virMutexLock(&walk->lock);
+
+    if (!(name = virCgroupCpuacctName(group, &partlen))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to find the partition of cgroup '%s'"),
+                       group->path);
+        goto cleanup;
+    }
+
+    if (VIR_STRNDUP(partition, virCgroupCpuacctPlacement(group),
+                    partlen) < 0)
+        goto cleanup;
+
+    if (!walk->partition &&
+        virCgroupNew(-1, partition, NULL, -1, &walk->partition) < 0)
+        goto cleanup;
+
+    if (STRNEQ_NULLABLE(virCgroupCpuacctPlacement(walk->partition),
+                        partition) ||
+        virHashLookup(walk->groups, name)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (virCgroupNew(-1, name, walk->partition, -1, &child) < 0 ||
+        virHashAddEntry(walk->groups, name, child) < 0)
+        goto cleanup;
+    child = NULL;
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&walk->lock);
+    virCgroupFree(&child);
+    VIR_FREE(partition);
+    return ret;
+}
+
+
+/**
+ * virCgroupGetCpuacctStatsAll:
+ * @walk: the walk
+ * @table: table to fill in
+ *
+ * Walks the partition of the groups added to @walk once and stores the
+ * CPU accounting of each of them into @table, sorted for
+ * virCgroupCpuacctStatsTableLookup. If groups were requested with
+ * virCgroupCpuacctStatsTableWant, only those are read. The caller may
+ * preallocate the statistics of @table, setting its @maxstats; they are
+ * grown as needed. Groups whose statistics can't be read, e.g. because
+ * their domain is shutting down, are left out of @table.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCgroupGetCpuacctStatsAll(virCgroupStatsWalkPtr walk,
+                            virCgroupCpuacctStatsTablePtr table)
+{
+    virHashTablePtr found = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char *path = NULL;
+    int direrr;
+    int ret = -1;
+
+    virMutexLock(&walk->lock);
+
+    if (!walk->partition) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_STRDUP(table->partition,
+                   virCgroupCpuacctPlacement(walk->partition)) < 0 ||
+        virCgroupPathOfController(walk->partition,
+                                  VIR_CGROUP_CONTROLLER_CPUACCT,
+                                  NULL, &path) < 0)
+        goto cleanup;
+
+    /* Only the groups which are found by this walk are kept */
+    if (!(found = virHashCreate(32, virCgroupStatsWalkGroupFree)))
+        goto cleanup;
+
+    if (virDirOpen(&dir, path) < 0)
+        goto cleanup;
+
+    if (table->wanted)
+        qsort(table->wanted, table->nwanted, sizeof(*table->wanted),
+              virCgroupCpuacctWantedCompare);
+
+    while ((direrr = virDirRead(dir, &ent, path)) > 0) {
+        virCgroupCpuacctStatsPtr stats;
+        virCgroupPtr group;
+        const char *name = ent->d_name;
+
+        if (ent->d_type != DT_DIR ||
+            !(group = virHashSteal(walk->groups, ent->d_name)))
+            continue;
+
+        if (virHashAddEntry(found, ent->d_name, group) < 0) {
+            virCgroupFree(&group);
+            goto cleanup;
+        }
+
+        if (table->wanted &&
+            !bsearch(&name, table->wanted, table->nwanted,
+                     sizeof(*table->wanted), virCgroupCpuacctWantedCompare))
+            continue;
+
+        if (VIR_RESIZE_N(table->stats, table->maxstats, table->nstats, 1) < 0)
+            goto cleanup;
+        stats = &table->stats[table->nstats];
+
+        if (virCgroupGetCpuacctUsage(group, &stats->usage) < 0 ||
+            virCgroupGetCpuacctStat(group, &stats->user, &stats->sys) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        if (VIR_STRDUP(stats->name, ent->d_name) < 0)
+            goto cleanup;
+        table->nstats++;
+    }
+
+    if (direrr < 0)
+        goto cleanup;
+
+    qsort(table->stats, table->nstats, sizeof(*table->stats),
+          virCgroupCpuacctStatsCompare);
+
+    ret = 0;
+
+ cleanup:
+    if (found) {
+        virHashFree(walk->groups);
+        walk->groups = found;
+    }
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(path);
+    virMutexUnlock(&walk->lock);
     return ret;
 }
 
@@ -4820,9 +5415,122 @@ virCgroupControllerAvailable(int controller ATTRIBUTE_UNUSED)
 {
     return false;
 }
+
+
+virCgroupStatsWalkPtr
+virCgroupStatsWalkNew(void)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return NULL;
+}
+
+
+void
+virCgroupStatsWalkFree(virCgroupStatsWalkPtr walk ATTRIBUTE_UNUSED)
+{
+}
+
+
+int
+virCgroupStatsWalkAddGroup(virCgroupStatsWalkPtr walk ATTRIBUTE_UNUSED,
+                           virCgroupPtr group ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
+
+
+int
+virCgroupGetCpuacctStatsAll(virCgroupStatsWalkPtr walk ATTRIBUTE_UNUSED,
+                            virCgroupCpuacctStatsTablePtr table ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Control groups not supported on this platform"));
+    return -1;
+}
 #endif /* !VIR_CGROUP_SUPPORTED */
 
 
+/**
+ * virCgroupCpuacctStatsTableWant:
+ * @table: table to be filled by virCgroupGetCpuacctStatsAll
+ * @group: a group to read, may be NULL
+ *
+ * Restricts virCgroupGetCpuacctStatsAll to the groups passed here,
+ * rather than all groups known to the walk. A @group with no cpuacct
+ * placement is ignored.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCgroupCpuacctStatsTableWant(virCgroupCpuacctStatsTablePtr table,
+                               virCgroupPtr group)
+{
+    const char *name;
+    char *tmp = NULL;
+    size_t partlen;
+
+    if (!(name = virCgroupCpuacctName(group, &partlen)))
+        return 0;
+
+    if (VIR_STRDUP(tmp, name) < 0 ||
+        VIR_APPEND_ELEMENT(table->wanted, table->nwanted, tmp) < 0) {
+        VIR_FREE(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virCgroupCpuacctStatsTableLookup:
+ * @table: table filled by virCgroupGetCpuacctStatsAll
+ * @group: the group to look up
+ *
+ * Returns the statistics of @group in @table, or NULL if @table
+ * doesn't hold them.
+ */
+virCgroupCpuacctStatsPtr
+virCgroupCpuacctStatsTableLookup(virCgroupCpuacctStatsTablePtr table,
+                                 virCgroupPtr group)
+{
+    virCgroupCpuacctStats key;
+    const char *name;
+    size_t partlen;
+
+    if (!table->nstats ||
+        !(name = virCgroupCpuacctName(group, &partlen)) ||
+        strlen(table->partition) != partlen ||
+        !STRPREFIX(virCgroupCpuacctPlacement(group), table->partition))
+        return NULL;
+
+    key.name = (char *) name;
+
+    return bsearch(&key, table->stats, table->nstats, sizeof(*table->stats),
+                   virCgroupCpuacctStatsCompare);
+}
+
+
+void
+virCgroupCpuacctStatsTableClear(virCgroupCpuacctStatsTablePtr table)
+{
+    size_t i;
+
+    for (i = 0; i < table->nstats; i++)
+        VIR_FREE(table->stats[i].name);
+    VIR_FREE(table->stats);
+    VIR_FREE(table->partition);
+    table->nstats = 0;
+    table->maxstats = 0;
+    virStringFreeListCount(table->wanted, table->nwanted);
+    table->wanted = NULL;
+    table->nwanted = 0;
+}
+
+
 int
 virCgroupDelThread(virCgroupPtr cgroup,
                    virCgroupThreadName nameval,
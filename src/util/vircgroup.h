@@ -263,6 +263,44 @@ int virCgroupGetCpuacctPercpuUsage(virCgroupPtr group, char **usage);
 int virCgroupGetCpuacctStat(virCgroupPtr group, unsigned long long *user,
                             unsigned long long *sys);
 
+typedef struct _virCgroupStatsWalk virCgroupStatsWalk;
+typedef virCgroupStatsWalk *virCgroupStatsWalkPtr;
+
+typedef struct _virCgroupCpuacctStats virCgroupCpuacctStats;
+typedef virCgroupCpuacctStats *virCgroupCpuacctStatsPtr;
+struct _virCgroupCpuacctStats {
+    char *name;               /* directory of the group in the partition */
+    unsigned long long usage; /* total CPU time in nanoseconds */
+    unsigned long long user;  /* user CPU time in nanoseconds */
+    unsigned long long sys;   /* system CPU time in nanoseconds */
+};
+
+typedef struct _virCgroupCpuacctStatsTable virCgroupCpuacctStatsTable;
+typedef virCgroupCpuacctStatsTable *virCgroupCpuacctStatsTablePtr;
+struct _virCgroupCpuacctStatsTable {
+    char *partition;                /* placement of the partition walked */
+    virCgroupCpuacctStatsPtr stats; /* sorted by name */
+    size_t nstats;
+    size_t maxstats;
+
+    char **wanted;                  /* groups to read, NULL for all */
+    size_t nwanted;
+};
+
+virCgroupStatsWalkPtr virCgroupStatsWalkNew(void);
+void virCgroupStatsWalkFree(virCgroupStatsWalkPtr walk);
+int virCgroupStatsWalkAddGroup(virCgroupStatsWalkPtr walk,
+                               virCgroupPtr group);
+
+int virCgroupGetCpuacctStatsAll(virCgroupStatsWalkPtr walk,
+                                virCgroupCpuacctStatsTablePtr table);
+int virCgroupCpuacctStatsTableWant(virCgroupCpuacctStatsTablePtr table,
+                                   virCgroupPtr group);
+virCgroupCpuacctStatsPtr
+virCgroupCpuacctStatsTableLookup(virCgroupCpuacctStatsTablePtr table,
+                                 virCgroupPtr group);
+void virCgroupCpuacctStatsTableClear(virCgroupCpuacctStatsTablePtr table);
+
 int virCgroupSetFreezerState(virCgroupPtr group, const char *state);
 int virCgroupGetFreezerState(virCgroupPtr group, char **state);
 
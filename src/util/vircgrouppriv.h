@@ -30,6 +30,7 @@
 # define __VIR_CGROUP_PRIV_H__
 
 # include "vircgroup.h"
+# include "virthread.h"
 
 struct virCgroupController {
     int type;
@@ -42,10 +43,33 @@ struct virCgroupController {
     char *placement;
 };
 
+/* Statistics files read through virCgroupStatRead */
+typedef enum {
+    VIR_CGROUP_STAT_CPUACCT_USAGE,
+    VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU,
+    VIR_CGROUP_STAT_CPUACCT_STAT,
+
+    VIR_CGROUP_STAT_LAST
+} virCgroupStatFile;
+
+struct virCgroupStatCache {
+    virMutex lock;                 /* guards the rest, see virCgroupStatLock */
+
+    int fds[VIR_CGROUP_STAT_LAST]; /* kept open, -1 if not */
+    char *buf;                     /* contents of the last file read */
+    size_t bufsize;
+
+    /* vCPU sub-groups, indexed by vCPU id, NULL if not used yet */
+    virCgroupPtr *vcpus;
+    size_t nvcpus;
+};
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    struct virCgroupStatCache *stats; /* NULL until the first stats read */
 };
 
 int virCgroupDetectMountsFromFile(virCgroupPtr group,
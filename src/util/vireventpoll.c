@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
 
 #include "virthread.h"
 #include "virlog.h"
@@ -47,6 +50,11 @@
 
 VIR_LOG_INIT("util.eventpoll");
 
+VIR_ENUM_IMPL(virEventPollBackend, VIR_EVENT_POLL_BACKEND_LAST,
+              "default",
+              "poll",
+              "epoll");
+
 static int virEventPollInterruptLocked(void);
 
 /* State for a single file handle being monitored */
@@ -58,6 +66,8 @@ struct virEventPollHandle {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    /* Next handle registered against the same fd */
+    struct virEventPollHandle *fdNext;
 };
 
 /* State for a single timer being generated */
@@ -69,6 +79,20 @@ struct virEventPollTimeout {
     virFreeCallback ff;
     void *opaque;
     int deleted;
+    /* Position in the timer heap, -1 if the timer is not armed */
+    ssize_t heapIndex;
+};
+
+/* State for a single file descriptor watched by the epoll backend */
+struct virEventPollFD {
+    /* All handles registered against this fd, in registration order */
+    struct virEventPollHandle *handles;
+    /* Union of events currently requested from the kernel */
+    int events;
+    bool registered;
+    /* errno from epoll_ctl if the fd could not be registered, in
+     * which case its readiness is emulated the way poll() reports it */
+    int error;
 };
 
 /* Allocate extra slots for virEventPollHandle/virEventPollTimeout
@@ -81,12 +105,42 @@ struct virEventPollLoop {
     int running;
     virThread leader;
     int wakeupfd[2];
+    virEventPollBackend backend;
+
+    /* Both lists are kept sorted by watch / timer ID, which allows
+     * the lookups by ID to use a binary search */
     size_t handlesCount;
     size_t handlesAlloc;
-    struct virEventPollHandle *handles;
+    struct virEventPollHandle **handles;
     size_t timeoutsCount;
     size_t timeoutsAlloc;
-    struct virEventPollTimeout *timeouts;
+    struct virEventPollTimeout **timeouts;
+
+    /* Binary min-heap of armed timers ordered by expiresAt. It is
+     * always allocated to hold every registered timer, so arming a
+     * timer can not fail */
+    size_t heapCount;
+    size_t heapAlloc;
+    struct virEventPollTimeout **heap;
+
+    /* Scratch list of timers found expired by a dispatch round */
+    size_t dueAlloc;
+    struct virEventPollTimeout **due;
+
+    /* poll() backend: the pollfd array is reused between iterations */
+    size_t pollfdsAlloc;
+    struct pollfd *pollfds;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* epoll() backend: registrations are persistent and every
+     * event maps straight to its handles via the fd table */
+    int epollfd;
+    size_t fdsAlloc;
+    struct virEventPollFD *fds;
+    size_t fdsEmulated;
+    size_t epollEventsAlloc;
+    struct epoll_event *epollEvents;
+#endif
 };
 
 /* Only have one event loop */
@@ -98,6 +152,186 @@ static int nextWatch = 1;
 /* Unique ID for the next timer to be registered */
 static int nextTimer = 1;
 
+
+static int
+virEventPollHandleCompare(const void *key, const void *elem)
+{
+    int watch = *(const int *)key;
+    const struct virEventPollHandle *handle =
+        *(struct virEventPollHandle *const *)elem;
+
+    if (watch < handle->watch)
+        return -1;
+    return watch > handle->watch;
+}
+
+static struct virEventPollHandle *
+virEventPollFindHandle(int watch)
+{
+    struct virEventPollHandle **handle;
+
+    handle = bsearch(&watch, eventLoop.handles, eventLoop.handlesCount,
+                     sizeof(*eventLoop.handles), virEventPollHandleCompare);
+    return handle ? *handle : NULL;
+}
+
+static int
+virEventPollTimeoutCompare(const void *key, const void *elem)
+{
+    int timer = *(const int *)key;
+    const struct virEventPollTimeout *timeout =
+        *(struct virEventPollTimeout *const *)elem;
+
+    if (timer < timeout->timer)
+        return -1;
+    return timer > timeout->timer;
+}
+
+static struct virEventPollTimeout *
+virEventPollFindTimeout(int timer)
+{
+    struct virEventPollTimeout **timeout;
+
+    timeout = bsearch(&timer, eventLoop.timeouts, eventLoop.timeoutsCount,
+                      sizeof(*eventLoop.timeouts), virEventPollTimeoutCompare);
+    return timeout ? *timeout : NULL;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * Recompute the set of events wanted on @fd from all live handles
+ * registered against it and push it down to the kernel. A fd with
+ * no events wanted is dropped from the epoll set entirely, since
+ * epoll would otherwise still report errors and hangups on it.
+ */
+static void
+virEventPollEpollUpdateFD(int fd)
+{
+    struct virEventPollFD *pfd;
+    struct virEventPollHandle *handle;
+    struct epoll_event ev;
+    bool wasEmulated;
+    int events = 0;
+    int rc;
+    char ebuf[1024];
+
+    if (fd < 0 || fd >= eventLoop.fdsAlloc)
+        return;
+
+    pfd = &eventLoop.fds[fd];
+    for (handle = pfd->handles; handle; handle = handle->fdNext) {
+        if (!handle->deleted)
+            events |= handle->events;
+    }
+
+    if (events == pfd->events && pfd->error == 0)
+        return;
+
+    wasEmulated = pfd->error != 0 && pfd->events != 0;
+
+    if (events == 0) {
+        if (pfd->registered &&
+            epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, NULL) < 0)
+            EVENT_DEBUG("Unable to remove fd %d from epoll set: %d",
+                        fd, errno);
+        pfd->registered = false;
+        pfd->error = 0;
+    } else {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+
+        /* The kernel drops registrations of closed fds behind our
+         * back, and a registration might outlive a handle removal
+         * when the fd was closed first, so retry with the other op */
+        if (pfd->registered) {
+            if ((rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev)) < 0 &&
+                errno == ENOENT)
+                rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, fd, &ev);
+        } else {
+            if ((rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, fd, &ev)) < 0 &&
+                errno == EEXIST)
+                rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev);
+        }
+
+        if (rc < 0) {
+            pfd->error = errno;
+            pfd->registered = false;
+            /* Regular files can not be watched, but poll() treats them
+             * as always ready, so that case is expected */
+            if (pfd->error != EPERM)
+                VIR_WARN("Unable to watch fd %d with epoll: %s",
+                         fd, virStrerror(pfd->error, ebuf, sizeof(ebuf)));
+        } else {
+            pfd->error = 0;
+            pfd->registered = true;
+        }
+    }
+
+    pfd->events = events;
+
+    if (wasEmulated)
+        eventLoop.fdsEmulated--;
+    if (pfd->error != 0 && pfd->events != 0)
+        eventLoop.fdsEmulated++;
+}
+
+
+static int
+virEventPollEpollAddHandle(struct virEventPollHandle *handle)
+{
+    struct virEventPollHandle **tail;
+
+    if (handle->fd < 0)
+        return 0;
+
+    if (handle->fd >= eventLoop.fdsAlloc &&
+        VIR_RESIZE_N(eventLoop.fds, eventLoop.fdsAlloc,
+                     eventLoop.fdsAlloc, handle->fd + 1 - eventLoop.fdsAlloc) < 0)
+        return -1;
+
+    for (tail = &eventLoop.fds[handle->fd].handles; *tail;
+         tail = &(*tail)->fdNext)
+        ;
+    *tail = handle;
+
+    virEventPollEpollUpdateFD(handle->fd);
+    return 0;
+}
+
+
+static void
+virEventPollEpollRemoveHandle(struct virEventPollHandle *handle)
+{
+    struct virEventPollHandle **prev;
+
+    if (handle->fd < 0 || handle->fd >= eventLoop.fdsAlloc)
+        return;
+
+    for (prev = &eventLoop.fds[handle->fd].handles; *prev;
+         prev = &(*prev)->fdNext) {
+        if (*prev == handle) {
+            *prev = handle->fdNext;
+            break;
+        }
+    }
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+/* Push changes of the handle's event set to the backend, if it
+ * keeps persistent state about the watched fds */
+static void
+virEventPollUpdateBackendHandle(struct virEventPollHandle *handle)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (eventLoop.backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+        virEventPollEpollUpdateFD(handle->fd);
+#endif
+}
+
+
 /*
  * Register a callback for monitoring file handle events.
  * NB, it *must* be safe to call this from within a callback
@@ -108,7 +342,12 @@ int virEventPollAddHandle(int fd, int events,
                           void *opaque,
                           virFreeCallback ff)
 {
+    struct virEventPollHandle *handle;
     int watch;
+
+    if (VIR_ALLOC(handle) < 0)
+        return -1;
+
     virMutexLock(&eventLoop.lock);
     if (eventLoop.handlesCount == eventLoop.handlesAlloc) {
         EVENT_DEBUG("Used %zu handle slots, adding at least %d more",
@@ -116,24 +355,33 @@ int virEventPollAddHandle(int fd, int events,
         if (VIR_RESIZE_N(eventLoop.handles, eventLoop.handlesAlloc,
                          eventLoop.handlesCount, EVENT_ALLOC_EXTENT) < 0) {
             virMutexUnlock(&eventLoop.lock);
+            VIR_FREE(handle);
             return -1;
         }
     }
 
-    watch = nextWatch++;
+    handle->fd = fd;
+    handle->events = virEventPollToNativeEvents(events);
+    handle->cb = cb;
+    handle->ff = ff;
+    handle->opaque = opaque;
+    handle->deleted = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (eventLoop.backend == VIR_EVENT_POLL_BACKEND_EPOLL &&
+        virEventPollEpollAddHandle(handle) < 0) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_FREE(handle);
+        return -1;
+    }
+#endif
 
-    eventLoop.handles[eventLoop.handlesCount].watch = watch;
-    eventLoop.handles[eventLoop.handlesCount].fd = fd;
-    eventLoop.handles[eventLoop.handlesCount].events =
-                                         virEventPollToNativeEvents(events);
-    eventLoop.handles[eventLoop.handlesCount].cb = cb;
-    eventLoop.handles[eventLoop.handlesCount].ff = ff;
-    eventLoop.handles[eventLoop.handlesCount].opaque = opaque;
-    eventLoop.handles[eventLoop.handlesCount].deleted = 0;
+    watch = handle->watch = nextWatch++;
+    eventLoop.handles[eventLoop.handlesCount++] = handle;
 
-    eventLoop.handlesCount++;
-
-    virEventPollInterruptLocked();
+    /* The epoll backend picks up new registrations while waiting */
+    if (eventLoop.backend != VIR_EVENT_POLL_BACKEND_EPOLL)
+        virEventPollInterruptLocked();
 
     PROBE(EVENT_POLL_ADD_HANDLE,
           "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
@@ -145,7 +393,7 @@ int virEventPollAddHandle(int fd, int events,
 
 void virEventPollUpdateHandle(int watch, int events)
 {
-    size_t i;
+    struct virEventPollHandle *handle;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_HANDLE,
           "watch=%d events=%d",
@@ -157,14 +405,12 @@ void virEventPollUpdateHandle(int watch, int events)
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].watch == watch) {
-            eventLoop.handles[i].events =
-                    virEventPollToNativeEvents(events);
+    if ((handle = virEventPollFindHandle(watch))) {
+        handle->events = virEventPollToNativeEvents(events);
+        virEventPollUpdateBackendHandle(handle);
+        if (eventLoop.backend != VIR_EVENT_POLL_BACKEND_EPOLL)
             virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+        found = true;
     }
     virMutexUnlock(&eventLoop.lock);
 
@@ -180,7 +426,7 @@ void virEventPollUpdateHandle(int watch, int events)
  */
 int virEventPollRemoveHandle(int watch)
 {
-    size_t i;
+    struct virEventPollHandle *handle;
     PROBE(EVENT_POLL_REMOVE_HANDLE,
           "watch=%d",
           watch);
@@ -191,20 +437,110 @@ int virEventPollRemoveHandle(int watch)
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].deleted)
-            continue;
-
-        if (eventLoop.handles[i].watch == watch) {
-            EVENT_DEBUG("mark delete %zu %d", i, eventLoop.handles[i].fd);
-            eventLoop.handles[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    handle = virEventPollFindHandle(watch);
+    if (!handle || handle->deleted) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
     }
+
+    EVENT_DEBUG("mark delete %d %d", handle->watch, handle->fd);
+    handle->deleted = 1;
+    virEventPollUpdateBackendHandle(handle);
+    virEventPollInterruptLocked();
     virMutexUnlock(&eventLoop.lock);
-    return -1;
+    return 0;
+}
+
+
+/*
+ * The timer heap. Only armed timers, that is those not deleted
+ * and with a non-negative frequency, live in the heap, so the
+ * next timer to expire is always found at its root.
+ */
+static void
+virEventPollTimeoutHeapSet(size_t i, struct virEventPollTimeout *timeout)
+{
+    eventLoop.heap[i] = timeout;
+    timeout->heapIndex = i;
+}
+
+static void
+virEventPollTimeoutHeapUp(size_t i)
+{
+    struct virEventPollTimeout *timeout = eventLoop.heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+
+        if (eventLoop.heap[parent]->expiresAt <= timeout->expiresAt)
+            break;
+
+        virEventPollTimeoutHeapSet(i, eventLoop.heap[parent]);
+        i = parent;
+    }
+    virEventPollTimeoutHeapSet(i, timeout);
+}
+
+static void
+virEventPollTimeoutHeapDown(size_t i)
+{
+    struct virEventPollTimeout *timeout = eventLoop.heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= eventLoop.heapCount)
+            break;
+        if (child + 1 < eventLoop.heapCount &&
+            eventLoop.heap[child + 1]->expiresAt < eventLoop.heap[child]->expiresAt)
+            child++;
+        if (timeout->expiresAt <= eventLoop.heap[child]->expiresAt)
+            break;
+
+        virEventPollTimeoutHeapSet(i, eventLoop.heap[child]);
+        i = child;
+    }
+    virEventPollTimeoutHeapSet(i, timeout);
+}
+
+static void
+virEventPollTimeoutHeapRemove(struct virEventPollTimeout *timeout)
+{
+    struct virEventPollTimeout *last;
+    size_t i = timeout->heapIndex;
+
+    if (timeout->heapIndex < 0)
+        return;
+
+    timeout->heapIndex = -1;
+    if (i == --eventLoop.heapCount)
+        return;
+
+    last = eventLoop.heap[eventLoop.heapCount];
+    virEventPollTimeoutHeapSet(i, last);
+    virEventPollTimeoutHeapUp(i);
+    virEventPollTimeoutHeapDown(last->heapIndex);
+}
+
+/*
+ * Place the timer in the heap according to its current state,
+ * after its frequency, expiry time or deleted flag changed.
+ */
+static void
+virEventPollTimeoutReschedule(struct virEventPollTimeout *timeout)
+{
+    if (timeout->deleted || timeout->frequency < 0) {
+        virEventPollTimeoutHeapRemove(timeout);
+        return;
+    }
+
+    if (timeout->heapIndex < 0) {
+        virEventPollTimeoutHeapSet(eventLoop.heapCount++, timeout);
+        virEventPollTimeoutHeapUp(timeout->heapIndex);
+    } else {
+        virEventPollTimeoutHeapUp(timeout->heapIndex);
+        virEventPollTimeoutHeapDown(timeout->heapIndex);
+    }
 }
 
 
@@ -218,34 +554,41 @@ int virEventPollAddTimeout(int frequency,
                            void *opaque,
                            virFreeCallback ff)
 {
+    struct virEventPollTimeout *timeout;
     unsigned long long now;
     int ret;
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
+    if (VIR_ALLOC(timeout) < 0)
+        return -1;
+
     virMutexLock(&eventLoop.lock);
     if (eventLoop.timeoutsCount == eventLoop.timeoutsAlloc) {
         EVENT_DEBUG("Used %zu timeout slots, adding at least %d more",
                     eventLoop.timeoutsAlloc, EVENT_ALLOC_EXTENT);
         if (VIR_RESIZE_N(eventLoop.timeouts, eventLoop.timeoutsAlloc,
-                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
-            virMutexUnlock(&eventLoop.lock);
-            return -1;
-        }
+                         eventLoop.timeoutsCount, EVENT_ALLOC_EXTENT) < 0)
+            goto error;
     }
+    if (VIR_RESIZE_N(eventLoop.heap, eventLoop.heapAlloc,
+                     eventLoop.timeoutsCount, 1) < 0)
+        goto error;
+
+    timeout->timer = nextTimer++;
+    timeout->frequency = frequency;
+    timeout->cb = cb;
+    timeout->ff = ff;
+    timeout->opaque = opaque;
+    timeout->deleted = 0;
+    timeout->expiresAt = frequency >= 0 ? frequency + now : 0;
+    timeout->heapIndex = -1;
 
-    eventLoop.timeouts[eventLoop.timeoutsCount].timer = nextTimer++;
-    eventLoop.timeouts[eventLoop.timeoutsCount].frequency = frequency;
-    eventLoop.timeouts[eventLoop.timeoutsCount].cb = cb;
-    eventLoop.timeouts[eventLoop.timeoutsCount].ff = ff;
-    eventLoop.timeouts[eventLoop.timeoutsCount].opaque = opaque;
-    eventLoop.timeouts[eventLoop.timeoutsCount].deleted = 0;
-    eventLoop.timeouts[eventLoop.timeoutsCount].expiresAt =
-        frequency >= 0 ? frequency + now : 0;
+    eventLoop.timeouts[eventLoop.timeoutsCount++] = timeout;
+    virEventPollTimeoutReschedule(timeout);
 
-    eventLoop.timeoutsCount++;
-    ret = nextTimer-1;
+    ret = timeout->timer;
     virEventPollInterruptLocked();
 
     PROBE(EVENT_POLL_ADD_TIMEOUT,
@@ -253,12 +596,17 @@ int virEventPollAddTimeout(int frequency,
           ret, frequency, cb, opaque, ff);
     virMutexUnlock(&eventLoop.lock);
     return ret;
+
+ error:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(timeout);
+    return -1;
 }
 
 void virEventPollUpdateTimeout(int timer, int frequency)
 {
+    struct virEventPollTimeout *timeout;
     unsigned long long now;
-    size_t i;
     bool found = false;
     PROBE(EVENT_POLL_UPDATE_TIMEOUT,
           "timer=%d frequency=%d",
@@ -273,17 +621,15 @@ void virEventPollUpdateTimeout(int timer, int frequency)
         return;
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].frequency = frequency;
-            eventLoop.timeouts[i].expiresAt =
-                frequency >= 0 ? frequency + now : 0;
-            VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
-                      eventLoop.timeouts[i].expiresAt);
-            virEventPollInterruptLocked();
-            found = true;
-            break;
-        }
+    if ((timeout = virEventPollFindTimeout(timer))) {
+        timeout->frequency = frequency;
+        timeout->expiresAt =
+            frequency >= 0 ? frequency + now : 0;
+        VIR_DEBUG("Set timer freq=%d expires=%llu", frequency,
+                  timeout->expiresAt);
+        virEventPollTimeoutReschedule(timeout);
+        virEventPollInterruptLocked();
+        found = true;
     }
     virMutexUnlock(&eventLoop.lock);
 
@@ -299,7 +645,7 @@ void virEventPollUpdateTimeout(int timer, int frequency)
  */
 int virEventPollRemoveTimeout(int timer)
 {
-    size_t i;
+    struct virEventPollTimeout *timeout;
     PROBE(EVENT_POLL_REMOVE_TIMEOUT,
           "timer=%d",
           timer);
@@ -310,23 +656,21 @@ int virEventPollRemoveTimeout(int timer)
     }
 
     virMutexLock(&eventLoop.lock);
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-
-        if (eventLoop.timeouts[i].timer == timer) {
-            eventLoop.timeouts[i].deleted = 1;
-            virEventPollInterruptLocked();
-            virMutexUnlock(&eventLoop.lock);
-            return 0;
-        }
+    timeout = virEventPollFindTimeout(timer);
+    if (!timeout || timeout->deleted) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
     }
+
+    timeout->deleted = 1;
+    virEventPollTimeoutReschedule(timeout);
+    virEventPollInterruptLocked();
     virMutexUnlock(&eventLoop.lock);
-    return -1;
+    return 0;
 }
 
-/* Iterates over all registered timeouts and determine which
- * will be the first to expire.
+/* Determine when the first of the armed timers will expire,
+ * which is always the one at the root of the timer heap.
  * @timeout: filled with expiry time of soonest timer, or -1 if
  *           no timeout is pending
  * returns: 0 on success, -1 on error
@@ -334,19 +678,11 @@ int virEventPollRemoveTimeout(int timer)
 static int virEventPollCalculateTimeout(int *timeout)
 {
     unsigned long long then = 0;
-    size_t i;
-    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.timeoutsCount);
-    /* Figure out if we need a timeout */
-    for (i = 0; i < eventLoop.timeoutsCount; i++) {
-        if (eventLoop.timeouts[i].deleted)
-            continue;
-        if (eventLoop.timeouts[i].frequency < 0)
-            continue;
+    EVENT_DEBUG("Calculate expiry of %zu timers", eventLoop.heapCount);
 
-        EVENT_DEBUG("Got a timeout scheduled for %llu", eventLoop.timeouts[i].expiresAt);
-        if (then == 0 ||
-            eventLoop.timeouts[i].expiresAt < then)
-            then = eventLoop.timeouts[i].expiresAt;
+    if (eventLoop.heapCount > 0) {
+        then = eventLoop.heap[0]->expiresAt;
+        EVENT_DEBUG("Got a timeout scheduled for %llu", then);
     }
 
     /* Calculate how long we should wait for a timeout if needed */
@@ -374,35 +710,31 @@ static int virEventPollCalculateTimeout(int *timeout)
 }
 
 /*
- * Allocate a pollfd array containing data for all registered
- * file handles. The caller must free the returned data struct
+ * Fill the reusable pollfd array with data for all registered
+ * file handles.
  * returns: the pollfd array, or NULL on error
  */
 static struct pollfd *virEventPollMakePollFDs(int *nfds) {
     struct pollfd *fds;
     size_t i;
 
-    *nfds = 0;
-    for (i = 0; i < eventLoop.handlesCount; i++) {
-        if (eventLoop.handles[i].events && !eventLoop.handles[i].deleted)
-            (*nfds)++;
-    }
-
-    /* Setup the poll file handle data structs */
-    if (VIR_ALLOC_N(fds, *nfds) < 0)
+    if (VIR_RESIZE_N(eventLoop.pollfds, eventLoop.pollfdsAlloc,
+                     0, MAX(eventLoop.handlesCount, 1)) < 0)
         return NULL;
+    fds = eventLoop.pollfds;
 
     *nfds = 0;
     for (i = 0; i < eventLoop.handlesCount; i++) {
+        struct virEventPollHandle *handle = eventLoop.handles[i];
         EVENT_DEBUG("Prepare n=%zu w=%d, f=%d e=%d d=%d", i,
-                    eventLoop.handles[i].watch,
-                    eventLoop.handles[i].fd,
-                    eventLoop.handles[i].events,
-                    eventLoop.handles[i].deleted);
-        if (!eventLoop.handles[i].events || eventLoop.handles[i].deleted)
+                    handle->watch,
+                    handle->fd,
+                    handle->events,
+                    handle->deleted);
+        if (!handle->events || handle->deleted)
             continue;
-        fds[*nfds].fd = eventLoop.handles[i].fd;
-        fds[*nfds].events = eventLoop.handles[i].events;
+        fds[*nfds].fd = handle->fd;
+        fds[*nfds].events = handle->events;
         fds[*nfds].revents = 0;
         (*nfds)++;
     }
@@ -411,10 +743,20 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 }
 
 
+static int
+virEventPollTimeoutCompareDue(const void *a, const void *b)
+{
+    const struct virEventPollTimeout *ta = *(struct virEventPollTimeout *const *)a;
+    const struct virEventPollTimeout *tb = *(struct virEventPollTimeout *const *)b;
+
+    return ta->timer < tb->timer ? -1 : ta->timer > tb->timer;
+}
+
+
 /*
- * Iterate over all timers and determine if any have expired.
- * Invoke the user supplied callback for each timer whose
- * expiry time is met, and schedule the next timeout. Does
+ * Collect all timers whose expiry time is met and invoke
+ * the user supplied callback for each of them, in the order
+ * they were registered, and schedule the next timeout. Does
  * not try to 'catch up' on time if the actual expiry time
  * was later than the requested time.
  *
@@ -426,37 +768,69 @@ static struct pollfd *virEventPollMakePollFDs(int *nfds) {
 static int virEventPollDispatchTimeouts(void)
 {
     unsigned long long now;
+    unsigned long long then;
+    size_t ndue = 0;
     size_t i;
-    /* Save this now - it may be changed during dispatch */
-    int ntimeouts = eventLoop.timeoutsCount;
-    VIR_DEBUG("Dispatch %d", ntimeouts);
+    VIR_DEBUG("Dispatch %zu", eventLoop.heapCount);
 
     if (virTimeMillisNow(&now) < 0)
         return -1;
 
-    for (i = 0; i < ntimeouts; i++) {
-        if (eventLoop.timeouts[i].deleted || eventLoop.timeouts[i].frequency < 0)
+    if (eventLoop.heapCount == 0)
+        return 0;
+
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    then = now + 20;
+
+    if (VIR_RESIZE_N(eventLoop.due, eventLoop.dueAlloc,
+                     0, eventLoop.heapCount) < 0)
+        return -1;
+
+    /* Expired timers form a subtree rooted at the top of the heap,
+     * so walk it breadth first using the result list as the queue */
+    if (eventLoop.heap[0]->expiresAt <= then)
+        eventLoop.due[ndue++] = eventLoop.heap[0];
+    for (i = 0; i < ndue; i++) {
+        size_t child = 2 * eventLoop.due[i]->heapIndex + 1;
+
+        if (child < eventLoop.heapCount &&
+            eventLoop.heap[child]->expiresAt <= then)
+            eventLoop.due[ndue++] = eventLoop.heap[child];
+        if (child + 1 < eventLoop.heapCount &&
+            eventLoop.heap[child + 1]->expiresAt <= then)
+            eventLoop.due[ndue++] = eventLoop.heap[child + 1];
+    }
+
+    qsort(eventLoop.due, ndue, sizeof(*eventLoop.due),
+          virEventPollTimeoutCompareDue);
+
+    for (i = 0; i < ndue; i++) {
+        struct virEventPollTimeout *timeout = eventLoop.due[i];
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+
+        /* An earlier callback may have deleted or rescheduled it */
+        if (timeout->deleted || timeout->frequency < 0 ||
+            timeout->expiresAt > then)
             continue;
 
-        /* Add 20ms fuzz so we don't pointlessly spin doing
-         * <10ms sleeps, particularly on kernels with low HZ
-         * it is fine that a timer expires 20ms earlier than
-         * requested
-         */
-        if (eventLoop.timeouts[i].expiresAt <= (now+20)) {
-            virEventTimeoutCallback cb = eventLoop.timeouts[i].cb;
-            int timer = eventLoop.timeouts[i].timer;
-            void *opaque = eventLoop.timeouts[i].opaque;
-            eventLoop.timeouts[i].expiresAt =
-                now + eventLoop.timeouts[i].frequency;
-
-            PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
-                  "timer=%d",
-                  timer);
-            virMutexUnlock(&eventLoop.lock);
-            (cb)(timer, opaque);
-            virMutexLock(&eventLoop.lock);
-        }
+        cb = timeout->cb;
+        timer = timeout->timer;
+        opaque = timeout->opaque;
+        timeout->expiresAt = now + timeout->frequency;
+        virEventPollTimeoutReschedule(timeout);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
     }
     return 0;
 }
@@ -481,25 +855,28 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
      * fds might be added on end of list, and they're not
      * in the fds array we've got */
     for (i = 0, n = 0; n < nfds && i < eventLoop.handlesCount; n++) {
+        struct virEventPollHandle *handle;
+
         while (i < eventLoop.handlesCount &&
-               (eventLoop.handles[i].fd != fds[n].fd ||
-                eventLoop.handles[i].events == 0)) {
+               (eventLoop.handles[i]->fd != fds[n].fd ||
+                eventLoop.handles[i]->events == 0)) {
             i++;
         }
         if (i == eventLoop.handlesCount)
             break;
 
-        VIR_DEBUG("i=%zu w=%d", i, eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].deleted) {
+        handle = eventLoop.handles[i];
+        VIR_DEBUG("i=%zu w=%d", i, handle->watch);
+        if (handle->deleted) {
             EVENT_DEBUG("Skip deleted n=%zu w=%d f=%d", i,
-                        eventLoop.handles[i].watch, eventLoop.handles[i].fd);
+                        handle->watch, handle->fd);
             continue;
         }
 
         if (fds[n].revents) {
-            virEventHandleCallback cb = eventLoop.handles[i].cb;
-            int watch = eventLoop.handles[i].watch;
-            void *opaque = eventLoop.handles[i].opaque;
+            virEventHandleCallback cb = handle->cb;
+            int watch = handle->watch;
+            void *opaque = handle->opaque;
             int hEvents = virEventPollFromNativeEvents(fds[n].revents);
             PROBE(EVENT_POLL_DISPATCH_HANDLE,
                   "watch=%d events=%d",
@@ -514,6 +891,86 @@ static int virEventPollDispatchHandles(int nfds, struct pollfd *fds)
 }
 
 
+#ifdef HAVE_SYS_EPOLL_H
+/* Invoke the callback of every handle registered against @fd
+ * which is interested in the reported events. Handles with a
+ * watch of @lastWatch or newer were added after the events were
+ * collected and are left for the next iteration.
+ */
+static void virEventPollDispatchFD(int fd, int revents, int lastWatch)
+{
+    struct virEventPollHandle *handle;
+
+    if (fd < 0 || fd >= eventLoop.fdsAlloc)
+        return;
+
+    /* NB, deleted handles are only unlinked from the list by
+     * virEventPollCleanupHandles, so it is safe to keep walking
+     * it after a callback dropped the lock */
+    for (handle = eventLoop.fds[fd].handles; handle; handle = handle->fdNext) {
+        virEventHandleCallback cb;
+        int watch;
+        void *opaque;
+        int hEvents;
+
+        if (handle->deleted || handle->events == 0 ||
+            handle->watch >= lastWatch)
+            continue;
+
+        if (!(hEvents = revents & (handle->events | POLLERR | POLLHUP | POLLNVAL)))
+            continue;
+
+        cb = handle->cb;
+        watch = handle->watch;
+        opaque = handle->opaque;
+        hEvents = virEventPollFromNativeEvents(hEvents);
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+}
+
+
+/* Dispatch the events reported by epoll_wait(), and the fake
+ * readiness of any fds epoll refused to watch.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventPollDispatchEpoll(int nevents, int lastWatch)
+{
+    size_t i;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (i = 0; i < nevents; i++)
+        virEventPollDispatchFD(eventLoop.epollEvents[i].data.fd,
+                               eventLoop.epollEvents[i].events,
+                               lastWatch);
+
+    for (i = 0; eventLoop.fdsEmulated > 0 && i < eventLoop.fdsAlloc; i++) {
+        struct virEventPollFD *pfd = &eventLoop.fds[i];
+        int revents;
+
+        if (pfd->error == 0 || pfd->events == 0)
+            continue;
+
+        if (pfd->error == EPERM)
+            revents = pfd->events & (POLLIN | POLLOUT);
+        else if (pfd->error == EBADF)
+            revents = POLLNVAL;
+        else
+            revents = POLLERR;
+
+        virEventPollDispatchFD(i, revents, lastWatch);
+    }
+
+    return 0;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+
 /* Used post dispatch to actually remove any timers that
  * were previously marked as deleted. This asynchronous
  * cleanup is needed to make dispatch re-entrant safe.
@@ -528,17 +985,19 @@ static void virEventPollCleanupTimeouts(void)
      * entries as needed to form contiguous series
      */
     for (i = 0; i < eventLoop.timeoutsCount;) {
-        if (!eventLoop.timeouts[i].deleted) {
+        struct virEventPollTimeout *timeout = eventLoop.timeouts[i];
+
+        if (!timeout->deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_TIMEOUT,
               "timer=%d",
-              eventLoop.timeouts[i].timer);
-        if (eventLoop.timeouts[i].ff) {
-            virFreeCallback ff = eventLoop.timeouts[i].ff;
-            void *opaque = eventLoop.timeouts[i].opaque;
+              timeout->timer);
+        if (timeout->ff) {
+            virFreeCallback ff = timeout->ff;
+            void *opaque = timeout->opaque;
             virMutexUnlock(&eventLoop.lock);
             ff(opaque);
             virMutexLock(&eventLoop.lock);
@@ -547,10 +1006,11 @@ static void virEventPollCleanupTimeouts(void)
         if ((i+1) < eventLoop.timeoutsCount) {
             memmove(eventLoop.timeouts+i,
                     eventLoop.timeouts+i+1,
-                    sizeof(struct virEventPollTimeout)*(eventLoop.timeoutsCount
-                                                    -(i+1)));
+                    sizeof(*eventLoop.timeouts)*(eventLoop.timeoutsCount
+                                                 -(i+1)));
         }
         eventLoop.timeoutsCount--;
+        VIR_FREE(timeout);
     }
 
     /* Release some memory if we've got a big chunk free */
@@ -577,29 +1037,36 @@ static void virEventPollCleanupHandles(void)
      * entries as needed to form contiguous series
      */
     for (i = 0; i < eventLoop.handlesCount;) {
-        if (!eventLoop.handles[i].deleted) {
+        struct virEventPollHandle *handle = eventLoop.handles[i];
+
+        if (!handle->deleted) {
             i++;
             continue;
         }
 
         PROBE(EVENT_POLL_PURGE_HANDLE,
               "watch=%d",
-              eventLoop.handles[i].watch);
-        if (eventLoop.handles[i].ff) {
-            virFreeCallback ff = eventLoop.handles[i].ff;
-            void *opaque = eventLoop.handles[i].opaque;
+              handle->watch);
+        if (handle->ff) {
+            virFreeCallback ff = handle->ff;
+            void *opaque = handle->opaque;
             virMutexUnlock(&eventLoop.lock);
             ff(opaque);
             virMutexLock(&eventLoop.lock);
         }
 
+#ifdef HAVE_SYS_EPOLL_H
+        if (eventLoop.backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+            virEventPollEpollRemoveHandle(handle);
+#endif
         if ((i+1) < eventLoop.handlesCount) {
             memmove(eventLoop.handles+i,
                     eventLoop.handles+i+1,
-                    sizeof(struct virEventPollHandle)*(eventLoop.handlesCount
-                                                   -(i+1)));
+                    sizeof(*eventLoop.handles)*(eventLoop.handlesCount
+                                                -(i+1)));
         }
         eventLoop.handlesCount--;
+        VIR_FREE(handle);
     }
 
     /* Release some memory if we've got a big chunk free */
@@ -613,24 +1080,18 @@ static void virEventPollCleanupHandles(void)
 }
 
 /*
- * Run a single iteration of the event loop, blocking until
- * at least one file handle has an event, or a timer expires
+ * Run a single iteration of the event loop using poll(),
+ * blocking until at least one file handle has an event,
+ * or a timer expires
  */
-int virEventPollRunOnce(void)
+static int virEventPollRunOncePoll(void)
 {
     struct pollfd *fds = NULL;
     int ret, timeout, nfds;
 
-    virMutexLock(&eventLoop.lock);
-    eventLoop.running = 1;
-    virThreadSelf(&eventLoop.leader);
-
-    virEventPollCleanupTimeouts();
-    virEventPollCleanupHandles();
-
     if (!(fds = virEventPollMakePollFDs(&nfds)) ||
         virEventPollCalculateTimeout(&timeout) < 0)
-        goto error;
+        return -1;
 
     virMutexUnlock(&eventLoop.lock);
 
@@ -645,31 +1106,107 @@ int virEventPollRunOnce(void)
             goto retry;
         virReportSystemError(errno, "%s",
                              _("Unable to poll on file handles"));
-        goto error_unlocked;
+        virMutexLock(&eventLoop.lock);
+        return -1;
     }
     EVENT_DEBUG("Poll got %d event(s)", ret);
 
     virMutexLock(&eventLoop.lock);
     if (virEventPollDispatchTimeouts() < 0)
-        goto error;
+        return -1;
 
     if (ret > 0 &&
         virEventPollDispatchHandles(nfds, fds) < 0)
-        goto error;
+        return -1;
+
+    return 0;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * Run a single iteration of the event loop using epoll_wait(),
+ * blocking until at least one file handle has an event,
+ * or a timer expires
+ */
+static int virEventPollRunOnceEpoll(void)
+{
+    int ret, timeout, maxevents;
+    int lastWatch = nextWatch;
+
+    if (VIR_RESIZE_N(eventLoop.epollEvents, eventLoop.epollEventsAlloc,
+                     0, MAX(eventLoop.handlesCount, 1)) < 0 ||
+        virEventPollCalculateTimeout(&timeout) < 0)
+        return -1;
+    maxevents = MIN(eventLoop.epollEventsAlloc, INT_MAX);
+
+    /* Don't block if poll() would consider some fds ready */
+    if (eventLoop.fdsEmulated > 0)
+        timeout = 0;
+
+    virMutexUnlock(&eventLoop.lock);
+
+ retry:
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%d timeout=%d",
+          maxevents, timeout);
+    ret = epoll_wait(eventLoop.epollfd, eventLoop.epollEvents,
+                     maxevents, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        virMutexLock(&eventLoop.lock);
+        return -1;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&eventLoop.lock);
+    if (virEventPollDispatchTimeouts() < 0)
+        return -1;
+
+    if (virEventPollDispatchEpoll(ret, lastWatch) < 0)
+        return -1;
+
+    return 0;
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventPollRunOnce(void)
+{
+    int ret;
+
+    virMutexLock(&eventLoop.lock);
+    eventLoop.running = 1;
+    virThreadSelf(&eventLoop.leader);
+
+    virEventPollCleanupTimeouts();
+    virEventPollCleanupHandles();
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (eventLoop.backend == VIR_EVENT_POLL_BACKEND_EPOLL)
+        ret = virEventPollRunOnceEpoll();
+    else
+#endif
+        ret = virEventPollRunOncePoll();
+    if (ret < 0)
+        goto cleanup;
 
     virEventPollCleanupTimeouts();
     virEventPollCleanupHandles();
 
     eventLoop.running = 0;
-    virMutexUnlock(&eventLoop.lock);
-    VIR_FREE(fds);
-    return 0;
 
- error:
+ cleanup:
     virMutexUnlock(&eventLoop.lock);
- error_unlocked:
-    VIR_FREE(fds);
-    return -1;
+    return ret;
 }
 
 
@@ -684,14 +1221,49 @@ static void virEventPollHandleWakeup(int watch ATTRIBUTE_UNUSED,
     virMutexUnlock(&eventLoop.lock);
 }
 
-int virEventPollInit(void)
+int virEventPollInitBackend(virEventPollBackend backend)
 {
+    if (backend == VIR_EVENT_POLL_BACKEND_DEFAULT)
+        backend = VIR_EVENT_POLL_BACKEND_POLL;
+
+#ifndef HAVE_SYS_EPOLL_H
+    if (backend == VIR_EVENT_POLL_BACKEND_EPOLL) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                       _("epoll event loop is not supported on this platform"));
+        return -1;
+    }
+#endif
+
+    /* Handles registered so far belong to the backend picked by
+     * the first initialization, so it can not be changed later */
+    if (eventLoop.backend != VIR_EVENT_POLL_BACKEND_DEFAULT &&
+        eventLoop.backend != backend) {
+        VIR_WARN("Event loop already uses %s backend, ignoring %s",
+                 virEventPollBackendTypeToString(eventLoop.backend),
+                 virEventPollBackendTypeToString(backend));
+        backend = eventLoop.backend;
+    }
+
     if (virMutexInit(&eventLoop.lock) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to initialize mutex"));
         return -1;
     }
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (backend == VIR_EVENT_POLL_BACKEND_EPOLL &&
+        eventLoop.backend != VIR_EVENT_POLL_BACKEND_EPOLL &&
+        (eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll file descriptor"));
+        return -1;
+    }
+#endif
+
+    eventLoop.backend = backend;
+    VIR_DEBUG("Using %s event loop backend",
+              virEventPollBackendTypeToString(backend));
+
     if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to setup wakeup pipe"));
@@ -712,6 +1284,21 @@ int virEventPollInit(void)
     return 0;
 }
 
+int virEventPollInit(void)
+{
+    const char *name = virGetEnvBlockSUID("LIBVIRT_EVENT_POLL_BACKEND");
+    int backend = VIR_EVENT_POLL_BACKEND_DEFAULT;
+
+    if (name && *name &&
+        (backend = virEventPollBackendTypeFromString(name)) < 0) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("unknown event loop backend '%s'"), name);
+        return -1;
+    }
+
+    return virEventPollInitBackend(backend);
+}
+
 static int virEventPollInterruptLocked(void)
 {
     char c = '\0';
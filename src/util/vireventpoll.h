@@ -25,6 +25,17 @@
 # define __VIR_EVENT_POLL_H__
 
 # include "internal.h"
+# include "virutil.h"
+
+typedef enum {
+    VIR_EVENT_POLL_BACKEND_DEFAULT = 0,
+    VIR_EVENT_POLL_BACKEND_POLL,   /* poll() on a freshly built fd array */
+    VIR_EVENT_POLL_BACKEND_EPOLL,  /* Linux epoll with persistent registration */
+
+    VIR_EVENT_POLL_BACKEND_LAST
+} virEventPollBackend;
+
+VIR_ENUM_DECL(virEventPollBackend)
 
 /**
  * virEventPollAddHandle: register a callback for monitoring file handle events
@@ -103,10 +114,26 @@ int virEventPollRemoveTimeout(int timer);
 /**
  * virEventPollInit: Initialize the event loop
  *
+ * The backend is taken from the LIBVIRT_EVENT_POLL_BACKEND
+ * environment variable, if set, and is poll() otherwise.
+ *
  * returns -1 if initialization failed
  */
 int virEventPollInit(void);
 
+/**
+ * virEventPollInitBackend: Initialize the event loop
+ *
+ * @backend: which system call to wait for events with
+ *
+ * The epoll backend keeps fds registered with the kernel for as
+ * long as their handle exists, so callers must remove a handle
+ * before closing its fd.
+ *
+ * returns -1 if initialization failed
+ */
+int virEventPollInitBackend(virEventPollBackend backend);
+
 /**
  * virEventPollRunOnce: run a single iteration of the event loop.
  *
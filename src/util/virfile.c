@@ -198,6 +198,26 @@ struct _virFileWrapperFd {
  */
 virFileWrapperFdPtr
 virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
+{
+    return virFileWrapperFdNewParallel(fd, name, flags, 0);
+}
+
+/**
+ * virFileWrapperFdNewParallel:
+ * @fd: pointer to fd to wrap
+ * @name: name of fd, for diagnostics
+ * @flags: bitwise-OR of virFileWrapperFdFlags
+ * @threads: number of threads doing I/O on the file, 0 or 1 for one
+ *
+ * Like virFileWrapperFdNew(), but with @threads greater than 1 the
+ * helper splits the file into fixed size chunks and reads or writes
+ * them with @threads concurrent positioned I/O requests, keeping the
+ * pipe side of the stream strictly sequential.  In that case @flags
+ * may be 0, since the helper is wanted for the parallelism alone.
+ */
+virFileWrapperFdPtr
+virFileWrapperFdNewParallel(int *fd, const char *name, unsigned int flags,
+                            unsigned int threads)
 {
     virFileWrapperFdPtr ret = NULL;
     bool output = false;
@@ -205,7 +225,7 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     int mode = -1;
     char *iohelper_path = NULL;
 
-    if (!flags) {
+    if (!flags && threads <= 1) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("invalid use with no flags"));
         return NULL;
@@ -266,6 +286,9 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
         virCommandAddArg(ret->cmd, "0");
     }
 
+    if (threads > 1)
+        virCommandAddArgFormat(ret->cmd, "%u", threads);
+
     /* In order to catch iohelper stderr, we must change
      * iohelper's env so virLog functions print to stderr
      */
@@ -302,6 +325,17 @@ virFileWrapperFdNew(int *fd ATTRIBUTE_UNUSED,
                  _("virFileWrapperFd unsupported on this platform"));
     return NULL;
 }
+
+virFileWrapperFdPtr
+virFileWrapperFdNewParallel(int *fd ATTRIBUTE_UNUSED,
+                            const char *name ATTRIBUTE_UNUSED,
+                            unsigned int fdflags ATTRIBUTE_UNUSED,
+                            unsigned int threads ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                 _("virFileWrapperFd unsupported on this platform"));
+    return NULL;
+}
 #endif
 
 /**
@@ -1186,6 +1220,189 @@ int safezero(int fd, off_t offset, off_t len)
     return safezero_slow(fd, offset, len);
 }
 
+/*
+ * Deallocate @len bytes of @fd starting at @offset so that they
+ * read back as zeroes, without changing the size of the file.
+ * If the file system (or the kernel) can't punch holes, zeroes
+ * are written instead.
+ *
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int
+virFilePunchHole(int fd, off_t offset, off_t len)
+{
+#if HAVE_FALLOCATE && HAVE_DECL_FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) == 0)
+        return 0;
+
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return -1;
+#endif
+
+    return safezero_slow(fd, offset, len);
+}
+
+
+/**
+ * virFileWriteHole:
+ * @fd: file to write to
+ * @length: size of the hole
+ *
+ * Leave a hole of @length bytes at the current position of @fd and
+ * move past it, as if that many zeroes were written: whatever @fd
+ * had there is deallocated, and a regular file grows as needed.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virFileWriteHole(int fd, long long length)
+{
+    struct stat sb;
+    off_t cur, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        fstat(fd, &sb) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        return -1;
+    }
+
+    /* Beyond the end of a regular file there's nothing to clear,
+     * while a block device has no size to go by */
+    end = S_ISREG(sb.st_mode) ? MIN(sb.st_size, cur + length) : cur + length;
+
+    if (cur < end &&
+        virFilePunchHole(fd, cur, end - cur) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to punch hole in file"));
+        return -1;
+    }
+
+    if (lseek(fd, cur + length, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seek in file"));
+        return -1;
+    }
+
+    /* A hole at the very end of a file only exists once the
+     * file is as long as it */
+    if (S_ISREG(sb.st_mode) && sb.st_size < cur + length &&
+        ftruncate(fd, cur + length) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to extend file"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+/**
+ * virFileInData:
+ * @fd: file to check
+ * @inData: set to 1 if current position is in data, 0 if in a hole
+ * @length: set to number of bytes until the next hole or data
+ *
+ * Find out whether the current position of @fd is inside data or
+ * inside a hole and how long that section is. The position of @fd
+ * is not changed. At the end of the file @inData is 0 and @length
+ * is 0 too.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virFileInData(int fd,
+              int *inData,
+              long long *length)
+{
+    int ret = -1;
+    off_t cur, data, hole, end;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to get current position in file"));
+        return -1;
+    }
+
+    data = lseek(fd, cur, SEEK_DATA);
+
+    if (data == (off_t) -1) {
+        /* ENXIO: there is no more data after @cur, so we are either
+         * in a hole at the end of the file or past the end.
+         * EINVAL: the file system doesn't know about holes, so
+         * everything up to the end is data. */
+        if (errno != ENXIO && errno != EINVAL) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to data"));
+            goto cleanup;
+        }
+
+        *inData = errno == EINVAL;
+
+        if ((end = lseek(fd, 0, SEEK_END)) == (off_t) -1) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to end of file"));
+            goto cleanup;
+        }
+
+        *length = end > cur ? end - cur : 0;
+        if (*length == 0)
+            *inData = 0;
+    } else if (data > cur) {
+        *inData = 0;
+        *length = data - cur;
+    } else {
+        /* Every file has an implicit hole at its end, so this
+         * always finds something */
+        if ((hole = lseek(fd, data, SEEK_HOLE)) == (off_t) -1) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to seek to hole"));
+            goto cleanup;
+        }
+
+        *inData = hole > cur;
+        *length = hole - cur;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to restore position in file"));
+        ret = -1;
+    }
+    return ret;
+}
+
+#else /* !defined(SEEK_DATA) || !defined(SEEK_HOLE) */
+
+int
+virFileInData(int fd,
+              int *inData,
+              long long *length)
+{
+    off_t cur, end;
+
+    /* Without SEEK_DATA the whole file looks like data */
+    if ((cur = lseek(fd, 0, SEEK_CUR)) == (off_t) -1 ||
+        (end = lseek(fd, 0, SEEK_END)) == (off_t) -1 ||
+        lseek(fd, cur, SEEK_SET) == (off_t) -1) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to seek in file"));
+        return -1;
+    }
+
+    *inData = end > cur;
+    *length = end > cur ? end - cur : 0;
+    return 0;
+}
+
+#endif /* !defined(SEEK_DATA) || !defined(SEEK_HOLE) */
+
+
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 /* search /proc/mounts for mount point of *type; return pointer to
  * malloc'ed string of the path if found, otherwise return NULL
@@ -43,6 +43,28 @@ ssize_t safewrite(int fd, const void *buf, size_t count)
     ATTRIBUTE_RETURN_CHECK;
 int safezero(int fd, off_t offset, off_t len)
     ATTRIBUTE_RETURN_CHECK;
+int virFilePunchHole(int fd, off_t offset, off_t len)
+    ATTRIBUTE_RETURN_CHECK;
+int virFileInData(int fd,
+                  int *inData,
+                  long long *length)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int virFileWriteHole(int fd, long long length);
+
+/* Sparse files travel through the pipe to libvirt_iohelper as a
+ * sequence of these records, a data record being followed by
+ * @length bytes of data and a hole record by nothing. */
+typedef enum {
+    VIR_FILE_SPARSE_DATA = 0,
+    VIR_FILE_SPARSE_HOLE,
+} virFileSparseType;
+
+typedef struct _virFileSparseRecord virFileSparseRecord;
+struct _virFileSparseRecord {
+    unsigned long long length;
+    unsigned int type; /* virFileSparseType */
+    unsigned int pad;
+};
 
 /* Don't call these directly - use the macros below */
 int virFileClose(int *fdptr, virFileCloseFlags flags)
@@ -94,6 +116,12 @@ virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
                                         unsigned int flags)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+virFileWrapperFdPtr virFileWrapperFdNewParallel(int *fd,
+                                                const char *name,
+                                                unsigned int flags,
+                                                unsigned int threads)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
 int virFileWrapperFdClose(virFileWrapperFdPtr dfd);
 
 void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -37,9 +37,9 @@
 
 VIR_LOG_INIT("util.hash");
 
-#define MAX_HASH_LEN 8
-
-/* #define DEBUG_GROW */
+/* Number of slots of the old table moved over to the new one by each
+ * insertion while the table is being resized */
+#define VIR_HASH_MIGRATE_STEP 16
 
 #define virHashIterationError(ret)                                      \
     do {                                                                \
@@ -48,24 +48,44 @@ VIR_LOG_INIT("util.hash");
     } while (0)
 
 /*
- * A single entry in the hash table
+ * A single slot in the hash table. The entries are stored right in
+ * the table, collisions are resolved by linear probing. The hash code
+ * of the key is kept along with it, so that most mismatches don't
+ * need to look at the key itself and resizing doesn't need to
+ * recompute it.
  */
 typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
-    struct _virHashEntry *next;
-    void *name;
+    void *name;         /* NULL for an unused slot */
     void *payload;
+    uint32_t code;
 };
 
+/* Marks a slot whose entry was removed. Lookups need to continue
+ * probing past it, insertions may reuse it. */
+static char virHashDeletedName;
+#define VIR_HASH_DELETED ((void *) &virHashDeletedName)
+
+#define VIR_HASH_ENTRY_USED(entry) \
+    ((entry)->name && (entry)->name != VIR_HASH_DELETED)
+
 /*
  * The entire hash table
  */
 struct _virHashTable {
-    virHashEntryPtr *table;
+    virHashEntryPtr table;
     uint32_t seed;
-    size_t size;
+    size_t size;        /* number of slots in @table, a power of two */
+    size_t nused;       /* slots of @table which are not unused */
     size_t nbElems;
+    /* While the table is being resized, entries not moved to @table
+     * yet are still in @oldTable. The resize is done incrementally,
+     * a few slots at a time, so that adding an entry never needs to
+     * rehash the whole table at once. */
+    virHashEntryPtr oldTable;
+    size_t oldSize;
+    size_t oldPos;      /* first slot of @oldTable not moved yet */
     /* True iff we are iterating over hash entries. */
     bool iterating;
     /* Pointer to the current entry during iteration. */
@@ -129,13 +149,120 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 }
 
 
-static size_t
-virHashComputeKey(const virHashTable *table, const void *name)
+static virHashEntryPtr
+virHashFindEntry(const virHashTable *table,
+                 virHashEntryPtr entries,
+                 size_t size,
+                 uint32_t code,
+                 const void *name)
+{
+    size_t mask = size - 1;
+    size_t i;
+
+    for (i = code & mask; entries[i].name; i = (i + 1) & mask) {
+        virHashEntryPtr entry = entries + i;
+
+        if (entry->code == code &&
+            entry->name != VIR_HASH_DELETED &&
+            table->keyEqual(entry->name, name))
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+static virHashEntryPtr
+virHashLookupEntry(const virHashTable *table,
+                   uint32_t code,
+                   const void *name)
+{
+    virHashEntryPtr entry;
+
+    if ((entry = virHashFindEntry(table, table->table, table->size,
+                                  code, name)))
+        return entry;
+
+    if (table->oldTable)
+        return virHashFindEntry(table, table->oldTable, table->oldSize,
+                                code, name);
+
+    return NULL;
+}
+
+
+/* Returns the slot of @table where an entry with @code is to be stored.
+ * The caller must make sure the entry is not in the table yet. */
+static virHashEntryPtr
+virHashFreeEntry(virHashTablePtr table,
+                 uint32_t code)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    size_t mask = table->size - 1;
+    size_t i = code & mask;
+
+    while (VIR_HASH_ENTRY_USED(table->table + i))
+        i = (i + 1) & mask;
+
+    if (!table->table[i].name)
+        table->nused++;
+
+    return table->table + i;
 }
 
+
+/* The entries of a table which is being resized are spread over two
+ * arrays. Iterating over @pass 0 and 1 covers all of them. */
+static virHashEntryPtr
+virHashGetEntries(const virHashTable *table,
+                  size_t pass,
+                  size_t *size)
+{
+    if (pass == 0) {
+        *size = table->oldSize;
+        return table->oldTable;
+    }
+
+    *size = table->size;
+    return table->table;
+}
+
+
+/* Moves up to @count slots of the old table over to the new one */
+static void
+virHashMigrate(virHashTablePtr table,
+               size_t count)
+{
+    while (table->oldTable && count-- > 0) {
+        virHashEntryPtr old = table->oldTable + table->oldPos++;
+
+        if (VIR_HASH_ENTRY_USED(old)) {
+            *virHashFreeEntry(table, old->code) = *old;
+            old->name = VIR_HASH_DELETED;
+        }
+
+        if (table->oldPos == table->oldSize) {
+            VIR_FREE(table->oldTable);
+            table->oldSize = 0;
+            table->oldPos = 0;
+        }
+    }
+}
+
+
+static void
+virHashEntryFree(virHashTablePtr table,
+                 virHashEntryPtr entry)
+{
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
+    entry->name = VIR_HASH_DELETED;
+    entry->payload = NULL;
+    table->nbElems--;
+}
+
+
 /**
  * virHashCreateFull:
  * @size: the size of the hash table
@@ -157,15 +284,19 @@ virHashTablePtr virHashCreateFull(ssize_t size,
                                   virHashKeyFree keyFree)
 {
     virHashTablePtr table = NULL;
+    size_t slots = 8;
 
     if (size <= 0)
         size = 256;
 
+    while (slots < size)
+        slots *= 2;
+
     if (VIR_ALLOC(table) < 0)
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
+    table->size = slots;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -173,7 +304,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (VIR_ALLOC_N(table->table, slots) < 0) {
         VIR_FREE(table);
         return NULL;
     }
@@ -234,66 +365,55 @@ virHashAtomicDispose(void *obj)
 /**
  * virHashGrow:
  * @table: the hash table
- * @size: the new size of the hash table
  *
- * resize the hash table
+ * Start resizing the hash table once it's getting full. The new table
+ * is at most half full with the current entries, which are moved to it
+ * gradually by subsequent insertions. Removed entries are dropped in
+ * the process, so the new table may be as large as the current one if
+ * there are lots of them.
  *
  * Returns 0 in case of success, -1 in case of failure
  */
 static int
-virHashGrow(virHashTablePtr table, size_t size)
+virHashGrow(virHashTablePtr table)
 {
-    size_t oldsize, i;
-    virHashEntryPtr *oldtable;
+    virHashEntryPtr newtable;
+    size_t size = table->size;
 
-#ifdef DEBUG_GROW
-    size_t nbElem = 0;
-#endif
+    /* Only one resize can be in progress at a time */
+    virHashMigrate(table, table->oldSize);
 
-    if (table == NULL)
-        return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
-        return -1;
+    while (size < (table->nbElems + 1) * 2)
+        size *= 2;
 
-    oldsize = table->size;
-    oldtable = table->table;
-    if (oldtable == NULL)
+    if (VIR_ALLOC_N_QUIET(newtable, size) < 0)
         return -1;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
-        table->table = oldtable;
-        return -1;
-    }
+    table->oldTable = table->table;
+    table->oldSize = table->size;
+    table->oldPos = 0;
+    table->table = newtable;
     table->size = size;
+    table->nused = 0;
 
-    for (i = 0; i < oldsize; i++) {
-        virHashEntryPtr iter = oldtable[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
-
-            iter->next = table->table[key];
-            table->table[key] = iter;
-
-#ifdef DEBUG_GROW
-            nbElem++;
-#endif
-            iter = next;
-        }
-    }
+    return 0;
+}
 
-    VIR_FREE(oldtable);
 
-#ifdef DEBUG_GROW
-    VIR_DEBUG("virHashGrow : from %d to %d, %ld elems", oldsize,
-              size, nbElem);
-#endif
+static void
+virHashEntriesFree(virHashTablePtr table,
+                   virHashEntryPtr entries,
+                   size_t size)
+{
+    size_t i;
 
-    return 0;
+    for (i = 0; i < size; i++) {
+        if (VIR_HASH_ENTRY_USED(entries + i))
+            virHashEntryFree(table, entries + i);
+    }
 }
 
+
 /**
  * virHashFree:
  * @table: the hash table
@@ -304,25 +424,13 @@ virHashGrow(virHashTablePtr table, size_t size)
 void
 virHashFree(virHashTablePtr table)
 {
-    size_t i;
-
     if (table == NULL)
         return;
 
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr iter = table->table[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-
-            if (table->dataFree)
-                table->dataFree(iter->payload, iter->name);
-            if (table->keyFree)
-                table->keyFree(iter->name);
-            VIR_FREE(iter);
-            iter = next;
-        }
-    }
+    virHashEntriesFree(table, table->oldTable, table->oldSize);
+    virHashEntriesFree(table, table->table, table->size);
 
+    VIR_FREE(table->oldTable);
     VIR_FREE(table->table);
     VIR_FREE(table);
 }
@@ -332,9 +440,9 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
                         bool is_update)
 {
-    size_t key, len = 0;
     virHashEntryPtr entry;
     void *new_name;
+    uint32_t code;
 
     if ((table == NULL) || (name == NULL))
         return -1;
@@ -342,40 +450,44 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = table->keyCode(name, table->seed);
 
     /* Check for duplicate entry */
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (is_update) {
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                entry->payload = userdata;
-                return 0;
-            } else {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("Duplicate key"));
-                return -1;
-            }
+    if ((entry = virHashLookupEntry(table, code, name))) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            entry->payload = userdata;
+            return 0;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Duplicate key"));
+            return -1;
         }
-        len++;
     }
 
-    if (VIR_ALLOC(entry) < 0 || !(new_name = table->keyCopy(name))) {
-        VIR_FREE(entry);
+    virHashMigrate(table, VIR_HASH_MIGRATE_STEP);
+
+    /* Keep the load factor, removed entries included, below 3/4 so
+     * that probing stays short. If there's no memory for a bigger
+     * table we can go on as long as there's a free slot left. */
+    if ((table->nused + 1) * 4 > table->size * 3 &&
+        virHashGrow(table) < 0 &&
+        table->nused + 1 >= table->size) {
+        virReportOOMError();
         return -1;
     }
 
+    if (!(new_name = table->keyCopy(name)))
+        return -1;
+
+    entry = virHashFreeEntry(table, code);
     entry->name = new_name;
     entry->payload = userdata;
-    entry->next = table->table[key];
-    table->table[key] = entry;
+    entry->code = code;
 
     table->nbElems++;
 
-    if (len > MAX_HASH_LEN)
-        virHashGrow(table, MAX_HASH_LEN * table->size);
-
     return 0;
 }
 
@@ -442,18 +554,17 @@ virHashAtomicUpdate(virHashAtomicPtr table,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
     virHashEntryPtr entry;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
-            return entry->payload;
-    }
-    return NULL;
+    if (!(entry = virHashLookupEntry(table,
+                                     table->keyCode(name, table->seed),
+                                     name)))
+        return NULL;
+
+    return entry->payload;
 }
 
 
@@ -514,7 +625,7 @@ virHashSize(const virHashTable *table)
  * virHashTableSize:
  * @table: the hash table
  *
- * Query the size of the hash @table, i.e., number of buckets in the table.
+ * Query the size of the hash @table, i.e., number of slots in the table.
  *
  * Returns the number of keys in the hash table or
  * -1 in case of error
@@ -543,30 +654,21 @@ int
 virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
-    virHashEntryPtr *nextptr;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
-    for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (table->iterating && table->current != entry)
-                virHashIterationError(-1);
+    if (!(entry = virHashLookupEntry(table,
+                                     table->keyCode(name, table->seed),
+                                     name)))
+        return -1;
 
-            if (table->dataFree)
-                table->dataFree(entry->payload, entry->name);
-            if (table->keyFree)
-                table->keyFree(entry->name);
-            *nextptr = entry->next;
-            VIR_FREE(entry);
-            table->nbElems--;
-            return 0;
-        }
-        nextptr = &entry->next;
-    }
+    if (table->iterating && table->current != entry)
+        virHashIterationError(-1);
+
+    virHashEntryFree(table, entry);
 
-    return -1;
+    return 0;
 }
 
 
@@ -587,7 +689,9 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
 int
 virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 {
-    size_t i;
+    virHashEntryPtr entries;
+    size_t size;
+    size_t pass, i;
     int ret = -1;
 
     if (table == NULL || iter == NULL)
@@ -598,18 +702,23 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry = table->table[i];
-        while (entry) {
-            virHashEntryPtr next = entry->next;
+
+    /* Entries are only moved between the arrays by insertions, which
+     * are not allowed here, so each of them is visited exactly once. */
+    for (pass = 0; pass < 2; pass++) {
+        entries = virHashGetEntries(table, pass, &size);
+        for (i = 0; i < size; i++) {
+            virHashEntryPtr entry = entries + i;
+
+            if (!VIR_HASH_ENTRY_USED(entry))
+                continue;
+
             table->current = entry;
             ret = iter(entry->payload, entry->name, data);
             table->current = NULL;
 
             if (ret < 0)
                 goto cleanup;
-
-            entry = next;
         }
     }
 
@@ -638,7 +747,9 @@ virHashRemoveSet(virHashTablePtr table,
                  virHashSearcher iter,
                  const void *data)
 {
-    size_t i, count = 0;
+    virHashEntryPtr entries;
+    size_t size;
+    size_t pass, i, count = 0;
 
     if (table == NULL || iter == NULL)
         return -1;
@@ -648,22 +759,16 @@ virHashRemoveSet(virHashTablePtr table,
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr *nextptr = table->table + i;
-
-        while (*nextptr) {
-            virHashEntryPtr entry = *nextptr;
-            if (!iter(entry->payload, entry->name, data)) {
-                nextptr = &entry->next;
-            } else {
+
+    for (pass = 0; pass < 2; pass++) {
+        entries = virHashGetEntries(table, pass, &size);
+        for (i = 0; i < size; i++) {
+            virHashEntryPtr entry = entries + i;
+
+            if (VIR_HASH_ENTRY_USED(entry) &&
+                iter(entry->payload, entry->name, data)) {
+                virHashEntryFree(table, entry);
                 count++;
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                if (table->keyFree)
-                    table->keyFree(entry->name);
-                *nextptr = entry->next;
-                VIR_FREE(entry);
-                table->nbElems--;
             }
         }
     }
@@ -712,7 +817,9 @@ void *virHashSearch(const virHashTable *ctable,
                     virHashSearcher iter,
                     const void *data)
 {
-    size_t i;
+    virHashEntryPtr entries;
+    size_t size;
+    size_t pass, i;
 
     /* Cast away const for internal detection of misuse.  */
     virHashTablePtr table = (virHashTablePtr)ctable;
@@ -725,10 +832,14 @@ void *virHashSearch(const virHashTable *ctable,
 
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry;
-        for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
+
+    for (pass = 0; pass < 2; pass++) {
+        entries = virHashGetEntries(table, pass, &size);
+        for (i = 0; i < size; i++) {
+            virHashEntryPtr entry = entries + i;
+
+            if (VIR_HASH_ENTRY_USED(entry) &&
+                iter(entry->payload, entry->name, data)) {
                 table->iterating = false;
                 return entry->payload;
             }
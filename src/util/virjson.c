@@ -56,6 +56,10 @@ typedef virJSONParserState *virJSONParserStatePtr;
 struct _virJSONParserState {
     virJSONValuePtr value;
     char *key;
+    bool keep; /* all children are wanted, regardless of the filter */
+    unsigned long long filter; /* filter paths matching this container */
+    int nextAction; /* virJSONParserFilterAction for the pending key */
+    unsigned long long nextFilter; /* filter paths matching the pending key */
 };
 
 typedef struct _virJSONParser virJSONParser;
@@ -64,7 +68,14 @@ struct _virJSONParser {
     virJSONValuePtr head;
     virJSONParserStatePtr state;
     size_t nstate;
+    size_t maxstate;
     int wrap;
+
+    /* Optional list of paths the caller is interested in */
+    const char *const *filter;
+    unsigned long long filterAll;
+    size_t root; /* number of containers above the document root */
+    size_t skip; /* nesting depth within an unwanted container */
 };
 
 
@@ -559,6 +570,31 @@ virJSONValueNewObject(void)
 }
 
 
+/* Like virJSONValueObjectAppend, but takes ownership of @key on success */
+static int
+virJSONValueObjectAppendKeySteal(virJSONValuePtr object,
+                                 char **key,
+                                 virJSONValuePtr value)
+{
+    if (object->type != VIR_JSON_TYPE_OBJECT)
+        return -1;
+
+    if (virJSONValueObjectHasKey(object, *key))
+        return -1;
+
+    if (VIR_REALLOC_N(object->data.object.pairs,
+                      object->data.object.npairs + 1) < 0)
+        return -1;
+
+    object->data.object.pairs[object->data.object.npairs].key = *key;
+    object->data.object.pairs[object->data.object.npairs].value = value;
+    object->data.object.npairs++;
+    *key = NULL;
+
+    return 0;
+}
+
+
 int
 virJSONValueObjectAppend(virJSONValuePtr object,
                          const char *key,
@@ -566,25 +602,14 @@ virJSONValueObjectAppend(virJSONValuePtr object,
 {
     char *newkey;
 
-    if (object->type != VIR_JSON_TYPE_OBJECT)
-        return -1;
-
-    if (virJSONValueObjectHasKey(object, key))
-        return -1;
-
     if (VIR_STRDUP(newkey, key) < 0)
         return -1;
 
-    if (VIR_REALLOC_N(object->data.object.pairs,
-                      object->data.object.npairs + 1) < 0) {
+    if (virJSONValueObjectAppendKeySteal(object, &newkey, value) < 0) {
         VIR_FREE(newkey);
         return -1;
     }
 
-    object->data.object.pairs[object->data.object.npairs].key = newkey;
-    object->data.object.pairs[object->data.object.npairs].value = value;
-    object->data.object.npairs++;
-
     return 0;
 }
 
@@ -1350,6 +1375,106 @@ virJSONValueCopy(const virJSONValue *in)
 
 
 #if WITH_YAJL
+typedef enum {
+    VIR_JSON_PARSER_FILTER_SKIP,    /* value is not wanted */
+    VIR_JSON_PARSER_FILTER_DESCEND, /* container leading to wanted values */
+    VIR_JSON_PARSER_FILTER_KEEP,    /* value is wanted including children */
+} virJSONParserFilterAction;
+
+
+/* Returns the @depth-th '/' separated component of @path and stores
+ * its length in @len, or NULL if @path is shorter than that. */
+static const char *
+virJSONParserFilterComponent(const char *path,
+                             size_t depth,
+                             size_t *len)
+{
+    while (depth--) {
+        if (!(path = strchr(path, '/')))
+            return NULL;
+        path++;
+    }
+
+    *len = strcspn(path, "/");
+    return path;
+}
+
+
+/* Matches a child of @state, which is at @depth below the document
+ * root, against the filter paths still applicable to @state. Array
+ * elements have no @key and thus are matched only by '*'. */
+static int
+virJSONParserFilterMatch(virJSONParserPtr parser,
+                         virJSONParserStatePtr state,
+                         size_t depth,
+                         const char *key,
+                         size_t keylen,
+                         unsigned long long *filter)
+{
+    unsigned long long matched = 0;
+    size_t i;
+
+    for (i = 0; parser->filter[i]; i++) {
+        const char *component;
+        size_t len;
+
+        if (!(state->filter & (1ULL << i)))
+            continue;
+
+        if (!(component = virJSONParserFilterComponent(parser->filter[i],
+                                                       depth, &len)))
+            continue;
+
+        if (!(len == 1 && component[0] == '*') &&
+            !(key && len == keylen && memcmp(component, key, len) == 0))
+            continue;
+
+        if (component[len] == '\0')
+            return VIR_JSON_PARSER_FILTER_KEEP;
+
+        matched |= 1ULL << i;
+    }
+
+    *filter = matched;
+    return matched ? VIR_JSON_PARSER_FILTER_DESCEND : VIR_JSON_PARSER_FILTER_SKIP;
+}
+
+
+/* Decides what to do with the value the parser is about to report */
+static int
+virJSONParserFilterValue(virJSONParserPtr parser,
+                         unsigned long long *filter)
+{
+    virJSONParserStatePtr state;
+
+    *filter = 0;
+
+    if (parser->skip)
+        return VIR_JSON_PARSER_FILTER_SKIP;
+
+    if (!parser->filter)
+        return VIR_JSON_PARSER_FILTER_KEEP;
+
+    if (parser->nstate <= parser->root) {
+        *filter = parser->filterAll;
+        return VIR_JSON_PARSER_FILTER_DESCEND;
+    }
+
+    state = &parser->state[parser->nstate-1];
+    if (state->keep)
+        return VIR_JSON_PARSER_FILTER_KEEP;
+
+    if (state->value->type == VIR_JSON_TYPE_OBJECT) {
+        *filter = state->nextFilter;
+        return state->nextAction;
+    }
+
+    return virJSONParserFilterMatch(parser, state,
+                                    parser->nstate - 1 - parser->root,
+                                    NULL, 0, filter);
+}
+
+
 static int
 virJSONParserInsertValue(virJSONParserPtr parser,
                          virJSONValuePtr value)
@@ -1372,12 +1497,10 @@ virJSONParserInsertValue(virJSONParserPtr parser,
                 return -1;
             }
 
-            if (virJSONValueObjectAppend(state->value,
-                                         state->key,
-                                         value) < 0)
+            if (virJSONValueObjectAppendKeySteal(state->value,
+                                                 &state->key,
+                                                 value) < 0)
                 return -1;
-
-            VIR_FREE(state->key);
         }   break;
 
         case VIR_JSON_TYPE_ARRAY: {
@@ -1401,15 +1524,42 @@ virJSONParserInsertValue(virJSONParserPtr parser,
 }
 
 
+static int
+virJSONParserPushState(virJSONParserPtr parser,
+                       virJSONValuePtr value,
+                       int action,
+                       unsigned long long filter)
+{
+    virJSONParserStatePtr state;
+
+    if (VIR_RESIZE_N(parser->state, parser->maxstate, parser->nstate, 1) < 0)
+        return -1;
+
+    state = &parser->state[parser->nstate++];
+    state->value = value;
+    state->key = NULL;
+    state->keep = action == VIR_JSON_PARSER_FILTER_KEEP;
+    state->filter = filter;
+    state->nextAction = VIR_JSON_PARSER_FILTER_SKIP;
+    state->nextFilter = 0;
+
+    return 0;
+}
+
+
 static int
 virJSONParserHandleNull(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewNull();
+    virJSONValuePtr value;
+    unsigned long long filter;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if (virJSONParserFilterValue(parser, &filter) == VIR_JSON_PARSER_FILTER_SKIP)
+        return 1;
+
+    if (!(value = virJSONValueNewNull()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1426,11 +1576,15 @@ virJSONParserHandleBoolean(void *ctx,
                            int boolean_)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
+    virJSONValuePtr value;
+    unsigned long long filter;
 
     VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
 
-    if (!value)
+    if (virJSONParserFilterValue(parser, &filter) == VIR_JSON_PARSER_FILTER_SKIP)
+        return 1;
+
+    if (!(value = virJSONValueNewBoolean(boolean_)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1448,18 +1602,24 @@ virJSONParserHandleNumber(void *ctx,
                           yajl_size_t l)
 {
     virJSONParserPtr parser = ctx;
-    char *str;
     virJSONValuePtr value;
+    unsigned long long filter;
 
-    if (VIR_STRNDUP(str, s, l) < 0)
-        return -1;
-    value = virJSONValueNewNumber(str);
-    VIR_FREE(str);
+    if (virJSONParserFilterValue(parser, &filter) == VIR_JSON_PARSER_FILTER_SKIP)
+        return 1;
 
-    VIR_DEBUG("parser=%p str=%s", parser, str);
+    /* Copy the number straight into the new value rather than going
+     * through a temporary string and virJSONValueNewNumber */
+    if (VIR_ALLOC(value) < 0)
+        return 0;
 
-    if (!value)
+    value->type = VIR_JSON_TYPE_NUMBER;
+    if (VIR_STRNDUP(value->data.number, s, l) < 0) {
+        VIR_FREE(value);
         return 0;
+    }
+
+    VIR_DEBUG("parser=%p str=%s", parser, value->data.number);
 
     if (virJSONParserInsertValue(parser, value) < 0) {
         virJSONValueFree(value);
@@ -1476,12 +1636,16 @@ virJSONParserHandleString(void *ctx,
                           yajl_size_t stringLen)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
-                                                     stringLen);
+    virJSONValuePtr value;
+    unsigned long long filter;
 
     VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
 
-    if (!value)
+    if (virJSONParserFilterValue(parser, &filter) == VIR_JSON_PARSER_FILTER_SKIP)
+        return 1;
+
+    if (!(value = virJSONValueNewStringLen((const char *)stringVal,
+                                           stringLen)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1503,12 +1667,28 @@ virJSONParserHandleMapKey(void *ctx,
 
     VIR_DEBUG("parser=%p key=%p", parser, (const char *)stringVal);
 
+    if (parser->skip)
+        return 1;
+
     if (!parser->nstate)
         return 0;
 
     state = &parser->state[parser->nstate-1];
     if (state->key)
         return 0;
+
+    /* Decide on the value now so that keys of unwanted
+     * values don't need to be copied at all */
+    if (parser->filter && !state->keep) {
+        state->nextAction = virJSONParserFilterMatch(parser, state,
+                                                     parser->nstate - 1 - parser->root,
+                                                     (const char *)stringVal,
+                                                     stringLen,
+                                                     &state->nextFilter);
+        if (state->nextAction == VIR_JSON_PARSER_FILTER_SKIP)
+            return 1;
+    }
+
     if (VIR_STRNDUP(state->key, (const char *)stringVal, stringLen) < 0)
         return 0;
     return 1;
@@ -1519,11 +1699,19 @@ static int
 virJSONParserHandleStartMap(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewObject();
+    virJSONValuePtr value;
+    unsigned long long filter;
+    int action;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if ((action = virJSONParserFilterValue(parser, &filter)) ==
+        VIR_JSON_PARSER_FILTER_SKIP) {
+        parser->skip++;
+        return 1;
+    }
+
+    if (!(value = virJSONValueNewObject()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1531,14 +1719,8 @@ virJSONParserHandleStartMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0) {
+    if (virJSONParserPushState(parser, value, action, filter) < 0)
         return 0;
-    }
-
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
 
     return 1;
 }
@@ -1552,6 +1734,11 @@ virJSONParserHandleEndMap(void *ctx)
 
     VIR_DEBUG("parser=%p", parser);
 
+    if (parser->skip) {
+        parser->skip--;
+        return 1;
+    }
+
     if (!parser->nstate)
         return 0;
 
@@ -1561,7 +1748,7 @@ virJSONParserHandleEndMap(void *ctx)
         return 0;
     }
 
-    VIR_DELETE_ELEMENT(parser->state, parser->nstate - 1, parser->nstate);
+    parser->nstate--;
 
     return 1;
 }
@@ -1571,11 +1758,19 @@ static int
 virJSONParserHandleStartArray(void *ctx)
 {
     virJSONParserPtr parser = ctx;
-    virJSONValuePtr value = virJSONValueNewArray();
+    virJSONValuePtr value;
+    unsigned long long filter;
+    int action;
 
     VIR_DEBUG("parser=%p", parser);
 
-    if (!value)
+    if ((action = virJSONParserFilterValue(parser, &filter)) ==
+        VIR_JSON_PARSER_FILTER_SKIP) {
+        parser->skip++;
+        return 1;
+    }
+
+    if (!(value = virJSONValueNewArray()))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -1583,14 +1778,9 @@ virJSONParserHandleStartArray(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0)
+    if (virJSONParserPushState(parser, value, action, filter) < 0)
         return 0;
 
-    parser->state[parser->nstate].value = value;
-    parser->state[parser->nstate].key = NULL;
-    parser->nstate++;
-
     return 1;
 }
 
@@ -1603,6 +1793,11 @@ virJSONParserHandleEndArray(void *ctx)
 
     VIR_DEBUG("parser=%p", parser);
 
+    if (parser->skip) {
+        parser->skip--;
+        return 1;
+    }
+
     if (!(parser->nstate - parser->wrap))
         return 0;
 
@@ -1612,7 +1807,7 @@ virJSONParserHandleEndArray(void *ctx)
         return 0;
     }
 
-    VIR_DELETE_ELEMENT(parser->state, parser->nstate - 1, parser->nstate);
+    parser->nstate--;
 
     return 1;
 }
@@ -1634,14 +1829,16 @@ static const yajl_callbacks parserCallbacks = {
 
 
 /* XXX add an incremental streaming parser - yajl trivially supports it */
-virJSONValuePtr
-virJSONValueFromString(const char *jsonstring)
+static virJSONValuePtr
+virJSONValueFromStringInternal(const char *jsonstring,
+                               const char *const *filter)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0, 0 };
+    virJSONParser parser;
     virJSONValuePtr ret = NULL;
     int rc;
     size_t len = strlen(jsonstring);
+    size_t i;
 # ifndef WITH_YAJL2
     yajl_parser_config cfg = { 0, 1 }; /* Match yajl 2 default behavior */
     virJSONValuePtr tmp;
@@ -1649,6 +1846,24 @@ virJSONValueFromString(const char *jsonstring)
 
     VIR_DEBUG("string=%s", jsonstring);
 
+    memset(&parser, 0, sizeof(parser));
+
+    if (filter) {
+        for (i = 0; filter[i]; i++) {
+            if (i == VIR_JSON_FILTER_MAX) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("too many JSON filter paths, at most %zu "
+                                 "are supported"), i);
+                return NULL;
+            }
+        }
+        parser.filter = filter;
+        if (i == VIR_JSON_FILTER_MAX)
+            parser.filterAll = ~0ULL;
+        else
+            parser.filterAll = (1ULL << i) - 1;
+    }
+
 # ifdef WITH_YAJL2
     hand = yajl_alloc(&parserCallbacks, NULL, &parser);
 # else
@@ -1669,6 +1884,7 @@ virJSONValueFromString(const char *jsonstring)
 # ifdef WITH_YAJL2
     rc = yajl_parse(hand, (const unsigned char *)jsonstring, len);
 # else
+    parser.root = 1;
     rc = yajl_parse(hand, (const unsigned char *)"[", 1);
     parser.wrap = 1;
     if (VIR_YAJL_STATUS_OK(rc))
@@ -1691,7 +1907,7 @@ virJSONValueFromString(const char *jsonstring)
         goto cleanup;
     }
 
-    if (parser.nstate != 0) {
+    if (parser.nstate != 0 || parser.skip != 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("cannot parse json %s: unterminated string/map/array"),
                        jsonstring);
@@ -1715,12 +1931,9 @@ virJSONValueFromString(const char *jsonstring)
  cleanup:
     yajl_free(hand);
 
-    if (parser.nstate) {
-        size_t i;
-        for (i = 0; i < parser.nstate; i++)
-            VIR_FREE(parser.state[i].key);
-        VIR_FREE(parser.state);
-    }
+    for (i = 0; i < parser.nstate; i++)
+        VIR_FREE(parser.state[i].key);
+    VIR_FREE(parser.state);
 
     VIR_DEBUG("result=%p", ret);
 
@@ -1728,6 +1941,38 @@ virJSONValueFromString(const char *jsonstring)
 }
 
 
+virJSONValuePtr
+virJSONValueFromString(const char *jsonstring)
+{
+    return virJSONValueFromStringInternal(jsonstring, NULL);
+}
+
+
+/**
+ * virJSONValueFromStringFiltered:
+ * @jsonstring: JSON document to parse
+ * @filter: NULL terminated list of paths to keep
+ *
+ * Parses @jsonstring like virJSONValueFromString, but only builds the
+ * parts of the tree the caller is interested in. Each path in @filter
+ * is a list of object keys separated by '/', where '*' matches any
+ * key as well as any array element. Values whose path has one of the
+ * @filter paths as prefix are kept including all their children,
+ * containers on the way to them are kept with only the matching
+ * children, and everything else is skipped without being allocated.
+ * The document root is always kept. At most VIR_JSON_FILTER_MAX paths
+ * are supported.
+ *
+ * Returns the parsed value or NULL on error.
+ */
+virJSONValuePtr
+virJSONValueFromStringFiltered(const char *jsonstring,
+                               const char *const *filter)
+{
+    return virJSONValueFromStringInternal(jsonstring, filter);
+}
+
+
 static int
 virJSONValueToStringOne(virJSONValuePtr object,
                         yajl_gen g)
@@ -1854,6 +2099,16 @@ virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
 }
 
 
+virJSONValuePtr
+virJSONValueFromStringFiltered(const char *jsonstring ATTRIBUTE_UNUSED,
+                               const char *const *filter ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return NULL;
+}
+
+
 char *
 virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                      bool pretty ATTRIBUTE_UNUSED)
@@ -162,6 +162,12 @@ int virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 virJSONValuePtr virJSONValueFromString(const char *jsonstring);
+
+/* Maximum number of paths accepted by virJSONValueFromStringFiltered */
+# define VIR_JSON_FILTER_MAX 64
+virJSONValuePtr virJSONValueFromStringFiltered(const char *jsonstring,
+                                               const char *const *filter)
+    ATTRIBUTE_NONNULL(1);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
@@ -889,6 +889,54 @@ virNetDevIPInfoClear(virNetDevIPInfoPtr ip)
 }
 
 
+/**
+ * virNetDevIPInfoCopy:
+ * @dst: destination, assumed to be empty
+ * @src: IP addresses and routes to copy
+ *
+ * Deep copies all addresses and routes of @src into @dst.
+ *
+ * Returns 0 on success, -1 (with @dst cleared) on failure.
+ */
+int
+virNetDevIPInfoCopy(virNetDevIPInfoPtr dst,
+                    const virNetDevIPInfo *src)
+{
+    size_t i;
+
+    if (src->nips &&
+        VIR_ALLOC_N(dst->ips, src->nips) < 0)
+        goto error;
+    for (i = 0; i < src->nips; i++) {
+        if (VIR_ALLOC(dst->ips[i]) < 0)
+            goto error;
+        *dst->ips[i] = *src->ips[i];
+        dst->nips++;
+    }
+
+    if (src->nroutes &&
+        VIR_ALLOC_N(dst->routes, src->nroutes) < 0)
+        goto error;
+    for (i = 0; i < src->nroutes; i++) {
+        if (VIR_ALLOC(dst->routes[i]) < 0)
+            goto error;
+        dst->nroutes++;
+        *dst->routes[i] = *src->routes[i];
+        dst->routes[i]->family = NULL;
+        if (VIR_STRDUP(dst->routes[i]->family, src->routes[i]->family) < 0)
+            goto error;
+    }
+
+    return 0;
+
+ error:
+    virNetDevIPInfoClear(dst);
+    dst->nips = 0;
+    dst->nroutes = 0;
+    return -1;
+}
+
+
 /**
  * virNetDevIPInfoAddToDev:
  * @ifname: name of device to operate on
@@ -87,6 +87,8 @@ virSocketAddrPtr virNetDevIPRouteGetGateway(virNetDevIPRoutePtr def);
 
 /* virNetDevIPInfo object */
 void virNetDevIPInfoClear(virNetDevIPInfoPtr ip);
+int virNetDevIPInfoCopy(virNetDevIPInfoPtr dst,
+                        const virNetDevIPInfo *src);
 int virNetDevIPInfoAddToDev(const char *ifname,
                             virNetDevIPInfo const *ipInfo);
 
@@ -0,0 +1,691 @@
+/*
+ * virpagecodec.c: zero and duplicate page elimination for save images
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * The encoded stream starts with a 16 byte magic followed by records,
+ * each made of a 16 byte little endian header { type, length, offset }:
+ *
+ *   DATA  length bytes of literal data follow the header
+ *   ZERO  length bytes of zeros
+ *   COPY  length bytes found at @offset bytes from the start of the
+ *         encoded stream, inside an earlier DATA record
+ *   END   end of stream, anything else means the image is truncated
+ *
+ * QEMU's migration stream does not keep guest pages at fixed offsets,
+ * each page being preceded by a small header, so the raw stream is cut
+ * into content defined chunks: identical pages yield identical chunks
+ * wherever they end up in the stream.  The encoder only remembers a
+ * fixed number of chunks, evicting the least recently seen ones, so a
+ * chunk coming back after many others is stored again.  The decoder
+ * resolves COPY records by reading the image file itself, so restoring
+ * needs neither a temporary file nor memory proportional to the image.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "virpagecodec.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "sha256.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("util.pagecodec");
+
+#define VIR_PAGE_CODEC_MAGIC "LibvirtPageDedup"
+
+#define VIR_PAGE_CODEC_RECORD 16
+
+/* Chunks are between 256 bytes and 16 KiB, about 1 KiB on average,
+ * except for runs of zeros which are cut out on their own */
+#define VIR_PAGE_CODEC_CHUNK_MIN 256
+#define VIR_PAGE_CODEC_CHUNK_MAX (16 * 1024)
+#define VIR_PAGE_CODEC_CHUNK_MASK ((1ULL << 10) - 1)
+#define VIR_PAGE_CODEC_ZERO_MIN 64
+#define VIR_PAGE_CODEC_ZERO_MAX (1024 * 1024)
+
+/* Truncated SHA-256, still far beyond what an image can collide on */
+#define VIR_PAGE_CODEC_DIGEST 16
+
+#define VIR_PAGE_CODEC_BUFSIZE (4 * 1024 * 1024)
+
+/* Chunks remembered by the encoder, 16 MiB worth of entries covering
+ * about 512 MiB of distinct data, in sets of a few entries each */
+#define VIR_PAGE_CODEC_TABLE_WAYS 4
+#define VIR_PAGE_CODEC_TABLE_SETS (128 * 1024)
+
+typedef enum {
+    VIR_PAGE_CODEC_END = 0,
+    VIR_PAGE_CODEC_DATA,
+    VIR_PAGE_CODEC_ZERO,
+    VIR_PAGE_CODEC_COPY,
+} virPageCodecRecordType;
+
+typedef struct _virPageCodecEntry virPageCodecEntry;
+struct _virPageCodecEntry {
+    unsigned char digest[VIR_PAGE_CODEC_DIGEST];
+    uint32_t len; /* 0 if the slot is empty */
+    uint32_t used; /* when the chunk was last seen */
+    uint64_t offset;
+};
+
+typedef struct _virPageEncoder virPageEncoder;
+struct _virPageEncoder {
+    int outfd;
+    virPageCodecStats stats;
+
+    uint64_t gear[256];
+
+    /* Chunks seen recently, set associative */
+    virPageCodecEntry *table;
+    uint32_t clock;
+
+    /* Encoded data not written out yet, starting at stats.output */
+    char *out;
+    size_t outlen;
+    size_t dataHdr; /* header of the DATA record being filled, or -1 */
+
+    /* ZERO or COPY run waiting to be extended */
+    virPageCodecRecordType runType;
+    uint64_t runLen;
+    uint64_t runOffset;
+};
+
+
+static void
+virPageCodecPackRecord(char *buf,
+                       virPageCodecRecordType type,
+                       uint32_t len,
+                       uint64_t offset)
+{
+    size_t i;
+
+    for (i = 0; i < 4; i++)
+        buf[i] = (type >> (8 * i)) & 0xff;
+    for (i = 0; i < 4; i++)
+        buf[4 + i] = (len >> (8 * i)) & 0xff;
+    for (i = 0; i < 8; i++)
+        buf[8 + i] = (offset >> (8 * i)) & 0xff;
+}
+
+
+static void
+virPageCodecUnpackRecord(const char *buf,
+                         uint32_t *type,
+                         uint32_t *len,
+                         uint64_t *offset)
+{
+    const unsigned char *ubuf = (const unsigned char *) buf;
+    size_t i;
+
+    *type = 0;
+    *len = 0;
+    *offset = 0;
+    for (i = 0; i < 4; i++)
+        *type |= (uint32_t) ubuf[i] << (8 * i);
+    for (i = 0; i < 4; i++)
+        *len |= (uint32_t) ubuf[4 + i] << (8 * i);
+    for (i = 0; i < 8; i++)
+        *offset |= (uint64_t) ubuf[8 + i] << (8 * i);
+}
+
+
+static bool
+virPageCodecIsZero(const char *buf, size_t len)
+{
+    /* memcmp against itself shifted by one byte avoids a zero buffer */
+    return buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0;
+}
+
+
+static virPageCodecEntry *
+virPageEncoderSet(virPageEncoder *enc,
+                  const unsigned char *digest)
+{
+    uint64_t hash;
+
+    memcpy(&hash, digest, sizeof(hash));
+    return &enc->table[(hash % VIR_PAGE_CODEC_TABLE_SETS) *
+                       VIR_PAGE_CODEC_TABLE_WAYS];
+}
+
+
+static virPageCodecEntry *
+virPageEncoderLookup(virPageEncoder *enc,
+                     const unsigned char *digest,
+                     uint32_t len)
+{
+    virPageCodecEntry *set = virPageEncoderSet(enc, digest);
+    size_t i;
+
+    for (i = 0; i < VIR_PAGE_CODEC_TABLE_WAYS; i++) {
+        if (set[i].len == len &&
+            memcmp(set[i].digest, digest, VIR_PAGE_CODEC_DIGEST) == 0) {
+            set[i].used = ++enc->clock;
+            return &set[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Remember a chunk, in place of the least recently seen one of its
+ * set, or in an empty slot */
+static void
+virPageEncoderInsert(virPageEncoder *enc,
+                     const unsigned char *digest,
+                     uint32_t len,
+                     uint64_t offset)
+{
+    virPageCodecEntry *set = virPageEncoderSet(enc, digest);
+    virPageCodecEntry *entry = set;
+    size_t i;
+
+    for (i = 0; i < VIR_PAGE_CODEC_TABLE_WAYS; i++) {
+        if (!set[i].len) {
+            entry = &set[i];
+            break;
+        }
+        /* Differences stay right across the clock wrapping around */
+        if ((int32_t) (set[i].used - entry->used) < 0)
+            entry = &set[i];
+    }
+
+    memcpy(entry->digest, digest, VIR_PAGE_CODEC_DIGEST);
+    entry->len = len;
+    entry->used = ++enc->clock;
+    entry->offset = offset;
+}
+
+
+static void
+virPageEncoderCloseData(virPageEncoder *enc)
+{
+    if (enc->dataHdr == (size_t) -1)
+        return;
+
+    virPageCodecPackRecord(enc->out + enc->dataHdr, VIR_PAGE_CODEC_DATA,
+                           enc->outlen - enc->dataHdr - VIR_PAGE_CODEC_RECORD,
+                           0);
+    enc->dataHdr = -1;
+}
+
+
+static int
+virPageEncoderFlush(virPageEncoder *enc)
+{
+    virPageEncoderCloseData(enc);
+
+    if (safewrite(enc->outfd, enc->out, enc->outlen) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to write encoded save image"));
+        return -1;
+    }
+
+    enc->stats.output += enc->outlen;
+    enc->outlen = 0;
+    return 0;
+}
+
+
+static int
+virPageEncoderRecord(virPageEncoder *enc,
+                     virPageCodecRecordType type,
+                     uint32_t len,
+                     uint64_t offset)
+{
+    virPageEncoderCloseData(enc);
+
+    if (enc->outlen + VIR_PAGE_CODEC_RECORD > VIR_PAGE_CODEC_BUFSIZE &&
+        virPageEncoderFlush(enc) < 0)
+        return -1;
+
+    virPageCodecPackRecord(enc->out + enc->outlen, type, len, offset);
+    enc->outlen += VIR_PAGE_CODEC_RECORD;
+    return 0;
+}
+
+
+static int
+virPageEncoderFlushRun(virPageEncoder *enc)
+{
+    virPageCodecRecordType type = enc->runType;
+
+    if (type == VIR_PAGE_CODEC_END)
+        return 0;
+
+    enc->runType = VIR_PAGE_CODEC_END;
+    return virPageEncoderRecord(enc, type, enc->runLen, enc->runOffset);
+}
+
+
+/* Extend the pending run if @len bytes of @type at @offset follow it,
+ * otherwise emit it and start a new one */
+static int
+virPageEncoderRun(virPageEncoder *enc,
+                  virPageCodecRecordType type,
+                  uint32_t len,
+                  uint64_t offset)
+{
+    if (enc->runType == type &&
+        enc->runLen + len <= UINT32_MAX &&
+        (type == VIR_PAGE_CODEC_ZERO ||
+         enc->runOffset + enc->runLen == offset)) {
+        enc->runLen += len;
+        return 0;
+    }
+
+    if (virPageEncoderFlushRun(enc) < 0)
+        return -1;
+
+    enc->runType = type;
+    enc->runLen = len;
+    enc->runOffset = offset;
+    return 0;
+}
+
+
+static int
+virPageEncoderData(virPageEncoder *enc,
+                   const char *buf,
+                   size_t len,
+                   uint64_t *offset)
+{
+    if (virPageEncoderFlushRun(enc) < 0)
+        return -1;
+
+    if (enc->outlen + len > VIR_PAGE_CODEC_BUFSIZE) {
+        if (virPageEncoderFlush(enc) < 0)
+            return -1;
+    }
+
+    if (enc->dataHdr == (size_t) -1) {
+        if (enc->outlen + VIR_PAGE_CODEC_RECORD + len > VIR_PAGE_CODEC_BUFSIZE &&
+            virPageEncoderFlush(enc) < 0)
+            return -1;
+        enc->dataHdr = enc->outlen;
+        enc->outlen += VIR_PAGE_CODEC_RECORD;
+    }
+
+    *offset = enc->stats.output + enc->outlen;
+    memcpy(enc->out + enc->outlen, buf, len);
+    enc->outlen += len;
+    return 0;
+}
+
+
+static int
+virPageEncoderChunk(virPageEncoder *enc,
+                    const char *buf,
+                    size_t len)
+{
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    virPageCodecEntry *entry;
+    uint64_t offset;
+
+    enc->stats.input += len;
+
+    if (virPageCodecIsZero(buf, len)) {
+        enc->stats.zero += len;
+        return virPageEncoderRun(enc, VIR_PAGE_CODEC_ZERO, len, 0);
+    }
+
+    sha256_buffer(buf, len, digest);
+    if ((entry = virPageEncoderLookup(enc, digest, len))) {
+        enc->stats.dup += len;
+        return virPageEncoderRun(enc, VIR_PAGE_CODEC_COPY, len, entry->offset);
+    }
+
+    if (virPageEncoderData(enc, buf, len, &offset) < 0)
+        return -1;
+
+    virPageEncoderInsert(enc, digest, len, offset);
+    return 0;
+}
+
+
+/* Length of the chunk starting at @buf, or 0 if @len bytes are not
+ * enough to tell where it ends */
+static size_t
+virPageEncoderCut(virPageEncoder *enc,
+                  const unsigned char *buf,
+                  size_t len,
+                  bool eof)
+{
+    uint64_t hash = 0;
+    size_t zeros = 0;
+    size_t i;
+
+    for (i = 0; i < len && i < VIR_PAGE_CODEC_ZERO_MAX && !buf[i]; i++)
+        ;
+    if (i >= VIR_PAGE_CODEC_ZERO_MIN && (i < len || eof))
+        return i;
+
+    for (i = 0; i < len && i < VIR_PAGE_CODEC_CHUNK_MAX; i++) {
+        /* Stop short of a run of zeros so that it starts a chunk */
+        zeros = buf[i] ? 0 : zeros + 1;
+        if (zeros == VIR_PAGE_CODEC_ZERO_MIN)
+            return i + 1 - zeros;
+
+        if (i >= VIR_PAGE_CODEC_CHUNK_MIN) {
+            hash = (hash << 1) + enc->gear[buf[i]];
+            if (!(hash & VIR_PAGE_CODEC_CHUNK_MASK))
+                return i + 1;
+        }
+    }
+
+    if (i == VIR_PAGE_CODEC_CHUNK_MAX || eof)
+        return i;
+    return 0;
+}
+
+
+/**
+ * virPageCodecEncode:
+ * @infd: file descriptor to read the raw stream from
+ * @outfd: file descriptor to write the encoded stream to
+ * @stats: filled with statistics about the stream, may be NULL
+ *
+ * Encode the whole of @infd, replacing zero and already seen data with
+ * short records.  The encoded stream must be stored in a file for
+ * virPageCodecDecode() to be able to resolve references.
+ *
+ * Returns 0 on success, -1 on error with error reported.
+ */
+int
+virPageCodecEncode(int infd,
+                   int outfd,
+                   virPageCodecStatsPtr stats)
+{
+    virPageEncoder enc;
+    char *in = NULL;
+    size_t inlen = 0;
+    size_t insize = VIR_PAGE_CODEC_BUFSIZE;
+    bool eof = false;
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    int ret = -1;
+    size_t i;
+
+    memset(&enc, 0, sizeof(enc));
+    enc.outfd = outfd;
+    enc.dataHdr = -1;
+    enc.runType = VIR_PAGE_CODEC_END;
+
+    /* Any table works, the decoder never needs to find the cut points */
+    for (i = 0; i < ARRAY_CARDINALITY(enc.gear); i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        enc.gear[i] = z ^ (z >> 31);
+    }
+
+    if (VIR_ALLOC_N(enc.table, VIR_PAGE_CODEC_TABLE_SETS *
+                    VIR_PAGE_CODEC_TABLE_WAYS) < 0 ||
+        VIR_ALLOC_N(enc.out, VIR_PAGE_CODEC_BUFSIZE) < 0 ||
+        VIR_ALLOC_N(in, insize) < 0)
+        goto cleanup;
+
+    memcpy(enc.out, VIR_PAGE_CODEC_MAGIC, VIR_PAGE_CODEC_RECORD);
+    enc.outlen = VIR_PAGE_CODEC_RECORD;
+
+    while (!eof || inlen) {
+        size_t done = 0;
+        size_t len;
+
+        if (!eof) {
+            ssize_t got = saferead(infd, in + inlen, insize - inlen);
+
+            if (got < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to read save image data"));
+                goto cleanup;
+            }
+            if (got == 0)
+                eof = true;
+            inlen += got;
+        }
+
+        while ((len = virPageEncoderCut(&enc,
+                                        (unsigned char *) in + done,
+                                        inlen - done, eof))) {
+            if (virPageEncoderChunk(&enc, in + done, len) < 0)
+                goto cleanup;
+            done += len;
+        }
+
+        memmove(in, in + done, inlen - done);
+        inlen -= done;
+    }
+
+    if (virPageEncoderFlushRun(&enc) < 0 ||
+        virPageEncoderRecord(&enc, VIR_PAGE_CODEC_END, 0, 0) < 0 ||
+        virPageEncoderFlush(&enc) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("Encoded %llu bytes into %llu, %llu zero, %llu duplicate",
+              enc.stats.input, enc.stats.output,
+              enc.stats.zero, enc.stats.dup);
+
+    if (stats)
+        *stats = enc.stats;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(in);
+    VIR_FREE(enc.out);
+    VIR_FREE(enc.table);
+    return ret;
+}
+
+
+typedef struct _virPageDecoder virPageDecoder;
+struct _virPageDecoder {
+    int infd;
+    char *in;
+    size_t inlen;
+    size_t inpos;
+
+    int outfd;
+    char *out;
+    size_t outlen;
+};
+
+
+static int
+virPageDecoderRead(virPageDecoder *dec,
+                   char *buf,
+                   size_t len)
+{
+    while (len) {
+        size_t todo;
+
+        if (dec->inpos == dec->inlen) {
+            ssize_t got = saferead(dec->infd, dec->in, VIR_PAGE_CODEC_BUFSIZE);
+
+            if (got < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to read save image data"));
+                return -1;
+            }
+            if (got == 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("save image data is truncated"));
+                return -1;
+            }
+            dec->inlen = got;
+            dec->inpos = 0;
+        }
+
+        todo = MIN(len, dec->inlen - dec->inpos);
+        memcpy(buf, dec->in + dec->inpos, todo);
+        dec->inpos += todo;
+        buf += todo;
+        len -= todo;
+    }
+
+    return 0;
+}
+
+
+static int
+virPageDecoderFlush(virPageDecoder *dec)
+{
+    if (safewrite(dec->outfd, dec->out, dec->outlen) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to write save image data"));
+        return -1;
+    }
+
+    dec->outlen = 0;
+    return 0;
+}
+
+
+/* Room for @len more bytes of output, at most VIR_PAGE_CODEC_BUFSIZE */
+static char *
+virPageDecoderReserve(virPageDecoder *dec,
+                      size_t len)
+{
+    char *ret;
+
+    if (dec->outlen + len > VIR_PAGE_CODEC_BUFSIZE &&
+        virPageDecoderFlush(dec) < 0)
+        return NULL;
+
+    ret = dec->out + dec->outlen;
+    dec->outlen += len;
+    return ret;
+}
+
+
+/**
+ * virPageCodecDecode:
+ * @infd: file descriptor to read the encoded stream from
+ * @imagefd: file descriptor of the file holding the encoded stream
+ * @base: offset of the encoded stream within @imagefd
+ * @outfd: file descriptor to write the raw stream to
+ *
+ * Decode a stream produced by virPageCodecEncode().  @infd is read
+ * sequentially and may be a pipe; @imagefd is only used for positioned
+ * reads of data referenced a second time.
+ *
+ * Returns 0 on success, -1 on error with error reported.
+ */
+int
+virPageCodecDecode(int infd,
+                   int imagefd,
+                   off_t base,
+                   int outfd)
+{
+    virPageDecoder dec;
+    char hdr[VIR_PAGE_CODEC_RECORD];
+    int ret = -1;
+
+    memset(&dec, 0, sizeof(dec));
+    dec.infd = infd;
+    dec.outfd = outfd;
+
+    if (VIR_ALLOC_N(dec.in, VIR_PAGE_CODEC_BUFSIZE) < 0 ||
+        VIR_ALLOC_N(dec.out, VIR_PAGE_CODEC_BUFSIZE) < 0)
+        goto cleanup;
+
+    if (virPageDecoderRead(&dec, hdr, sizeof(hdr)) < 0)
+        goto cleanup;
+    if (memcmp(hdr, VIR_PAGE_CODEC_MAGIC, sizeof(hdr)) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("save image data is not deduplicated"));
+        goto cleanup;
+    }
+
+    while (1) {
+        uint32_t type;
+        uint32_t len;
+        uint64_t offset;
+
+        if (virPageDecoderRead(&dec, hdr, sizeof(hdr)) < 0)
+            goto cleanup;
+        virPageCodecUnpackRecord(hdr, &type, &len, &offset);
+
+        if (type == VIR_PAGE_CODEC_END)
+            break;
+
+        if (type != VIR_PAGE_CODEC_DATA &&
+            type != VIR_PAGE_CODEC_ZERO &&
+            type != VIR_PAGE_CODEC_COPY) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("unknown record type %u in save image data"),
+                           type);
+            goto cleanup;
+        }
+
+        while (len) {
+            size_t todo = MIN(len, VIR_PAGE_CODEC_BUFSIZE);
+            char *buf;
+            ssize_t got;
+
+            if (!(buf = virPageDecoderReserve(&dec, todo)))
+                goto cleanup;
+
+            switch ((virPageCodecRecordType) type) {
+            case VIR_PAGE_CODEC_DATA:
+                if (virPageDecoderRead(&dec, buf, todo) < 0)
+                    goto cleanup;
+                break;
+            case VIR_PAGE_CODEC_COPY:
+                if ((got = pread(imagefd, buf, todo, base + offset)) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("Unable to read save image data"));
+                    goto cleanup;
+                }
+                if ((size_t) got != todo) {
+                    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                   _("save image data is truncated"));
+                    goto cleanup;
+                }
+                offset += todo;
+                break;
+            case VIR_PAGE_CODEC_ZERO:
+                memset(buf, 0, todo);
+                break;
+            case VIR_PAGE_CODEC_END:
+            default:
+                break;
+            }
+
+            len -= todo;
+        }
+    }
+
+    if (virPageDecoderFlush(&dec) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(dec.in);
+    VIR_FREE(dec.out);
+    return ret;
+}
@@ -0,0 +1,45 @@
+/*
+ * virpagecodec.h: zero and duplicate page elimination for save images
+ *
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_PAGE_CODEC_H__
+# define __VIR_PAGE_CODEC_H__
+
+# include "internal.h"
+
+typedef struct _virPageCodecStats virPageCodecStats;
+typedef virPageCodecStats *virPageCodecStatsPtr;
+struct _virPageCodecStats {
+    unsigned long long input;  /* bytes of raw stream consumed */
+    unsigned long long output; /* bytes of encoded stream produced */
+    unsigned long long zero;   /* raw bytes stored as zero runs */
+    unsigned long long dup;    /* raw bytes stored as references */
+};
+
+int virPageCodecEncode(int infd,
+                       int outfd,
+                       virPageCodecStatsPtr stats);
+
+int virPageCodecDecode(int infd,
+                       int imagefd,
+                       off_t base,
+                       int outfd);
+
+#endif /* __VIR_PAGE_CODEC_H__ */
@@ -28,6 +28,7 @@
 
 #include "virthreadpool.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "virthread.h"
 #include "virerror.h"
 
@@ -53,25 +54,61 @@ struct _virThreadPoolJobList {
     virThreadPoolJobPtr firstPrio;
 };
 
+typedef struct _virThreadPoolWorker virThreadPoolWorker;
+typedef virThreadPoolWorker *virThreadPoolWorkerPtr;
+
+/* Each ordinary worker has a queue of its own, so that submitting and
+ * picking up jobs doesn't serialize all the threads on a single lock.
+ * A worker takes jobs from the head of its queue, idle workers steal
+ * them from the tail of the others' queues. */
+struct _virThreadPoolWorker {
+    virThreadPoolPtr pool;
+    virThread thread;
+
+    virMutex lock;
+    virCond cond;
+    /* The following fields are protected by @lock */
+    virThreadPoolJobList jobs;
+    bool wakeup;   /* new jobs might be available, don't go to sleep */
+    bool exiting;  /* the worker doesn't accept jobs anymore */
+
+    /* Lock-free hints for job submitters and thieves. They are updated
+     * atomically, but they are peeked at without any barriers where a
+     * stale value doesn't hurt, see virThreadPoolWorkerMain. */
+    int njobs;     /* number of jobs in @jobs */
+    int idle;      /* the worker is out of jobs and may go to sleep */
+
+    size_t victim; /* where to start looking for jobs to steal */
+};
+
 
 struct _virThreadPool {
-    bool quit;
+    int quit; /* also read by workers without @mutex */
+    int shrink; /* there are more workers than @maxWorkers allows, set
+                   with @mutex held and read by workers without it */
 
     virThreadPoolJobFunc jobFunc;
     const char *jobFuncName;
     void *jobOpaque;
+    /* Priority jobs and jobs which couldn't be handed to an ordinary
+     * worker; protected by @mutex */
     virThreadPoolJobList jobList;
-    size_t jobQueueDepth;
+    int njobList;
+    int jobQueueDepth;
 
     virMutex mutex;
-    virCond cond;
     virCond quit_cond;
 
+    /* @workers may be read with either @workersLock or @mutex held, and
+     * modified only with both of them held (in this order). The same
+     * applies to @nWorkers and @maxWorkers. */
+    virRWLock workersLock;
     size_t maxWorkers;
     size_t minWorkers;
-    size_t freeWorkers;
+    int freeWorkers;
     size_t nWorkers;
-    virThreadPtr workers;
+    virThreadPoolWorkerPtr *workers;
+    int nextWorker;
 
     size_t maxPrioWorkers;
     size_t nPrioWorkers;
@@ -79,11 +116,6 @@ struct _virThreadPool {
     virCond prioCond;
 };
 
-struct virThreadPoolWorkerData {
-    virThreadPoolPtr pool;
-    virCondPtr cond;
-    bool priority;
-};
 
 /* Test whether the worker needs to quit if the current number of workers @count
  * is greater than @limit actually allows.
@@ -93,17 +125,325 @@ static inline bool virThreadPoolWorkerQuitHelper(size_t count, size_t limit)
     return count > limit;
 }
 
-static void virThreadPoolWorker(void *opaque)
+
+/* Must be called with @mutex held whenever @nWorkers or @maxWorkers
+ * changes */
+static void
+virThreadPoolUpdateShrink(virThreadPoolPtr pool)
+{
+    virAtomicIntSet(&pool->shrink,
+                    virThreadPoolWorkerQuitHelper(pool->nWorkers,
+                                                  pool->maxWorkers));
+}
+
+
+static void
+virThreadPoolJobListAppend(virThreadPoolJobListPtr list,
+                           virThreadPoolJobPtr job)
+{
+    job->next = NULL;
+    job->prev = list->tail;
+    if (list->tail)
+        list->tail->next = job;
+    list->tail = job;
+
+    if (!list->head)
+        list->head = job;
+
+    if (job->priority && !list->firstPrio)
+        list->firstPrio = job;
+}
+
+
+static void
+virThreadPoolJobListRemove(virThreadPoolJobListPtr list,
+                           virThreadPoolJobPtr job)
+{
+    if (job == list->firstPrio) {
+        virThreadPoolJobPtr tmp = job->next;
+        while (tmp) {
+            if (tmp->priority)
+                break;
+            tmp = tmp->next;
+        }
+        list->firstPrio = tmp;
+    }
+
+    if (job->prev)
+        job->prev->next = job->next;
+    else
+        list->head = job->next;
+    if (job->next)
+        job->next->prev = job->prev;
+    else
+        list->tail = job->prev;
+}
+
+
+static void
+virThreadPoolJobListFree(virThreadPoolJobListPtr list)
+{
+    virThreadPoolJobPtr job;
+
+    while ((job = list->head)) {
+        list->head = job->next;
+        VIR_FREE(job);
+    }
+    list->tail = list->firstPrio = NULL;
+}
+
+
+/* Takes the first job from the shared list. The caller must not hold
+ * any worker's lock. */
+static virThreadPoolJobPtr
+virThreadPoolTakeSharedJob(virThreadPoolPtr pool)
+{
+    virThreadPoolJobPtr job = NULL;
+
+    if (!pool->njobList)
+        return NULL;
+
+    virMutexLock(&pool->mutex);
+    if (!pool->quit && (job = pool->jobList.head)) {
+        virThreadPoolJobListRemove(&pool->jobList, job);
+        virAtomicIntAdd(&pool->njobList, -1);
+        virAtomicIntAdd(&pool->jobQueueDepth, -1);
+    }
+    virMutexUnlock(&pool->mutex);
+
+    return job;
+}
+
+
+/* Takes a job from the head (@steal is false) or tail (@steal is true)
+ * of the queue of @worker. */
+static virThreadPoolJobPtr
+virThreadPoolWorkerTakeJob(virThreadPoolWorkerPtr worker,
+                           bool steal)
+{
+    virThreadPoolJobPtr job;
+
+    if (!worker->njobs)
+        return NULL;
+
+    virMutexLock(&worker->lock);
+    if ((job = steal ? worker->jobs.tail : worker->jobs.head)) {
+        virThreadPoolJobListRemove(&worker->jobs, job);
+        virAtomicIntAdd(&worker->njobs, -1);
+        virAtomicIntAdd(&worker->pool->jobQueueDepth, -1);
+    }
+    virMutexUnlock(&worker->lock);
+
+    return job;
+}
+
+
+static virThreadPoolJobPtr
+virThreadPoolWorkerSteal(virThreadPoolWorkerPtr self)
 {
-    struct virThreadPoolWorkerData *data = opaque;
-    virThreadPoolPtr pool = data->pool;
-    virCondPtr cond = data->cond;
-    bool priority = data->priority;
-    size_t *curWorkers = priority ? &pool->nPrioWorkers : &pool->nWorkers;
-    size_t *maxLimit = priority ? &pool->maxPrioWorkers : &pool->maxWorkers;
+    virThreadPoolPtr pool = self->pool;
     virThreadPoolJobPtr job = NULL;
+    size_t start;
+    size_t i;
 
-    VIR_FREE(data);
+    virRWLockRead(&pool->workersLock);
+    start = self->victim++;
+    for (i = 0; i < pool->nWorkers && !job; i++) {
+        virThreadPoolWorkerPtr victim = pool->workers[(start + i) % pool->nWorkers];
+
+        if (victim != self)
+            job = virThreadPoolWorkerTakeJob(victim, true);
+    }
+    virRWLockUnlock(&pool->workersLock);
+
+    return job;
+}
+
+
+static virThreadPoolJobPtr
+virThreadPoolWorkerNextJob(virThreadPoolWorkerPtr worker)
+{
+    virThreadPoolJobPtr job;
+
+    if (worker->pool->quit)
+        return NULL;
+
+    /* priority jobs are not queued with ordinary workers, check them
+     * first so that they don't wait behind the ordinary ones */
+    if ((job = virThreadPoolTakeSharedJob(worker->pool)))
+        return job;
+
+    if ((job = virThreadPoolWorkerTakeJob(worker, false)))
+        return job;
+
+    return virThreadPoolWorkerSteal(worker);
+}
+
+
+/* Wakes up an idle ordinary worker, if there's any, so that it can
+ * pick up a job which was queued elsewhere. Must be called with
+ * @workersLock held. */
+static void
+virThreadPoolWakeIdleWorker(virThreadPoolPtr pool,
+                            virThreadPoolWorkerPtr skip)
+{
+    size_t start;
+    size_t i;
+
+    if (!pool->freeWorkers)
+        return;
+
+    start = (unsigned int) virAtomicIntInc(&pool->nextWorker);
+    for (i = 0; i < pool->nWorkers; i++) {
+        virThreadPoolWorkerPtr worker = pool->workers[(start + i) % pool->nWorkers];
+        bool woken = false;
+
+        if (worker == skip || !worker->idle)
+            continue;
+
+        virMutexLock(&worker->lock);
+        if (!worker->wakeup && !worker->exiting) {
+            worker->wakeup = true;
+            virCondSignal(&worker->cond);
+            woken = true;
+        }
+        virMutexUnlock(&worker->lock);
+
+        if (woken)
+            return;
+    }
+}
+
+
+static void
+virThreadPoolWorkerFree(virThreadPoolWorkerPtr worker)
+{
+    if (!worker)
+        return;
+
+    virThreadPoolJobListFree(&worker->jobs);
+    virMutexDestroy(&worker->lock);
+    virCondDestroy(&worker->cond);
+    VIR_FREE(worker);
+}
+
+
+/* Removes @worker from the pool if the pool is being shut down or
+ * shrunk. @idle tells whether the worker is counted in @freeWorkers.
+ * Returns true if the worker should exit. */
+static bool
+virThreadPoolWorkerCheckQuit(virThreadPoolWorkerPtr worker,
+                             bool idle)
+{
+    virThreadPoolPtr pool = worker->pool;
+    virThreadPoolJobPtr job;
+    bool requeued = false;
+    size_t i;
+
+    /* Cheap check first, both virThreadPoolFree and lowering the limit
+     * wake up all workers after the change, so nothing can be missed */
+    if (!virAtomicIntGet(&pool->quit) &&
+        !virAtomicIntGet(&pool->shrink))
+        return false;
+
+    virMutexLock(&pool->mutex);
+
+    if (!pool->quit &&
+        !virThreadPoolWorkerQuitHelper(pool->nWorkers, pool->maxWorkers)) {
+        virMutexUnlock(&pool->mutex);
+        return false;
+    }
+
+    /* Jobs queued with a worker which is being removed due to lowered
+     * limit still need to be processed, so hand them over to the shared
+     * list. Once marked as exiting, no more jobs will be queued. */
+    virMutexLock(&worker->lock);
+    worker->exiting = true;
+    while (!pool->quit && (job = worker->jobs.head)) {
+        virThreadPoolJobListRemove(&worker->jobs, job);
+        virAtomicIntAdd(&worker->njobs, -1);
+        virThreadPoolJobListAppend(&pool->jobList, job);
+        virAtomicIntInc(&pool->njobList);
+        requeued = true;
+    }
+    virMutexUnlock(&worker->lock);
+
+    virRWLockWrite(&pool->workersLock);
+    for (i = 0; i < pool->nWorkers; i++) {
+        if (pool->workers[i] == worker) {
+            VIR_DELETE_ELEMENT_INPLACE(pool->workers, i, pool->nWorkers);
+            break;
+        }
+    }
+    virThreadPoolUpdateShrink(pool);
+    if (requeued)
+        virThreadPoolWakeIdleWorker(pool, NULL);
+    virRWLockUnlock(&pool->workersLock);
+
+    /* @pool may be gone as soon as we signal @quit_cond and unlock it */
+    if (idle)
+        virAtomicIntAdd(&pool->freeWorkers, -1);
+    if (pool->nWorkers == 0 && pool->nPrioWorkers == 0)
+        virCondSignal(&pool->quit_cond);
+    virMutexUnlock(&pool->mutex);
+
+    return true;
+}
+
+
+static void virThreadPoolWorkerMain(void *opaque)
+{
+    virThreadPoolWorkerPtr worker = opaque;
+    virThreadPoolPtr pool = worker->pool;
+    virThreadPoolJobPtr job;
+
+    while (1) {
+        /* Busy workers need to check whether they should quit before
+         * taking another job, idle ones after waking up, so that a
+         * busy pool shrinks too once the limit is lowered */
+        if (virThreadPoolWorkerCheckQuit(worker, false))
+            break;
+
+        if (!(job = virThreadPoolWorkerNextJob(worker))) {
+            /* Advertise that we're idle before checking for jobs one
+             * more time. Whoever queues a job after that check sees
+             * the flag and wakes us up, see virThreadPoolWakeIdleWorker */
+            virAtomicIntSet(&worker->idle, 1);
+            virAtomicIntInc(&pool->freeWorkers);
+
+            if (!(job = virThreadPoolWorkerNextJob(worker))) {
+                if (virThreadPoolWorkerCheckQuit(worker, true))
+                    break;
+
+                virMutexLock(&worker->lock);
+                while (!worker->jobs.head && !worker->wakeup) {
+                    if (virCondWait(&worker->cond, &worker->lock) < 0)
+                        break;
+                }
+                worker->wakeup = false;
+                virMutexUnlock(&worker->lock);
+            }
+
+            virAtomicIntSet(&worker->idle, 0);
+            virAtomicIntAdd(&pool->freeWorkers, -1);
+
+            if (!job)
+                continue;
+        }
+
+        (pool->jobFunc)(job->data, pool->jobOpaque);
+        VIR_FREE(job);
+    }
+
+    virThreadPoolWorkerFree(worker);
+}
+
+
+/* Priority workers process just the priority jobs from the shared list */
+static void virThreadPoolPrioWorker(void *opaque)
+{
+    virThreadPoolPtr pool = opaque;
+    virThreadPoolJobPtr job = NULL;
 
     virMutexLock(&pool->mutex);
 
@@ -114,54 +454,25 @@ static void virThreadPoolWorker(void *opaque)
          * another job (and before taking another one from the queue); and
          * free workers need to check for this right after waking up.
          */
-        if (virThreadPoolWorkerQuitHelper(*curWorkers, *maxLimit))
+        if (virThreadPoolWorkerQuitHelper(pool->nPrioWorkers,
+                                          pool->maxPrioWorkers))
             goto out;
-        while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
-            if (!priority)
-                pool->freeWorkers++;
-            if (virCondWait(cond, &pool->mutex) < 0) {
-                if (!priority)
-                    pool->freeWorkers--;
+        while (!pool->quit && !pool->jobList.firstPrio) {
+            if (virCondWait(&pool->prioCond, &pool->mutex) < 0)
                 goto out;
-            }
-            if (!priority)
-                pool->freeWorkers--;
 
-            if (virThreadPoolWorkerQuitHelper(*curWorkers, *maxLimit))
+            if (virThreadPoolWorkerQuitHelper(pool->nPrioWorkers,
+                                              pool->maxPrioWorkers))
                 goto out;
         }
 
         if (pool->quit)
             break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
-
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority)
-                    break;
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
-
-        pool->jobQueueDepth--;
+        job = pool->jobList.firstPrio;
+        virThreadPoolJobListRemove(&pool->jobList, job);
+        virAtomicIntAdd(&pool->njobList, -1);
+        virAtomicIntAdd(&pool->jobQueueDepth, -1);
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
@@ -170,41 +481,29 @@ static void virThreadPoolWorker(void *opaque)
     }
 
  out:
-    if (priority)
-        pool->nPrioWorkers--;
-    else
-        pool->nWorkers--;
+    pool->nPrioWorkers--;
     if (pool->nWorkers == 0 && pool->nPrioWorkers == 0)
         virCondSignal(&pool->quit_cond);
     virMutexUnlock(&pool->mutex);
 }
 
+
+/* Must be called with @mutex held */
 static int
-virThreadPoolExpand(virThreadPoolPtr pool, size_t gain, bool priority)
+virThreadPoolExpandPrio(virThreadPoolPtr pool, size_t gain)
 {
-    virThreadPtr *workers = priority ? &pool->prioWorkers : &pool->workers;
-    size_t *curWorkers = priority ? &pool->nPrioWorkers : &pool->nWorkers;
     size_t i = 0;
-    struct virThreadPoolWorkerData *data = NULL;
 
-    if (VIR_EXPAND_N(*workers, *curWorkers, gain) < 0)
+    if (VIR_EXPAND_N(pool->prioWorkers, pool->nPrioWorkers, gain) < 0)
         return -1;
 
     for (i = 0; i < gain; i++) {
-        if (VIR_ALLOC(data) < 0)
-            goto error;
-
-        data->pool = pool;
-        data->cond = priority ? &pool->prioCond : &pool->cond;
-        data->priority = priority;
-
-        if (virThreadCreateFull(&(*workers)[i],
+        if (virThreadCreateFull(&pool->prioWorkers[pool->nPrioWorkers - gain + i],
                                 false,
-                                virThreadPoolWorker,
+                                virThreadPoolPrioWorker,
                                 pool->jobFuncName,
                                 true,
-                                data) < 0) {
-            VIR_FREE(data);
+                                pool) < 0) {
             virReportSystemError(errno, "%s", _("Failed to create thread"));
             goto error;
         }
@@ -213,10 +512,63 @@ virThreadPoolExpand(virThreadPoolPtr pool, size_t gain, bool priority)
     return 0;
 
  error:
-    *curWorkers -= gain - i;
+    pool->nPrioWorkers -= gain - i;
     return -1;
 }
 
+
+/* Must be called with @mutex held */
+static int
+virThreadPoolExpand(virThreadPoolPtr pool, size_t gain)
+{
+    virThreadPoolWorkerPtr worker = NULL;
+    size_t i;
+
+    for (i = 0; i < gain; i++) {
+        if (VIR_ALLOC(worker) < 0)
+            return -1;
+
+        worker->pool = pool;
+
+        if (virMutexInit(&worker->lock) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to init mutex"));
+            VIR_FREE(worker);
+            return -1;
+        }
+
+        if (virCondInit(&worker->cond) < 0) {
+            virReportSystemError(errno, "%s", _("Unable to init condition"));
+            virMutexDestroy(&worker->lock);
+            VIR_FREE(worker);
+            return -1;
+        }
+
+        virRWLockWrite(&pool->workersLock);
+        if (VIR_APPEND_ELEMENT_COPY(pool->workers, pool->nWorkers, worker) < 0) {
+            virRWLockUnlock(&pool->workersLock);
+            virThreadPoolWorkerFree(worker);
+            return -1;
+        }
+        virRWLockUnlock(&pool->workersLock);
+
+        if (virThreadCreateFull(&worker->thread,
+                                false,
+                                virThreadPoolWorkerMain,
+                                pool->jobFuncName,
+                                true,
+                                worker) < 0) {
+            virReportSystemError(errno, "%s", _("Failed to create thread"));
+            virRWLockWrite(&pool->workersLock);
+            pool->nWorkers--;
+            virRWLockUnlock(&pool->workersLock);
+            virThreadPoolWorkerFree(worker);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 virThreadPoolPtr
 virThreadPoolNewFull(size_t minWorkers,
                      size_t maxWorkers,
@@ -226,6 +578,7 @@ virThreadPoolNewFull(size_t minWorkers,
                      void *opaque)
 {
     virThreadPoolPtr pool;
+    int rc;
 
     if (minWorkers > maxWorkers)
         minWorkers = maxWorkers;
@@ -241,25 +594,25 @@ virThreadPoolNewFull(size_t minWorkers,
 
     if (virMutexInit(&pool->mutex) < 0)
         goto error;
-    if (virCondInit(&pool->cond) < 0)
+    if (virRWLockInit(&pool->workersLock) < 0)
         goto error;
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
+    if (virCondInit(&pool->prioCond) < 0)
+        goto error;
 
     pool->minWorkers = minWorkers;
     pool->maxWorkers = maxWorkers;
     pool->maxPrioWorkers = prioWorkers;
 
-    if (virThreadPoolExpand(pool, minWorkers, false) < 0)
-        goto error;
-
-    if (prioWorkers) {
-        if (virCondInit(&pool->prioCond) < 0)
-            goto error;
+    virMutexLock(&pool->mutex);
+    rc = virThreadPoolExpand(pool, minWorkers);
+    if (rc == 0 && prioWorkers)
+        rc = virThreadPoolExpandPrio(pool, prioWorkers);
+    virMutexUnlock(&pool->mutex);
 
-        if (virThreadPoolExpand(pool, prioWorkers, true) < 0)
-            goto error;
-    }
+    if (rc < 0)
+        goto error;
 
     return pool;
 
@@ -271,38 +624,39 @@ virThreadPoolNewFull(size_t minWorkers,
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
-    virThreadPoolJobPtr job;
-    bool priority = false;
+    size_t i;
 
     if (!pool)
         return;
 
     virMutexLock(&pool->mutex);
-    pool->quit = true;
-    if (pool->nWorkers > 0)
-        virCondBroadcast(&pool->cond);
-    if (pool->nPrioWorkers > 0) {
-        priority = true;
+    virAtomicIntSet(&pool->quit, 1);
+    if (pool->nPrioWorkers > 0)
         virCondBroadcast(&pool->prioCond);
+
+    virRWLockRead(&pool->workersLock);
+    for (i = 0; i < pool->nWorkers; i++) {
+        virThreadPoolWorkerPtr worker = pool->workers[i];
+
+        virMutexLock(&worker->lock);
+        worker->wakeup = true;
+        virCondSignal(&worker->cond);
+        virMutexUnlock(&worker->lock);
     }
+    virRWLockUnlock(&pool->workersLock);
 
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
-    }
+    virThreadPoolJobListFree(&pool->jobList);
 
     VIR_FREE(pool->workers);
     virMutexUnlock(&pool->mutex);
     virMutexDestroy(&pool->mutex);
+    virRWLockDestroy(&pool->workersLock);
     virCondDestroy(&pool->quit_cond);
-    virCondDestroy(&pool->cond);
-    if (priority) {
-        VIR_FREE(pool->prioWorkers);
-        virCondDestroy(&pool->prioCond);
-    }
+    virCondDestroy(&pool->prioCond);
+    VIR_FREE(pool->prioWorkers);
     VIR_FREE(pool);
 }
 
@@ -353,24 +707,81 @@ size_t virThreadPoolGetCurrentWorkers(virThreadPoolPtr pool)
 
 size_t virThreadPoolGetFreeWorkers(virThreadPoolPtr pool)
 {
-    size_t ret;
-
-    virMutexLock(&pool->mutex);
-    ret = pool->freeWorkers;
-    virMutexUnlock(&pool->mutex);
+    int ret = virAtomicIntGet(&pool->freeWorkers);
 
-    return ret;
+    return ret > 0 ? ret : 0;
 }
 
 size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
 {
-    size_t ret;
+    int ret = virAtomicIntGet(&pool->jobQueueDepth);
 
-    virMutexLock(&pool->mutex);
-    ret = pool->jobQueueDepth;
-    virMutexUnlock(&pool->mutex);
+    return ret > 0 ? ret : 0;
+}
 
-    return ret;
+
+static bool
+virThreadPoolWorkerPushJob(virThreadPoolWorkerPtr worker,
+                           virThreadPoolJobPtr job)
+{
+    virMutexLock(&worker->lock);
+    if (worker->exiting) {
+        virMutexUnlock(&worker->lock);
+        return false;
+    }
+
+    virThreadPoolJobListAppend(&worker->jobs, job);
+    virAtomicIntInc(&worker->pool->jobQueueDepth);
+    virAtomicIntInc(&worker->njobs);
+
+    /* The worker sets @idle before it checks the queues for the last
+     * time, so a busy worker is guaranteed to see the job. An idle one
+     * needs to be woken up, but just once. */
+    if (!worker->wakeup && worker->idle) {
+        worker->wakeup = true;
+        virCondSignal(&worker->cond);
+    }
+    virMutexUnlock(&worker->lock);
+
+    return true;
+}
+
+
+/* Hands @job over to one of the ordinary workers, preferring the idle
+ * ones. Must be called with @workersLock held. */
+static bool
+virThreadPoolQueueJob(virThreadPoolPtr pool,
+                      virThreadPoolJobPtr job)
+{
+    virThreadPoolWorkerPtr worker;
+    size_t start;
+    size_t i;
+
+    if (pool->nWorkers == 0)
+        return false;
+
+    start = (unsigned int) virAtomicIntInc(&pool->nextWorker);
+
+    if (pool->freeWorkers > 0) {
+        for (i = 0; i < pool->nWorkers; i++) {
+            worker = pool->workers[(start + i) % pool->nWorkers];
+            if (worker->idle &&
+                virThreadPoolWorkerPushJob(worker, job))
+                return true;
+        }
+    }
+
+    for (i = 0; i < pool->nWorkers; i++) {
+        worker = pool->workers[(start + i) % pool->nWorkers];
+        if (virThreadPoolWorkerPushJob(worker, job)) {
+            /* the worker is busy, let somebody else steal the job if
+             * they have nothing to do */
+            virThreadPoolWakeIdleWorker(pool, worker);
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /*
@@ -382,44 +793,58 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobData)
 {
     virThreadPoolJobPtr job;
+    bool expand;
+    bool queued = false;
 
-    virMutexLock(&pool->mutex);
     if (pool->quit)
-        goto error;
-
-    if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
-        pool->nWorkers < pool->maxWorkers &&
-        virThreadPoolExpand(pool, 1, false) < 0)
-        goto error;
+        return -1;
 
     if (VIR_ALLOC(job) < 0)
-        goto error;
+        return -1;
 
     job->data = jobData;
     job->priority = priority;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
+    /* Fast path: no need to touch @mutex if the job can be queued with
+     * one of the existing workers */
+    virRWLockRead(&pool->workersLock);
+    expand = pool->freeWorkers <=
+             pool->jobQueueDepth &&
+             pool->nWorkers < pool->maxWorkers;
+    if (!priority && !expand)
+        queued = virThreadPoolQueueJob(pool, job);
+    virRWLockUnlock(&pool->workersLock);
+
+    if (queued)
+        return 0;
 
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
+    virMutexLock(&pool->mutex);
+    if (pool->quit)
+        goto error;
 
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    if (expand &&
+        pool->nWorkers < pool->maxWorkers &&
+        virThreadPoolExpand(pool, 1) < 0)
+        goto error;
 
-    pool->jobQueueDepth++;
+    virRWLockRead(&pool->workersLock);
+    if (priority || !virThreadPoolQueueJob(pool, job)) {
+        virThreadPoolJobListAppend(&pool->jobList, job);
+        virAtomicIntInc(&pool->jobQueueDepth);
+        virAtomicIntInc(&pool->njobList);
 
-    virCondSignal(&pool->cond);
-    if (priority)
-        virCondSignal(&pool->prioCond);
+        if (priority)
+            virCondSignal(&pool->prioCond);
+        virThreadPoolWakeIdleWorker(pool, NULL);
+    }
+    virRWLockUnlock(&pool->workersLock);
 
     virMutexUnlock(&pool->mutex);
     return 0;
 
  error:
     virMutexUnlock(&pool->mutex);
+    VIR_FREE(job);
     return -1;
 }
 
@@ -444,23 +869,38 @@ virThreadPoolSetParameters(virThreadPoolPtr pool,
 
     if (minWorkers >= 0) {
         if ((size_t) minWorkers > pool->nWorkers &&
-            virThreadPoolExpand(pool, minWorkers - pool->nWorkers,
-                                false) < 0)
+            virThreadPoolExpand(pool, minWorkers - pool->nWorkers) < 0)
             goto error;
         pool->minWorkers = minWorkers;
     }
 
     if (maxWorkers >= 0) {
+        size_t i;
+
+        virRWLockWrite(&pool->workersLock);
         pool->maxWorkers = maxWorkers;
-        virCondBroadcast(&pool->cond);
+        virThreadPoolUpdateShrink(pool);
+        virRWLockUnlock(&pool->workersLock);
+
+        /* Idle workers need to notice they are over the limit */
+        virRWLockRead(&pool->workersLock);
+        for (i = 0; i < pool->nWorkers; i++) {
+            virThreadPoolWorkerPtr worker = pool->workers[i];
+
+            virMutexLock(&worker->lock);
+            worker->wakeup = true;
+            virCondSignal(&worker->cond);
+            virMutexUnlock(&worker->lock);
+        }
+        virRWLockUnlock(&pool->workersLock);
     }
 
     if (prioWorkers >= 0) {
         if (prioWorkers < pool->nPrioWorkers) {
             virCondBroadcast(&pool->prioCond);
         } else if ((size_t) prioWorkers > pool->nPrioWorkers &&
-                   virThreadPoolExpand(pool, prioWorkers - pool->nPrioWorkers,
-                                       true) < 0) {
+                   virThreadPoolExpandPrio(pool,
+                                           prioWorkers - pool->nPrioWorkers) < 0) {
             goto error;
         }
         pool->maxPrioWorkers = prioWorkers;
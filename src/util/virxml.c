@@ -918,6 +918,214 @@ virXMLChildElementCount(xmlNodePtr node)
 }
 
 
+/*
+ * The helpers below look at the direct children of a node, or their
+ * children, and cover the most common XPath queries made by the parsers:
+ *
+ *   virXPathNode("./name")              virXMLNodeGetSubelement
+ *   virXPathNodeSet("./name")           virXMLNodeGetSubelementList
+ *   virXPathNodeSet("./parent/name")    virXMLNodeGetSubelementPathList
+ *   virXPathString("string(./name)")    virXMLNodeGetSubelementContent
+ *   virXPathULongLong("string(./name)") virXMLNodeGetSubelementULongLong
+ *
+ * Unlike XPath, they need neither a context nor compiling and
+ * evaluating an expression, which matters in parsers run once per
+ * device.
+ */
+
+/**
+ * virXMLNodeGetSubelement:
+ * @node: XML element
+ * @name: name of the child element to look for
+ *
+ * Returns the first child element of @node called @name, or NULL.
+ */
+xmlNodePtr
+virXMLNodeGetSubelement(xmlNodePtr node,
+                        const char *name)
+{
+    xmlNodePtr cur;
+
+    if (!node)
+        return NULL;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE &&
+            xmlStrEqual(cur->name, BAD_CAST name))
+            return cur;
+    }
+
+    return NULL;
+}
+
+
+static int
+virXMLNodeAppendSubelements(xmlNodePtr node,
+                            const char *name,
+                            xmlNodePtr **list,
+                            size_t *nlist)
+{
+    xmlNodePtr cur;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE ||
+            (name && !xmlStrEqual(cur->name, BAD_CAST name)))
+            continue;
+
+        if (!list)
+            (*nlist)++;
+        else if (VIR_APPEND_ELEMENT_COPY(*list, *nlist, cur) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virXMLNodeGetSubelementList:
+ * @node: XML element
+ * @name: name of the child elements to collect, or NULL for all of them
+ * @list: returns the array of elements, if not NULL
+ *
+ * Collects the child elements of @node called @name in document order.
+ * The caller must free @list, which is set to NULL if there are none.
+ *
+ * Returns the number of elements found, or -1 on allocation failure.
+ */
+int
+virXMLNodeGetSubelementList(xmlNodePtr node,
+                            const char *name,
+                            xmlNodePtr **list)
+{
+    xmlNodePtr *ret = NULL;
+    size_t nret = 0;
+
+    if (list)
+        *list = NULL;
+
+    if (!node)
+        return 0;
+
+    if (virXMLNodeAppendSubelements(node, name, list ? &ret : NULL,
+                                    &nret) < 0) {
+        VIR_FREE(ret);
+        return -1;
+    }
+
+    if (list)
+        *list = ret;
+    return nret;
+}
+
+
+/**
+ * virXMLNodeGetSubelementPathList:
+ * @node: XML element
+ * @parent: name of the child elements to look into
+ * @name: name of their child elements to collect, or NULL for all of them
+ * @list: returns the array of elements, if not NULL
+ *
+ * Like virXMLNodeGetSubelementList, but collects the elements called
+ * @name from every child of @node called @parent, as
+ * virXPathNodeSet("./parent/name") does.
+ *
+ * Returns the number of elements found, or -1 on allocation failure.
+ */
+int
+virXMLNodeGetSubelementPathList(xmlNodePtr node,
+                                const char *parent,
+                                const char *name,
+                                xmlNodePtr **list)
+{
+    xmlNodePtr cur;
+    xmlNodePtr *ret = NULL;
+    size_t nret = 0;
+
+    if (list)
+        *list = NULL;
+
+    if (!node)
+        return 0;
+
+    for (cur = node->children; cur; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE ||
+            !xmlStrEqual(cur->name, BAD_CAST parent))
+            continue;
+
+        if (virXMLNodeAppendSubelements(cur, name, list ? &ret : NULL,
+                                        &nret) < 0) {
+            VIR_FREE(ret);
+            return -1;
+        }
+    }
+
+    if (list)
+        *list = ret;
+    return nret;
+}
+
+
+/**
+ * virXMLNodeGetSubelementContent:
+ * @node: XML element
+ * @name: name of the child element
+ *
+ * Returns a copy of the text content of the first child element of @node
+ * called @name, or NULL if there is no such element, it is empty or on
+ * allocation failure.
+ */
+char *
+virXMLNodeGetSubelementContent(xmlNodePtr node,
+                               const char *name)
+{
+    xmlNodePtr child;
+    char *content;
+
+    if (!(child = virXMLNodeGetSubelement(node, name)))
+        return NULL;
+
+    if (!(content = (char *) xmlNodeGetContent(child)))
+        return NULL;
+
+    if (!*content)
+        VIR_FREE(content);
+
+    return content;
+}
+
+
+/**
+ * virXMLNodeGetSubelementULongLong:
+ * @node: XML element
+ * @name: name of the child element
+ * @value: the returned unsigned long long value
+ *
+ * Parses the content of the first child element of @node called @name.
+ *
+ * Returns 0 in case of success in which case @value is set,
+ *         -1 if there is no such element or it is empty, or
+ *         -2 if the content isn't an unsigned long long.
+ */
+int
+virXMLNodeGetSubelementULongLong(xmlNodePtr node,
+                                 const char *name,
+                                 unsigned long long *value)
+{
+    char *content;
+    int ret = 0;
+
+    if (!(content = virXMLNodeGetSubelementContent(node, name)))
+        return -1;
+
+    if (virStrToLong_ull(content, NULL, 10, value) < 0)
+        ret = -2;
+
+    VIR_FREE(content);
+    return ret;
+}
+
+
 /**
  * virXMLNodeToString: convert an XML node ptr to an XML string
  *
@@ -74,6 +74,20 @@ int              virXPathNodeSet(const char *xpath,
 char *          virXMLPropString(xmlNodePtr node,
                                  const char *name);
 long     virXMLChildElementCount(xmlNodePtr node);
+xmlNodePtr  virXMLNodeGetSubelement(xmlNodePtr node,
+                                    const char *name);
+int     virXMLNodeGetSubelementList(xmlNodePtr node,
+                                    const char *name,
+                                    xmlNodePtr **list);
+int     virXMLNodeGetSubelementPathList(xmlNodePtr node,
+                                        const char *parent,
+                                        const char *name,
+                                        xmlNodePtr **list);
+char * virXMLNodeGetSubelementContent(xmlNodePtr node,
+                                      const char *name);
+int virXMLNodeGetSubelementULongLong(xmlNodePtr node,
+                                     const char *name,
+                                     unsigned long long *value);
 
 /* Internal function; prefer the macros below.  */
 xmlDocPtr      virXMLParseHelper(int domcode,
@@ -23,9 +23,13 @@
 #include "testutils.h"
 #include "virerror.h"
 #include "viralloc.h"
+#include "virfile.h"
 #include "virlog.h"
 
 #include "domain_conf.h"
+#include "virdomainobjlist.h"
+#include "virthread.h"
+#include "viruuid.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -79,6 +83,276 @@ static int testGetFilesystem(const void *opaque)
     return ret;
 }
 
+
+#define LOOKUP_DOMAINS 64
+
+static virDomainObjListPtr lookupDoms;
+static unsigned char lookupUUIDs[LOOKUP_DOMAINS][VIR_UUID_BUFLEN];
+static char lookupNames[LOOKUP_DOMAINS][32];
+
+static int
+testLookupInit(void)
+{
+    virDomainDefPtr def = NULL;
+    virDomainObjPtr vm;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(lookupDoms = virDomainObjListNew()))
+        return -1;
+
+    for (i = 0; i < LOOKUP_DOMAINS; i++) {
+        char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+        snprintf(lookupNames[i], sizeof(lookupNames[i]), "dom%zu", i);
+        snprintf(uuidstr, sizeof(uuidstr),
+                 "c7a5fdbd-edaf-9455-926a-d65c1600%04zx", i);
+        if (virUUIDParse(uuidstr, lookupUUIDs[i]) < 0)
+            goto cleanup;
+
+        if (virAsprintf(&xml,
+                        "<domain type='test'>"
+                        "  <name>%s</name>"
+                        "  <uuid>%s</uuid>"
+                        "  <memory>1048576</memory>"
+                        "  <os><type>hvm</type></os>"
+                        "</domain>", lookupNames[i], uuidstr) < 0)
+            goto cleanup;
+
+        if (!(def = virDomainDefParseString(xml, caps, xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            goto cleanup;
+
+        if (!(vm = virDomainObjListAdd(lookupDoms, def, xmlopt, 0, NULL)))
+            goto cleanup;
+        def = NULL;
+        virObjectUnlock(vm);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+struct testLookupData {
+    size_t thread;
+    size_t nthreads;
+    size_t nlookups;
+    int ret;
+};
+
+static void
+testLookupThread(void *opaque)
+{
+    struct testLookupData *data = opaque;
+    virDomainObjPtr vm;
+    size_t i;
+
+    for (i = 0; i < data->nlookups; i++) {
+        /* each thread has a disjoint set of domains to look up */
+        size_t idx = (data->thread + i * data->nthreads) % LOOKUP_DOMAINS;
+
+        if (i % 2)
+            vm = virDomainObjListFindByName(lookupDoms, lookupNames[idx]);
+        else
+            vm = virDomainObjListFindByUUIDRef(lookupDoms, lookupUUIDs[idx]);
+
+        if (!vm || STRNEQ(vm->def->name, lookupNames[idx])) {
+            virDomainObjEndAPI(&vm);
+            data->ret = -1;
+            return;
+        }
+        virDomainObjEndAPI(&vm);
+    }
+}
+
+/* Many threads looking up different domains at the same time should
+ * not need to wait for each other */
+static int
+testLookupParallel(const void *opaque)
+{
+    size_t nthreads = *(const size_t *) opaque;
+    struct testLookupData *data = NULL;
+    virThreadPtr threads = NULL;
+    size_t nlookups = virTestGetExpensive() ? 1000000 : 100000;
+    size_t started = 0;
+    unsigned long long nsecs;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(data, nthreads) < 0 ||
+        VIR_ALLOC_N(threads, nthreads) < 0)
+        goto cleanup;
+
+    nsecs = virTestNowNs();
+    for (i = 0; i < nthreads; i++) {
+        data[i].thread = i;
+        data[i].nthreads = nthreads;
+        data[i].nlookups = nlookups / nthreads;
+        if (virThreadCreate(&threads[i], true,
+                            testLookupThread, &data[i]) < 0)
+            goto cleanup;
+        started++;
+    }
+
+    while (started > 0) {
+        started--;
+        virThreadJoin(&threads[started]);
+        if (data[started].ret < 0)
+            goto cleanup;
+    }
+    nsecs = virTestNowNs() - nsecs;
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%zu threads: %llu lookups per second\n", nthreads,
+                       nlookups * 1000000000ull / (nsecs ? nsecs : 1));
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < started; i++)
+        virThreadJoin(&threads[i]);
+    VIR_FREE(data);
+    VIR_FREE(threads);
+    return ret;
+}
+
+#define LOAD_SCRATCHDIR_TEMPLATE abs_builddir "/domainconfload-XXXXXX"
+
+static char loadDir[] = LOAD_SCRATCHDIR_TEMPLATE;
+static size_t loadDomains;
+static char **loadOrder;
+
+static int
+testLoadInit(void)
+{
+    char *path = NULL;
+    char *xml = NULL;
+    size_t i;
+    int ret = -1;
+
+    loadDomains = virTestGetExpensive() ? 1000 : 200;
+
+    if (!mkdtemp(loadDir)) {
+        fprintf(stderr, "Cannot create scratch dir %s\n", loadDir);
+        return -1;
+    }
+
+    for (i = 0; i < loadDomains; i++) {
+        if (virAsprintf(&path, "%s/load%zu.xml", loadDir, i) < 0 ||
+            virAsprintf(&xml,
+                        "<domain type='test'>\n"
+                        "  <name>load%zu</name>\n"
+                        "  <uuid>c7a5fdbd-edaf-9455-926a-d65c1601%04zx</uuid>\n"
+                        "  <memory>1048576</memory>\n"
+                        "  <vcpu>2</vcpu>\n"
+                        "  <os><type>hvm</type></os>\n"
+                        "  <devices>\n"
+                        "    <disk type='file' device='disk'>\n"
+                        "      <source file='/var/lib/images/load%zu.img'/>\n"
+                        "      <target dev='hda' bus='ide'/>\n"
+                        "    </disk>\n"
+                        "    <interface type='network'>\n"
+                        "      <source network='default'/>\n"
+                        "    </interface>\n"
+                        "  </devices>\n"
+                        "</domain>\n", i, i, i) < 0)
+            goto cleanup;
+
+        if (virFileWriteStr(path, xml, 0600) < 0)
+            goto cleanup;
+
+        VIR_FREE(path);
+        VIR_FREE(xml);
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+struct testLoadOrder {
+    char **names;
+    size_t nnames;
+};
+
+static void
+testLoadNotify(virDomainObjPtr vm,
+               int newVM ATTRIBUTE_UNUSED,
+               void *opaque)
+{
+    struct testLoadOrder *order = opaque;
+    char *name;
+
+    if (VIR_STRDUP(name, vm->def->name) < 0 ||
+        VIR_APPEND_ELEMENT(order->names, order->nnames, name) < 0)
+        VIR_FREE(name);
+}
+
+/* Loading a directory of configs with more threads has to give the
+ * same list, with the domains added in the same order */
+static int
+testLoadParallel(const void *opaque)
+{
+    unsigned int nworkers = *(const unsigned int *) opaque;
+    virDomainObjListPtr doms = NULL;
+    struct testLoadOrder order = { NULL, 0 };
+    unsigned long long nsecs;
+    size_t i;
+    int ret = -1;
+
+    if (!(doms = virDomainObjListNew()))
+        goto cleanup;
+
+    nsecs = virTestNowNs();
+    if (virDomainObjListLoadAllConfigs(doms, loadDir, loadDir, 0, nworkers,
+                                       caps, xmlopt,
+                                       testLoadNotify, &order) < 0)
+        goto cleanup;
+    nsecs = virTestNowNs() - nsecs;
+
+    if (order.nnames != loadDomains ||
+        virDomainObjListNumOfDomains(doms, false, NULL, NULL) != loadDomains) {
+        VIR_TEST_DEBUG("loaded %zu domains instead of %zu\n",
+                       order.nnames, loadDomains);
+        goto cleanup;
+    }
+
+    if (!loadOrder) {
+        loadOrder = order.names;
+        order.names = NULL;
+    } else {
+        for (i = 0; i < loadDomains; i++) {
+            if (STRNEQ(loadOrder[i], order.names[i])) {
+                VIR_TEST_DEBUG("domain %s loaded instead of %s\n",
+                               order.names[i], loadOrder[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%u threads: %zu domains loaded in %llu ms\n",
+                       nworkers, loadDomains, nsecs / 1000000);
+
+    ret = 0;
+
+ cleanup:
+    virStringFreeListCount(order.names, order.nnames);
+    virObjectUnref(doms);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -106,6 +380,43 @@ mymain(void)
     DO_TEST_GET_FS("/dev/pts", false);
     DO_TEST_GET_FS("/doesnotexist", false);
 
+    if (testLookupInit() < 0) {
+        ret = -1;
+    } else {
+        static const size_t lookupThreads[] = { 1, 2, 4, 8, 16 };
+        size_t i;
+
+        for (i = 0; i < ARRAY_CARDINALITY(lookupThreads); i++) {
+            char name[64];
+
+            snprintf(name, sizeof(name), "Parallel lookup with %zu threads",
+                     lookupThreads[i]);
+            if (virTestRun(name, testLookupParallel, &lookupThreads[i]) < 0)
+                ret = -1;
+        }
+    }
+    virObjectUnref(lookupDoms);
+
+    if (testLoadInit() < 0) {
+        ret = -1;
+    } else {
+        /* The first run gives the reference order of domains */
+        static const unsigned int loadThreads[] = { 1, 2, 4, 8, 16 };
+        size_t i;
+
+        for (i = 0; i < ARRAY_CARDINALITY(loadThreads); i++) {
+            char name[64];
+
+            snprintf(name, sizeof(name), "Load configs with %u threads",
+                     loadThreads[i]);
+            if (virTestRun(name, testLoadParallel, &loadThreads[i]) < 0)
+                ret = -1;
+        }
+    }
+    virStringFreeListCount(loadOrder, loadDomains);
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(loadDir);
+
     virObjectUnref(caps);
     virObjectUnref(xmlopt);
 
@@ -25,15 +25,19 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <time.h>
+#include <sys/wait.h>
 
 #include "testutils.h"
 #include "internal.h"
+#include "viralloc.h"
 #include "virfile.h"
 #include "virthread.h"
 #include "virlog.h"
 #include "virutil.h"
 #include "vireventpoll.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 VIR_LOG_INIT("tests.eventtest");
 
 #define NUM_FDS 31
@@ -294,8 +298,108 @@ resetAll(void)
     }
 }
 
+#define BENCH_ROUNDS 2000
+
+static void
+testBenchReader(int watch ATTRIBUTE_UNUSED,
+                int fd,
+                int events ATTRIBUTE_UNUSED,
+                void *data)
+{
+    size_t *fired = data;
+    char one;
+
+    if (read(fd, &one, 1) == 1)
+        (*fired)++;
+}
+
+/* Measure how long it takes to dispatch a single ready handle
+ * while @nidle other handles are registered but idle. With the
+ * epoll backend the cost should stay flat as @nidle grows. */
 static int
-mymain(void)
+testEventBenchmark(virEventPollBackend backend, size_t nidle)
+{
+    int *fds = NULL;
+    int *watches = NULL;
+    int active[2] = { -1, -1 };
+    int activeWatch = -1;
+    size_t fired = 0;
+    unsigned long long nsecs;
+    char name[64];
+    char one = '1';
+    size_t i;
+    int ret = EXIT_FAILURE;
+
+    snprintf(name, sizeof(name), "Dispatch with %zu idle handles", nidle);
+
+    if (VIR_ALLOC_N(fds, nidle * 2) < 0 ||
+        VIR_ALLOC_N(watches, nidle) < 0)
+        goto cleanup;
+    for (i = 0; i < nidle * 2; i++)
+        fds[i] = -1;
+
+    for (i = 0; i < nidle; i++) {
+        if (pipe(fds + i * 2) < 0) {
+            testEventReport(name, 1, "Cannot create pipe: %d\n", errno);
+            goto cleanup;
+        }
+        watches[i] = virEventPollAddHandle(fds[i * 2],
+                                           VIR_EVENT_HANDLE_READABLE,
+                                           testBenchReader, &fired, NULL);
+    }
+
+    if (pipe(active) < 0) {
+        testEventReport(name, 1, "Cannot create pipe: %d\n", errno);
+        goto cleanup;
+    }
+    activeWatch = virEventPollAddHandle(active[0],
+                                        VIR_EVENT_HANDLE_READABLE,
+                                        testBenchReader, &fired, NULL);
+
+    /* Warm up, which also purges handles left over by earlier runs */
+    if (safewrite(active[1], &one, 1) != 1 ||
+        virEventPollRunOnce() < 0)
+        goto cleanup;
+
+    fired = 0;
+    nsecs = virTestNowNs();
+    for (i = 0; i < BENCH_ROUNDS; i++) {
+        if (safewrite(active[1], &one, 1) != 1 ||
+            virEventPollRunOnce() < 0)
+            goto cleanup;
+    }
+    nsecs = virTestNowNs() - nsecs;
+
+    if (fired != BENCH_ROUNDS) {
+        testEventReport(name, 1, "Expected %d dispatches, got %zu\n",
+                        BENCH_ROUNDS, fired);
+        goto cleanup;
+    }
+
+    VIR_TEST_DEBUG("%s backend, %zu idle handles: %llu ns per dispatch\n",
+                   virEventPollBackendTypeToString(backend), nidle,
+                   nsecs / BENCH_ROUNDS);
+    testEventReport(name, 0, NULL);
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (activeWatch > 0)
+        virEventPollRemoveHandle(activeWatch);
+    for (i = 0; watches && i < nidle; i++) {
+        if (watches[i] > 0)
+            virEventPollRemoveHandle(watches[i]);
+    }
+    for (i = 0; fds && i < nidle * 2; i++)
+        VIR_FORCE_CLOSE(fds[i]);
+    VIR_FORCE_CLOSE(active[0]);
+    VIR_FORCE_CLOSE(active[1]);
+    VIR_FREE(fds);
+    VIR_FREE(watches);
+    return ret;
+}
+
+static int
+testEventLoop(virEventPollBackend backend)
 {
     size_t i;
     pthread_t eventThread;
@@ -317,7 +421,8 @@ mymain(void)
         return EXIT_FAILURE;
     }
 
-    virEventPollInit();
+    if (virEventPollInitBackend(backend) < 0)
+        return EXIT_FAILURE;
 
     for (i = 0; i < NUM_FDS; i++) {
         handles[i].delete = -1;
@@ -507,9 +612,42 @@ mymain(void)
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    /* The event thread is idle now, so run the loop directly */
+    if (virTestGetExpensive() &&
+        (testEventBenchmark(backend, 10) != EXIT_SUCCESS ||
+         testEventBenchmark(backend, 100) != EXIT_SUCCESS ||
+         testEventBenchmark(backend, 400) != EXIT_SUCCESS))
+        return EXIT_FAILURE;
+
     //pthread_kill(eventThread, SIGTERM);
 
     return EXIT_SUCCESS;
 }
 
+static int
+mymain(void)
+{
+    int ret = EXIT_SUCCESS;
+#ifdef HAVE_SYS_EPOLL_H
+    pid_t pid;
+    int status;
+
+    /* The event loop can be initialized only once per process,
+     * so the epoll backend gets a child process of its own */
+    fflush(stderr);
+    if ((pid = fork()) < 0)
+        return EXIT_FAILURE;
+    if (pid == 0)
+        _exit(testEventLoop(VIR_EVENT_POLL_BACKEND_EPOLL));
+    if (waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        ret = EXIT_FAILURE;
+#endif
+
+    if (testEventLoop(VIR_EVENT_POLL_BACKEND_POLL) != EXIT_SUCCESS)
+        ret = EXIT_FAILURE;
+
+    return ret;
+}
+
 VIRT_TEST_MAIN(mymain)
@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "testutils.h"
 
@@ -314,6 +315,206 @@ static int testFDStreamWriteNonblock(const void *data)
     return testFDStreamWriteCommon(data, false);
 }
 
+
+#define SPARSE_DATA_LEN (64 * 1024)
+#define SPARSE_HOLE_LEN (4 * 1024 * 1024)
+
+/*
+ * Pump @in into @out, forwarding holes as holes. The amount of
+ * bytes skipped over is returned in @holes. Non-blocking streams
+ * are polled until they are ready.
+ */
+static int
+testFDStreamSparseCopy(virStreamPtr in,
+                       virStreamPtr out,
+                       char *buf,
+                       size_t buflen,
+                       long long *holes)
+{
+    for (;;) {
+        int got = virStreamRecvFlags(in, buf, buflen,
+                                     VIR_STREAM_RECV_STOP_AT_HOLE);
+        int done;
+
+        if (got == -2) {
+            usleep(20 * 1000);
+            continue;
+        }
+        if (got == -3) {
+            long long length;
+
+            if (virStreamRecvHole(in, &length, 0) < 0)
+                return -1;
+            while ((done = virStreamSendHole(out, length, 0)) == -2)
+                usleep(20 * 1000);
+            if (done < 0)
+                return -1;
+            *holes += length;
+            continue;
+        }
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+
+        while (got > 0) {
+            if ((done = virStreamSend(out, buf, got)) == -2) {
+                usleep(20 * 1000);
+                continue;
+            }
+            if (done < 0)
+                return -1;
+            memmove(buf, buf + done, got - done);
+            got -= done;
+        }
+    }
+
+    if (virStreamFinish(in) < 0 ||
+        virStreamFinish(out) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * Copy a file consisting of data, hole, data, hole from one
+ * sparse stream into another, forwarding holes as holes. The
+ * non-blocking streams go through the iohelper.
+ */
+static int testFDStreamSparseCommon(const char *scratchdir, bool blocking)
+{
+    char *src = NULL;
+    char *dst = NULL;
+    char *pattern = NULL;
+    char *buf = NULL;
+    char *expect = NULL;
+    virConnectPtr conn = NULL;
+    virStreamPtr in = NULL;
+    virStreamPtr out = NULL;
+    off_t total = 2 * (SPARSE_DATA_LEN + SPARSE_HOLE_LEN);
+    long long holes = 0;
+    struct stat sb;
+    int fd = -1;
+    size_t i;
+    int ret = -1;
+
+    if (!(conn = virConnectOpen("test:///default")))
+        goto cleanup;
+
+    if (VIR_ALLOC_N(pattern, SPARSE_DATA_LEN) < 0 ||
+        VIR_ALLOC_N(buf, SPARSE_DATA_LEN) < 0)
+        goto cleanup;
+
+    for (i = 0; i < SPARSE_DATA_LEN; i++)
+        pattern[i] = (i % 255) + 1;
+
+    if (virAsprintf(&src, "%s/sparse-src.data", scratchdir) < 0 ||
+        virAsprintf(&dst, "%s/sparse-dst.data", scratchdir) < 0)
+        goto cleanup;
+
+    if ((fd = open(src, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0 ||
+        safewrite(fd, pattern, SPARSE_DATA_LEN) != SPARSE_DATA_LEN ||
+        lseek(fd, SPARSE_HOLE_LEN, SEEK_CUR) < 0 ||
+        safewrite(fd, pattern, SPARSE_DATA_LEN) != SPARSE_DATA_LEN ||
+        ftruncate(fd, total) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    /* Leave stale data in the destination so that holes
+     * have to be punched rather than just skipped over */
+    if ((fd = open(dst, O_CREAT|O_WRONLY|O_EXCL, 0600)) < 0)
+        goto cleanup;
+    for (i = 0; i < (SPARSE_DATA_LEN + SPARSE_HOLE_LEN) / SPARSE_DATA_LEN; i++) {
+        if (safewrite(fd, pattern, SPARSE_DATA_LEN) != SPARSE_DATA_LEN)
+            goto cleanup;
+    }
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (!(in = virStreamNew(conn, blocking ? 0 : VIR_STREAM_NONBLOCK)) ||
+        !(out = virStreamNew(conn, blocking ? 0 : VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (virFDStreamOpenBlockDevice(in, src, 0, 0, true, O_RDONLY) < 0 ||
+        virFDStreamOpenBlockDevice(out, dst, 0, 0, true, O_WRONLY) < 0)
+        goto cleanup;
+
+    if (testFDStreamSparseCopy(in, out, buf, SPARSE_DATA_LEN, &holes) < 0) {
+        virFilePrintf(stderr, "Failed to copy sparse stream: %s\n",
+                      virGetLastErrorMessage());
+        goto cleanup;
+    }
+
+    if (virFileReadAll(dst, total + 1, &expect) != total) {
+        virFilePrintf(stderr, "Unexpected size of %s\n", dst);
+        goto cleanup;
+    }
+
+    for (i = 0; i < total; i++) {
+        char want = 0;
+
+        if (i < SPARSE_DATA_LEN)
+            want = pattern[i];
+        else if (i >= SPARSE_DATA_LEN + SPARSE_HOLE_LEN &&
+                 i < 2 * SPARSE_DATA_LEN + SPARSE_HOLE_LEN)
+            want = pattern[i - SPARSE_DATA_LEN - SPARSE_HOLE_LEN];
+
+        if (expect[i] != want) {
+            virFilePrintf(stderr, "Mismatched data at offset %zu\n", i);
+            goto cleanup;
+        }
+    }
+
+    /* Filesystems without SEEK_HOLE report the whole file as data */
+    VIR_TEST_DEBUG("Transferred %lld bytes as holes\n", holes);
+    if (holes) {
+        if (holes != 2 * SPARSE_HOLE_LEN) {
+            virFilePrintf(stderr, "Expected %d bytes of holes, got %lld\n",
+                          2 * SPARSE_HOLE_LEN, holes);
+            goto cleanup;
+        }
+
+        if (stat(dst, &sb) < 0)
+            goto cleanup;
+
+        if (sb.st_blocks * 512 >= total) {
+            virFilePrintf(stderr, "Destination is not sparse\n");
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    if (in)
+        virStreamFree(in);
+    if (out)
+        virStreamFree(out);
+    VIR_FORCE_CLOSE(fd);
+    if (src)
+        unlink(src);
+    if (dst)
+        unlink(dst);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(src);
+    VIR_FREE(dst);
+    VIR_FREE(pattern);
+    VIR_FREE(buf);
+    VIR_FREE(expect);
+    return ret;
+}
+
+
+static int testFDStreamSparseBlock(const void *data)
+{
+    return testFDStreamSparseCommon(data, true);
+}
+static int testFDStreamSparseNonblock(const void *data)
+{
+    return testFDStreamSparseCommon(data, false);
+}
+
 #define SCRATCHDIRTEMPLATE abs_builddir "/fakesysfsdir-XXXXXX"
 
 static int
@@ -335,6 +536,10 @@ mymain(void)
         ret = -1;
     if (virTestRun("Stream write non-blocking ", testFDStreamWriteNonblock, scratchdir) < 0)
         ret = -1;
+    if (virTestRun("Stream sparse copy blocking ", testFDStreamSparseBlock, scratchdir) < 0)
+        ret = -1;
+    if (virTestRun("Stream sparse copy non-blocking ", testFDStreamSparseNonblock, scratchdir) < 0)
+        ret = -1;
 
     if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
         virFileDeleteTree(scratchdir);
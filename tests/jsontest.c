@@ -7,12 +7,17 @@
 
 #include "internal.h"
 #include "virjson.h"
+#include "viralloc.h"
+#include "virbuffer.h"
 #include "testutils.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 struct testInfo {
     const char *doc;
     const char *expect;
     bool pass;
+    const char *const *filter;
 };
 
 
@@ -311,6 +316,215 @@ testJSONCopy(const void *data)
 }
 
 
+static int
+testJSONFromStringFiltered(const void *data)
+{
+    const struct testInfo *info = data;
+    virJSONValuePtr json;
+    char *result = NULL;
+    int ret = -1;
+
+    if (!(json = virJSONValueFromStringFiltered(info->doc, info->filter))) {
+        VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (!(result = virJSONValueToString(json, false))) {
+        VIR_TEST_VERBOSE("Fail to format filtered %s\n", info->doc);
+        goto cleanup;
+    }
+
+    if (STRNEQ(info->expect, result)) {
+        virTestDifference(stderr, info->expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(result);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
+static size_t
+testJSONCountNodes(virJSONValuePtr value)
+{
+    size_t count = 1;
+    size_t i;
+
+    switch (value->type) {
+    case VIR_JSON_TYPE_OBJECT:
+        for (i = 0; i < value->data.object.npairs; i++)
+            count += testJSONCountNodes(value->data.object.pairs[i].value);
+        break;
+    case VIR_JSON_TYPE_ARRAY:
+        for (i = 0; i < value->data.array.nvalues; i++)
+            count += testJSONCountNodes(value->data.array.values[i]);
+        break;
+    }
+
+    return count;
+}
+
+
+static const char *const testBlockstatsFilter[] = {
+    "id",
+    "return/*/device",
+    "return/*/stats/rd_bytes",
+    "return/*/stats/wr_bytes",
+    "return/*/stats/rd_operations",
+    "return/*/stats/wr_operations",
+    "return/*/parent/stats/wr_highest_offset",
+    NULL
+};
+
+
+static int
+testJSONFilterBenchmarkOne(const char *doc,
+                           const char *const *filter,
+                           size_t loops,
+                           size_t *nodes,
+                           int *allocs,
+                           unsigned long long *nsecs)
+{
+    unsigned long long start;
+    virJSONValuePtr json;
+    size_t i;
+
+    virAllocTestInit();
+    if (!(json = virJSONValueFromStringFiltered(doc, filter)))
+        return -1;
+    *allocs = virAllocTestCount();
+    *nodes = testJSONCountNodes(json);
+    virJSONValueFree(json);
+
+    start = virTestNowNs();
+
+    for (i = 0; i < loops; i++) {
+        if (!(json = virJSONValueFromStringFiltered(doc, filter)))
+            return -1;
+        virJSONValueFree(json);
+    }
+
+    *nsecs = virTestNowNs() - start;
+    return 0;
+}
+
+
+/* Compares building the full tree of a query-blockstats reply with
+ * building only the parts qemuMonitorJSONGetAllBlockStatsInfo reads */
+static int
+testJSONFilterBenchmark(const void *data ATTRIBUTE_UNUSED)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    size_t ndevices = virTestGetExpensive() ? 512 : 64;
+    size_t loops = virTestGetExpensive() ? 200 : 1;
+    size_t fullNodes, filteredNodes;
+    int fullAllocs, filteredAllocs;
+    unsigned long long fullTime, filteredTime;
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr devices;
+    char *doc = NULL;
+    int ret = -1;
+    size_t i;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < ndevices; i++) {
+        virBufferAsprintf(&buf,
+                          "%s{\"device\": \"drive-virtio-disk%zu\", "
+                          "\"parent\": {\"stats\": {\"flush_total_time_ns\": 0, "
+                          "\"wr_highest_offset\": 5256018944, "
+                          "\"wr_total_time_ns\": 0, \"wr_bytes\": 0, "
+                          "\"rd_total_time_ns\": 0, \"flush_operations\": 0, "
+                          "\"wr_operations\": 0, \"rd_bytes\": 0, "
+                          "\"rd_operations\": 0}}, "
+                          "\"stats\": {\"flush_total_time_ns\": 0, "
+                          "\"wr_highest_offset\": 10406001664, "
+                          "\"wr_total_time_ns\": 530699221, "
+                          "\"wr_bytes\": 2845696, "
+                          "\"rd_total_time_ns\": 640616474, "
+                          "\"flush_operations\": 0, "
+                          "\"wr_operations\": 174, "
+                          "\"rd_bytes\": 28505088, "
+                          "\"rd_operations\": 1279, "
+                          "\"rd_merged\": 0, \"wr_merged\": 0, "
+                          "\"idle_time_ns\": 1120315290, "
+                          "\"failed_rd_operations\": 0, "
+                          "\"failed_wr_operations\": 0, "
+                          "\"invalid_rd_operations\": 0, "
+                          "\"invalid_wr_operations\": 0, "
+                          "\"account_invalid\": true, "
+                          "\"account_failed\": true, "
+                          "\"timed_stats\": []}}",
+                          i ? ", " : "", i);
+    }
+    virBufferAddLit(&buf, "], \"id\": \"libvirt-11\"}");
+
+    if (!(doc = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (testJSONFilterBenchmarkOne(doc, NULL, loops,
+                                   &fullNodes, &fullAllocs, &fullTime) < 0 ||
+        testJSONFilterBenchmarkOne(doc, testBlockstatsFilter, loops,
+                                   &filteredNodes, &filteredAllocs,
+                                   &filteredTime) < 0)
+        goto cleanup;
+
+    /* Make sure the filtered tree still has everything we asked for */
+    if (!(json = virJSONValueFromStringFiltered(doc, testBlockstatsFilter)) ||
+        !(devices = virJSONValueObjectGetArray(json, "return")) ||
+        virJSONValueArraySize(devices) != ndevices) {
+        VIR_TEST_VERBOSE("filtered reply lacks device list\n");
+        goto cleanup;
+    }
+
+    for (i = 0; i < ndevices; i++) {
+        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
+        virJSONValuePtr stats = virJSONValueObjectGetObject(dev, "stats");
+        virJSONValuePtr parent = virJSONValueObjectGetObject(dev, "parent");
+        unsigned long long val;
+
+        if (!virJSONValueObjectGetString(dev, "device") || !stats || !parent ||
+            virJSONValueObjectGetNumberUlong(stats, "rd_bytes", &val) < 0 ||
+            val != 28505088 ||
+            virJSONValueObjectHasKey(stats, "idle_time_ns") != 0 ||
+            !(parent = virJSONValueObjectGetObject(parent, "stats")) ||
+            virJSONValueObjectGetNumberUlong(parent, "wr_highest_offset",
+                                             &val) < 0 ||
+            val != 5256018944ULL) {
+            VIR_TEST_VERBOSE("filtered reply for device %zu is wrong\n", i);
+            goto cleanup;
+        }
+    }
+
+    if (filteredNodes >= fullNodes) {
+        VIR_TEST_VERBOSE("filtering didn't reduce the tree: %zu vs %zu nodes\n",
+                         filteredNodes, fullNodes);
+        goto cleanup;
+    }
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("\n%zu devices, %zu parses: full tree %zu nodes "
+                       "in %llu ms, filtered %zu nodes in %llu ms\n",
+                       ndevices, loops, fullNodes, fullTime / 1000000,
+                       filteredNodes, filteredTime / 1000000);
+    /* Only OOM testing builds keep track of allocations */
+    if (fullAllocs > 0)
+        VIR_TEST_DEBUG("allocations per parse: full %d, filtered %d\n",
+                       fullAllocs, filteredAllocs);
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(json);
+    VIR_FREE(doc);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -329,6 +543,14 @@ mymain(void)
 #define DO_TEST_PARSE_FAIL(name, doc)           \
     DO_TEST_FULL(name, FromString, doc, NULL, false)
 
+#define DO_TEST_FILTER(name, doc, expect, ...)                      \
+    do {                                                            \
+        static const char *const filter[] = { __VA_ARGS__, NULL };  \
+        struct testInfo info = { doc, expect, true, filter };       \
+        if (virTestRun(name, testJSONFromStringFiltered, &info) < 0) \
+            ret = -1;                                               \
+    } while (0)
+
 
     DO_TEST_PARSE("Simple", "{\"return\": {}, \"id\": \"libvirt-1\"}");
     DO_TEST_PARSE("NotSoSimple", "{\"QMP\": {\"version\": {\"qemu\":"
@@ -448,6 +670,31 @@ mymain(void)
                  "{ \"a\": {}, \"b\": 1, \"c\": \"str\", \"d\": [] }",
                  NULL, true);
 
+    DO_TEST_FILTER("filter keys",
+                   "{\"return\": [{\"device\": \"ide0\", \"stats\": {\"a\": 1}},"
+                   "{\"device\": \"ide1\", \"stats\": {\"a\": 2}}],"
+                   "\"id\": \"libvirt-1\"}",
+                   "{\"return\":[{\"device\":\"ide0\"},{\"device\":\"ide1\"}],"
+                   "\"id\":\"libvirt-1\"}",
+                   "return/*/device", "id");
+    DO_TEST_FILTER("filter nested",
+                   "{\"return\": [{\"device\": \"ide0\", \"stats\": {\"a\": 1, "
+                   "\"b\": [1, 2], \"c\": {\"d\": null}}, \"parent\": {\"e\": [{}]}}]}",
+                   "{\"return\":[{\"stats\":{\"b\":[1,2],\"c\":{}},\"parent\":{\"e\":[{}]}}]}",
+                   "return/*/stats/b", "return/*/parent", "return/*/stats/c/x");
+    DO_TEST_FILTER("filter wildcard key",
+                   "{\"a\": {\"x\": 1, \"y\": 2}, \"b\": {\"x\": 3, \"z\": 4}}",
+                   "{\"a\":{\"x\":1},\"b\":{\"x\":3}}",
+                   "*/x");
+    DO_TEST_FILTER("filter everything", "{\"a\": [1, {\"b\": 2}], \"c\": 3}",
+                   "{}", "d");
+    DO_TEST_FILTER("filter scalar root", "[1, \"a\", [2]]",
+                   "[1,\"a\",[]]", "*/x");
+
+    if (virTestRun("filtered parse benchmark",
+                   testJSONFilterBenchmark, NULL) < 0)
+        ret = -1;
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
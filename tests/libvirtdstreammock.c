@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_SPLICE
+# include <fcntl.h>
+
+# include "virmock.h"
+
+static ssize_t (*real_splice)(int fd_in, loff_t *off_in,
+                              int fd_out, loff_t *off_out,
+                              size_t len, unsigned int flags);
+
+/* Provided by libvirtdstreamtest, which wants to know how much
+ * stream data went where. Child processes, like the iohelper,
+ * inherit this mock but not the symbol. */
+static void (*wrap_splice)(int fd_out, ssize_t len);
+
+ssize_t
+splice(int fd_in, loff_t *off_in,
+       int fd_out, loff_t *off_out,
+       size_t len, unsigned int flags)
+{
+    ssize_t ret;
+
+    VIR_MOCK_REAL_INIT(splice);
+    if (!wrap_splice)
+        wrap_splice = dlsym(RTLD_DEFAULT, "testStreamSpliced");
+
+    ret = real_splice(fd_in, off_in, fd_out, off_out, len, flags);
+
+    if (ret > 0 && wrap_splice)
+        wrap_splice(fd_out, ret);
+
+    return ret;
+}
+#endif /* HAVE_SPLICE */
@@ -0,0 +1,1259 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "testutils.h"
+
+#include "libvirtd.h"
+#include "stream.h"
+#include "fdstream.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virutil.h"
+#include "rpc/virnetserver.h"
+#include "rpc/virnetclient.h"
+#include "rpc/virnetclientprogram.h"
+#include "rpc/virnetclientstream.h"
+#ifdef WITH_GNUTLS
+# include "virnettlshelpers.h"
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * These tests run volume uploads and downloads between a
+ * virNetClient and the daemon's stream code, with the storage
+ * driver replaced by plain files in a scratch directory. The
+ * daemon side goes through the libvirt_iohelper, just like
+ * the storage driver's non-blocking streams do.
+ *
+ * Plain downloads to a client on the UNIX socket splice their data
+ * into it, the libvirtdstreammock tells us how much went that way.
+ * Other calls can be answered in between the stream packets, and
+ * TLS clients have to get the data copied.
+ *
+ * With VIR_TEST_EXPENSIVE the benchmarks download a large file through
+ * the splice path and through both copy paths and report how much CPU
+ * time the test process spent per GiB.
+ *
+ * The stream window test feeds upload packets to the daemon's
+ * stream filter directly and watches how many it reads.
+ */
+
+#define TEST_DATA_LEN (64 * 1024)
+#define TEST_HOLE_LEN (4 * 1024 * 1024)
+#define TEST_FILE_LEN (2 * (TEST_DATA_LEN + TEST_HOLE_LEN))
+#define TEST_BENCH_LEN (1024ull * 1024 * 1024)
+
+virNetServerProgramPtr remoteProgram;
+
+static virConnectPtr testConn;
+static char testPattern[TEST_DATA_LEN];
+
+/* What the emulated storage driver reads from and writes to */
+static char *testDaemonSrc;
+static char *testDaemonDst;
+/* Volume download/upload flags the emulated storage driver knows */
+static unsigned int testDaemonFlags;
+/* Bytes spliced into a socket, counted by the mock */
+static unsigned long long testSpliced;
+
+#if defined WITH_GNUTLS && !defined WIN32 && HAVE_LIBTASN1_H && \
+    LIBGNUTLS_VERSION_NUMBER >= 0x020600
+# define TEST_STREAM_TLS 1
+
+# define KEYFILE "key-stream.pem"
+
+static virNetTLSContextPtr testServerTLS;
+static virNetTLSContextPtr testClientTLS;
+#endif
+
+struct testStreamInfo {
+    bool upload;
+    unsigned int daemonFlags;
+    unsigned int flags;
+    unsigned int recvFlags;
+    bool fallback; /* daemon must reject @flags */
+    bool interleave; /* make other calls while downloading */
+    bool tls;
+    bool splice; /* data must be spliced into the socket */
+    unsigned long long benchLen; /* download this much and time it */
+};
+
+struct testStreamPeer {
+    const struct testStreamInfo *info;
+    virNetClientPtr client;
+    virNetClientProgramPtr prog;
+    unsigned int serial;
+    const char *src;
+    const char *dst;
+    char *buf;
+    long long holes;
+    unsigned long long received;
+    int result;
+    bool done;
+};
+
+
+static int
+testStreamDispatchOpen(virNetServerClientPtr client,
+                       virNetMessagePtr msg,
+                       virNetMessageErrorPtr rerr,
+                       unsigned int flags,
+                       bool upload)
+{
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
+    daemonClientStream *stream = NULL;
+    virStreamPtr st = NULL;
+    bool sparse = !!(flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM);
+    int rv = -1;
+
+    /* What a storage driver does with flags it doesn't know */
+    virCheckFlagsGoto(testDaemonFlags, cleanup);
+
+    if (!(st = virStreamNew(priv->conn, VIR_STREAM_NONBLOCK)))
+        goto cleanup;
+
+    if (!(stream = daemonCreateClientStream(client, st, remoteProgram,
+                                            &msg->header, sparse)))
+        goto cleanup;
+
+    if (virFDStreamOpenBlockDevice(st, upload ? testDaemonDst : testDaemonSrc,
+                                   0, 0, sparse,
+                                   upload ? O_WRONLY : O_RDONLY) < 0)
+        goto cleanup;
+
+    if (daemonAddClientStream(client, stream, !upload) < 0)
+        goto cleanup;
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        if (stream) {
+            virStreamAbort(st);
+            daemonFreeClientStream(client, stream);
+        } else {
+            virObjectUnref(st);
+        }
+    }
+    return rv;
+}
+
+
+static int
+testStreamDispatchUpload(virNetServerPtr server ATTRIBUTE_UNUSED,
+                         virNetServerClientPtr client,
+                         virNetMessagePtr msg,
+                         virNetMessageErrorPtr rerr,
+                         void *args,
+                         void *ret ATTRIBUTE_UNUSED)
+{
+    unsigned int *flags = args;
+
+    return testStreamDispatchOpen(client, msg, rerr, *flags, true);
+}
+
+
+static int
+testStreamDispatchDownload(virNetServerPtr server ATTRIBUTE_UNUSED,
+                           virNetServerClientPtr client,
+                           virNetMessagePtr msg,
+                           virNetMessageErrorPtr rerr,
+                           void *args,
+                           void *ret ATTRIBUTE_UNUSED)
+{
+    unsigned int *flags = args;
+
+    return testStreamDispatchOpen(client, msg, rerr, *flags, false);
+}
+
+
+static int
+testStreamDispatchPing(virNetServerPtr server ATTRIBUTE_UNUSED,
+                       virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                       virNetMessagePtr msg,
+                       virNetMessageErrorPtr rerr ATTRIBUTE_UNUSED,
+                       void *args ATTRIBUTE_UNUSED,
+                       void *ret)
+{
+    unsigned int *serial = ret;
+
+    *serial = msg->header.serial;
+    return 0;
+}
+
+
+/* Just the flags of remote_storage_vol_{up,down}load_args matter
+ * here, so the procedures take nothing but those */
+static virNetServerProgramProc testStreamProcs[] = {
+    [REMOTE_PROC_STORAGE_VOL_UPLOAD] = {
+        .func = testStreamDispatchUpload,
+        .arg_len = sizeof(unsigned int),
+        .arg_filter = (xdrproc_t) xdr_u_int,
+        .ret_filter = (xdrproc_t) xdr_void,
+    },
+    [REMOTE_PROC_STORAGE_VOL_DOWNLOAD] = {
+        .func = testStreamDispatchDownload,
+        .arg_len = sizeof(unsigned int),
+        .arg_filter = (xdrproc_t) xdr_u_int,
+        .ret_filter = (xdrproc_t) xdr_void,
+    },
+    /* Any call will do for getting a reply in between stream
+     * packets, this one hands back its serial */
+    [REMOTE_PROC_CONNECT_GET_LIB_VERSION] = {
+        .func = testStreamDispatchPing,
+        .arg_filter = (xdrproc_t) xdr_void,
+        .ret_len = sizeof(unsigned int),
+        .ret_filter = (xdrproc_t) xdr_u_int,
+    },
+};
+
+
+static void
+testStreamClientClose(virNetServerClientPtr client)
+{
+    daemonClientPrivatePtr priv = virNetServerClientGetPrivateData(client);
+
+    daemonRemoveAllClientStreams(priv->streams);
+}
+
+
+static void *
+testStreamClientNew(virNetServerClientPtr client,
+                    void *opaque ATTRIBUTE_UNUSED)
+{
+    daemonClientPrivatePtr priv;
+
+    if (VIR_ALLOC(priv) < 0)
+        return NULL;
+
+    if (virMutexInit(&priv->lock) < 0) {
+        VIR_FREE(priv);
+        virReportSystemError(errno, "%s", "unable to init mutex");
+        return NULL;
+    }
+
+    priv->conn = virObjectRef(testConn);
+    virNetServerClientSetCloseHook(client, testStreamClientClose);
+    return priv;
+}
+
+
+static void
+testStreamClientFree(void *opaque)
+{
+    daemonClientPrivatePtr priv = opaque;
+
+    virObjectUnref(priv->conn);
+    virMutexDestroy(&priv->lock);
+    VIR_FREE(priv);
+}
+
+
+void testStreamSpliced(int fd, ssize_t len);
+
+void
+testStreamSpliced(int fd, ssize_t len)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        testSpliced += len;
+}
+
+
+/* Lay out @path as data, hole, data, hole */
+static int
+testStreamMakeSparse(const char *path)
+{
+    int fd;
+
+    if ((fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0600)) < 0 ||
+        safewrite(fd, testPattern, TEST_DATA_LEN) != TEST_DATA_LEN ||
+        lseek(fd, TEST_HOLE_LEN, SEEK_CUR) < 0 ||
+        safewrite(fd, testPattern, TEST_DATA_LEN) != TEST_DATA_LEN ||
+        ftruncate(fd, TEST_FILE_LEN) < 0 ||
+        VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, "Cannot create %s", path);
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Fill @path with @length bytes of data */
+static int
+testStreamMakeDense(const char *path,
+                    unsigned long long length)
+{
+    unsigned long long offset;
+    int fd;
+
+    if ((fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0600)) < 0)
+        goto error;
+
+    for (offset = 0; offset < length; offset += TEST_DATA_LEN) {
+        ssize_t chunk = MIN(length - offset, TEST_DATA_LEN);
+
+        if (safewrite(fd, testPattern, chunk) != chunk)
+            goto error;
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virReportSystemError(errno, "Cannot create %s", path);
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
+
+
+/* Fill the first half of @path with data, so that holes have
+ * to be punched rather than just skipped over */
+static int
+testStreamMakeStale(const char *path)
+{
+    int fd;
+    size_t i;
+
+    if ((fd = open(path, O_CREAT|O_WRONLY|O_TRUNC, 0600)) < 0)
+        goto error;
+
+    for (i = 0; i < (TEST_DATA_LEN + TEST_HOLE_LEN) / TEST_DATA_LEN; i++) {
+        if (safewrite(fd, testPattern, TEST_DATA_LEN) != TEST_DATA_LEN)
+            goto error;
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virReportSystemError(errno, "Cannot create %s", path);
+    VIR_FORCE_CLOSE(fd);
+    return -1;
+}
+
+
+/* How many bytes of @path are holes, as far as the
+ * file system can tell */
+static long long
+testStreamCountHoles(const char *path)
+{
+    long long offset = 0;
+    long long holes = 0;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        virReportSystemError(errno, "Cannot open %s", path);
+        return -1;
+    }
+
+    while (offset < TEST_FILE_LEN) {
+        int inData;
+        long long length;
+
+        if (virFileInData(fd, &inData, &length) < 0 ||
+            length <= 0 ||
+            lseek(fd, length, SEEK_CUR) < 0) {
+            holes = -1;
+            break;
+        }
+
+        if (!inData)
+            holes += length;
+        offset += length;
+    }
+
+    VIR_FORCE_CLOSE(fd);
+    return holes;
+}
+
+
+/* Check that @path holds what testStreamMakeSparse wrote, and
+ * is sparse itself if any @holes were transferred */
+static int
+testStreamCheck(const char *path,
+                long long holes)
+{
+    char *data = NULL;
+    struct stat sb;
+    size_t i;
+    int ret = -1;
+
+    if (virFileReadAll(path, TEST_FILE_LEN + 1, &data) != TEST_FILE_LEN) {
+        virFilePrintf(stderr, "Unexpected size of %s\n", path);
+        goto cleanup;
+    }
+
+    for (i = 0; i < TEST_FILE_LEN; i++) {
+        char want = 0;
+
+        if (i < TEST_DATA_LEN)
+            want = testPattern[i];
+        else if (i >= TEST_DATA_LEN + TEST_HOLE_LEN &&
+                 i < 2 * TEST_DATA_LEN + TEST_HOLE_LEN)
+            want = testPattern[i - TEST_DATA_LEN - TEST_HOLE_LEN];
+
+        if (data[i] != want) {
+            virFilePrintf(stderr, "Mismatched data at offset %zu\n", i);
+            goto cleanup;
+        }
+    }
+
+    if (holes) {
+        if (stat(path, &sb) < 0)
+            goto cleanup;
+
+        if (sb.st_blocks * 512 >= TEST_FILE_LEN) {
+            virFilePrintf(stderr, "%s is not sparse\n", path);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(data);
+    return ret;
+}
+
+
+static virNetClientStreamPtr
+testStreamOpen(struct testStreamPeer *peer,
+               unsigned int flags)
+{
+    virNetClientStreamPtr st;
+    unsigned int serial = peer->serial++;
+    int proc = peer->info->upload ?
+        REMOTE_PROC_STORAGE_VOL_UPLOAD : REMOTE_PROC_STORAGE_VOL_DOWNLOAD;
+
+    if (!(st = virNetClientStreamNew(peer->prog, proc, serial,
+                                     !!(flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM))))
+        return NULL;
+
+    if (virNetClientAddStream(peer->client, st) < 0)
+        goto error;
+
+    if (virNetClientProgramCall(peer->prog, peer->client, serial, proc,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t) xdr_u_int, &flags,
+                                (xdrproc_t) xdr_void, NULL) < 0) {
+        virNetClientRemoveStream(peer->client, st);
+        goto error;
+    }
+
+    return st;
+
+ error:
+    virObjectUnref(st);
+    return NULL;
+}
+
+
+/* Make a call while the stream is going, its reply has to find
+ * its way in between the stream packets the daemon has queued */
+static int
+testStreamPing(struct testStreamPeer *peer)
+{
+    unsigned int serial = peer->serial++;
+    unsigned int ret = 0;
+
+    if (virNetClientProgramCall(peer->prog, peer->client, serial,
+                                REMOTE_PROC_CONNECT_GET_LIB_VERSION,
+                                0, NULL, NULL, NULL,
+                                (xdrproc_t) xdr_void, NULL,
+                                (xdrproc_t) xdr_u_int, &ret) < 0)
+        return -1;
+
+    if (ret != serial) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Reply for call %u came with %u", serial, ret);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testStreamFinish(struct testStreamPeer *peer,
+                 virNetClientStreamPtr st,
+                 bool abort)
+{
+    int ret = -1;
+
+    if (!virNetClientStreamRaiseError(st) &&
+        virNetClientStreamSendPacket(st, peer->client,
+                                     abort ? VIR_NET_ERROR : VIR_NET_OK,
+                                     NULL, 0) == 0)
+        ret = 0;
+
+    virNetClientRemoveStream(peer->client, st);
+    virObjectUnref(st);
+    return abort ? -1 : ret;
+}
+
+
+static int
+testStreamDownload(struct testStreamPeer *peer,
+                   virNetClientStreamPtr st)
+{
+    int fd = -1;
+    int ret = -1;
+
+    /* Benchmarks only count what they get */
+    if (!peer->info->benchLen &&
+        (fd = open(peer->dst, O_WRONLY)) < 0) {
+        virReportSystemError(errno, "Cannot open %s", peer->dst);
+        return -1;
+    }
+
+    for (;;) {
+        int got;
+
+        if (virNetClientStreamRaiseError(st))
+            goto cleanup;
+
+        got = virNetClientStreamRecvPacket(st, peer->client,
+                                           peer->buf, TEST_DATA_LEN,
+                                           false, peer->info->recvFlags);
+        if (got == -3) {
+            long long length;
+
+            if (virNetClientStreamRecvHole(st, &length, 0) < 0 ||
+                virFileWriteHole(fd, length) < 0)
+                goto cleanup;
+            peer->holes += length;
+            continue;
+        }
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+
+        peer->received += got;
+        if (fd >= 0 && safewrite(fd, peer->buf, got) != got) {
+            virReportSystemError(errno, "Cannot write %s", peer->dst);
+            goto cleanup;
+        }
+
+        if (peer->info->interleave && testStreamPing(peer) < 0)
+            goto cleanup;
+    }
+
+    if (fd >= 0 && VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, "Cannot close %s", peer->dst);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static int
+testStreamUpload(struct testStreamPeer *peer,
+                 virNetClientStreamPtr st,
+                 bool sparse)
+{
+    long long offset = 0;
+    int fd;
+    int ret = -1;
+
+    if ((fd = open(peer->src, O_RDONLY)) < 0) {
+        virReportSystemError(errno, "Cannot open %s", peer->src);
+        return -1;
+    }
+
+    while (offset < TEST_FILE_LEN) {
+        int inData = 1;
+        long long length = TEST_FILE_LEN - offset;
+
+        if (virNetClientStreamRaiseError(st))
+            goto cleanup;
+
+        if (sparse && virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+
+        if (!inData) {
+            if (virNetClientStreamSendHole(st, peer->client, length, 0) < 0)
+                goto cleanup;
+            if (lseek(fd, length, SEEK_CUR) < 0) {
+                virReportSystemError(errno, "Cannot seek %s", peer->src);
+                goto cleanup;
+            }
+            peer->holes += length;
+            offset += length;
+            continue;
+        }
+
+        if (length > TEST_DATA_LEN)
+            length = TEST_DATA_LEN;
+
+        if (saferead(fd, peer->buf, length) != length) {
+            virReportSystemError(errno, "Cannot read %s", peer->src);
+            goto cleanup;
+        }
+
+        if (virNetClientStreamSendPacket(st, peer->client, VIR_NET_CONTINUE,
+                                         peer->buf, length) < 0)
+            goto cleanup;
+        offset += length;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+
+static int
+testStreamTransfer(struct testStreamPeer *peer)
+{
+    const struct testStreamInfo *info = peer->info;
+    virNetClientStreamPtr st;
+    unsigned int flags = info->flags;
+    int rv;
+
+    if (!(st = testStreamOpen(peer, flags))) {
+        virErrorPtr err = virGetLastError();
+
+        if (!info->fallback || !err || err->code != VIR_ERR_INVALID_ARG)
+            return -1;
+
+        /* An older daemon: try again without a sparse stream */
+        VIR_TEST_DEBUG("Daemon rejected flags: %s\n", err->message);
+        virResetLastError();
+        flags = 0;
+        if (!(st = testStreamOpen(peer, flags)))
+            return -1;
+    } else if (info->fallback) {
+        virFilePrintf(stderr, "Daemon accepted unknown flags 0x%x\n", flags);
+        return testStreamFinish(peer, st, true);
+    }
+
+    if (info->upload)
+        rv = testStreamUpload(peer, st, flags != 0);
+    else
+        rv = testStreamDownload(peer, st);
+
+    return testStreamFinish(peer, st, rv < 0);
+}
+
+
+static void
+testStreamPeerRun(void *opaque)
+{
+    struct testStreamPeer *peer = opaque;
+
+#ifdef TEST_STREAM_TLS
+    if (peer->info->tls &&
+        virNetClientSetTLSSession(peer->client, testClientTLS) < 0)
+        peer->result = -1;
+    else
+#endif
+        peer->result = testStreamTransfer(peer);
+
+    if (peer->result < 0)
+        virFilePrintf(stderr, "Stream transfer failed: %s\n",
+                      virGetLastErrorMessage());
+
+    peer->done = true;
+    virNetClientClose(peer->client);
+}
+
+
+/* User plus system time of the whole test process, that is the
+ * daemon side and the client thread */
+static unsigned long long
+testStreamCPUTime(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        return 0;
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+
+static int
+testStream(const void *opaque)
+{
+    const struct testStreamInfo *info = opaque;
+    struct testStreamPeer peer;
+    virNetServerPtr srv = NULL;
+    virNetSocketPtr lsock = NULL;
+    virNetSocketPtr ssock = NULL;
+    virNetServerClientPtr sclient = NULL;
+    char *scratchdir = NULL;
+    char *sockpath = NULL;
+    char *src = NULL;
+    char *dst = NULL;
+    long long holes;
+    unsigned long long length = TEST_FILE_LEN;
+    unsigned long long spliced = 0;
+    unsigned long long cpuns = 0;
+    unsigned long long ns = 0;
+#ifdef WITH_GNUTLS
+    virNetTLSContextPtr tls = NULL;
+#endif
+    virThread thread;
+    bool joined = true;
+    int ret = -1;
+
+    if (info->benchLen) {
+        if (!virTestGetExpensive())
+            return EXIT_AM_SKIP;
+        length = info->benchLen;
+    }
+
+    memset(&peer, 0, sizeof(peer));
+    peer.info = info;
+    peer.result = -1;
+
+    if (VIR_STRDUP(scratchdir, "/tmp/libvirtdstreamtest-XXXXXX") < 0)
+        goto cleanup;
+
+    if (!mkdtemp(scratchdir)) {
+        virReportSystemError(errno, "Cannot create %s", scratchdir);
+        VIR_FREE(scratchdir);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&sockpath, "%s/sock", scratchdir) < 0 ||
+        virAsprintf(&src, "%s/src.data", scratchdir) < 0 ||
+        virAsprintf(&dst, "%s/dst.data", scratchdir) < 0 ||
+        VIR_ALLOC_N(peer.buf, TEST_DATA_LEN) < 0)
+        goto cleanup;
+
+    if (info->benchLen) {
+        if (testStreamMakeDense(src, length) < 0)
+            goto cleanup;
+    } else if (testStreamMakeSparse(src) < 0 ||
+               testStreamMakeStale(dst) < 0) {
+        goto cleanup;
+    }
+
+    /* The file system may not tell holes apart from zeroes */
+    if (info->flags && !info->fallback &&
+        (info->upload || info->recvFlags & VIR_STREAM_RECV_STOP_AT_HOLE)) {
+        if ((holes = testStreamCountHoles(src)) < 0)
+            goto cleanup;
+    } else {
+        holes = 0;
+    }
+
+#ifdef HAVE_SPLICE
+    if (info->splice)
+        spliced = length;
+#endif
+#ifdef TEST_STREAM_TLS
+    if (info->tls)
+        tls = testServerTLS;
+#endif
+
+    testDaemonFlags = info->daemonFlags;
+    testSpliced = 0;
+    testDaemonSrc = src;
+    testDaemonDst = dst;
+    peer.src = src;
+    peer.dst = dst;
+
+    if (!(srv = virNetServerNew("test", 1, 1, 2, 0, 1, 0, 5, 5, NULL,
+                                NULL, NULL, NULL, NULL)) ||
+        virNetServerAddProgram(srv, remoteProgram) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(sockpath, 0700, -1, getegid(), &lsock) < 0 ||
+        virNetSocketListen(lsock, 0) < 0)
+        goto cleanup;
+
+    if (!(peer.client = virNetClientNewUNIX(sockpath, false, NULL)) ||
+        virNetSocketAccept(lsock, &ssock) < 0 || !ssock)
+        goto cleanup;
+
+    if (!(sclient = virNetServerClientNew(1, ssock, 0, false, 5,
+#ifdef WITH_GNUTLS
+                                          tls,
+#endif
+                                          testStreamClientNew, NULL,
+                                          testStreamClientFree, NULL)) ||
+        virNetServerAddClient(srv, sclient) < 0)
+        goto cleanup;
+
+    if (!(peer.prog = virNetClientProgramNew(REMOTE_PROGRAM,
+                                             REMOTE_PROTOCOL_VERSION,
+                                             NULL, 0, NULL)) ||
+        virNetClientAddProgram(peer.client, peer.prog) < 0)
+        goto cleanup;
+
+    cpuns = testStreamCPUTime();
+    ns = virTestNowNs();
+
+    if (virThreadCreate(&thread, true, testStreamPeerRun, &peer) < 0)
+        goto cleanup;
+    joined = false;
+
+    while (!peer.done) {
+        if (virEventRunDefaultImpl() < 0)
+            goto cleanup;
+    }
+
+    virThreadJoin(&thread);
+    joined = true;
+
+    cpuns = testStreamCPUTime() - cpuns;
+    ns = virTestNowNs() - ns;
+
+    if (peer.result < 0)
+        goto cleanup;
+
+    VIR_TEST_DEBUG("Transferred %lld bytes as holes\n", peer.holes);
+    if (peer.holes != holes) {
+        virFilePrintf(stderr, "Expected %lld bytes of holes, got %lld\n",
+                      holes, peer.holes);
+        goto cleanup;
+    }
+
+    if (info->benchLen) {
+        if (peer.received != length) {
+            virFilePrintf(stderr, "Expected %llu bytes, got %llu\n",
+                          length, peer.received);
+            goto cleanup;
+        }
+
+        VIR_TEST_DEBUG("%.1f ms CPU per GiB, %.1f MiB/s\n",
+                       cpuns / 1e6 / (length / (1024.0 * 1024 * 1024)),
+                       length / (1024.0 * 1024) / (ns ? ns / 1e9 : 1));
+    } else if (testStreamCheck(dst, holes) < 0) {
+        goto cleanup;
+    }
+
+    VIR_TEST_DEBUG("Spliced %llu bytes\n", testSpliced);
+    if (testSpliced != spliced) {
+        virFilePrintf(stderr, "Expected %llu bytes spliced, got %llu\n",
+                      spliced, testSpliced);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (!joined) {
+        virNetClientClose(peer.client);
+        virThreadJoin(&thread);
+    }
+    if (ret < 0 && virGetLastError())
+        virFilePrintf(stderr, "%s\n", virGetLastErrorMessage());
+    if (sclient)
+        virNetServerClientClose(sclient);
+    if (srv)
+        virNetServerProcessClients(srv);
+    virObjectUnref(sclient);
+    virObjectUnref(srv);
+    if (peer.client)
+        virNetClientClose(peer.client);
+    virObjectUnref(peer.prog);
+    virObjectUnref(peer.client);
+    virObjectUnref(ssock);
+    virObjectUnref(lsock);
+    if (scratchdir && getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+    VIR_FREE(peer.buf);
+    VIR_FREE(scratchdir);
+    VIR_FREE(sockpath);
+    VIR_FREE(src);
+    VIR_FREE(dst);
+    return ret;
+}
+
+
+#define TEST_WINDOW_PACKETS 4
+#define TEST_WINDOW_REQUESTS 2
+/* A pipe buffer page per packet, so that reading one packet's
+ * worth from the pipe lets the stream take exactly one more */
+#define TEST_WINDOW_PAYLOAD 4096
+
+static int
+testStreamWindowCount(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                      virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    size_t *nread = opaque;
+
+    (*nread)++;
+    return 0;
+}
+
+
+static void
+testStreamWindowTimeout(int timer ATTRIBUTE_UNUSED,
+                        void *opaque)
+{
+    bool *expired = opaque;
+    *expired = true;
+}
+
+
+/* Check that a client uploading faster than the stream drains
+ * gets throttled after the stream window plus its request limit,
+ * and resumes once the stream takes the queued packets */
+static int
+testStreamWindow(const void *opaque ATTRIBUTE_UNUSED)
+{
+    size_t npackets = 3 * (TEST_WINDOW_PACKETS + TEST_WINDOW_REQUESTS);
+    virNetMessageHeader hdr;
+    virNetSocketPtr sock = NULL;
+    virNetServerClientPtr client = NULL;
+    virNetMessagePtr msg = NULL;
+    daemonClientStream *stream = NULL;
+    virStreamPtr st = NULL;
+    char payload[TEST_WINDOW_PAYLOAD];
+    bool expired;
+    int timer = -1;
+    int sv[2] = { -1, -1 };
+    int pipefd[2] = { -1, -1 };
+    size_t nread = 0;
+    size_t consumed = 0;
+    size_t i;
+    int ret = -1;
+
+    daemonStreamSetLimits(VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX,
+                          TEST_WINDOW_PACKETS);
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0 ||
+        pipe(pipefd) < 0) {
+        virReportSystemError(errno, "%s",
+                             "Cannot create socket pair");
+        goto cleanup;
+    }
+
+    /* Fill the pipe, so that the stream takes nothing
+     * until the test reads from the other end */
+    memset(payload, 'x', sizeof(payload));
+    if (virSetNonBlock(pipefd[1]) < 0)
+        goto cleanup;
+    while (write(pipefd[1], payload, sizeof(payload)) == sizeof(payload))
+        ;
+    if (errno != EAGAIN) {
+        virReportSystemError(errno, "%s", "Cannot fill pipe");
+        goto cleanup;
+    }
+
+    if (!(st = virStreamNew(testConn, VIR_STREAM_NONBLOCK)) ||
+        virFDStreamOpen(st, pipefd[1]) < 0)
+        goto cleanup;
+    pipefd[1] = -1;
+
+    if (virNetSocketNewConnectSockFD(sv[0], &sock) < 0)
+        goto cleanup;
+    sv[0] = -1;
+
+    if (!(client = virNetServerClientNew(1, sock, 0, false,
+                                         TEST_WINDOW_REQUESTS,
+#ifdef WITH_GNUTLS
+                                         NULL,
+#endif
+                                         testStreamClientNew, NULL,
+                                         testStreamClientFree, NULL)) ||
+        virNetServerClientAddFilter(client, testStreamWindowCount,
+                                    &nread) < 0)
+        goto cleanup;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.prog = REMOTE_PROGRAM;
+    hdr.vers = REMOTE_PROTOCOL_VERSION;
+    hdr.proc = REMOTE_PROC_STORAGE_VOL_UPLOAD;
+    hdr.serial = 1;
+
+    if (!(stream = daemonCreateClientStream(client, st, remoteProgram,
+                                            &hdr, false)))
+        goto cleanup;
+    st = NULL;
+
+    if (daemonAddClientStream(client, stream, false) < 0) {
+        daemonFreeClientStream(client, stream);
+        goto cleanup;
+    }
+
+    if (virNetServerClientInit(client) < 0)
+        goto cleanup;
+
+    /* All of it fits into the socket buffer at once */
+    for (i = 0; i < npackets; i++) {
+        if (!(msg = virNetMessageNew(false)))
+            goto cleanup;
+        msg->header = hdr;
+        msg->header.type = VIR_NET_STREAM;
+        msg->header.status = VIR_NET_CONTINUE;
+
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageEncodePayloadRaw(msg, payload,
+                                          sizeof(payload)) < 0)
+            goto cleanup;
+
+        if (safewrite(sv[1], msg->buffer, msg->bufferLength) < 0) {
+            virReportSystemError(errno, "%s", "Cannot write packet");
+            goto cleanup;
+        }
+
+        virNetMessageFree(msg);
+        msg = NULL;
+    }
+
+    if ((timer = virEventAddTimeout(100, testStreamWindowTimeout,
+                                    &expired, NULL)) < 0)
+        goto cleanup;
+
+    while (consumed < npackets) {
+        size_t want = MIN(consumed + TEST_WINDOW_PACKETS + TEST_WINDOW_REQUESTS,
+                          npackets);
+
+        /* Wait for the reads to stall */
+        expired = false;
+        virEventUpdateTimeout(timer, 100);
+        while (!expired) {
+            if (virNetServerClientWantClose(client) ||
+                virEventRunDefaultImpl() < 0)
+                goto cleanup;
+        }
+
+        if (nread != want) {
+            virFilePrintf(stderr, "Expected %zu packets read, got %zu\n",
+                          want, nread);
+            goto cleanup;
+        }
+
+        /* Make room for everything read so far. Once the stream
+         * takes the tracked packets, reading resumes */
+        for (i = consumed; i < nread; i++) {
+            if (saferead(pipefd[0], payload, sizeof(payload)) !=
+                sizeof(payload)) {
+                virReportSystemError(errno, "%s", "Cannot drain pipe");
+                goto cleanup;
+            }
+        }
+        consumed = nread;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0 && virGetLastError())
+        virFilePrintf(stderr, "%s\n", virGetLastErrorMessage());
+    if (timer != -1)
+        virEventRemoveTimeout(timer);
+    virNetMessageFree(msg);
+    if (client) {
+        virNetServerClientClose(client);
+        virObjectUnref(client);
+    }
+    virObjectUnref(st);
+    virObjectUnref(sock);
+    VIR_FORCE_CLOSE(sv[0]);
+    VIR_FORCE_CLOSE(sv[1]);
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    return ret;
+}
+
+
+#ifdef TEST_STREAM_TLS
+static struct testTLSCertReq testCACertReq = {
+    NULL, "cacert-stream.pem",
+    "UK", "libvirt CA", NULL, NULL, NULL, NULL,
+    true, true, true,
+    true, true, GNUTLS_KEY_KEY_CERT_SIGN,
+    false, false, NULL, NULL,
+    0, 0,
+};
+
+static struct testTLSCertReq testServerCertReq = {
+    NULL, "servercert-stream.pem",
+    "UK", "libvirt.org", NULL, NULL, NULL, NULL,
+    true, true, false,
+    true, true, GNUTLS_KEY_DIGITAL_SIGNATURE | GNUTLS_KEY_KEY_ENCIPHERMENT,
+    true, true, GNUTLS_KP_TLS_WWW_SERVER, NULL,
+    0, 0,
+};
+
+static struct testTLSCertReq testClientCertReq = {
+    NULL, "clientcert-stream.pem",
+    "UK", "libvirt", NULL, NULL, NULL, NULL,
+    true, true, false,
+    true, true, GNUTLS_KEY_DIGITAL_SIGNATURE | GNUTLS_KEY_KEY_ENCIPHERMENT,
+    true, true, GNUTLS_KP_TLS_WWW_CLIENT, NULL,
+    0, 0,
+};
+
+
+static int
+testStreamTLSInit(void)
+{
+    setenv("GNUTLS_FORCE_FIPS_MODE", "2", 1);
+
+    testTLSInit(KEYFILE);
+    testTLSGenerateCert(&testCACertReq, NULL);
+    testTLSGenerateCert(&testServerCertReq, testCACertReq.crt);
+    testTLSGenerateCert(&testClientCertReq, testCACertReq.crt);
+
+    if (!(testServerTLS = virNetTLSContextNewServer(testCACertReq.filename,
+                                                    NULL,
+                                                    testServerCertReq.filename,
+                                                    KEYFILE,
+                                                    NULL, NULL,
+                                                    false, true)) ||
+        !(testClientTLS = virNetTLSContextNewClient(testCACertReq.filename,
+                                                    NULL,
+                                                    testClientCertReq.filename,
+                                                    KEYFILE,
+                                                    NULL,
+                                                    false, true)))
+        return -1;
+
+    return 0;
+}
+
+
+static void
+testStreamTLSCleanup(void)
+{
+    virObjectUnref(testServerTLS);
+    virObjectUnref(testClientTLS);
+    testTLSDiscardCert(&testClientCertReq);
+    testTLSDiscardCert(&testServerCertReq);
+    testTLSDiscardCert(&testCACertReq);
+    testTLSCleanup(KEYFILE);
+}
+#endif /* TEST_STREAM_TLS */
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    size_t i;
+
+    for (i = 0; i < TEST_DATA_LEN; i++)
+        testPattern[i] = (i % 255) + 1;
+
+    if (virEventRegisterDefaultImpl() < 0 ||
+        !(testConn = virConnectOpen("test:///default")) ||
+        !(remoteProgram = virNetServerProgramNew(REMOTE_PROGRAM,
+                                                 REMOTE_PROTOCOL_VERSION,
+                                                 testStreamProcs,
+                                                 ARRAY_CARDINALITY(testStreamProcs)))) {
+        virDispatchError(NULL);
+        return EXIT_FAILURE;
+    }
+
+#ifdef TEST_STREAM_TLS
+    if (testStreamTLSInit() < 0) {
+        virDispatchError(NULL);
+        return EXIT_FAILURE;
+    }
+#endif
+
+#define DO_TEST(name, ...)                                                  \
+    do {                                                                    \
+        struct testStreamInfo info = { __VA_ARGS__ };                       \
+        if (virTestRun(name, testStream, &info) < 0)                        \
+            ret = -1;                                                       \
+    } while (0)
+
+#define SPARSE_DOWNLOAD VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM
+#define SPARSE_UPLOAD VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM
+#define STOP_AT_HOLE VIR_STREAM_RECV_STOP_AT_HOLE
+
+    DO_TEST("Sparse download",
+            .daemonFlags = SPARSE_DOWNLOAD, .flags = SPARSE_DOWNLOAD,
+            .recvFlags = STOP_AT_HOLE);
+    DO_TEST("Sparse download read as zeroes",
+            .daemonFlags = SPARSE_DOWNLOAD, .flags = SPARSE_DOWNLOAD);
+    DO_TEST("Plain download",
+            .daemonFlags = SPARSE_DOWNLOAD, .recvFlags = STOP_AT_HOLE,
+            .splice = true);
+    DO_TEST("Plain download with other calls",
+            .daemonFlags = SPARSE_DOWNLOAD, .recvFlags = STOP_AT_HOLE,
+            .interleave = true, .splice = true);
+#ifdef TEST_STREAM_TLS
+    DO_TEST("Plain download over TLS",
+            .daemonFlags = SPARSE_DOWNLOAD, .recvFlags = STOP_AT_HOLE,
+            .interleave = true, .tls = true);
+#endif
+    DO_TEST("Sparse download from old daemon",
+            .flags = SPARSE_DOWNLOAD, .recvFlags = STOP_AT_HOLE,
+            .fallback = true, .splice = true);
+    DO_TEST("Sparse upload",
+            .upload = true,
+            .daemonFlags = SPARSE_UPLOAD, .flags = SPARSE_UPLOAD);
+    DO_TEST("Plain upload",
+            .upload = true, .daemonFlags = SPARSE_UPLOAD);
+    DO_TEST("Sparse upload to old daemon",
+            .upload = true, .flags = SPARSE_UPLOAD, .fallback = true);
+
+    /* Downloads of a file without holes: spliced, copied as framed
+     * data from the iohelper, and copied to a TLS session, which
+     * adds the cost of encrypting it */
+    DO_TEST("Plain download benchmark",
+            .daemonFlags = SPARSE_DOWNLOAD, .splice = true,
+            .benchLen = TEST_BENCH_LEN);
+    DO_TEST("Sparse download benchmark",
+            .daemonFlags = SPARSE_DOWNLOAD, .flags = SPARSE_DOWNLOAD,
+            .benchLen = TEST_BENCH_LEN);
+#ifdef TEST_STREAM_TLS
+    DO_TEST("Plain download over TLS benchmark",
+            .daemonFlags = SPARSE_DOWNLOAD, .tls = true,
+            .benchLen = TEST_BENCH_LEN);
+#endif
+
+    if (virTestRun("Stream window", testStreamWindow, NULL) < 0)
+        ret = -1;
+
+#ifdef TEST_STREAM_TLS
+    testStreamTLSCleanup();
+#endif
+    virObjectUnref(remoteProgram);
+    virConnectClose(testConn);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/libvirtdstreammock.so")
@@ -19,9 +19,13 @@
 
 #include <config.h>
 
+#include <fcntl.h>
+#include <time.h>
+
 #include "testutils.h"
 #include "testutilsqemu.h"
 #include "qemumonitortestutils.h"
+#include "virfile.h"
 #define __QEMU_CAPSRIV_H_ALLOW__
 #include "qemu/qemu_capspriv.h"
 
@@ -33,6 +37,7 @@ struct _testQemuData {
     virDomainXMLOptionPtr xmlopt;
     const char *archName;
     const char *base;
+    const char *scratchdir;
 };
 
 
@@ -121,12 +126,183 @@ testQemuCapsCopy(const void *opaque)
 }
 
 
+/* Storing the capabilities in the binary cache format and loading them
+ * back must not change anything, while corrupted data must be refused */
+static int
+testQemuCapsBinary(const void *opaque)
+{
+    int ret = -1;
+    const testQemuData *data = opaque;
+    char *capsFile = NULL;
+    virCapsPtr caps = NULL;
+    virQEMUCapsPtr orig = NULL;
+    virQEMUCapsPtr loaded = NULL;
+    virQEMUCapsPtr broken = NULL;
+    char *bin = NULL;
+    size_t len;
+    time_t qemuctime;
+    time_t selfctime;
+    unsigned long selfvers;
+    char *actual = NULL;
+
+    if (virAsprintf(&capsFile, "%s/qemucapabilitiesdata/%s.%s.xml",
+                    abs_srcdir, data->base, data->archName) < 0)
+        goto cleanup;
+
+    if (!(caps = virCapabilitiesNew(virArchFromString(data->archName),
+                                    false, false)))
+        goto cleanup;
+
+    if (!(orig = qemuTestParseCapabilities(caps, capsFile)))
+        goto cleanup;
+
+    if (!(bin = virQEMUCapsFormatCacheBinary(orig, 1234, 5678, &len)))
+        goto cleanup;
+
+    if (!(loaded = virQEMUCapsNew()) ||
+        virQEMUCapsParseCacheBinary(caps, loaded, bin, len, &qemuctime,
+                                    &selfctime, &selfvers) < 0)
+        goto cleanup;
+
+    if (selfctime != 1234 || selfvers != 5678) {
+        VIR_TEST_DEBUG("unexpected selfctime %lld or selfvers %lu\n",
+                       (long long) selfctime, selfvers);
+        goto cleanup;
+    }
+
+    if (!(actual = virQEMUCapsFormatCache(loaded, 0, 0)))
+        goto cleanup;
+
+    if (virTestCompareToFile(actual, capsFile) < 0)
+        goto cleanup;
+
+    if (!(broken = virQEMUCapsNew()) ||
+        virQEMUCapsParseCacheBinary(caps, broken, bin, len - 1, &qemuctime,
+                                    &selfctime, &selfvers) == 0) {
+        VIR_TEST_DEBUG("truncated cache was not refused\n");
+        goto cleanup;
+    }
+
+    /* Make the last string unterminated */
+    bin[len - 1] = 'x';
+    virObjectUnref(broken);
+    if (!(broken = virQEMUCapsNew()) ||
+        virQEMUCapsParseCacheBinary(caps, broken, bin, len, &qemuctime,
+                                    &selfctime, &selfvers) == 0) {
+        VIR_TEST_DEBUG("unterminated string in cache was not refused\n");
+        goto cleanup;
+    }
+    virResetLastError();
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(capsFile);
+    VIR_FREE(bin);
+    VIR_FREE(actual);
+    virObjectUnref(caps);
+    virObjectUnref(orig);
+    virObjectUnref(loaded);
+    virObjectUnref(broken);
+    return ret;
+}
+
+
+/* Compare the time needed to load the XML and the binary cache, which
+ * is what libvirtd does for every QEMU binary on startup */
+static int
+testQemuCapsCacheBenchmark(const void *opaque)
+{
+    int ret = -1;
+    const testQemuData *data = opaque;
+    size_t nloops = 1000;
+    char *capsFile = NULL;
+    char *binFile = NULL;
+    virCapsPtr caps = NULL;
+    virQEMUCapsPtr qemuCaps = NULL;
+    char *bin = NULL;
+    size_t len;
+    time_t qemuctime;
+    time_t selfctime;
+    unsigned long selfvers;
+    unsigned long long start, xml, binary;
+    int fd = -1;
+    size_t i;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    if (virAsprintf(&capsFile, "%s/qemucapabilitiesdata/%s.%s.xml",
+                    abs_srcdir, data->base, data->archName) < 0 ||
+        virAsprintf(&binFile, "%s/%s.%s.bin",
+                    data->scratchdir, data->base, data->archName) < 0)
+        goto cleanup;
+
+    if (!(caps = virCapabilitiesNew(virArchFromString(data->archName),
+                                    false, false)))
+        goto cleanup;
+
+    if (!(qemuCaps = qemuTestParseCapabilities(caps, capsFile)) ||
+        !(bin = virQEMUCapsFormatCacheBinary(qemuCaps, 0, 0, &len)))
+        goto cleanup;
+    virObjectUnref(qemuCaps);
+    qemuCaps = NULL;
+
+    if ((fd = open(binFile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        safewrite(fd, bin, len) < 0 ||
+        VIR_CLOSE(fd) < 0) {
+        VIR_TEST_DEBUG("cannot write '%s'\n", binFile);
+        goto cleanup;
+    }
+
+    start = virTestNowNs();
+    for (i = 0; i < nloops; i++) {
+        if (!(qemuCaps = qemuTestParseCapabilities(caps, capsFile)))
+            goto cleanup;
+        virObjectUnref(qemuCaps);
+    }
+    xml = virTestNowNs();
+
+    for (i = 0; i < nloops; i++) {
+        if (!(qemuCaps = virQEMUCapsNew()))
+            goto cleanup;
+        if (virQEMUCapsLoadCacheBinary(caps, qemuCaps, binFile, &qemuctime,
+                                       &selfctime, &selfvers) < 0)
+            goto cleanup;
+        virObjectUnref(qemuCaps);
+    }
+    binary = virTestNowNs();
+    qemuCaps = NULL;
+
+    VIR_TEST_DEBUG("%s.%s: XML %llu us, binary %llu us per load\n",
+                   data->base, data->archName,
+                   (xml - start) / nloops / 1000,
+                   (binary - xml) / nloops / 1000);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (binFile)
+        unlink(binFile);
+    VIR_FREE(capsFile);
+    VIR_FREE(binFile);
+    VIR_FREE(bin);
+    virObjectUnref(caps);
+    virObjectUnref(qemuCaps);
+    return ret;
+}
+
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/qemucapscache-XXXXXX"
+
 static int
 mymain(void)
 {
     int ret = 0;
     virQEMUDriver driver;
     testQemuData data;
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
 
 #if !WITH_YAJL
     fputs("libvirt not compiled with yajl, skipping this test\n", stderr);
@@ -139,7 +315,13 @@ mymain(void)
 
     virEventRegisterDefaultImpl();
 
+    if (!mkdtemp(scratchdir)) {
+        virFilePrintf(stderr, "Cannot create scratch dir");
+        return EXIT_FAILURE;
+    }
+
     data.xmlopt = driver.xmlopt;
+    data.scratchdir = scratchdir;
 
 #define DO_TEST(arch, name)                                             \
     do {                                                                \
@@ -150,6 +332,12 @@ mymain(void)
         if (virTestRun("copy " name "(" arch ")",                       \
                        testQemuCapsCopy, &data) < 0)                    \
             ret = -1;                                                   \
+        if (virTestRun("binary " name "(" arch ")",                     \
+                       testQemuCapsBinary, &data) < 0)                  \
+            ret = -1;                                                   \
+        if (virTestRun("load benchmark " name "(" arch ")",             \
+                       testQemuCapsCacheBenchmark, &data) < 0)          \
+            ret = -1;                                                   \
     } while (0)
 
     DO_TEST("x86_64", "caps_1.2.2");
@@ -172,6 +360,9 @@ mymain(void)
      * to generate updated or new *.replies data files.
      */
 
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
     qemuTestDriverFree(&driver);
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
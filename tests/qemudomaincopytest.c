@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "qemu/qemu_domain.h"
+# include "testutilsqemu.h"
+# include "virbuffer.h"
+# include "virfile.h"
+# include "virstring.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+/* What virDomainDefCopy did before disks and interfaces were copied
+ * natively */
+static virDomainDefPtr
+testDomainDefCopyXML(virDomainDefPtr def,
+                     bool migratable)
+{
+    virDomainDefPtr ret;
+    char *xml;
+    unsigned int format_flags = VIR_DOMAIN_DEF_FORMAT_SECURE;
+
+    if (migratable)
+        format_flags |= VIR_DOMAIN_DEF_FORMAT_INACTIVE |
+                        VIR_DOMAIN_DEF_FORMAT_MIGRATABLE;
+
+    if (!(xml = virDomainDefFormat(def, driver.caps, format_flags)))
+        return NULL;
+
+    ret = virDomainDefParseString(xml, driver.caps, driver.xmlopt, NULL,
+                                  VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                  VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+testDomainDefCopyCompare(virDomainDefPtr def,
+                         bool migratable)
+{
+    virDomainDefPtr expect = NULL;
+    virDomainDefPtr actual = NULL;
+    char *expectXML = NULL;
+    char *actualXML = NULL;
+    int ret = -1;
+
+    if (!(expect = testDomainDefCopyXML(def, migratable)) ||
+        !(actual = virDomainDefCopy(def, driver.caps, driver.xmlopt, NULL,
+                                    migratable)))
+        goto cleanup;
+
+    if (!(expectXML = virDomainDefFormat(expect, driver.caps,
+                                         VIR_DOMAIN_DEF_FORMAT_SECURE)) ||
+        !(actualXML = virDomainDefFormat(actual, driver.caps,
+                                         VIR_DOMAIN_DEF_FORMAT_SECURE)))
+        goto cleanup;
+
+    if (STRNEQ(expectXML, actualXML)) {
+        virTestDifference(stderr, expectXML, actualXML);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(expect);
+    virDomainDefFree(actual);
+    VIR_FREE(expectXML);
+    VIR_FREE(actualXML);
+    return ret;
+}
+
+
+struct testDomainDefCopyInfo {
+    const char *path;
+    unsigned int parseFlags;
+    bool stripControllers;
+};
+
+
+/* Take the addresses from controllers, like the parser of the copy
+ * would have to assign them to a definition coming from elsewhere */
+static void
+testDomainDefCopyStripControllers(virDomainDefPtr def)
+{
+    size_t i;
+
+    for (i = 0; i < def->ncontrollers; i++) {
+        virDomainDeviceInfoPtr info = &def->controllers[i]->info;
+
+        if (info->type != VIR_DOMAIN_DEVICE_ADDRESS_TYPE_PCI)
+            continue;
+
+        memset(&info->addr, 0, sizeof(info->addr));
+        info->type = VIR_DOMAIN_DEVICE_ADDRESS_TYPE_NONE;
+    }
+}
+
+
+static int
+testDomainDefCopyFile(const void *opaque)
+{
+    const struct testDomainDefCopyInfo *info = opaque;
+    virDomainDefPtr def;
+    int ret = -1;
+
+    /* Inputs for the negative tests of qemuxml2argv don't parse */
+    if (!(def = virDomainDefParseFile(info->path, driver.caps, driver.xmlopt,
+                                      NULL, info->parseFlags))) {
+        virResetLastError();
+        return EXIT_AM_SKIP;
+    }
+
+    if (info->stripControllers)
+        testDomainDefCopyStripControllers(def);
+
+    if (testDomainDefCopyCompare(def, false) < 0 ||
+        testDomainDefCopyCompare(def, true) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    return ret;
+}
+
+
+/* Copy what the driver keeps for running domains, too. It has
+ * aliases, the actual network, block jobs, backing chains and
+ * the labels that were skipped */
+# define STATUS_PARSE_FLAGS (VIR_DOMAIN_DEF_PARSE_STATUS | \
+                             VIR_DOMAIN_DEF_PARSE_ACTUAL_NET | \
+                             VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES)
+
+static int
+testDomainDefCopyDir(const char *dir_path)
+{
+    DIR *dir = NULL;
+    struct dirent *ent;
+    int ret = 0;
+    int rc;
+    char *test_name = NULL;
+    char *xml_path = NULL;
+    struct testDomainDefCopyInfo info = { NULL, 0, false };
+
+    if (virDirOpen(&dir, dir_path) < 0)
+        return -1;
+
+    while ((rc = virDirRead(dir, &ent, dir_path)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&xml_path, "%s/%s", dir_path, ent->d_name) < 0 ||
+            virAsprintf(&test_name, "Copy %s", ent->d_name) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        info.path = xml_path;
+        info.parseFlags = 0;
+        if (virTestRun(test_name, testDomainDefCopyFile, &info) < 0)
+            ret = -1;
+        VIR_FREE(test_name);
+
+        if (virAsprintf(&test_name, "Copy status %s", ent->d_name) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        info.parseFlags = STATUS_PARSE_FLAGS;
+        if (virTestRun(test_name, testDomainDefCopyFile, &info) < 0)
+            ret = -1;
+
+        VIR_FREE(test_name);
+        VIR_FREE(xml_path);
+    }
+
+    if (rc < 0)
+        ret = -1;
+
+ cleanup:
+    VIR_FREE(test_name);
+    VIR_FREE(xml_path);
+    VIR_DIR_CLOSE(dir);
+    return ret;
+}
+
+
+# define BENCH_DEVICES 256
+
+static char *
+testDomainDefCopyBenchXML(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *dst;
+    size_t i;
+
+    virBufferAddLit(&buf,
+                    "<domain type='kvm'>\n"
+                    "  <name>copybench</name>\n"
+                    "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db1809</uuid>\n"
+                    "  <memory unit='KiB'>4194304</memory>\n"
+                    "  <vcpu placement='static'>4</vcpu>\n"
+                    "  <os>\n"
+                    "    <type arch='x86_64' machine='pc'>hvm</type>\n"
+                    "  </os>\n"
+                    "  <devices>\n"
+                    "    <emulator>/usr/bin/qemu-system-x86_64</emulator>\n");
+
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        if (!(dst = virIndexToDiskName(i, "vd"))) {
+            virBufferFreeAndReset(&buf);
+            return NULL;
+        }
+
+        virBufferAsprintf(&buf,
+                          "    <disk type='file' device='disk'>\n"
+                          "      <driver name='qemu' type='qcow2' cache='none'/>\n"
+                          "      <source file='/var/lib/libvirt/images/disk%zu.qcow2'/>\n"
+                          "      <target dev='%s' bus='virtio'/>\n"
+                          "      <serial>disk%zu</serial>\n"
+                          "      <alias name='virtio-disk%zu'/>\n"
+                          "    </disk>\n",
+                          i, dst, i, i);
+        VIR_FREE(dst);
+    }
+
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        virBufferAsprintf(&buf,
+                          "    <interface type='bridge'>\n"
+                          "      <mac address='52:54:00:%02zx:%02zx:01'/>\n"
+                          "      <source bridge='br%zu'/>\n"
+                          "      <target dev='vnet%zu'/>\n"
+                          "      <model type='virtio'/>\n"
+                          "      <driver name='vhost' queues='4'/>\n"
+                          "      <alias name='net%zu'/>\n"
+                          "    </interface>\n",
+                          i >> 8, i & 0xff, i % 4, i, i);
+    }
+
+    virBufferAddLit(&buf,
+                    "    <memballoon model='none'/>\n"
+                    "  </devices>\n"
+                    "</domain>\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static int
+testDomainDefCopyBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    size_t iterations = 200;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr copy;
+    unsigned long long xmlns, nativens;
+    char *xml = NULL;
+    int ret = -1;
+    size_t i;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    if (!(xml = testDomainDefCopyBenchXML()) ||
+        !(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                        NULL, 0)))
+        goto cleanup;
+
+    if (testDomainDefCopyCompare(def, false) < 0)
+        goto cleanup;
+
+    xmlns = virTestNowNs();
+    for (i = 0; i < iterations; i++) {
+        if (!(copy = testDomainDefCopyXML(def, false)))
+            goto cleanup;
+        virDomainDefFree(copy);
+    }
+    xmlns = virTestNowNs() - xmlns;
+
+    nativens = virTestNowNs();
+    for (i = 0; i < iterations; i++) {
+        if (!(copy = virDomainDefCopy(def, driver.caps, driver.xmlopt,
+                                      NULL, false)))
+            goto cleanup;
+        virDomainDefFree(copy);
+    }
+    nativens = virTestNowNs() - nativens;
+
+    VIR_TEST_DEBUG("%d disks and %d interfaces: %.1f copies/s via XML, "
+                   "%.1f copies/s native\n",
+                   BENCH_DEVICES, BENCH_DEVICES,
+                   iterations * 1e9 / (xmlns ? xmlns : 1),
+                   iterations * 1e9 / (nativens ? nativens : 1));
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    virQEMUCapsPtr qemuCaps = NULL;
+    struct testDomainDefCopyInfo addressless = {
+        abs_srcdir "/qemudomaincopydata/address-less-controllers.xml",
+        0, true,
+    };
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    /* Enough to auto-add PCI bridges for the bigger inputs */
+    if (!(qemuCaps = virQEMUCapsNew())) {
+        ret = -1;
+        goto cleanup;
+    }
+    virQEMUCapsSetList(qemuCaps,
+                       QEMU_CAPS_DEVICE_PCI_BRIDGE,
+                       QEMU_CAPS_DEVICE_DMI_TO_PCI_BRIDGE,
+                       QEMU_CAPS_LAST);
+    if (qemuTestCapsCacheInsert(driver.qemuCapsCache, "copy", qemuCaps) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (testDomainDefCopyDir(abs_srcdir "/qemuxml2argvdata") < 0 ||
+        testDomainDefCopyDir(abs_srcdir "/qemudomaincopydata") < 0)
+        ret = -1;
+
+    /* The copy must not hand out the addresses of disks and
+     * interfaces once more */
+    if (virTestRun("Copy address-less controllers",
+                   testDomainDefCopyFile, &addressless) < 0)
+        ret = -1;
+
+    if (virTestRun("Copy benchmark", testDomainDefCopyBench, NULL) < 0)
+        ret = -1;
+
+ cleanup:
+    virObjectUnref(qemuCaps);
+    qemuTestDriverFree(&driver);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
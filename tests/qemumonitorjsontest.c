@@ -543,6 +543,76 @@ testQemuMonitorJSONGetCommands(const void *data)
 }
 
 
+/* Feed a multi-megabyte reply through the monitor receive path
+ * and report the throughput it achieved */
+static int
+testQemuMonitorJSONGetCommandsLarge(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *reply = NULL;
+    size_t replyLen;
+    char **commands = NULL;
+    int ncommands = 0;
+    size_t want = virTestGetExpensive() ? 200000 : 50000;
+    unsigned long long nsecs;
+    char last[32];
+    int ret = -1;
+    size_t i;
+
+    if (!test)
+        return -1;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < want; i++)
+        virBufferAsprintf(&buf, "%s{\"name\": \"command-%zu\"}",
+                          i ? ", " : "", i);
+    virBufferAddLit(&buf, "]}");
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+    replyLen = virBufferUse(&buf);
+    reply = virBufferContentAndReset(&buf);
+
+    if (qemuMonitorTestAddItem(test, "query-commands", reply) < 0)
+        goto cleanup;
+
+    nsecs = virTestNowNs();
+    if ((ncommands = qemuMonitorGetCommands(qemuMonitorTestGetMonitor(test),
+                                            &commands)) < 0)
+        goto cleanup;
+    nsecs = virTestNowNs() - nsecs;
+
+    if (ncommands != want) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "ncommands %d is not %zu", ncommands, want);
+        goto cleanup;
+    }
+
+    snprintf(last, sizeof(last), "command-%zu", want - 1);
+    if (STRNEQ(commands[want - 1], last)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "last command %s is wrong", commands[want - 1]);
+        goto cleanup;
+    }
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("\nreceived %zu byte reply in %llu ms (%llu KiB/s)\n",
+                       replyLen, nsecs / 1000000,
+                       replyLen * 1000000000ull / 1024 / MAX(nsecs, 1));
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    qemuMonitorTestFree(test);
+    for (i = 0; i < ncommands; i++)
+        VIR_FREE(commands[i]);
+    VIR_FREE(commands);
+    VIR_FREE(reply);
+    return ret;
+}
+
+
 static int
 testQemuMonitorJSONGetTPMModels(const void *data)
 {
@@ -2642,6 +2712,7 @@ mymain(void)
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
+    DO_TEST(GetCommandsLarge);
     DO_TEST(GetTPMModels);
     DO_TEST(GetCommandLineOptionParameters);
     if (qemuMonitorJSONTestAttachChardev(driver.xmlopt) < 0)
@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "qemu/qemu_domain.h"
+# include "testutilsqemu.h"
+# include "virevent.h"
+# include "virfile.h"
+# include "virstring.h"
+# include "virthread.h"
+# include "virtime.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define SCRATCHDIRTEMPLATE abs_builddir "/qemustatussavedir-XXXXXX"
+
+/* how long to wait for the timer or the worker before giving up */
+# define TEST_STATUS_SAVE_TIMEOUT 5000
+
+static virQEMUDriver driver;
+
+static const char testDomainXML[] =
+    "<domain type='qemu'>"
+    "  <name>statussave</name>"
+    "  <uuid>c7a5fdbd-edaf-9455-926a-d65c16db1809</uuid>"
+    "  <memory unit='KiB'>219100</memory>"
+    "  <vcpu placement='static'>1</vcpu>"
+    "  <os>"
+    "    <type arch='x86_64' machine='pc'>hvm</type>"
+    "  </os>"
+    "  <devices>"
+    "    <emulator>/usr/bin/qemu-system-x86_64</emulator>"
+    "  </devices>"
+    "</domain>";
+
+/* Jobs are held back by the worker until the gate is opened, so that
+ * a test can look at (and cancel) a write which is queued already */
+static virMutex testLock;
+static virCond testCond;
+static bool testGateClosed;
+static size_t testProcessed;
+
+
+/* What qemuProcessEventHandler does with the event */
+static void
+testStatusSaveHandler(void *data,
+                      void *opaque)
+{
+    struct qemuProcessEvent *processEvent = data;
+    virDomainObjPtr vm = processEvent->vm;
+    virQEMUDriverPtr drv = opaque;
+
+    virMutexLock(&testLock);
+    while (testGateClosed)
+        ignore_value(virCondWait(&testCond, &testLock));
+    virMutexUnlock(&testLock);
+
+    virObjectLock(vm);
+    if (processEvent->eventType == QEMU_PROCESS_EVENT_SAVE_STATUS)
+        qemuDomainSaveStatusProcess(drv, vm);
+    virDomainObjEndAPI(&vm);
+    VIR_FREE(processEvent);
+
+    virMutexLock(&testLock);
+    testProcessed++;
+    virCondBroadcast(&testCond);
+    virMutexUnlock(&testLock);
+}
+
+
+static void
+testStatusSaveGate(bool closed)
+{
+    virMutexLock(&testLock);
+    testGateClosed = closed;
+    virCondBroadcast(&testCond);
+    virMutexUnlock(&testLock);
+}
+
+
+static int
+testStatusSaveWaitProcessed(size_t count)
+{
+    unsigned long long deadline;
+    int ret = 0;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += TEST_STATUS_SAVE_TIMEOUT;
+
+    virMutexLock(&testLock);
+    while (testProcessed < count) {
+        if (virCondWaitUntil(&testCond, &testLock, deadline) < 0) {
+            VIR_TEST_DEBUG("Worker processed %zu jobs, expected %zu\n",
+                           testProcessed, count);
+            ret = -1;
+            break;
+        }
+    }
+    virMutexUnlock(&testLock);
+
+    return ret;
+}
+
+
+/* Runs the event loop until the pending timer of @vm fired */
+static int
+testStatusSaveRunTimer(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long now;
+    unsigned long long deadline;
+    bool pending;
+
+    if (virTimeMillisNow(&deadline) < 0)
+        return -1;
+    deadline += TEST_STATUS_SAVE_TIMEOUT;
+
+    while (true) {
+        virObjectLock(vm);
+        pending = priv->statusSaveTimer != -1;
+        virObjectUnlock(vm);
+
+        if (!pending)
+            return 0;
+
+        if (virTimeMillisNow(&now) < 0 || now > deadline) {
+            VIR_TEST_DEBUG("Status save timer did not fire\n");
+            return -1;
+        }
+
+        if (virEventRunDefaultImpl() < 0)
+            return -1;
+    }
+}
+
+
+static virDomainObjPtr
+testStatusSaveNewVM(void)
+{
+    virDomainObjPtr vm;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)))
+        return NULL;
+
+    if (!(vm->def = virDomainDefParseString(testDomainXML,
+                                            driver.caps,
+                                            driver.xmlopt,
+                                            NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE))) {
+        virObjectUnref(vm);
+        return NULL;
+    }
+
+    vm->def->id = 1;
+    virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
+
+    return vm;
+}
+
+
+static void
+testStatusSaveFreeVM(virDomainObjPtr vm)
+{
+    char *file;
+
+    if (!vm)
+        return;
+
+    qemuDomainSaveStatusCancel(vm);
+
+    if (virAsprintf(&file, "%s/%s.xml",
+                    driver.config->stateDir, vm->def->name) == 0) {
+        unlink(file);
+        VIR_FREE(file);
+    }
+
+    virObjectUnref(vm);
+}
+
+
+static int
+testStatusSaveCheck(virDomainObjPtr vm,
+                    unsigned long long requested,
+                    unsigned long long written,
+                    bool pending)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *file = NULL;
+    bool exists;
+    int ret = -1;
+
+    if (virAsprintf(&file, "%s/%s.xml",
+                    driver.config->stateDir, vm->def->name) < 0)
+        return -1;
+    exists = virFileExists(file);
+
+    if (priv->statusSaveRequested != requested) {
+        VIR_TEST_DEBUG("Expected %llu requested writes, got %llu\n",
+                       requested, priv->statusSaveRequested);
+        goto cleanup;
+    }
+
+    if (priv->statusSaveWritten != written) {
+        VIR_TEST_DEBUG("Expected %llu writes, got %llu\n",
+                       written, priv->statusSaveWritten);
+        goto cleanup;
+    }
+
+    if (priv->statusSaveDirty != pending) {
+        VIR_TEST_DEBUG("Expected a write %s pending\n",
+                       pending ? "to be" : "not to be");
+        goto cleanup;
+    }
+
+    if (exists != (written > 0)) {
+        VIR_TEST_DEBUG("Status XML %s\n",
+                       exists ? "was written" : "is missing");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(file);
+    return ret;
+}
+
+
+static int
+testStatusSaveCoalesce(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    size_t processed = testProcessed;
+    size_t i;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+
+    virObjectLock(vm);
+    for (i = 0; i < 5; i++) {
+        if (qemuDomainSaveStatus(&driver, vm) < 0)
+            goto cleanup;
+    }
+    if (testStatusSaveCheck(vm, 5, 0, true) < 0)
+        goto cleanup;
+    virObjectUnlock(vm);
+
+    if (testStatusSaveRunTimer(vm) < 0 ||
+        testStatusSaveWaitProcessed(processed + 1) < 0)
+        goto unlocked;
+
+    virObjectLock(vm);
+    if (testStatusSaveCheck(vm, 5, 1, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+ unlocked:
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+static int
+testStatusSaveQueued(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    size_t processed = testProcessed;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+    priv = vm->privateData;
+
+    testStatusSaveGate(true);
+
+    virObjectLock(vm);
+    if (qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    virObjectUnlock(vm);
+
+    if (testStatusSaveRunTimer(vm) < 0)
+        goto unlocked;
+
+    /* further requests go with the write waiting for the worker */
+    virObjectLock(vm);
+    if (!priv->statusSaveQueued) {
+        VIR_TEST_DEBUG("Status save was not queued\n");
+        goto cleanup;
+    }
+    if (qemuDomainSaveStatus(&driver, vm) < 0 ||
+        qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    if (priv->statusSaveTimer != -1) {
+        VIR_TEST_DEBUG("Timer armed while a write is queued\n");
+        goto cleanup;
+    }
+    if (testStatusSaveCheck(vm, 3, 0, true) < 0)
+        goto cleanup;
+    virObjectUnlock(vm);
+
+    testStatusSaveGate(false);
+    if (testStatusSaveWaitProcessed(processed + 1) < 0)
+        goto unlocked;
+
+    virObjectLock(vm);
+    if (testStatusSaveCheck(vm, 3, 1, false) < 0)
+        goto cleanup;
+    if (priv->statusSaveQueued) {
+        VIR_TEST_DEBUG("Status save still marked as queued\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+ unlocked:
+    testStatusSaveGate(false);
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+static int
+testStatusSaveSync(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+    priv = vm->privateData;
+
+    virObjectLock(vm);
+    if (qemuDomainSaveStatus(&driver, vm) < 0 ||
+        qemuDomainSaveStatusSync(&driver, vm) < 0)
+        goto cleanup;
+
+    if (priv->statusSaveTimer != -1) {
+        VIR_TEST_DEBUG("Timer left behind by the synchronous write\n");
+        goto cleanup;
+    }
+    if (testStatusSaveCheck(vm, 2, 1, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+static int
+testStatusSaveFlush(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+    priv = vm->privateData;
+
+    virObjectLock(vm);
+
+    /* nothing to write */
+    qemuDomainSaveStatusFlush(&driver, vm);
+    if (testStatusSaveCheck(vm, 0, 0, false) < 0)
+        goto cleanup;
+
+    if (qemuDomainSaveStatus(&driver, vm) < 0 ||
+        qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    qemuDomainSaveStatusFlush(&driver, vm);
+
+    if (priv->statusSaveTimer != -1) {
+        VIR_TEST_DEBUG("Timer left behind by the flush\n");
+        goto cleanup;
+    }
+    if (testStatusSaveCheck(vm, 2, 1, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+/* qemuProcessStop drops the pending write before removing the file */
+static int
+testStatusSaveCancel(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    qemuDomainObjPrivatePtr priv;
+    size_t processed = testProcessed;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+    priv = vm->privateData;
+
+    virObjectLock(vm);
+
+    /* while the timer is armed */
+    if (qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    qemuDomainSaveStatusCancel(vm);
+    if (priv->statusSaveTimer != -1) {
+        VIR_TEST_DEBUG("Timer left behind by the cancel\n");
+        goto cleanup;
+    }
+    if (testStatusSaveCheck(vm, 1, 0, false) < 0)
+        goto cleanup;
+
+    /* and once the write waits for the worker */
+    testStatusSaveGate(true);
+    if (qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    virObjectUnlock(vm);
+
+    if (testStatusSaveRunTimer(vm) < 0)
+        goto unlocked;
+
+    virObjectLock(vm);
+    qemuDomainSaveStatusCancel(vm);
+    virObjectUnlock(vm);
+
+    testStatusSaveGate(false);
+    if (testStatusSaveWaitProcessed(processed + 1) < 0)
+        goto unlocked;
+
+    virObjectLock(vm);
+    if (testStatusSaveCheck(vm, 2, 0, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+ unlocked:
+    testStatusSaveGate(false);
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+static int
+testStatusSaveInactive(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virDomainObjPtr vm;
+    size_t processed = testProcessed;
+    int ret = -1;
+
+    if (!(vm = testStatusSaveNewVM()))
+        return -1;
+
+    virObjectLock(vm);
+    if (qemuDomainSaveStatus(&driver, vm) < 0)
+        goto cleanup;
+    vm->def->id = -1;
+    virObjectUnlock(vm);
+
+    if (testStatusSaveRunTimer(vm) < 0 ||
+        testStatusSaveWaitProcessed(processed + 1) < 0)
+        goto unlocked;
+
+    virObjectLock(vm);
+    if (testStatusSaveCheck(vm, 1, 0, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virObjectUnlock(vm);
+ unlocked:
+    testStatusSaveFreeVM(vm);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+
+    if (virMutexInit(&testLock) < 0 ||
+        virCondInit(&testCond) < 0 ||
+        virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+    if (!mkdtemp(scratchdir)) {
+        virFilePrintf(stderr, "Cannot create %s\n", scratchdir);
+        return EXIT_FAILURE;
+    }
+
+    if (qemuTestDriverInit(&driver) < 0) {
+        virFileDeleteTree(scratchdir);
+        return EXIT_FAILURE;
+    }
+
+    VIR_FREE(driver.config->stateDir);
+    if (VIR_STRDUP(driver.config->stateDir, scratchdir) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+    driver.config->statusSaveDelay = 10;
+
+    if (!(driver.workerPool = virThreadPoolNew(0, 1, 0,
+                                               testStatusSaveHandler,
+                                               &driver))) {
+        ret = -1;
+        goto cleanup;
+    }
+
+# define DO_TEST(name, func) \
+    do { \
+        if (virTestRun("Status save " name, func, NULL) < 0) \
+            ret = -1; \
+    } while (0)
+
+    DO_TEST("coalesce", testStatusSaveCoalesce);
+    DO_TEST("queued", testStatusSaveQueued);
+    DO_TEST("sync", testStatusSaveSync);
+    DO_TEST("flush", testStatusSaveFlush);
+    DO_TEST("cancel", testStatusSaveCancel);
+    DO_TEST("inactive", testStatusSaveInactive);
+
+# undef DO_TEST
+
+ cleanup:
+    virThreadPoolFree(driver.workerPool);
+    driver.workerPool = NULL;
+    qemuTestDriverFree(&driver);
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
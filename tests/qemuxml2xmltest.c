@@ -16,6 +16,7 @@
 # include "qemu/qemu_domain_address.h"
 # include "qemu/qemu_domain.h"
 # include "testutilsqemu.h"
+# include "virfile.h"
 # include "virstring.h"
 
 # define VIR_FROM_THIS VIR_FROM_NONE
@@ -308,6 +309,155 @@ testInfoSet(struct testInfo *info,
 }
 
 
+/*
+ * Device elements may be spread over several <devices> elements. The
+ * parser has always collected them from all of them, so check that
+ * disk-many split in two parses the same as the original.
+ */
+static int
+testSplitDevices(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *path = abs_srcdir
+        "/qemuxml2argvdata/qemuxml2argv-disk-many.xml";
+    virDomainDefPtr def = NULL;
+    char *xml = NULL;
+    char *splitXML = NULL;
+    char *expectXML = NULL;
+    char *actualXML = NULL;
+    char *pos;
+    int ret = -1;
+
+    if (virTestLoadFile(path, &xml) < 0)
+        goto cleanup;
+
+    if (!(pos = strstr(xml, "    <controller "))) {
+        VIR_TEST_DEBUG("no controller in %s\n", path);
+        goto cleanup;
+    }
+
+    if (virAsprintf(&splitXML, "%.*s  </devices>\n  <devices>\n%s",
+                    (int) (pos - xml), xml, pos) < 0)
+        goto cleanup;
+
+    if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                        NULL, 0)) ||
+        !(expectXML = virDomainDefFormat(def, driver.caps, 0)))
+        goto cleanup;
+    virDomainDefFree(def);
+
+    if (!(def = virDomainDefParseString(splitXML, driver.caps, driver.xmlopt,
+                                        NULL, 0)) ||
+        !(actualXML = virDomainDefFormat(def, driver.caps, 0)))
+        goto cleanup;
+
+    if (virTestCompareToString(expectXML, actualXML) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virDomainDefFree(def);
+    VIR_FREE(xml);
+    VIR_FREE(splitXML);
+    VIR_FREE(expectXML);
+    VIR_FREE(actualXML);
+    return ret;
+}
+
+
+/*
+ * Report how many domains per second the parser gets through when
+ * fed all the inputs of qemuxml2argvtest. The tests above compare
+ * what it makes of them against the expected output.
+ */
+static int
+testParseBench(const void *opaque ATTRIBUTE_UNUSED)
+{
+    const char *dir_path = abs_srcdir "/qemuxml2argvdata";
+    size_t iterations = 20;
+    virQEMUCapsPtr qemuCaps = NULL;
+    virDomainDefPtr def;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    char **xmls = NULL;
+    size_t nxmls = 0;
+    char *path = NULL;
+    char *xml = NULL;
+    unsigned long long nsecs;
+    size_t i, j;
+    int rc;
+    int ret = -1;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    /* Enough to auto-add PCI bridges for the bigger inputs */
+    if (!(qemuCaps = virQEMUCapsNew()))
+        goto cleanup;
+    virQEMUCapsSetList(qemuCaps,
+                       QEMU_CAPS_DEVICE_PCI_BRIDGE,
+                       QEMU_CAPS_DEVICE_DMI_TO_PCI_BRIDGE,
+                       QEMU_CAPS_LAST);
+    if (qemuTestCapsCacheInsert(driver.qemuCapsCache, "parse-bench",
+                                qemuCaps) < 0)
+        goto cleanup;
+
+    if (virDirOpen(&dir, dir_path) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, dir_path)) > 0) {
+        if (!virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&path, "%s/%s", dir_path, ent->d_name) < 0 ||
+            virTestLoadFile(path, &xml) < 0)
+            goto cleanup;
+        VIR_FREE(path);
+
+        /* Inputs for the negative tests don't parse */
+        if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL, 0))) {
+            virResetLastError();
+            VIR_FREE(xml);
+            continue;
+        }
+        virDomainDefFree(def);
+
+        if (VIR_APPEND_ELEMENT(xmls, nxmls, xml) < 0)
+            goto cleanup;
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    nsecs = virTestNowNs();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < nxmls; j++) {
+            if (!(def = virDomainDefParseString(xmls[j], driver.caps,
+                                                driver.xmlopt, NULL, 0)))
+                goto cleanup;
+            virDomainDefFree(def);
+        }
+    }
+
+    nsecs = virTestNowNs() - nsecs;
+
+    VIR_TEST_DEBUG("%zu domains: %.1f domains parsed/s\n",
+                   nxmls, iterations * nxmls * 1e9 / (nsecs ? nsecs : 1));
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nxmls; i++)
+        VIR_FREE(xmls[i]);
+    VIR_FREE(xmls);
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    VIR_DIR_CLOSE(dir);
+    virObjectUnref(qemuCaps);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -890,6 +1040,12 @@ mymain(void)
     DO_TEST("intel-iommu",
             QEMU_CAPS_DEVICE_PCI_BRIDGE, QEMU_CAPS_DEVICE_DMI_TO_PCI_BRIDGE);
 
+    if (virTestRun("QEMU XML split devices", testSplitDevices, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("QEMU XML parse benchmark", testParseBench, NULL) < 0)
+        ret = -1;
+
     qemuTestDriverFree(&driver);
 
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
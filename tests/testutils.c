@@ -34,6 +34,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <time.h>
 #include "testutils.h"
 #include "internal.h"
 #include "viralloc.h"
@@ -832,6 +833,20 @@ virTestGetRegenerate(void)
     return testRegenerate;
 }
 
+/*
+ * Returns the monotonic clock in nanoseconds, for the benchmarks which
+ * time themselves. Those only run with VIR_TEST_EXPENSIVE set.
+ */
+unsigned long long
+virTestNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static int
 virTestSetEnvPath(void)
 {
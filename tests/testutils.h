@@ -83,6 +83,8 @@ unsigned int virTestGetVerbose(void);
 unsigned int virTestGetExpensive(void);
 unsigned int virTestGetRegenerate(void);
 
+unsigned long long virTestNowNs(void);
+
 # define VIR_TEST_DEBUG(...)                    \
     do {                                        \
         if (virTestGetDebug())                  \
@@ -26,6 +26,7 @@
 # include <stdlib.h>
 # include <unistd.h>
 # include <fcntl.h>
+# include <dirent.h>
 # include <sys/stat.h>
 
 # ifdef MAJOR_IN_MKDEV
@@ -47,6 +48,7 @@ static int (*real___xstat)(int ver, const char *path, struct stat *sb);
 static int (*real_lstat)(const char *path, struct stat *sb);
 static int (*real___lxstat)(int ver, const char *path, struct stat *sb);
 static int (*real_mkdir)(const char *path, mode_t mode);
+static DIR *(*real_opendir)(const char *path);
 
 /* Don't make static, since it causes problems with clang
  * when passed as an arg to asprintf()
@@ -401,6 +403,7 @@ static void init_syms(void)
     VIR_MOCK_REAL_INIT_ALT(stat, __xstat);
     VIR_MOCK_REAL_INIT(mkdir);
     VIR_MOCK_REAL_INIT(open);
+    VIR_MOCK_REAL_INIT(opendir);
 }
 
 static void init_sysfs(void)
@@ -738,6 +741,27 @@ int open(const char *path, int flags, ...)
     free(newpath);
     return ret;
 }
+
+DIR *opendir(const char *path)
+{
+    DIR *ret;
+    char *newpath = NULL;
+
+    init_syms();
+
+    if (STRPREFIX(path, SYSFS_CGROUP_PREFIX)) {
+        init_sysfs();
+        if (asprintf(&newpath, "%s/%s",
+                     fakesysfscgroupdir,
+                     path + strlen(SYSFS_CGROUP_PREFIX)) < 0) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    ret = real_opendir(newpath ? newpath : path);
+    free(newpath);
+    return ret;
+}
 #else
 /* Nothing to override on non-__linux__ platforms */
 #endif
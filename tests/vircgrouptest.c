@@ -692,6 +692,245 @@ static int testCgroupGetPercpuStats(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+# define TEST_NVCPUS 64
+
+static int
+testCgroupNewVcpus(virCgroupPtr *cgroup,
+                   virBitmapPtr *vcpus)
+{
+    virCgroupPtr vcpu = NULL;
+    size_t i;
+    int rv;
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_CPU) |
+                                    (1 << VIR_CGROUP_CONTROLLER_CPUACCT),
+                                    cgroup)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        return -1;
+    }
+
+    if (!(*vcpus = virBitmapNew(TEST_NVCPUS)))
+        return -1;
+
+    for (i = 0; i < TEST_NVCPUS; i++) {
+        if (virCgroupNewThread(*cgroup, VIR_CGROUP_THREAD_VCPU, i,
+                               true, &vcpu) < 0)
+            return -1;
+        virCgroupFree(&vcpu);
+        ignore_value(virBitmapSetBit(*vcpus, i));
+    }
+
+    return 0;
+}
+
+static int testCgroupGetPercpuVcpuStats(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr cgroup = NULL;
+    virBitmapPtr vcpus = NULL;
+    virTypedParameterPtr params = NULL;
+    size_t i, j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(params, EXPECTED_NCPUS * 2) < 0 ||
+        testCgroupNewVcpus(&cgroup, &vcpus) < 0)
+        goto cleanup;
+
+    /* The second round reads from the files kept open by the first */
+    for (j = 0; j < 2; j++) {
+        if (virCgroupGetPercpuStats(cgroup, params, 2, 0,
+                                    EXPECTED_NCPUS, vcpus) != 2) {
+            fprintf(stderr, "Failed call to virCgroupGetPercpuStats\n");
+            goto cleanup;
+        }
+
+        /* Each vCPU group has the same usage as the domain */
+        for (i = 0; i < EXPECTED_NCPUS; i++) {
+            virTypedParameterPtr cputime = &params[i * 2];
+            virTypedParameterPtr vcputime = &params[i * 2 + 1];
+
+            if (STRNEQ(vcputime->field, VIR_DOMAIN_CPU_STATS_VCPUTIME) ||
+                vcputime->value.ul != cputime->value.ul * TEST_NVCPUS) {
+                fprintf(stderr,
+                        "Wrong vcputime at %zu in round %zu: %s=%llu\n",
+                        i, j, vcputime->field, vcputime->value.ul);
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    virBitmapFree(vcpus);
+    VIR_FREE(params);
+    return ret;
+}
+
+static int testCgroupStatsBench(const void *args ATTRIBUTE_UNUSED)
+{
+    size_t iterations = 10000;
+    virCgroupPtr cgroup = NULL;
+    virBitmapPtr vcpus = NULL;
+    virTypedParameterPtr params = NULL;
+    unsigned long long usage, user, sys;
+    unsigned long long ns;
+    size_t i;
+    int ret = -1;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    if (VIR_ALLOC_N(params, EXPECTED_NCPUS * 2) < 0 ||
+        testCgroupNewVcpus(&cgroup, &vcpus) < 0)
+        goto cleanup;
+
+    /* What a domain stats call reads for a 64 vCPU guest */
+    ns = virTestNowNs();
+    for (i = 0; i < iterations; i++) {
+        if (virCgroupGetCpuacctUsage(cgroup, &usage) < 0 ||
+            virCgroupGetCpuacctStat(cgroup, &user, &sys) < 0 ||
+            virCgroupGetPercpuStats(cgroup, params, 2, 0,
+                                    EXPECTED_NCPUS, vcpus) < 0)
+            goto cleanup;
+    }
+    ns = virTestNowNs() - ns;
+
+    VIR_TEST_DEBUG("%d vCPUs: %.1f stats calls/s\n",
+                   TEST_NVCPUS, iterations * 1e9 / (ns ? ns : 1));
+
+    ret = 0;
+
+ cleanup:
+    virCgroupFree(&cgroup);
+    virBitmapFree(vcpus);
+    VIR_FREE(params);
+    return ret;
+}
+
+# define TEST_NDOMAINS 3
+
+static int testCgroupGetCpuacctStatsAll(const void *args ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr partition = NULL;
+    virCgroupPtr domains[TEST_NDOMAINS] = { NULL };
+    virCgroupStatsWalkPtr walk = NULL;
+    virCgroupCpuacctStatsTable table;
+    virCgroupCpuacctStatsPtr stats;
+    unsigned long long usage, user, sys;
+    char *name = NULL;
+    size_t i;
+    int rv, ret = -1;
+
+    memset(&table, 0, sizeof(table));
+
+    if ((rv = virCgroupNewPartition("/virtualmachines", true,
+                                    (1 << VIR_CGROUP_CONTROLLER_CPU) |
+                                    (1 << VIR_CGROUP_CONTROLLER_CPUACCT),
+                                    &partition)) < 0) {
+        fprintf(stderr, "Could not create /virtualmachines cgroup: %d\n", -rv);
+        goto cleanup;
+    }
+
+    for (i = 0; i < TEST_NDOMAINS; i++) {
+        if (virAsprintf(&name, "dom%zu", i) < 0 ||
+            virCgroupNewDomainPartition(partition, "lxc", name, true,
+                                        &domains[i]) < 0)
+            goto cleanup;
+        VIR_FREE(name);
+    }
+
+    if (!(walk = virCgroupStatsWalkNew()))
+        goto cleanup;
+
+    /* Nothing to walk before the walk knows about any group */
+    if (virCgroupGetCpuacctStatsAll(walk, &table) < 0)
+        goto cleanup;
+    if (table.nstats != 0) {
+        fprintf(stderr, "Expected no stats, got %zu\n", table.nstats);
+        goto cleanup;
+    }
+    virCgroupCpuacctStatsTableClear(&table);
+
+    for (i = 0; i < TEST_NDOMAINS; i++) {
+        if (virCgroupStatsWalkAddGroup(walk, domains[i]) < 0)
+            goto cleanup;
+    }
+    /* Outside of the partition of the domains, so not walked */
+    if (virCgroupStatsWalkAddGroup(walk, partition) < 0)
+        goto cleanup;
+
+    if (virCgroupGetCpuacctStatsAll(walk, &table) < 0)
+        goto cleanup;
+    if (table.nstats != TEST_NDOMAINS) {
+        fprintf(stderr, "Expected %d stats, got %zu\n",
+                TEST_NDOMAINS, table.nstats);
+        goto cleanup;
+    }
+
+    for (i = 0; i < TEST_NDOMAINS; i++) {
+        if (!(stats = virCgroupCpuacctStatsTableLookup(&table, domains[i]))) {
+            fprintf(stderr, "Missing stats of domain %zu\n", i);
+            goto cleanup;
+        }
+
+        if (virCgroupGetCpuacctUsage(domains[i], &usage) < 0 ||
+            virCgroupGetCpuacctStat(domains[i], &user, &sys) < 0)
+            goto cleanup;
+
+        if (stats->usage != usage || stats->user != user ||
+            stats->sys != sys) {
+            fprintf(stderr,
+                    "Wrong stats of domain %zu: %llu %llu %llu, "
+                    "expected %llu %llu %llu\n", i,
+                    stats->usage, stats->user, stats->sys,
+                    usage, user, sys);
+            goto cleanup;
+        }
+    }
+
+    if (virCgroupCpuacctStatsTableLookup(&table, partition)) {
+        fprintf(stderr, "Unexpected stats of the partition\n");
+        goto cleanup;
+    }
+    virCgroupCpuacctStatsTableClear(&table);
+
+    /* Only the groups asked for are read, in any order */
+    if (virCgroupCpuacctStatsTableWant(&table, domains[2]) < 0 ||
+        virCgroupCpuacctStatsTableWant(&table, NULL) < 0 ||
+        virCgroupCpuacctStatsTableWant(&table, domains[0]) < 0)
+        goto cleanup;
+
+    if (virCgroupGetCpuacctStatsAll(walk, &table) < 0)
+        goto cleanup;
+    if (table.nstats != 2) {
+        fprintf(stderr, "Expected 2 stats, got %zu\n", table.nstats);
+        goto cleanup;
+    }
+
+    if (!virCgroupCpuacctStatsTableLookup(&table, domains[0]) ||
+        !virCgroupCpuacctStatsTableLookup(&table, domains[2])) {
+        fprintf(stderr, "Missing stats of a wanted domain\n");
+        goto cleanup;
+    }
+    if (virCgroupCpuacctStatsTableLookup(&table, domains[1])) {
+        fprintf(stderr, "Unexpected stats of domain 1\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virCgroupCpuacctStatsTableClear(&table);
+    virCgroupStatsWalkFree(walk);
+    for (i = 0; i < TEST_NDOMAINS; i++)
+        virCgroupFree(&domains[i]);
+    virCgroupFree(&partition);
+    VIR_FREE(name);
+    return ret;
+}
+
 static int testCgroupGetMemoryUsage(const void *args ATTRIBUTE_UNUSED)
 {
     virCgroupPtr cgroup = NULL;
@@ -922,6 +1161,15 @@ mymain(void)
     if (virTestRun("virCgroupGetPercpuStats works", testCgroupGetPercpuStats, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupGetPercpuStats vcpus", testCgroupGetPercpuVcpuStats, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Stats benchmark", testCgroupStatsBench, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("virCgroupGetCpuacctStatsAll works", testCgroupGetCpuacctStatsAll, NULL) < 0)
+        ret = -1;
+
     setenv("VIR_CGROUP_MOCK_MODE", "allinone", 1);
     if (virTestRun("New cgroup for self (allinone)", testCgroupNewForSelfAllInOne, NULL) < 0)
         ret = -1;
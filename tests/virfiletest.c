@@ -21,11 +21,14 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <fcntl.h>
 
 #include "testutils.h"
 #include "virfile.h"
 #include "virstring.h"
 
+#define VIR_FROM_THIS VIR_FROM_NONE
+
 
 #if defined HAVE_MNTENT_H && defined HAVE_GETMNTENT_R
 static int testFileCheckMounts(const char *prefix,
@@ -118,6 +121,166 @@ testFileSanitizePath(const void *opaque)
 }
 
 
+#ifndef WIN32
+# define WRAPPER_TEMPLATE abs_builddir "/virfiletest-wrapper-XXXXXX"
+
+/* Push a stream that is not a multiple of the helper's chunk size
+ * through a parallel wrapper into a file, then read it back the same
+ * way and check both the file and the stream that came out.  */
+static int
+testFileWrapperParallel(const void *opaque)
+{
+    unsigned int threads = *(const unsigned int *)opaque;
+    char path[] = WRAPPER_TEMPLATE;
+    ssize_t len = 5 * 1024 * 1024 + 1234;
+    virFileWrapperFdPtr wfd = NULL;
+    char *data = NULL;
+    char *back = NULL;
+    char *contents = NULL;
+    int fd = -1;
+    int ret = -1;
+    ssize_t i;
+
+    if (VIR_ALLOC_N(data, len) < 0 ||
+        VIR_ALLOC_N(back, len + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < len; i++)
+        data[i] = (i * 2654435761U) >> 13;
+
+    if ((fd = mkostemp(path, O_CLOEXEC)) < 0) {
+        fprintf(stderr, "cannot create %s\n", path);
+        goto cleanup;
+    }
+    VIR_FORCE_CLOSE(fd);
+
+    if ((fd = open(path, O_WRONLY | O_TRUNC)) < 0 ||
+        !(wfd = virFileWrapperFdNewParallel(&fd, path, 0, threads)))
+        goto cleanup;
+
+    if (safewrite(fd, data, len) != len ||
+        VIR_CLOSE(fd) < 0 ||
+        virFileWrapperFdClose(wfd) < 0)
+        goto cleanup;
+    virFileWrapperFdFree(wfd);
+    wfd = NULL;
+
+    if (virFileReadAll(path, len + 1, &contents) != len ||
+        memcmp(contents, data, len) != 0) {
+        fprintf(stderr, "file written with %u threads differs\n", threads);
+        goto cleanup;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        !(wfd = virFileWrapperFdNewParallel(&fd, path, 0, threads)))
+        goto cleanup;
+
+    if (saferead(fd, back, len + 1) != len ||
+        VIR_CLOSE(fd) < 0 ||
+        virFileWrapperFdClose(wfd) < 0)
+        goto cleanup;
+
+    if (memcmp(back, data, len) != 0) {
+        fprintf(stderr, "file read with %u threads differs\n", threads);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virFileWrapperFdFree(wfd);
+    unlink(path);
+    VIR_FREE(contents);
+    VIR_FREE(back);
+    VIR_FREE(data);
+    return ret;
+}
+
+
+/* Time a save-like stream of small writes going through the helper
+ * into a fresh file, either via the page cache or bypassing it.  Run
+ * from a build directory on tmpfs or a loop device to take the disk
+ * out of the picture and see the helper's own copy rate.  This writes
+ * 128 MiB per case, so it only runs with VIR_TEST_EXPENSIVE=1.  */
+static int
+testFileWrapperThroughput(const void *opaque)
+{
+    bool bypass = *(const bool *)opaque;
+    char path[] = WRAPPER_TEMPLATE;
+    size_t total = 128 * 1024 * 1024;
+    size_t bufsize = 256 * 1024;
+    unsigned int flags = VIR_FILE_WRAPPER_NON_BLOCKING;
+    int oflags = O_WRONLY | O_TRUNC;
+    virFileWrapperFdPtr wfd = NULL;
+    unsigned long long nsecs;
+    char *buf = NULL;
+    size_t done;
+    int fd = -1;
+    int ret = -1;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    if (bypass) {
+        int directFlag = virFileDirectFdFlag();
+
+        if (directFlag < 0)
+            return EXIT_AM_SKIP;
+        oflags |= directFlag;
+        flags |= VIR_FILE_WRAPPER_BYPASS_CACHE;
+    }
+
+    if (VIR_ALLOC_N(buf, bufsize) < 0)
+        goto cleanup;
+    memset(buf, 0x5a, bufsize);
+
+    if ((fd = mkostemp(path, O_CLOEXEC)) < 0) {
+        fprintf(stderr, "cannot create %s\n", path);
+        goto cleanup;
+    }
+    VIR_FORCE_CLOSE(fd);
+
+    if ((fd = open(path, oflags)) < 0) {
+        /* Not every file system can do O_DIRECT, tmpfs among them */
+        if (bypass && errno == EINVAL)
+            ret = EXIT_AM_SKIP;
+        goto cleanup;
+    }
+
+    nsecs = virTestNowNs();
+
+    if (!(wfd = virFileWrapperFdNew(&fd, path, flags)))
+        goto cleanup;
+
+    for (done = 0; done < total; done += bufsize) {
+        if (safewrite(fd, buf, bufsize) < 0)
+            goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0 ||
+        virFileWrapperFdClose(wfd) < 0)
+        goto cleanup;
+
+    nsecs = virTestNowNs() - nsecs;
+
+    VIR_TEST_DEBUG("%s: %llu MiB/s\n",
+                   bypass ? "bypass cache" : "page cache",
+                   (unsigned long long) total * 1000000000ull /
+                   (nsecs ? nsecs : 1) / (1024 * 1024));
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    virFileWrapperFdFree(wfd);
+    unlink(path);
+    VIR_FREE(buf);
+    return ret;
+}
+#endif /* ! WIN32 */
+
+
 static int
 mymain(void)
 {
@@ -186,6 +349,30 @@ mymain(void)
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo//hoo");
     DO_TEST_SANITIZE_PATH_SAME("gluster://bar.baz/fooo///////hoo");
 
+#ifndef WIN32
+# define DO_TEST_WRAPPER_PARALLEL(THREADS)                                     \
+    do {                                                                       \
+        unsigned int threads = THREADS;                                        \
+        if (virTestRun("wrapper parallel " #THREADS, testFileWrapperParallel,  \
+                       &threads) < 0)                                          \
+            ret = -1;                                                          \
+    } while (0)
+
+    DO_TEST_WRAPPER_PARALLEL(2);
+    DO_TEST_WRAPPER_PARALLEL(8);
+
+# define DO_TEST_WRAPPER_THROUGHPUT(BYPASS)                                    \
+    do {                                                                       \
+        bool bypass = BYPASS;                                                  \
+        if (virTestRun("wrapper throughput " #BYPASS,                          \
+                       testFileWrapperThroughput, &bypass) < 0)                \
+            ret = -1;                                                          \
+    } while (0)
+
+    DO_TEST_WRAPPER_THROUGHPUT(false);
+    DO_TEST_WRAPPER_THROUGHPUT(true);
+#endif /* ! WIN32 */
+
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
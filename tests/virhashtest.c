@@ -26,9 +26,6 @@ testHashInit(int size)
     if (!(hash = virHashCreate(size, NULL)))
         return NULL;
 
-    /* entires are added in reverse order so that they will be linked in
-     * collision list in the same order as in the uuids array
-     */
     for (i = ARRAY_CARDINALITY(uuids) - 1; i >= 0; i--) {
         ssize_t oldsize = virHashTableSize(hash);
         if (virHashAddEntry(hash, uuids[i], (void *) uuids[i]) < 0) {
@@ -597,6 +594,152 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static char **
+testHashKeys(size_t nkeys)
+{
+    char **keys;
+    size_t i;
+
+    if (VIR_ALLOC_N(keys, nkeys) < 0)
+        return NULL;
+
+    for (i = 0; i < nkeys; i++) {
+        if (virAsprintf(&keys[i], "key%zu", i) < 0) {
+            virStringFreeListCount(keys, i);
+            return NULL;
+        }
+    }
+
+    return keys;
+}
+
+
+/* Entries have to stay reachable while the table is being resized
+ * and removed entries must not be found again */
+static int
+testHashResize(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash = NULL;
+    size_t nkeys = 10000;
+    char **keys = NULL;
+    size_t iter_count = 0;
+    size_t i, j;
+    int ret = -1;
+
+    if (!(keys = testHashKeys(nkeys)) ||
+        !(hash = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < nkeys; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+
+        /* Drop every third entry right away to leave some removed
+         * slots behind */
+        if (i % 3 == 0 &&
+            virHashRemoveEntry(hash, keys[i]) < 0)
+            goto cleanup;
+
+        for (j = i > 20 ? i - 20 : 0; j <= i; j++) {
+            void *payload = virHashLookup(hash, keys[j]);
+
+            if ((j % 3 == 0) != !payload ||
+                (payload && payload != keys[j])) {
+                VIR_TEST_VERBOSE("\nwrong lookup result for \"%s\"\n",
+                                 keys[j]);
+                goto cleanup;
+            }
+        }
+    }
+
+    virHashForEach(hash, testHashCheckForEachCount, &iter_count);
+    if (virHashSize(hash) != nkeys - (nkeys + 2) / 3 ||
+        iter_count != virHashSize(hash)) {
+        VIR_TEST_VERBOSE("\nhash contains %zd elements, iteration finds %zu\n",
+                         virHashSize(hash), iter_count);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    virStringFreeListCount(keys, nkeys);
+    return ret;
+}
+
+
+static int
+testHashBenchIter(void *payload ATTRIBUTE_UNUSED,
+                  const void *name ATTRIBUTE_UNUSED,
+                  void *data)
+{
+    size_t *count = data;
+    *count += 1;
+    return 0;
+}
+
+
+/* Measure the cost of the basic operations on a table with the number
+ * of entries given by the test */
+static int
+testHashBenchmark(const void *data)
+{
+    const struct testInfo *info = data;
+    size_t nkeys = info->count;
+    virHashTablePtr hash = NULL;
+    char **keys = NULL;
+    unsigned long long start, insert, lookup, iterate, removal;
+    size_t count = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!(keys = testHashKeys(nkeys)) ||
+        !(hash = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    start = virTestNowNs();
+    for (i = 0; i < nkeys; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+    insert = virTestNowNs();
+
+    for (i = 0; i < nkeys; i++) {
+        if (virHashLookup(hash, keys[(i * 7919) % nkeys]) !=
+            keys[(i * 7919) % nkeys])
+            goto cleanup;
+    }
+    lookup = virTestNowNs();
+
+    if (virHashForEach(hash, testHashBenchIter, &count) < 0 ||
+        count != nkeys)
+        goto cleanup;
+    iterate = virTestNowNs();
+
+    for (i = 0; i < nkeys; i++) {
+        if (virHashRemoveEntry(hash, keys[i]) < 0)
+            goto cleanup;
+    }
+    removal = virTestNowNs();
+
+    VIR_TEST_DEBUG("%zu entries: insert %llu ns, lookup %llu ns, "
+                   "iterate %llu ns, remove %llu ns per entry\n",
+                   nkeys,
+                   (insert - start) / nkeys,
+                   (lookup - insert) / nkeys,
+                   (iterate - lookup) / nkeys,
+                   (removal - iterate) / nkeys);
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    virStringFreeListCount(keys, nkeys);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -635,6 +778,13 @@ mymain(void)
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
     DO_TEST("Equal", Equal);
+    DO_TEST("Resize", Resize);
+    if (virTestGetExpensive()) {
+        DO_TEST_COUNT("Benchmark", Benchmark, 1000);
+        DO_TEST_COUNT("Benchmark", Benchmark, 10000);
+        DO_TEST_COUNT("Benchmark", Benchmark, 100000);
+        DO_TEST_COUNT("Benchmark", Benchmark, 1000000);
+    }
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -28,6 +28,7 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virtypedparam.h"
 #include "rpc/virnetmessage.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -521,6 +522,257 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
     return ret;
 }
 
+static int testMessagePoolCheck(virNetMessagePoolPtr pool,
+                                unsigned long long expectHits,
+                                unsigned long long expectMisses,
+                                unsigned long long expectRetained)
+{
+    unsigned long long hits, misses, retained;
+
+    virNetMessagePoolGetStats(pool, &hits, &misses, &retained, NULL);
+
+    if (hits != expectHits || misses != expectMisses ||
+        retained != expectRetained) {
+        VIR_TEST_DEBUG("Expected hits=%llu misses=%llu retained=%llu, "
+                       "got hits=%llu misses=%llu retained=%llu",
+                       expectHits, expectMisses, expectRetained,
+                       hits, misses, retained);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int testMessagePool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePoolPtr pool = NULL;
+    virNetMessagePtr msg = NULL;
+    char *data = NULL;
+    size_t datalen = VIR_NET_MESSAGE_INITIAL * 2;
+    size_t smallSize = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
+    size_t largeSize;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(data, datalen) < 0)
+        return -1;
+    memset(data, 'x', datalen);
+
+    if (!(pool = virNetMessagePoolNew(1024 * 1024)))
+        goto cleanup;
+
+    /* Only the first message needs to allocate its buffer */
+    for (i = 0; i < 100; i++) {
+        if (!(msg = virNetMessageNewPooled(pool, true)))
+            goto cleanup;
+
+        msg->header.prog = 0x11223344;
+        msg->header.vers = 0x01;
+        msg->header.proc = 0x666;
+        msg->header.type = VIR_NET_STREAM;
+        msg->header.serial = i;
+        msg->header.status = VIR_NET_CONTINUE;
+
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageEncodePayloadRaw(msg, data, 10) < 0)
+            goto cleanup;
+
+        virNetMessageFree(msg);
+        msg = NULL;
+    }
+
+    if (testMessagePoolCheck(pool, 99, 1, smallSize) < 0)
+        goto cleanup;
+
+    /* Growing the buffer swaps it for one of a larger class and
+     * gives the small one back */
+    if (!(msg = virNetMessageNewPooled(pool, true)))
+        goto cleanup;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadRaw(msg, data, datalen) < 0)
+        goto cleanup;
+
+    if (msg->bufferSize < msg->bufferLength ||
+        msg->bufferLength != (VIR_NET_MESSAGE_LEN_MAX +
+                              VIR_NET_MESSAGE_HEADER_MAX + datalen)) {
+        VIR_TEST_DEBUG("Unexpected buffer length %zu size %zu",
+                       msg->bufferLength, msg->bufferSize);
+        goto cleanup;
+    }
+
+    if (testMessagePoolCheck(pool, 100, 2, smallSize) < 0)
+        goto cleanup;
+
+    largeSize = msg->bufferSize;
+    virNetMessageClear(msg);
+    if (testMessagePoolCheck(pool, 100, 2, smallSize + largeSize) < 0)
+        goto cleanup;
+
+    /* Clearing keeps the message attached to the pool */
+    if (virNetMessageResizeBuffer(msg, 4) < 0 ||
+        msg->bufferSize != 4096)
+        goto cleanup;
+
+    if (testMessagePoolCheck(pool, 100, 3, smallSize + largeSize) < 0)
+        goto cleanup;
+
+    virNetMessageFree(msg);
+    msg = NULL;
+    virObjectUnref(pool);
+
+    /* Buffers beyond the retention limit are freed */
+    if (!(pool = virNetMessagePoolNew(4096)))
+        goto cleanup;
+
+    if (!(msg = virNetMessageNewPooled(pool, true)))
+        goto cleanup;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    virNetMessageFree(msg);
+    msg = NULL;
+
+    if (testMessagePoolCheck(pool, 0, 1, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    virObjectUnref(pool);
+    VIR_FREE(data);
+    return ret;
+}
+
+
+/* Mimics the layout of remote_typed_param arrays as found in
+ * replies like virConnectGetAllDomainStats */
+typedef struct {
+    char *field;
+    unsigned int type;
+    uint64_t value;
+} testTypedParam;
+
+typedef struct {
+    unsigned int nparams;
+    testTypedParam *params;
+} testTypedParamList;
+
+static size_t testTypedParamListEncodes;
+
+static bool_t testXDRTypedParam(XDR *xdrs, testTypedParam *param)
+{
+    return xdr_string(xdrs, &param->field, VIR_TYPED_PARAM_FIELD_LENGTH) &&
+        xdr_u_int(xdrs, &param->type) &&
+        xdr_uint64_t(xdrs, &param->value);
+}
+
+static bool_t testXDRTypedParamList(XDR *xdrs, testTypedParamList *list)
+{
+    if (xdrs->x_op == XDR_ENCODE)
+        testTypedParamListEncodes++;
+
+    return xdr_array(xdrs, (char **) &list->params, &list->nparams,
+                     ~0, sizeof(testTypedParam),
+                     (xdrproc_t) testXDRTypedParam);
+}
+
+static int testMessagePayloadEncodeLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    testTypedParamList list = { 0, NULL };
+    testTypedParamList decoded = { 0, NULL };
+    virNetMessagePtr msg = NULL;
+    size_t nrounds = virTestGetExpensive() ? 100 : 1;
+    unsigned long long nsecs;
+    size_t i;
+    int ret = -1;
+
+    list.nparams = 100000;
+    if (VIR_ALLOC_N(list.params, list.nparams) < 0)
+        return -1;
+
+    for (i = 0; i < list.nparams; i++) {
+        if (virAsprintf(&list.params[i].field, "block.%zu.rd.bytes", i) < 0)
+            goto cleanup;
+        list.params[i].type = VIR_TYPED_PARAM_ULLONG;
+        list.params[i].value = i * 4096;
+    }
+
+    nsecs = virTestNowNs();
+    for (i = 0; i < nrounds; i++) {
+        if (!(msg = virNetMessageNew(false)))
+            goto cleanup;
+
+        msg->header.prog = 0x11223344;
+        msg->header.vers = 0x01;
+        msg->header.proc = 0x666;
+        msg->header.type = VIR_NET_REPLY;
+        msg->header.serial = i;
+        msg->header.status = VIR_NET_OK;
+
+        testTypedParamListEncodes = 0;
+        if (virNetMessageEncodeHeader(msg) < 0 ||
+            virNetMessageEncodePayload(msg,
+                                       (xdrproc_t) testXDRTypedParamList,
+                                       &list) < 0)
+            goto cleanup;
+
+        if (i < nrounds - 1) {
+            virNetMessageFree(msg);
+            msg = NULL;
+        }
+    }
+    nsecs = virTestNowNs() - nsecs;
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%u params, %zu bytes: %llu us per reply, "
+                       "payload encoded %zu times\n",
+                       list.nparams, msg->bufferLength,
+                       nsecs / nrounds / 1000, testTypedParamListEncodes);
+
+#ifdef HAVE_XDR_SIZEOF
+    /* Failed attempt into the initial buffer, sizing, final encoding */
+    if (testTypedParamListEncodes > 3) {
+        VIR_TEST_DEBUG("Payload was encoded %zu times\n",
+                       testTypedParamListEncodes);
+        goto cleanup;
+    }
+#endif
+
+    /* Make sure the payload survived, reading it back as if only
+     * the length word had been received so far */
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0 ||
+        virNetMessageDecodePayload(msg,
+                                   (xdrproc_t) testXDRTypedParamList,
+                                   &decoded) < 0)
+        goto cleanup;
+
+    if (decoded.nparams != list.nparams) {
+        VIR_TEST_DEBUG("Expected %u params got %u\n",
+                       list.nparams, decoded.nparams);
+        goto cleanup;
+    }
+
+    for (i = 0; i < list.nparams; i++) {
+        if (STRNEQ(decoded.params[i].field, list.params[i].field) ||
+            decoded.params[i].value != list.params[i].value) {
+            VIR_TEST_DEBUG("Param %zu differs\n", i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    xdr_free((xdrproc_t) testXDRTypedParamList, (char *) &decoded);
+    for (i = 0; i < list.nparams; i++)
+        VIR_FREE(list.params[i].field);
+    VIR_FREE(list.params);
+    return ret;
+}
 
 static int
 mymain(void)
@@ -544,6 +796,12 @@ mymain(void)
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Payload Encode Large", testMessagePayloadEncodeLarge, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Message Pool", testMessagePool, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -20,8 +20,17 @@
 
 #include <config.h>
 
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <poll.h>
+
 #include "testutils.h"
 #include "virerror.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virutil.h"
+#include "virthread.h"
 #include "rpc/virnetserverclient.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
@@ -136,17 +145,719 @@ static int testIdentity(const void *opaque ATTRIBUTE_UNUSED)
     return ret;
 }
 
+/* Returns the number of read (@field "syscr") or write ("syscw")
+ * syscalls issued by this process so far, or 0 if the kernel
+ * doesn't account them */
+static unsigned long long
+testGetSyscalls(const char *field)
+{
+    char *buf = NULL;
+    char *tmp;
+    unsigned long long ret = 0;
+
+    if (virFileReadAllQuiet("/proc/self/io", 4096, &buf) < 0)
+        return 0;
+
+    if ((tmp = strstr(buf, field)) && tmp[strlen(field)] == ':')
+        ignore_value(virStrToLong_ull(tmp + strlen(field) + 1,
+                                      NULL, 10, &ret));
+
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+# define STORM_CLIENTS 100
+# define STORM_BURST 16
+
+struct testStormClient {
+    int peer;
+    virNetServerClientPtr client;
+    size_t received;
+};
+
+/* Queue bursts of events to many clients at once and check
+ * that every client gets all of them, in order */
+static int
+testEventStorm(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testStormClient *clients = NULL;
+    size_t nrounds = virTestGetExpensive() ? 1000 : 100;
+    size_t nclients = 0;
+    virNetMessagePtr tmpl = NULL;
+    char payload[96];
+    char buf[4096];
+    unsigned long long nsecs;
+    unsigned long long syscalls;
+    size_t expected;
+    size_t round;
+    size_t i, j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(clients, STORM_CLIENTS) < 0)
+        goto cleanup;
+
+    /* Something of the size of a typical lifecycle event */
+    if (!(tmpl = virNetMessageNew(false)))
+        goto cleanup;
+    tmpl->header.prog = 0x20008086;
+    tmpl->header.vers = 1;
+    tmpl->header.proc = 107;
+    tmpl->header.type = VIR_NET_MESSAGE;
+    tmpl->header.status = VIR_NET_OK;
+    memset(payload, 'x', sizeof(payload));
+    if (virNetMessageEncodeHeader(tmpl) < 0 ||
+        virNetMessageEncodePayloadRaw(tmpl, payload, sizeof(payload)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < STORM_CLIENTS; i++) {
+        int sv[2];
+        virNetSocketPtr sock = NULL;
+
+        if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            virReportSystemError(errno, "%s",
+                                 "Cannot create socket pair");
+            goto cleanup;
+        }
+        clients[i].peer = sv[1];
+        nclients++;
+
+        if (virSetNonBlock(sv[1]) < 0 ||
+            virNetSocketNewConnectSockFD(sv[0], &sock) < 0) {
+            VIR_FORCE_CLOSE(sv[0]);
+            goto cleanup;
+        }
+
+        clients[i].client = virNetServerClientNew(i + 1, sock, 0, false, 1,
+# ifdef WITH_GNUTLS
+                                                  NULL,
+# endif
+                                                  NULL, NULL, NULL, NULL);
+        virObjectUnref(sock);
+        if (!clients[i].client ||
+            virNetServerClientInit(clients[i].client) < 0)
+            goto cleanup;
+    }
+
+    syscalls = testGetSyscalls("syscw");
+    nsecs = virTestNowNs();
+    for (round = 0; round < nrounds; round++) {
+        for (i = 0; i < STORM_CLIENTS; i++) {
+            for (j = 0; j < STORM_BURST; j++) {
+                virNetMessagePtr msg;
+
+                if (!(msg = virNetMessageNew(false)))
+                    goto cleanup;
+                msg->header = tmpl->header;
+                msg->bufferLength = tmpl->bufferLength;
+                if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    virNetMessageFree(msg);
+                    goto cleanup;
+                }
+                memcpy(msg->buffer, tmpl->buffer, msg->bufferLength);
+
+                if (virNetServerClientSendMessage(clients[i].client, msg) < 0) {
+                    virNetMessageFree(msg);
+                    goto cleanup;
+                }
+            }
+        }
+
+        expected = (round + 1) * STORM_BURST * tmpl->bufferLength;
+        for (;;) {
+            bool done = true;
+
+            for (i = 0; i < STORM_CLIENTS; i++) {
+                ssize_t got;
+
+                while ((got = read(clients[i].peer, buf, sizeof(buf))) > 0) {
+                    for (j = 0; j < (size_t) got; j++) {
+                        size_t off = (clients[i].received + j) % tmpl->bufferLength;
+                        if (buf[j] != tmpl->buffer[off]) {
+                            fprintf(stderr, "Client %zu got corrupted data\n", i);
+                            goto cleanup;
+                        }
+                    }
+                    clients[i].received += got;
+                }
+                if (got == 0 || (got < 0 && errno != EAGAIN)) {
+                    fprintf(stderr, "Client %zu lost connection\n", i);
+                    goto cleanup;
+                }
+
+                if (clients[i].received > expected) {
+                    fprintf(stderr, "Client %zu got too much data\n", i);
+                    goto cleanup;
+                }
+                if (clients[i].received < expected)
+                    done = false;
+            }
+
+            if (done)
+                break;
+
+            if (virEventRunDefaultImpl() < 0)
+                goto cleanup;
+        }
+    }
+    nsecs = virTestNowNs() - nsecs;
+    syscalls = testGetSyscalls("syscw") - syscalls;
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%d clients: %llu messages per second, "
+                       "%llu write syscalls for %zu messages\n",
+                       STORM_CLIENTS,
+                       nrounds * STORM_CLIENTS * STORM_BURST *
+                       1000000000ull / (nsecs ? nsecs : 1),
+                       syscalls, nrounds * STORM_CLIENTS * STORM_BURST);
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nclients; i++) {
+        if (clients[i].client) {
+            virNetServerClientClose(clients[i].client);
+            virObjectUnref(clients[i].client);
+        }
+        VIR_FORCE_CLOSE(clients[i].peer);
+    }
+    VIR_FREE(clients);
+    virNetMessageFree(tmpl);
+    return ret;
+}
+
+# define PIPELINE_BATCH 32
+
+struct testPipelineData {
+    unsigned int serial;
+    size_t nfds;
+    bool failed;
+};
+
+static int
+testPipelineDispatch(virNetServerClientPtr client,
+                     virNetMessagePtr msg,
+                     void *opaque)
+{
+    struct testPipelineData *data = opaque;
+    struct stat sb;
+
+    if (msg->header.serial != data->serial) {
+        fprintf(stderr, "Expected call %u, got %u\n",
+                data->serial, msg->header.serial);
+        data->failed = true;
+    }
+    data->serial++;
+
+    if (msg->header.type == VIR_NET_CALL_WITH_FDS) {
+        if (msg->nfds != 1 || fstat(msg->fds[0], &sb) < 0 ||
+            !S_ISFIFO(sb.st_mode)) {
+            fprintf(stderr, "Call %u didn't get its pipe\n",
+                    msg->header.serial);
+            data->failed = true;
+        }
+        data->nfds++;
+    }
+
+    virNetMessageFree(msg);
+    virObjectUnref(client);
+    return 0;
+}
+
+
+static int
+testPipelineSend(virNetSocketPtr sock,
+                 const char *buf,
+                 size_t len)
+{
+    while (len > 0) {
+        ssize_t rv = virNetSocketWrite(sock, buf, len);
+        if (rv < 0)
+            return -1;
+        buf += rv;
+        len -= rv;
+    }
+    return 0;
+}
+
+
+/* Send batches of small calls back to back and check that all of
+ * them are dispatched, in order. If @fd is not -1, some of the calls
+ * carry it along. */
+static int
+testPipelineRun(int serverfd,
+                int peerfd,
+                int fd,
+                size_t nrounds,
+                const char *transport)
+{
+    virNetSocketPtr sock = NULL;
+    virNetSocketPtr peer = NULL;
+    virNetServerClientPtr client = NULL;
+    virNetMessagePtr msg = NULL;
+    struct testPipelineData data = { 0 };
+    char *batch = NULL;
+    size_t batchLength = 0;
+    size_t fdOffset = 0;
+    unsigned long long nsecs;
+    unsigned long long syscalls;
+    char payload[40];
+    size_t round;
+    size_t i;
+    int ret = -1;
+
+    if (virNetSocketNewConnectSockFD(serverfd, &sock) < 0) {
+        VIR_FORCE_CLOSE(serverfd);
+        VIR_FORCE_CLOSE(peerfd);
+        goto cleanup;
+    }
+    if (virNetSocketNewConnectSockFD(peerfd, &peer) < 0) {
+        VIR_FORCE_CLOSE(peerfd);
+        goto cleanup;
+    }
+    if (virNetSocketSetBlocking(peer, true) < 0)
+        goto cleanup;
+
+    if (!(client = virNetServerClientNew(1, sock, 0, false,
+                                         nrounds * PIPELINE_BATCH + 1,
+# ifdef WITH_GNUTLS
+                                         NULL,
+# endif
+                                         NULL, NULL, NULL, NULL)))
+        goto cleanup;
+    virNetServerClientSetDispatcher(client, testPipelineDispatch, &data);
+    if (virNetServerClientInit(client) < 0)
+        goto cleanup;
+
+    /* Something of the size of a virDomainGetInfo call */
+    memset(payload, 0, sizeof(payload));
+    syscalls = testGetSyscalls("syscr");
+    nsecs = virTestNowNs();
+    for (round = 0; round < nrounds; round++) {
+        VIR_FREE(batch);
+        batchLength = 0;
+        fdOffset = 0;
+
+        for (i = 0; i < PIPELINE_BATCH; i++) {
+            if (!(msg = virNetMessageNew(false)))
+                goto cleanup;
+            msg->header.prog = 0x20008086;
+            msg->header.vers = 1;
+            msg->header.proc = 16;
+            msg->header.type = VIR_NET_CALL;
+            msg->header.serial = round * PIPELINE_BATCH + i;
+            msg->header.status = VIR_NET_OK;
+
+            if (fd != -1 && round % 2 == 0 && i == PIPELINE_BATCH / 2) {
+                msg->header.type = VIR_NET_CALL_WITH_FDS;
+                msg->nfds = 1;
+            }
+
+            if (virNetMessageEncodeHeader(msg) < 0 ||
+                (msg->nfds && virNetMessageEncodeNumFDs(msg) < 0) ||
+                virNetMessageEncodePayloadRaw(msg, payload,
+                                              sizeof(payload)) < 0)
+                goto cleanup;
+            msg->nfds = 0;
+
+            if (VIR_REALLOC_N(batch, batchLength + msg->bufferLength) < 0)
+                goto cleanup;
+            memcpy(batch + batchLength, msg->buffer, msg->bufferLength);
+            batchLength += msg->bufferLength;
+            if (msg->header.type == VIR_NET_CALL_WITH_FDS)
+                fdOffset = batchLength;
+
+            virNetMessageFree(msg);
+            msg = NULL;
+        }
+
+        /* The descriptor goes right after the call it belongs to,
+         * with the rest of the batch behind it */
+        if (fdOffset) {
+            if (testPipelineSend(peer, batch, fdOffset) < 0 ||
+                virNetSocketSendFD(peer, fd) != 1 ||
+                testPipelineSend(peer, batch + fdOffset,
+                                 batchLength - fdOffset) < 0)
+                goto cleanup;
+        } else {
+            if (testPipelineSend(peer, batch, batchLength) < 0)
+                goto cleanup;
+        }
+
+        while (data.serial < (round + 1) * PIPELINE_BATCH) {
+            if (data.failed ||
+                virNetServerClientWantClose(client) ||
+                virEventRunDefaultImpl() < 0)
+                goto cleanup;
+        }
+        if (data.failed)
+            goto cleanup;
+    }
+    nsecs = virTestNowNs() - nsecs;
+    syscalls = testGetSyscalls("syscr") - syscalls;
+
+    if (fd != -1 && data.nfds != (nrounds + 1) / 2) {
+        fprintf(stderr, "Expected %zu descriptors, got %zu\n",
+                (nrounds + 1) / 2, data.nfds);
+        goto cleanup;
+    }
+
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%s: %llu calls per second, "
+                       "%llu read syscalls for %zu calls\n",
+                       transport,
+                       nrounds * PIPELINE_BATCH * 1000000000ull /
+                       (nsecs ? nsecs : 1),
+                       syscalls, nrounds * PIPELINE_BATCH);
+
+    ret = 0;
+
+ cleanup:
+    if (client) {
+        virNetServerClientClose(client);
+        virObjectUnref(client);
+    }
+    virNetMessageFree(msg);
+    virObjectUnref(sock);
+    virObjectUnref(peer);
+    VIR_FREE(batch);
+    return ret;
+}
+
+
+static int
+testPipelineTCP(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int lfd = -1;
+    int peerfd = -1;
+    int serverfd = -1;
+    int ret = EXIT_AM_SKIP;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* Sandboxed builds may not have a loopback device */
+    if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(lfd, 1) < 0 ||
+        getsockname(lfd, (struct sockaddr *) &addr, &addrlen) < 0 ||
+        (peerfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(peerfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        (serverfd = accept(lfd, NULL, NULL)) < 0) {
+        VIR_FORCE_CLOSE(peerfd);
+        goto cleanup;
+    }
+
+    ret = testPipelineRun(serverfd, peerfd, -1,
+                          virTestGetExpensive() ? 10000 : 1000,
+                          "TCP");
+
+ cleanup:
+    VIR_FORCE_CLOSE(lfd);
+    return ret;
+}
+
+
+static int
+testPipelineUNIX(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int sv[2];
+    int pipefd[2] = { -1, -1 };
+    int ret = -1;
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        virReportSystemError(errno, "%s",
+                             "Cannot create socket pair");
+        return -1;
+    }
+
+    if (pipe(pipefd) < 0) {
+        VIR_FORCE_CLOSE(sv[0]);
+        VIR_FORCE_CLOSE(sv[1]);
+        return -1;
+    }
+
+    ret = testPipelineRun(sv[0], sv[1], pipefd[0],
+                          virTestGetExpensive() ? 10000 : 1000,
+                          "UNIX");
+
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    return ret;
+}
+
+
+# define STREAM_LINK_LATENCY_NS (2 * 1000 * 1000ull)
+# define STREAM_LINK_WINDOW (4 * 1024 * 1024)
+# define STREAM_LINK_SLOTS 4096
+
+/* The far end of a stream: a link which delivers whatever is
+ * written to it after a fixed latency and takes at most
+ * STREAM_LINK_WINDOW bytes in flight, like a long TCP connection */
+struct testStreamLink {
+    int fd;
+    size_t expected;
+    size_t delivered;
+    bool failed;
+};
+
+static void
+testStreamLinkRun(void *opaque)
+{
+    struct testStreamLink *link = opaque;
+    size_t lengths[STREAM_LINK_SLOTS];
+    unsigned long long deadlines[STREAM_LINK_SLOTS];
+    size_t head = 0, count = 0;
+    size_t inflight = 0;
+    char buf[65536];
+
+    while (link->delivered < link->expected) {
+        unsigned long long now = virTestNowNs();
+        struct pollfd fds[1];
+        int timeout = -1;
+
+        while (count && deadlines[head] <= now) {
+            inflight -= lengths[head];
+            link->delivered += lengths[head];
+            head = (head + 1) % STREAM_LINK_SLOTS;
+            count--;
+        }
+        if (link->delivered >= link->expected)
+            break;
+
+        if (count)
+            timeout = (deadlines[head] - now + 999999) / 1000000;
+
+        fds[0].fd = link->fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+
+        if (count == STREAM_LINK_SLOTS || inflight >= STREAM_LINK_WINDOW) {
+            /* Link is full, nothing gets read until it drains */
+            if (poll(NULL, 0, timeout) < 0 && errno != EINTR)
+                goto error;
+            continue;
+        }
+
+        if (poll(fds, 1, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+
+        if (fds[0].revents) {
+            ssize_t got = read(link->fd, buf,
+                               MIN(sizeof(buf),
+                                   STREAM_LINK_WINDOW - inflight));
+            if (got <= 0)
+                goto error;
+
+            lengths[(head + count) % STREAM_LINK_SLOTS] = got;
+            deadlines[(head + count) % STREAM_LINK_SLOTS] =
+                virTestNowNs() + STREAM_LINK_LATENCY_NS;
+            count++;
+            inflight += got;
+        }
+    }
+    return;
+
+ error:
+    link->failed = true;
+}
+
+
+struct testStreamSource {
+    virNetServerClientPtr client;
+    const char *payload;
+    size_t packetSize;
+    size_t window;
+    size_t inflight;
+    size_t queued;
+};
+
+static void
+testStreamSourceFinished(virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                         void *opaque)
+{
+    struct testStreamSource *src = opaque;
+    src->inflight--;
+}
+
+
+static int
+testStreamSourceQueue(struct testStreamSource *src)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+    msg->header.prog = 0x20008086;
+    msg->header.vers = 1;
+    msg->header.proc = 209;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 1;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadRaw(msg, src->payload,
+                                      src->packetSize) < 0) {
+        virNetMessageFree(msg);
+        return -1;
+    }
+
+    msg->cb = testStreamSourceFinished;
+    msg->opaque = src;
+    src->inflight++;
+    src->queued++;
+
+    if (virNetServerClientSendMessage(src->client, msg) < 0) {
+        virNetMessageFree(msg);
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Push stream data to a client over a link with latency, keeping
+ * @window packets of @packetSize queued like the daemon does for
+ * downloads */
+static int
+testStreamThroughputRun(size_t packetSize,
+                        size_t window)
+{
+    struct testStreamSource src = { NULL, NULL, packetSize, window, 0, 0 };
+    struct testStreamLink link = { -1, 0, 0, false };
+    size_t total = 1024 * 1024 * 1024;
+    size_t npackets = total / packetSize;
+    virNetSocketPtr sock = NULL;
+    virThread thread;
+    bool running = false;
+    char *payload = NULL;
+    unsigned long long nsecs;
+    int sv[2];
+    int ret = -1;
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        virReportSystemError(errno, "%s",
+                             "Cannot create socket pair");
+        return -1;
+    }
+    link.fd = sv[1];
+
+    if (virNetSocketNewConnectSockFD(sv[0], &sock) < 0) {
+        VIR_FORCE_CLOSE(sv[0]);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(payload, packetSize) < 0)
+        goto cleanup;
+    src.payload = payload;
+
+    if (!(src.client = virNetServerClientNew(1, sock, 0, false, 1,
+# ifdef WITH_GNUTLS
+                                             NULL,
+# endif
+                                             NULL, NULL, NULL, NULL)) ||
+        virNetServerClientInit(src.client) < 0)
+        goto cleanup;
+
+    /* Each packet carries a length word and the header
+     * in front of the data itself */
+    link.expected = npackets * (packetSize + VIR_NET_MESSAGE_LEN_MAX +
+                                VIR_NET_MESSAGE_HEADER_MAX);
+
+    if (virThreadCreate(&thread, true, testStreamLinkRun, &link) < 0)
+        goto cleanup;
+    running = true;
+
+    nsecs = virTestNowNs();
+    while (src.queued < npackets || src.inflight) {
+        while (src.inflight < src.window && src.queued < npackets) {
+            if (testStreamSourceQueue(&src) < 0)
+                goto cleanup;
+        }
+
+        if (link.failed ||
+            virNetServerClientWantClose(src.client) ||
+            virEventRunDefaultImpl() < 0)
+            goto cleanup;
+    }
+    virThreadJoin(&thread);
+    running = false;
+    nsecs = virTestNowNs() - nsecs;
+
+    if (link.failed || link.delivered != link.expected) {
+        fprintf(stderr, "Link got %zu bytes, expected %zu\n",
+                link.delivered, link.expected);
+        goto cleanup;
+    }
+
+    VIR_TEST_DEBUG("packet %zu window %zu: %llu MiB/s\n",
+                   packetSize, window,
+                   (unsigned long long) total * 1000000000ull /
+                   (nsecs ? nsecs : 1) / (1024 * 1024));
+
+    ret = 0;
+
+ cleanup:
+    /* Closing our end makes the link see EOF if it is
+     * still waiting for data */
+    if (src.client)
+        virNetServerClientClose(src.client);
+    if (running)
+        virThreadJoin(&thread);
+    virObjectUnref(src.client);
+    virObjectUnref(sock);
+    VIR_FORCE_CLOSE(sv[1]);
+    VIR_FREE(payload);
+    return ret;
+}
+
+
+static int
+testStreamThroughput(const void *opaque ATTRIBUTE_UNUSED)
+{
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    /* What the daemon used to do, then what it does by default */
+    if (testStreamThroughputRun(VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX, 1) < 0 ||
+        testStreamThroughputRun(1024 * 1024, 4) < 0)
+        return -1;
+    return 0;
+}
+
 
 static int
 mymain(void)
 {
     int ret = 0;
 
+    virEventRegisterDefaultImpl();
 
     if (virTestRun("Identity",
                    testIdentity, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Event storm",
+                   testEventStorm, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Pipelined calls over TCP",
+                   testPipelineTCP, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Pipelined calls with FDs over UNIX",
+                   testPipelineUNIX, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Stream throughput with latency",
+                   testStreamThroughput, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 VIRT_TEST_MAIN_PRELOAD(mymain, abs_builddir "/.libs/virnetserverclientmock.so")
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library;  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "virpagecodec.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "testutils.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.pagecodectest");
+
+#define TEMPLATE abs_builddir "/virpagecodectest-XXXXXX"
+
+#define PAGE_SIZE 4096
+#define PAGE_POOL 64
+
+/* Stands in for the save image header and domain XML */
+#define IMAGE_BASE 8192
+
+struct testPageCodecData {
+    const char *name;
+    unsigned int zeroPct;  /* pages full of zeros */
+    unsigned int dupPct;   /* pages taken from a small pool */
+    unsigned int maxPct;   /* largest acceptable encoded size */
+};
+
+static uint64_t
+testPageCodecRandom(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void
+testPageCodecFill(char *buf, size_t len, uint64_t *state)
+{
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t v = testPageCodecRandom(state);
+        memcpy(buf + i, &v, sizeof(v));
+    }
+}
+
+/* Write something shaped like QEMU's migration stream: a preamble,
+ * then pages each preceded by an 8 byte address and flags word */
+static int
+testPageCodecGenerate(int fd,
+                      const struct testPageCodecData *data,
+                      size_t npages)
+{
+    char *pool = NULL;
+    char *page = NULL;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    int ret = -1;
+    size_t i;
+
+    if (VIR_ALLOC_N(pool, PAGE_POOL * PAGE_SIZE) < 0 ||
+        VIR_ALLOC_N(page, PAGE_SIZE + 8) < 0)
+        goto cleanup;
+
+    testPageCodecFill(pool, PAGE_POOL * PAGE_SIZE, &state);
+
+    if (safewrite(fd, "QEVM\0\0\0\3", 8) < 0)
+        goto cleanup;
+
+    for (i = 0; i < npages; i++) {
+        uint64_t addr = (i * PAGE_SIZE) | 0x8;
+        unsigned int pct = testPageCodecRandom(&state) % 100;
+
+        memcpy(page, &addr, sizeof(addr));
+        if (pct < data->zeroPct)
+            memset(page + 8, 0, PAGE_SIZE);
+        else if (pct < data->zeroPct + data->dupPct)
+            memcpy(page + 8,
+                   pool + (testPageCodecRandom(&state) % PAGE_POOL) * PAGE_SIZE,
+                   PAGE_SIZE);
+        else
+            testPageCodecFill(page + 8, PAGE_SIZE, &state);
+
+        if (safewrite(fd, page, PAGE_SIZE + 8) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(pool);
+    VIR_FREE(page);
+    return ret;
+}
+
+static int
+testPageCodecCopy(int infd, int outfd)
+{
+    char buf[64 * 1024];
+    ssize_t got;
+
+    while ((got = saferead(infd, buf, sizeof(buf))) > 0) {
+        if (safewrite(outfd, buf, got) < 0)
+            return -1;
+    }
+
+    return got;
+}
+
+static int
+testPageCodecCompare(int fd1, int fd2)
+{
+    char buf1[64 * 1024];
+    char buf2[64 * 1024];
+    ssize_t got1, got2;
+
+    if (lseek(fd1, 0, SEEK_SET) < 0 ||
+        lseek(fd2, 0, SEEK_SET) < 0)
+        return -1;
+
+    do {
+        got1 = saferead(fd1, buf1, sizeof(buf1));
+        got2 = saferead(fd2, buf2, sizeof(buf2));
+        if (got1 < 0 || got1 != got2 ||
+            memcmp(buf1, buf2, got1) != 0)
+            return -1;
+    } while (got1);
+
+    return 0;
+}
+
+static int
+testPageCodecRoundTrip(const void *opaque)
+{
+    const struct testPageCodecData *data = opaque;
+    size_t npages = (virTestGetExpensive() ? 256 : 16) * 1024;
+    char rawpath[] = TEMPLATE;
+    char imagepath[] = TEMPLATE;
+    char outpath[] = TEMPLATE;
+    int rawfd = -1;
+    int imagefd = -1;
+    int outfd = -1;
+    char base[IMAGE_BASE];
+    virPageCodecStats stats;
+    unsigned long long rawns = 0;
+    unsigned long long decodens;
+    int ret = -1;
+
+    if ((rawfd = mkostemp(rawpath, O_CLOEXEC)) < 0 ||
+        (imagefd = mkostemp(imagepath, O_CLOEXEC)) < 0 ||
+        (outfd = mkostemp(outpath, O_CLOEXEC)) < 0) {
+        fprintf(stderr, "cannot create temporary files\n");
+        goto cleanup;
+    }
+
+    if (testPageCodecGenerate(rawfd, data, npages) < 0 ||
+        lseek(rawfd, 0, SEEK_SET) < 0)
+        goto cleanup;
+
+    memset(base, 'H', sizeof(base));
+    if (safewrite(imagefd, base, sizeof(base)) < 0 ||
+        virPageCodecEncode(rawfd, imagefd, &stats) < 0)
+        goto cleanup;
+
+    if (stats.input != npages * (PAGE_SIZE + 8) + 8) {
+        fprintf(stderr, "encoder consumed %llu bytes\n", stats.input);
+        goto cleanup;
+    }
+
+    if (stats.output * 100 > stats.input * data->maxPct) {
+        fprintf(stderr, "%s: %llu bytes encoded into %llu, "
+                "more than %u%%\n", data->name,
+                stats.input, stats.output, data->maxPct);
+        goto cleanup;
+    }
+
+    /* What restoring a raw image costs, versus decoding this one */
+    if (virTestGetExpensive()) {
+        if (lseek(rawfd, 0, SEEK_SET) < 0 ||
+            ftruncate(outfd, 0) < 0 ||
+            lseek(outfd, 0, SEEK_SET) < 0)
+            goto cleanup;
+        rawns = virTestNowNs();
+        if (testPageCodecCopy(rawfd, outfd) < 0)
+            goto cleanup;
+        rawns = virTestNowNs() - rawns;
+    }
+
+    if (lseek(imagefd, IMAGE_BASE, SEEK_SET) < 0 ||
+        ftruncate(outfd, 0) < 0 ||
+        lseek(outfd, 0, SEEK_SET) < 0)
+        goto cleanup;
+    decodens = virTestNowNs();
+    if (virPageCodecDecode(imagefd, imagefd, IMAGE_BASE, outfd) < 0)
+        goto cleanup;
+    decodens = virTestNowNs() - decodens;
+
+    if (testPageCodecCompare(rawfd, outfd) < 0) {
+        fprintf(stderr, "%s: decoded stream differs\n", data->name);
+        goto cleanup;
+    }
+
+    VIR_TEST_DEBUG("%s: %llu KiB raw, %llu KiB encoded "
+                   "(%llu KiB zero, %llu KiB duplicate)\n",
+                   data->name, stats.input / 1024, stats.output / 1024,
+                   stats.zero / 1024, stats.dup / 1024);
+    if (virTestGetExpensive())
+        VIR_TEST_DEBUG("%s: restore %llu ms raw, %llu ms decoded\n",
+                       data->name, rawns / 1000000, decodens / 1000000);
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(rawfd);
+    VIR_FORCE_CLOSE(imagefd);
+    VIR_FORCE_CLOSE(outfd);
+    unlink(rawpath);
+    unlink(imagepath);
+    unlink(outpath);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(NAME, ZERO, DUP, MAX)                                   \
+    do {                                                                \
+        struct testPageCodecData data = { NAME, ZERO, DUP, MAX };       \
+        if (virTestRun("round trip " NAME,                              \
+                       testPageCodecRoundTrip, &data) < 0)              \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* Nothing to gain, the format must not cost much either */
+    DO_TEST("unique", 0, 0, 101);
+    /* An idle guest: mostly zero pages and a few common ones */
+    DO_TEST("idle", 70, 20, 25);
+    DO_TEST("duplicates", 0, 80, 75);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2016 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+
+#include "testutils.h"
+
+#include "viralloc.h"
+#include "viratomic.h"
+#include "virthread.h"
+#include "virthreadpool.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+typedef struct _testPoolData testPoolData;
+typedef testPoolData *testPoolDataPtr;
+struct _testPoolData {
+    virMutex lock;
+    virCond cond;
+    size_t njobs;
+    size_t done;
+    int *runs;      /* how many times each job was run */
+    size_t *order;  /* order in which the jobs were run */
+
+    /* used by testPriority */
+    bool blocked;
+    bool release;
+    bool prioDone;
+
+    /* used by testShrinkBusy */
+    bool hold;
+    size_t running;
+    size_t tokens;
+};
+
+
+static int
+testPoolDataInit(testPoolDataPtr data,
+                 size_t njobs)
+{
+    memset(data, 0, sizeof(*data));
+    data->njobs = njobs;
+
+    if (virMutexInit(&data->lock) < 0 ||
+        virCondInit(&data->cond) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(data->runs, njobs) < 0 ||
+        VIR_ALLOC_N(data->order, njobs) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+testPoolDataClear(testPoolDataPtr data)
+{
+    VIR_FREE(data->runs);
+    VIR_FREE(data->order);
+    virMutexDestroy(&data->lock);
+    virCondDestroy(&data->cond);
+}
+
+
+static void
+testPoolCountJob(void *jobdata,
+                 void *opaque)
+{
+    testPoolDataPtr data = opaque;
+    size_t idx = (intptr_t) jobdata;
+
+    virAtomicIntInc(&data->runs[idx]);
+
+    virMutexLock(&data->lock);
+    data->order[data->done++] = idx;
+    if (data->done == data->njobs)
+        virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+static int
+testPoolWaitDone(testPoolDataPtr data)
+{
+    int ret = 0;
+
+    virMutexLock(&data->lock);
+    while (data->done < data->njobs) {
+        if (virCondWait(&data->cond, &data->lock) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    virMutexUnlock(&data->lock);
+
+    return ret;
+}
+
+
+static int
+testPoolSendJobs(virThreadPoolPtr pool,
+                 size_t from,
+                 size_t to)
+{
+    size_t i;
+
+    for (i = from; i < to; i++) {
+        if (virThreadPoolSendJob(pool, 0, (void *)(intptr_t) i) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/* Every job has to be run exactly once regardless of which worker
+ * queue it ends up in and who eventually runs it */
+static int
+testAllJobs(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testPoolData data;
+    virThreadPoolPtr pool = NULL;
+    size_t njobs = 10000;
+    size_t i;
+    int ret = -1;
+
+    if (testPoolDataInit(&data, njobs) < 0)
+        goto cleanup;
+
+    if (!(pool = virThreadPoolNew(2, 8, 0, testPoolCountJob, &data)))
+        goto cleanup;
+
+    if (testPoolSendJobs(pool, 0, njobs / 2) < 0)
+        goto cleanup;
+
+    /* Lowering the limit must not lose jobs queued with the workers
+     * which are going away */
+    if (virThreadPoolSetParameters(pool, 1, 3, -1) < 0)
+        goto cleanup;
+
+    if (testPoolSendJobs(pool, njobs / 2, njobs) < 0 ||
+        testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    for (i = 0; i < njobs; i++) {
+        if (data.runs[i] != 1) {
+            VIR_TEST_DEBUG("job %zu was run %d times\n", i, data.runs[i]);
+            goto cleanup;
+        }
+    }
+
+    if (virThreadPoolGetJobQueueDepth(pool) != 0) {
+        VIR_TEST_DEBUG("job queue depth is %zu\n",
+                       virThreadPoolGetJobQueueDepth(pool));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virThreadPoolFree(pool);
+    testPoolDataClear(&data);
+    return ret;
+}
+
+
+/* Pools with a single worker process the jobs in the order they were
+ * submitted, some callers rely on that */
+static int
+testSingleWorkerOrder(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testPoolData data;
+    virThreadPoolPtr pool = NULL;
+    size_t njobs = 1000;
+    size_t i;
+    int ret = -1;
+
+    if (testPoolDataInit(&data, njobs) < 0)
+        goto cleanup;
+
+    if (!(pool = virThreadPoolNew(0, 1, 0, testPoolCountJob, &data)))
+        goto cleanup;
+
+    if (testPoolSendJobs(pool, 0, njobs) < 0 ||
+        testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    for (i = 0; i < njobs; i++) {
+        if (data.order[i] != i) {
+            VIR_TEST_DEBUG("job %zu run as %zu-th\n", data.order[i], i);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virThreadPoolFree(pool);
+    testPoolDataClear(&data);
+    return ret;
+}
+
+
+static void
+testPoolPrioJob(void *jobdata,
+                void *opaque)
+{
+    testPoolDataPtr data = opaque;
+    bool priority = !!jobdata;
+
+    virMutexLock(&data->lock);
+    if (priority) {
+        data->prioDone = true;
+        virCondBroadcast(&data->cond);
+    } else {
+        data->blocked = true;
+        virCondBroadcast(&data->cond);
+        while (!data->release)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+    }
+    virMutexUnlock(&data->lock);
+}
+
+
+/* A priority job has to be processed even if all ordinary workers are
+ * stuck */
+static int
+testPriority(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testPoolData data;
+    virThreadPoolPtr pool = NULL;
+    unsigned long long then;
+    int ret = -1;
+
+    if (testPoolDataInit(&data, 0) < 0)
+        goto cleanup;
+
+    if (!(pool = virThreadPoolNew(1, 1, 1, testPoolPrioJob, &data)))
+        goto cleanup;
+
+    if (virThreadPoolSendJob(pool, 0, NULL) < 0)
+        goto cleanup;
+
+    virMutexLock(&data.lock);
+    while (!data.blocked)
+        ignore_value(virCondWait(&data.cond, &data.lock));
+    virMutexUnlock(&data.lock);
+
+    if (virThreadPoolSendJob(pool, 1, (void *) 1) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&then) < 0)
+        goto cleanup;
+    then += 10 * 1000;
+
+    virMutexLock(&data.lock);
+    while (!data.prioDone) {
+        if (virCondWaitUntil(&data.cond, &data.lock, then) < 0)
+            break;
+    }
+    ret = data.prioDone ? 0 : -1;
+    data.release = true;
+    virCondBroadcast(&data.cond);
+    virMutexUnlock(&data.lock);
+
+ cleanup:
+    virThreadPoolFree(pool);
+    testPoolDataClear(&data);
+    return ret;
+}
+
+
+static void
+testPoolHoldJob(void *jobdata,
+                void *opaque)
+{
+    testPoolDataPtr data = opaque;
+    size_t idx = (intptr_t) jobdata;
+
+    virAtomicIntInc(&data->runs[idx]);
+
+    virMutexLock(&data->lock);
+    data->running++;
+    virCondBroadcast(&data->cond);
+    while (data->hold && !data->tokens)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    if (data->hold)
+        data->tokens--;
+    data->running--;
+    data->done++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+
+/* Lowering the limit has to get rid of surplus workers even if they
+ * keep finding queued jobs, and their jobs must not get lost */
+static int
+testShrinkBusy(const void *opaque ATTRIBUTE_UNUSED)
+{
+    testPoolData data;
+    virThreadPoolPtr pool = NULL;
+    size_t nworkers = 4;
+    size_t njobs = 100;
+    size_t i;
+    int ret = -1;
+
+    if (testPoolDataInit(&data, njobs) < 0)
+        goto cleanup;
+    data.hold = true;
+
+    if (!(pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                  testPoolHoldJob, &data)))
+        goto cleanup;
+
+    /* Get every worker stuck in a job with more jobs queued behind */
+    if (testPoolSendJobs(pool, 0, njobs) < 0)
+        goto cleanup;
+
+    virMutexLock(&data.lock);
+    while (data.running < nworkers)
+        ignore_value(virCondWait(&data.cond, &data.lock));
+    virMutexUnlock(&data.lock);
+
+    if (virThreadPoolSetParameters(pool, 0, 1, -1) < 0)
+        goto cleanup;
+
+    /* Let all but one worker finish their current job. They have to
+     * quit instead of getting stuck in the next one. */
+    virMutexLock(&data.lock);
+    data.tokens = nworkers - 1;
+    virCondBroadcast(&data.cond);
+    virMutexUnlock(&data.lock);
+
+    for (i = 0; i < 1000; i++) {
+        if (virThreadPoolGetCurrentWorkers(pool) == 1)
+            break;
+        usleep(10 * 1000);
+    }
+
+    virMutexLock(&data.lock);
+    data.hold = false;
+    virCondBroadcast(&data.cond);
+    virMutexUnlock(&data.lock);
+
+    if (virThreadPoolGetCurrentWorkers(pool) != 1) {
+        VIR_TEST_DEBUG("%zu workers left\n",
+                       virThreadPoolGetCurrentWorkers(pool));
+        goto cleanup;
+    }
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+
+    for (i = 0; i < njobs; i++) {
+        if (data.runs[i] != 1) {
+            VIR_TEST_DEBUG("job %zu was run %d times\n", i, data.runs[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    virThreadPoolFree(pool);
+    testPoolDataClear(&data);
+    return ret;
+}
+
+
+#define BENCH_SUBMITTERS 4
+
+typedef struct _testPoolSubmitter testPoolSubmitter;
+struct _testPoolSubmitter {
+    virThreadPoolPtr pool;
+    size_t from;
+    size_t to;
+    int ret;
+};
+
+
+static void
+testPoolSubmitterThread(void *opaque)
+{
+    testPoolSubmitter *submitter = opaque;
+
+    submitter->ret = testPoolSendJobs(submitter->pool,
+                                      submitter->from, submitter->to);
+}
+
+
+/* Measure job throughput with several threads submitting short jobs */
+static int
+testBenchmark(const void *opaque)
+{
+    size_t nworkers = *(const size_t *) opaque;
+    testPoolData data;
+    testPoolSubmitter submitters[BENCH_SUBMITTERS];
+    virThread threads[BENCH_SUBMITTERS];
+    virThreadPoolPtr pool = NULL;
+    size_t njobs = 400000;
+    size_t nthreads = 0;
+    unsigned long long nsecs;
+    size_t i;
+    int ret = -1;
+
+    if (!virTestGetExpensive())
+        return EXIT_AM_SKIP;
+
+    if (testPoolDataInit(&data, njobs) < 0)
+        goto cleanup;
+
+    if (!(pool = virThreadPoolNew(nworkers, nworkers, 0,
+                                  testPoolCountJob, &data)))
+        goto cleanup;
+
+    nsecs = virTestNowNs();
+    for (i = 0; i < BENCH_SUBMITTERS; i++) {
+        submitters[i].pool = pool;
+        submitters[i].from = njobs * i / BENCH_SUBMITTERS;
+        submitters[i].to = njobs * (i + 1) / BENCH_SUBMITTERS;
+        submitters[i].ret = 0;
+        if (virThreadCreate(&threads[i], true,
+                            testPoolSubmitterThread, &submitters[i]) < 0)
+            goto cleanup;
+        nthreads++;
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        virThreadJoin(&threads[i]);
+        if (submitters[i].ret < 0)
+            goto cleanup;
+    }
+    nthreads = 0;
+
+    if (testPoolWaitDone(&data) < 0)
+        goto cleanup;
+    nsecs = virTestNowNs() - nsecs;
+
+    VIR_TEST_DEBUG("%zu workers: %llu jobs per second\n",
+                   nworkers, njobs * 1000000000ull / (nsecs ? nsecs : 1));
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&threads[i]);
+    virThreadPoolFree(pool);
+    testPoolDataClear(&data);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    static const size_t benchWorkers[] = { 1, 2, 4, 8, 16 };
+    size_t i;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+
+    if (virTestRun("all jobs", testAllJobs, NULL) < 0)
+        ret = -1;
+    if (virTestRun("single worker order", testSingleWorkerOrder, NULL) < 0)
+        ret = -1;
+    if (virTestRun("priority", testPriority, NULL) < 0)
+        ret = -1;
+    if (virTestRun("shrink busy", testShrinkBusy, NULL) < 0)
+        ret = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(benchWorkers); i++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "benchmark %zu workers", benchWorkers[i]);
+        if (virTestRun(name, testBenchmark, &benchWorkers[i]) < 0)
+            ret = -1;
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -2017,6 +2017,10 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("add backing chain information to block stats"),
     },
+    {.name = "cached",
+     .type = VSH_OT_BOOL,
+     .help = N_("allow returning recently cached stats"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -2117,6 +2121,9 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "backing"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING;
 
+    if (vshCommandOptBool(cmd, "cached"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_CACHED;
+
     if (vshCommandOptBool(cmd, "domain")) {
         if (VIR_ALLOC_N(domlist, 1) < 0)
             goto cleanup;
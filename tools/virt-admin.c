@@ -867,6 +867,65 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/* ------------------------
+ * Command srv-msgpool-info
+ * ------------------------
+ */
+
+static const vshCmdInfo info_srv_msgpool_info[] = {
+    {.name = "help",
+     .data = N_("get server's RPC message buffer pool statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics of the pool server's RPC messages "
+                "take their buffers from")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_msgpool_info[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve the message pool statistics from."),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdSrvMsgpoolInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    const char *srvname = NULL;
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetMessagePoolStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve message pool statistics "
+                              "from server"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++)
+        vshPrint(ctl, "%-20s: %llu\n", params[i].field, params[i].value.ul);
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
 /* -----------------------
  * Command srv-clients-set
  * -----------------------
@@ -1311,6 +1370,16 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "srv-msgpool-info",
+     .flags = VSH_CMD_FLAG_ALIAS,
+     .alias = "server-msgpool-info"
+    },
+    {.name = "server-msgpool-info",
+     .handler = cmdSrvMsgpoolInfo,
+     .opts = opts_srv_msgpool_info,
+     .info = info_srv_msgpool_info,
+     .flags = 0
+    },
     {.name = NULL}
 };
 